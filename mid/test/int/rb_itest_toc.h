@@ -0,0 +1,120 @@
+/* rb_itest_toc.h
+ */
+ 
+#ifndef RB_ITEST_TOC_H
+#define RB_ITEST_TOC_H
+
+int sprite_index_query_matches_scan();
+int sprite_sort_full_is_exact();
+int sprite_sort_benchmark();
+int generate_archive_test_data();
+int decode_archive_simple();
+int decode_archive_overencode();
+int decode_archive_defaults();
+int decode_archive_multitype();
+int decode_archive_short_body();
+int decode_archive_short_length();
+int decode_archive_short_id();
+int decode_archive_empty_type();
+int defect_20210505_hi_tempo_note_loss();
+int defect_20210503_different_sounds();
+int defect_20210502_mystery_clipping();
+int vmgr_layers_match_reference();
+int vmgr_dirty_rects_match_full_render();
+int vmgr_buffers_match_single();
+int present_block_delivers_every_frame();
+int present_drop_oldest_merges_damage();
+int present_benchmark();
+int headless_ring_and_hash();
+int headless_capture();
+int headless_vsync();
+int headless_not_default();
+int vmgr_bands_match_serial();
+int vmgr_bands_lights_match_serial();
+int vmgr_bands_benchmark();
+int vmgr_indexed_matches_argb();
+int vmgr_bgbits_scroll_matches_refresh();
+int blit_xform_benchmark();
+int blit8_benchmark();
+int vmgr_culled_sprites_match_unculled();
+int lights_match_float_reference();
+int lights_color_blend_match_float_reference();
+int lights_halfres_and_bands();
+int lights_benchmark();
+int pcm_cache_round_trip();
+int pcm_cache_shared_file();
+int harm_table_matches_additive();
+int generate_and_print_curve();
+int env_linear_legs_bit_exact();
+int env_curved_legs_follow_geometric_series();
+int pcmprint_pool_matches_inline();
+int pcmprint_pool_prewarm_song();
+int pcmprint_require_never_waits();
+int pcmprint_pool_persists_to_cache();
+int pcm_store_evicts_least_recently_used();
+int pcm_store_keys_on_program_content();
+int expect_known_builtin_nodes();
+int validate_builtin_nodes();
+
+static const struct rb_itest {
+  int (*fn)();
+  const char *name;
+  const char *file;
+  int line;
+  const char *tags;
+  int ignore;
+} rb_itestv[]={
+  {sprite_index_query_matches_scan,"sprite_index_query_matches_scan","test_sprite_index.c",37,"sprite",0},
+  {sprite_sort_full_is_exact,"sprite_sort_full_is_exact","test_sprite_sort.c",38,"sprite",0},
+  {sprite_sort_benchmark,"sprite_sort_benchmark","test_sprite_sort.c",186,"",1},
+  {generate_archive_test_data,"generate_archive_test_data","test_archive.c",42,"",1},
+  {decode_archive_simple,"decode_archive_simple","test_archive.c",158,"",0},
+  {decode_archive_overencode,"decode_archive_overencode","test_archive.c",188,"",0},
+  {decode_archive_defaults,"decode_archive_defaults","test_archive.c",218,"",0},
+  {decode_archive_multitype,"decode_archive_multitype","test_archive.c",248,"",0},
+  {decode_archive_short_body,"decode_archive_short_body","test_archive.c",266,"",0},
+  {decode_archive_short_length,"decode_archive_short_length","test_archive.c",284,"",0},
+  {decode_archive_short_id,"decode_archive_short_id","test_archive.c",302,"",0},
+  {decode_archive_empty_type,"decode_archive_empty_type","test_archive.c",327,"",0},
+  {defect_20210505_hi_tempo_note_loss,"defect_20210505_hi_tempo_note_loss","20210505_hi_tempo_note_loss.c",21,"regression",0},
+  {defect_20210503_different_sounds,"defect_20210503_different_sounds","20210503_different_sounds.c",95,"regression",1},
+  {defect_20210502_mystery_clipping,"defect_20210502_mystery_clipping","20210502_mystery_clipping.c",43,"regression",0},
+  {vmgr_layers_match_reference,"vmgr_layers_match_reference","test_vmgr_layers.c",41,"video",0},
+  {vmgr_dirty_rects_match_full_render,"vmgr_dirty_rects_match_full_render","test_vmgr_dirty.c",10,"video",0},
+  {vmgr_buffers_match_single,"vmgr_buffers_match_single","test_vmgr_present.c",23,"video",0},
+  {present_block_delivers_every_frame,"present_block_delivers_every_frame","test_vmgr_present.c",159,"video",0},
+  {present_drop_oldest_merges_damage,"present_drop_oldest_merges_damage","test_vmgr_present.c",171,"video",0},
+  {present_benchmark,"present_benchmark","test_vmgr_present.c",190,"",1},
+  {headless_ring_and_hash,"headless_ring_and_hash","test_video_headless.c",31,"",0},
+  {headless_capture,"headless_capture","test_video_headless.c",147,"",0},
+  {headless_vsync,"headless_vsync","test_video_headless.c",197,"",0},
+  {headless_not_default,"headless_not_default","test_video_headless.c",218,"",0},
+  {vmgr_bands_match_serial,"vmgr_bands_match_serial","test_vmgr_bands.c",34,"video",0},
+  {vmgr_bands_lights_match_serial,"vmgr_bands_lights_match_serial","test_vmgr_bands.c",105,"video",0},
+  {vmgr_bands_benchmark,"vmgr_bands_benchmark","test_vmgr_bands.c",152,"video",1},
+  {vmgr_indexed_matches_argb,"vmgr_indexed_matches_argb","test_vmgr_indexed.c",45,"video",0},
+  {vmgr_bgbits_scroll_matches_refresh,"vmgr_bgbits_scroll_matches_refresh","test_vmgr_bgbits.c",10,"video",0},
+  {blit_xform_benchmark,"blit_xform_benchmark","test_image_blit.c",24,"video",1},
+  {blit8_benchmark,"blit8_benchmark","test_image_blit.c",70,"video",1},
+  {vmgr_culled_sprites_match_unculled,"vmgr_culled_sprites_match_unculled","test_vmgr_cull.c",17,"video",0},
+  {lights_match_float_reference,"lights_match_float_reference","test_lights.c",75,"video",0},
+  {lights_color_blend_match_float_reference,"lights_color_blend_match_float_reference","test_lights.c",114,"video",0},
+  {lights_halfres_and_bands,"lights_halfres_and_bands","test_lights.c",151,"video",0},
+  {lights_benchmark,"lights_benchmark","test_lights.c",224,"",1},
+  {pcm_cache_round_trip,"pcm_cache_round_trip","test_pcm_cache.c",23,"synth",0},
+  {pcm_cache_shared_file,"pcm_cache_shared_file","test_pcm_cache.c",85,"synth",0},
+  {harm_table_matches_additive,"harm_table_matches_additive","test_synth_node_harm.c",14,"synth",0},
+  {generate_and_print_curve,"generate_and_print_curve","test_synth_node_env.c",100,"",1},
+  {env_linear_legs_bit_exact,"env_linear_legs_bit_exact","test_synth_node_env.c",184,"synth",0},
+  {env_curved_legs_follow_geometric_series,"env_curved_legs_follow_geometric_series","test_synth_node_env.c",228,"synth",0},
+  {pcmprint_pool_matches_inline,"pcmprint_pool_matches_inline","test_pcmprint_pool.c",44,"synth",0},
+  {pcmprint_pool_prewarm_song,"pcmprint_pool_prewarm_song","test_pcmprint_pool.c",83,"synth",0},
+  {pcmprint_require_never_waits,"pcmprint_require_never_waits","test_pcmprint_pool.c",142,"synth",0},
+  {pcmprint_pool_persists_to_cache,"pcmprint_pool_persists_to_cache","test_pcmprint_pool.c",204,"synth",0},
+  {pcm_store_evicts_least_recently_used,"pcm_store_evicts_least_recently_used","test_pcm_store.c",24,"synth",0},
+  {pcm_store_keys_on_program_content,"pcm_store_keys_on_program_content","test_pcm_store.c",86,"synth",0},
+  {expect_known_builtin_nodes,"expect_known_builtin_nodes","builtin_nodes.c",5,"",0},
+  {validate_builtin_nodes,"validate_builtin_nodes","builtin_nodes.c",37,"",0},
+};
+
+#endif
@@ -19,6 +19,7 @@ struct rb_ossmidi;
 #define RB_CLI_COMMAND_synthc  5
 #define RB_CLI_COMMAND_imagec  6
 #define RB_CLI_COMMAND_songc   7
+#define RB_CLI_COMMAND_palettec 8
  
 struct rb_cli {
 // argv:
@@ -29,6 +30,7 @@ struct rb_cli {
   int audiochanc;
   const char *datapath;
   const char *dstpath;
+  int indexed;
   const char **pargv;
   int pargc,parga;
 // Global state by request only:
@@ -75,6 +77,7 @@ int rb_cli_main_archive(struct rb_cli *cli);
 int rb_cli_main_synthc(struct rb_cli *cli);
 int rb_cli_main_imagec(struct rb_cli *cli);
 int rb_cli_main_songc(struct rb_cli *cli);
+int rb_cli_main_palettec(struct rb_cli *cli);
 
 /* Helpers for serial data.
  ************************************************************/
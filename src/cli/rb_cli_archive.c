@@ -142,6 +142,7 @@ static int rb_cli_archive_cb_outer(
   else if ((basec== 4)&&!memcmp(base,"grid",       4)) context->restype=RB_RES_TYPE_grid;
   else if ((basec== 4)&&!memcmp(base,"text",       4)) context->restype=RB_RES_TYPE_text;
   else if ((basec== 4)&&!memcmp(base,"data",       4)) context->restype=RB_RES_TYPE_data;
+  else if ((basec== 7)&&!memcmp(base,"palette",    7)) context->restype=RB_RES_TYPE_palt;
   else {
     fprintf(stderr,"%.*s: Unknown resource type. Will output as 'data'\n",pathc,path);
     context->restype=RB_RES_TYPE_data;
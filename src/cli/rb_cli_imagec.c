@@ -120,6 +120,99 @@ static int rb_imagec_select_format_from_png(const struct rb_png_image *png) {
   return -1;
 }
 
+/* Indexed output.
+ * If there are no more than 256 distinct colors, and the palette doesn't cost more than it saves,
+ * emit RB_IMAGE_FORMAT_I8 instead of (format).
+ * Colors are normalized the way (format) would store them, and the palette is in order of first appearance.
+ * Only with "--indexed": I8 decodes slower than direct formats, so it's a per-image choice.
+ * Returns 0 if it doesn't fit.
+ */
+ 
+struct rb_imagec_palette {
+  uint32_t v[256];
+  int c;
+  int hashv[1024]; // Index in (v) plus one, zero if unused.
+};
+
+static int rb_imagec_palette_intern(struct rb_imagec_palette *palette,uint32_t argb) {
+  int p=(argb*2654435761u)>>22;
+  for (;;p=(p+1)&1023) {
+    int i=palette->hashv[p];
+    if (!i) break;
+    if (palette->v[i-1]==argb) return i-1;
+  }
+  if (palette->c>=256) return -1;
+  palette->v[palette->c]=argb;
+  palette->hashv[p]=++(palette->c);
+  return palette->c-1;
+}
+
+static int rb_imagec_indexed(
+  void *dstpp,
+  const struct rb_png_image *png,
+  uint32_t (*rdpx)(const uint8_t *src),
+  int srcxstride,
+  int format,
+  int directc
+) {
+  struct rb_imagec_palette *palette=calloc(1,sizeof(struct rb_imagec_palette));
+  if (!palette) return -1;
+  uint8_t *indexv=malloc(png->w*png->h);
+  if (!indexv) {
+    free(palette);
+    return -1;
+  }
+  
+  uint8_t *dstp=indexv;
+  const uint8_t *srcrow=png->pixels;
+  int yi=png->h;
+  for (;yi-->0;srcrow+=png->stride) {
+    const uint8_t *srcp=srcrow;
+    int xi=png->w;
+    for (;xi-->0;srcp+=srcxstride,dstp++) {
+      uint32_t argb=rdpx(srcp);
+      switch (format) {
+        case RB_IMAGE_FORMAT_RGB: argb|=0xff000000; break;
+        case RB_IMAGE_FORMAT_RGBCK: if (argb&0xff000000) argb|=0xff000000; else argb=0; break;
+        case RB_IMAGE_FORMAT_RGBA: if (!(argb&0xff000000)) argb=0; break;
+      }
+      int ix=rb_imagec_palette_intern(palette,argb);
+      if (ix<0) {
+        free(palette);
+        free(indexv);
+        return 0;
+      }
+      *dstp=ix;
+    }
+  }
+  
+  int palettec=1+palette->c*4;
+  int dstc=4+palettec+png->w*png->h;
+  if (dstc>=directc) {
+    free(palette);
+    free(indexv);
+    return 0;
+  }
+  uint8_t *dst=malloc(dstc);
+  if (!dst) {
+    free(palette);
+    free(indexv);
+    return -1;
+  }
+  dst[0]=RB_IMAGE_FORMAT_I8;
+  dst[1]=(png->w-1)>>4;
+  dst[2]=((png->w-1)<<4)|((png->h-1)>>8);
+  dst[3]=png->h-1;
+  dst[4]=palette->c-1;
+  int i=0; for (;i<palette->c;i++) rb_imagec_wrpx_rgba(dst+5+i*4,palette->v[i]);
+  memcpy(dst+4+palettec,indexv,png->w*png->h);
+  
+  free(palette);
+  free(indexv);
+  *(void**)dstpp=dst;
+  return dstc;
+}
+
 /* Convert in memory.
  */
  
@@ -187,6 +280,15 @@ static int rb_imagec(void *dstpp,const char *src,int srcc,struct rb_cli *cli) {
   }
   
   int dstc=4+dststride*png.h;
+  
+  if (cli->indexed&&((format==RB_IMAGE_FORMAT_RGBA)||(format==RB_IMAGE_FORMAT_RGB)||(format==RB_IMAGE_FORMAT_RGBCK))) {
+    int err=rb_imagec_indexed(dstpp,&png,rdpx,srcxstride,format,dstc);
+    if (err) {
+      rb_png_image_cleanup(&png);
+      return err;
+    }
+  }
+  
   uint8_t *dst=calloc(1,dstc);
   if (!dst) {
     rb_png_image_cleanup(&png);
@@ -261,3 +363,84 @@ int rb_cli_main_imagec(struct rb_cli *cli) {
   free(dst);
   return 0;
 }
+
+/* Palette: Every pixel is one color, LRTB.
+ */
+ 
+static int rb_palettec(void *dstpp,const char *src,int srcc,struct rb_cli *cli) {
+
+  struct rb_png_image png={0};
+  if (rb_png_decode(&png,src,srcc)<0) {
+    fprintf(stderr,"%s: Failed to decode PNG: %.*s\n",cli->datapath,png.messagec,png.message);
+    rb_png_image_cleanup(&png);
+    return -1;
+  }
+  
+  if ((png.w<1)||(png.h<1)||(png.w*png.h>256)) {
+    fprintf(stderr,"%s: Palette must have 1..256 pixels, found %dx%d\n",cli->datapath,png.w,png.h);
+    rb_png_image_cleanup(&png);
+    return -1;
+  }
+  
+  uint32_t (*rdpx)(const uint8_t *src)=0;
+  int srcxstride=0;
+  switch (png.colortype) {
+    case 2: srcxstride=3; rdpx=rb_imagec_rdpx_rgb; break;
+    case 6: srcxstride=4; rdpx=rb_imagec_rdpx_rgba; break;
+    default: {
+        fprintf(stderr,"%s: Palette must be RGB or RGBA, found colortype %d\n",cli->datapath,png.colortype);
+        rb_png_image_cleanup(&png);
+        return -1;
+      }
+  }
+  
+  int dstc=1+png.w*png.h*4;
+  uint8_t *dst=malloc(dstc);
+  if (!dst) {
+    rb_png_image_cleanup(&png);
+    return -1;
+  }
+  dst[0]=png.w*png.h-1;
+  uint8_t *dstp=dst+1;
+  const uint8_t *srcrow=png.pixels;
+  int yi=png.h;
+  for (;yi-->0;srcrow+=png.stride) {
+    const uint8_t *srcp=srcrow;
+    int xi=png.w;
+    for (;xi-->0;srcp+=srcxstride,dstp+=4) rb_imagec_wrpx_rgba(dstp,rdpx(srcp));
+  }
+  
+  rb_png_image_cleanup(&png);
+  *(void**)dstpp=dst;
+  return dstc;
+}
+
+int rb_cli_main_palettec(struct rb_cli *cli) {
+  if (!cli->dstpath||!cli->dstpath[0]) {
+    fprintf(stderr,"%s: '--dst=PATH' required\n",cli->exename);
+    return -1;
+  }
+  
+  void *src=0;
+  int srcc=rb_file_read(&src,cli->datapath);
+  if (srcc<0) {
+    fprintf(stderr,"%s:ERROR: Failed to read file\n",cli->datapath);
+    return -1;
+  }
+  
+  void *dst=0;
+  int dstc=rb_palettec(&dst,src,srcc,cli);
+  free(src);
+  if (dstc<0) {
+    fprintf(stderr,"%s:ERROR: Failed to convert palette\n",cli->datapath);
+    return -1;
+  }
+  
+  if (rb_file_write(cli->dstpath,dst,dstc)<0) {
+    fprintf(stderr,"%s:ERROR: Failed to write output (%d bytes)\n",cli->dstpath,dstc);
+    free(dst);
+    return -1;
+  }
+  free(dst);
+  return 0;
+}
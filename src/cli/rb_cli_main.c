@@ -13,6 +13,7 @@ int main(int argc,char **argv) {
     case RB_CLI_COMMAND_synthc: err=rb_cli_main_synthc(&cli); break;
     case RB_CLI_COMMAND_imagec: err=rb_cli_main_imagec(&cli); break;
     case RB_CLI_COMMAND_songc: err=rb_cli_main_songc(&cli); break;
+    case RB_CLI_COMMAND_palettec: err=rb_cli_main_palettec(&cli); break;
     
     default: rb_cli_print_usage(&cli); err=-1; break;
   }
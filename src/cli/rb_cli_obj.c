@@ -21,6 +21,7 @@ void rb_cli_print_usage(struct rb_cli *cli) {
     "  synthc       Compile one instrument or sound effect.\n"
     "  imagec       Convert one PNG file to our internal format.\n"
     "  songc        Convert one MIDI file to our internal format.\n"
+    "  palettec     Convert one PNG file to a palette, one color per pixel.\n"
     "\n"
     "OPTIONS:\n"
     "  --audio=NAME    [%s] Audio driver.\n"
@@ -28,6 +29,7 @@ void rb_cli_print_usage(struct rb_cli *cli) {
     "  --chanc=COUNT   [1] Audio channel count.\n"
     "  --data=PATH     [src/data] Directory containing data input files.\n"
     "  --dst=PATH      [] Output file.\n"
+    "  --indexed       [0] imagec: Emit indexed color if it fits in 256 colors and comes out smaller.\n"
     "\n"
   ,cli->exename
   ,default_audio?default_audio->name:"ERROR!"
@@ -73,6 +75,7 @@ static int rb_cli_command_eval(const char *src) {
   _(synthc)
   _(imagec)
   _(songc)
+  _(palettec)
   
   #undef _
   return -1;
@@ -112,11 +115,18 @@ static int rb_cli_receive_arg(struct rb_cli *cli,const char *k,int kc,const char
     } \
   }
   
+  // Bare "--indexed" means "--indexed=1".
+  if (!vc&&(kc==7)&&!memcmp(k,"indexed",7)) {
+    cli->indexed=1;
+    return 0;
+  }
+  
   STRARG(audioname,"audio")
   INTARG(audiorate,"rate",100,200000)
   INTARG(audiochanc,"chanc",1,8)
   STRARG(datapath,"data")
   STRARG(dstpath,"dst")
+  INTARG(indexed,"indexed",0,1)
   
   #undef STRARG
   #undef INTARG
@@ -83,6 +83,7 @@ static int rb_cli_plan_cb_song(
 }
 
 /* Receive image file.
+ * "NAME.i8.png" opts in to indexed color.
  */
  
 static int rb_cli_plan_cb_image(
@@ -97,8 +98,32 @@ static int rb_cli_plan_cb_image(
   
   while ((subpathc>=1)&&(subpath[0]=='/')) { subpath++; subpathc--; }
   
+  const char *opt="";
+  if ((basec>=7)&&!memcmp(base+basec-7,".i8.png",7)) opt=" --indexed";
+  
+  fprintf(context->dstf,"DATAMIDFILES+=$(DATAMIDDIR)/%.*s\n",subpathc,subpath);
+  fprintf(context->dstf,"$(DATAMIDDIR)/%.*s:%.*s $(EXE_CLI);$(PRECMD) $(EXE_CLI) imagec --dst=$@ --data=$<%s\n",subpathc,subpath,pathc,path,opt);
+  
+  return 0;
+}
+
+/* Receive palette file.
+ */
+ 
+static int rb_cli_plan_cb_palette(
+  const char *path,int pathc,
+  const char *base,int basec,
+  char type,
+  void *userdata
+) {
+  struct rb_plan_context *context=userdata;
+  const char *subpath=path+context->srcdirlen;
+  int subpathc=pathc-context->srcdirlen;
+  
+  while ((subpathc>=1)&&(subpath[0]=='/')) { subpath++; subpathc--; }
+  
   fprintf(context->dstf,"DATAMIDFILES+=$(DATAMIDDIR)/%.*s\n",subpathc,subpath);
-  fprintf(context->dstf,"$(DATAMIDDIR)/%.*s:%.*s $(EXE_CLI);$(PRECMD) $(EXE_CLI) imagec --dst=$@ --data=$<\n",subpathc,subpath,pathc,path);
+  fprintf(context->dstf,"$(DATAMIDDIR)/%.*s:%.*s $(EXE_CLI);$(PRECMD) $(EXE_CLI) palettec --dst=$@ --data=$<\n",subpathc,subpath,pathc,path);
   
   return 0;
 }
@@ -133,6 +158,9 @@ static int rb_cli_plan_cb_outer(
   if ((basec==5)&&!memcmp(base,"image",5)) {
     return rb_dir_read(path,rb_cli_plan_cb_image,context);
   }
+  if ((basec==7)&&!memcmp(base,"palette",7)) {
+    return rb_dir_read(path,rb_cli_plan_cb_palette,context);
+  }
   
   fprintf(stderr,"%.*s: Unexpected directory in outer data directory, ignoring.\n",pathc,path);
   return 0;
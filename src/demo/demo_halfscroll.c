@@ -27,8 +27,8 @@ static int cameradsty=0;
 static int demo_halfscroll_update_camera() {
   if (vmgr->sprites->c<1) return 0;
   struct rb_sprite *sprite=vmgr->sprites->v[0];
-  int xlimit=vmgr->grid->w*16-RB_FB_W;
-  int ylimit=vmgr->grid->h*16-RB_FB_H;
+  int xlimit=vmgr->layerv[0].grid->w*16-RB_FB_W;
+  int ylimit=vmgr->layerv[0].grid->h*16-RB_FB_H;
 
   #if INTERVAL==CONTINUOUS
   vmgr->scrollx=sprite->x-(RB_FB_W>>1);
@@ -115,11 +115,11 @@ static int hero_sprite_update(struct rb_sprite *sprite) {
   sprite->x+=SPRITE->dx*speed;
   sprite->y+=SPRITE->dy*speed;
   if (sprite->x<8) sprite->x=8;
-  else if (sprite->x>vmgr->grid->w*16-8) sprite->x=vmgr->grid->w*16-8;
+  else if (sprite->x>vmgr->layerv[0].grid->w*16-8) sprite->x=vmgr->layerv[0].grid->w*16-8;
   if (sprite->y<8) sprite->y=8;
-  else if (sprite->y>vmgr->grid->h*16-8) sprite->y=vmgr->grid->h*16-8;
+  else if (sprite->y>vmgr->layerv[0].grid->h*16-8) sprite->y=vmgr->layerv[0].grid->h*16-8;
   
-  int a=(sprite->y*0xff)/(vmgr->grid->h*16);
+  int a=(sprite->y*0xff)/(vmgr->layerv[0].grid->h*16);
   if (a<0) a=0;
   else if (a>0xff) a=0xff;
 
@@ -226,6 +226,7 @@ static int demo_halfscroll_res(
 static int demo_halfscroll_init() {
 
   if (!(vmgr=rb_vmgr_new())) return -1;
+  if (rb_vmgr_set_threads(vmgr,rb_demo_threads)<0) return -1;
   
   struct rb_inmgr_delegate indelegate={
     .cb_event=demo_halfscroll_inmgr_event,
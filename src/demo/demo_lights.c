@@ -195,6 +195,7 @@ static int demo_lights_res(
 static int demo_lights_init() {
 
   if (!(vmgr=rb_vmgr_new())) return -1;
+  if (rb_vmgr_set_threads(vmgr,rb_demo_threads)<0) return -1;
   
   struct rb_inmgr_delegate indelegate={
     .cb_event=demo_lights_inmgr_event,
@@ -206,6 +207,7 @@ static int demo_lights_init() {
   if (rb_archive_read("out/data",demo_lights_res,0)<0) return -1;
   
   if (demo_lights_setup()<0) return -1;
+  if (rb_vmgr_set_lights(vmgr,&lights)<0) return -1;
   
   return 0;
 }
@@ -225,8 +227,6 @@ static int demo_lights_update() {
   if (demo_lights_poll_input()<0) return -1;
   if (demo_lights_move_extralights()<0) return -1;
   if (!(rb_demo_override_fb=rb_vmgr_render(vmgr))) return -1;
-
-  if (rb_lights_draw(rb_demo_override_fb,&lights,vmgr->scrollx,vmgr->scrolly)<0) return -1;
   
   rb_image_blit_unchecked(
     rb_demo_override_fb,(rb_demo_override_fb->w>>1)-(message->w>>1),rb_demo_override_fb->h-message->h-5,
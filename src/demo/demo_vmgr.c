@@ -13,15 +13,11 @@ static int demo_vmgr_cb_res(uint32_t restype,int resid,const void *src,int srcc,
   switch (restype) {
   
     case RB_RES_TYPE_imag: {
-        struct rb_image *image=rb_image_new_decode(src,srcc);
-        if (!image) {
+        if (rb_vmgr_set_image_serial(vmgr,resid,src,srcc)<0) {
           fprintf(stderr,"Failed to decode imag:%d, %d bytes encoded\n",resid,srcc);
           return -1;
         }
-        int err=rb_vmgr_set_image(vmgr,resid,image);
-        rb_image_del(image);
-        return err;
-      }
+      } break;
     
     // In real life, you would lock the synth while loading or changing song.
     // I'm not bothering here, whatever.
@@ -102,8 +98,8 @@ static int make_random_sprite() {
   struct rb_sprite *sprite=rb_sprite_new(&my_sprite_type);
   if (!sprite) return -1;
   
-  sprite->x=rand()%(vmgr->grid->w*16);
-  sprite->y=rand()%(vmgr->grid->h*16);
+  sprite->x=rand()%(vmgr->layerv[0].grid->w*16);
+  sprite->y=rand()%(vmgr->layerv[0].grid->h*16);
   SPRITE->dfx=((rand()&15)-7)/7.0;
   SPRITE->dfy=((rand()&15)-7)/7.0;
   SPRITE->fx=sprite->x;
@@ -120,6 +116,7 @@ static int make_random_sprite() {
 
 static int demo_vmgr_init() {
   if (!(vmgr=rb_vmgr_new())) return -1;
+  if (rb_vmgr_set_threads(vmgr,rb_demo_threads)<0) return -1;
   rb_demo_override_fb=vmgr->fb;
   
   if (rb_archive_read("out/data",demo_vmgr_cb_res,0)<0) {
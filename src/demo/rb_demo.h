@@ -52,6 +52,7 @@ extern struct rb_image *rb_demo_override_fb; // demo may set this to provide its
 extern struct rb_synth *rb_demo_synth;
 extern int rb_demo_mousex;
 extern int rb_demo_mousey;
+extern int rb_demo_threads; // For rb_vmgr_set_threads(), from the command line.
 
 struct rb_demo {
   const char *name;
@@ -1,4 +1,5 @@
 #include "rb_demo.h"
+#include "rabbit/rb_video_headless.h"
 #include <unistd.h>
 #include <sys/time.h>
 #include <time.h>
@@ -18,6 +19,7 @@ struct rb_audio *rb_demo_audio=0;
 struct rb_synth *rb_demo_synth=0;
 int rb_demo_mousex=0;
 int rb_demo_mousey=0;
+int rb_demo_threads=1;
 static double rb_demo_starttime=0.0;
 static int rb_demo_framec=0;
 static double rb_demo_austarttime=0.0;
@@ -25,6 +27,22 @@ static double rb_demo_auendtime=0.0;
 static int rb_demo_auframec=0;
 static struct timespec starttime={0},cpustarttime={0};
 
+/* Options from the command line.
+ */
+
+static const char *rb_demo_video_name=0;
+static int rb_demo_frame_limit=0;
+static int rb_demo_rate=-1;
+static int rb_demo_hash=0;
+static const char *rb_demo_capture=0;
+static int rb_demo_no_audio=0;
+
+/* With --no-audio, we still run the synth, one 60 Hz frame's worth per video frame, and discard it.
+ * Keeps the demos working, and their audio cost in the measurement, without any driver.
+ */
+#define RB_DEMO_SILENT_RATE 44100
+#define RB_DEMO_SILENT_FRAME (RB_DEMO_SILENT_RATE/60)
+
 /* Current real time.
  */
  
@@ -74,7 +92,7 @@ static void rb_rcvsig(int sigid) {
 static void rb_demo_quit(int status) {
 
   double endtime=rb_demo_now();
-  int audiorate=1;
+  int audiorate=RB_DEMO_SILENT_RATE;
   
   if (rb_demo_audio) {
     audiorate=rb_demo_audio->delegate.rate;
@@ -85,6 +103,18 @@ static void rb_demo_quit(int status) {
   rb_demo->quit();
   
   if (rb_demo_video) {
+    if (!status&&(rb_demo_video->type==&rb_video_type_headless)) {
+      struct rb_video_headless *headless=(struct rb_video_headless*)rb_demo_video;
+      if (headless->framec>0) {
+        fprintf(stderr,
+          "%s:HEADLESS: %d frames, swap %.03fms/frame, %d vsync missed.\n",
+          rb_demo->name,headless->framec,(headless->swaptime*1000.0)/headless->framec,headless->latec
+        );
+      }
+      if (headless->hash_enable) {
+        fprintf(stdout,"%016llx\n",(unsigned long long)headless->hashsum);
+      }
+    }
     rb_video_del(rb_demo_video);
     rb_demo_video=0;
   }
@@ -203,13 +233,39 @@ static int rb_demo_init() {
       .cb_key=rb_demo_cb_key,
       .fullscreen=0,
     };
-    if (!(rb_demo_video=rb_video_new(0,&delegate))) {
-      fprintf(stderr,"Failed to initialize default video driver.\n");
+    const struct rb_video_type *type=0;
+    if (rb_demo_video_name&&!(type=rb_video_type_by_name(rb_demo_video_name,-1))) {
+      fprintf(stderr,"Video driver '%s' not found.\n",rb_demo_video_name);
+      return -1;
+    }
+    if (!(rb_demo_video=rb_video_new(type,&delegate))) {
+      fprintf(stderr,"Failed to initialize %s video driver.\n",type?type->name:"default");
       return -1;
     }
+    if (rb_demo_video->type==&rb_video_type_headless) {
+      struct rb_video_headless *headless=(struct rb_video_headless*)rb_demo_video;
+      if (rb_demo_rate>=0) headless->rate=rb_demo_rate;
+      headless->hash_enable=rb_demo_hash;
+      if (rb_demo_capture) {
+        int format=RB_VIDEO_HEADLESS_CAPTURE_RAW;
+        int pathc=strlen(rb_demo_capture);
+        if ((pathc>=4)&&!strcmp(rb_demo_capture+pathc-4,".png")) format=RB_VIDEO_HEADLESS_CAPTURE_PNG;
+        if (rb_video_headless_set_capture(rb_demo_video,rb_demo_capture,format)<0) {
+          fprintf(stderr,"Invalid capture pattern '%s'. Need exactly one integer conversion, eg 'out/frames/%%05d.png'.\n",rb_demo_capture);
+          return -1;
+        }
+      }
+    } else if ((rb_demo_rate>=0)||rb_demo_hash||rb_demo_capture) {
+      fprintf(stderr,"%s: --rate, --hash, and --capture only apply to the headless video driver.\n",rb_demo->name);
+    }
   }
   
-  if (rb_demo->use_audio) {
+  if (rb_demo->use_audio&&rb_demo_no_audio) {
+    if (!(rb_demo_synth=rb_synth_new(RB_DEMO_SILENT_RATE,1))) {
+      fprintf(stderr,"Failed to initialize synthesizer.\n");
+      return -1;
+    }
+  } else if (rb_demo->use_audio) {
     struct rb_audio_delegate delegate={
       .rate=44100,
       .chanc=1,
@@ -254,6 +310,12 @@ static int rb_demo_main() {
         fprintf(stderr,"Update audio driver '%s' failed\n",rb_demo_audio->type->name);
         return -1;
       }
+    } else if (rb_demo_synth) {
+      int16_t silent[RB_DEMO_SILENT_FRAME];
+      if (rb_demo_cb_pcm_out(silent,RB_DEMO_SILENT_FRAME,0)<0) {
+        fprintf(stderr,"%s: synth failed\n",rb_demo->name);
+        return -1;
+      }
     }
     
     if (rb_demo_video) {
@@ -273,6 +335,7 @@ static int rb_demo_main() {
     }
 
     rb_demo_framec++;
+    if (rb_demo_frame_limit&&(rb_demo_framec>=rb_demo_frame_limit)) return 0;
   }
   return 0;
 }
@@ -299,13 +362,38 @@ static const struct rb_demo *rb_get_demo_by_name(const char *name) {
 /* Main entry point.
  */
  
+static void rb_demo_print_usage(const char *exename) {
+  fprintf(stderr,
+    "Usage: %s [NAME] [OPTIONS]\n"
+    "  --video=DRIVER     Video driver, eg 'headless'. Default is the first real display that works.\n"
+    "  --frames=N         Quit after N frames.\n"
+    "  --no-audio         No audio driver. The synth still runs, in the main loop, output discarded.\n"
+    "  --threads=N        Composite vmgr demos in N bands in parallel. Output should be identical.\n"
+    "Headless only:\n"
+    "  --rate=HZ          Simulated vsync, default 60. Zero to run as fast as possible.\n"
+    "  --hash             Print a hash of all frames to stdout at exit.\n"
+    "  --capture=PATTERN  Write each frame, eg 'out/frames/%%05d.png'. Raw ARGB unless it ends '.png'.\n",
+    exename
+  );
+}
+
 int main(int argc,char **argv) {
   const char *name=RB_DEFAULT_DEMO_NAME;
-  if (argc>2) {
-    fprintf(stderr,"Usage: %s [NAME]\n",argv[0]);
-    return 1;
-  } else if (argc==2) {
-    name=argv[1];
+  int argi=1,namec=0;
+  for (;argi<argc;argi++) {
+    const char *arg=argv[argi];
+    if (!strncmp(arg,"--video=",8)) rb_demo_video_name=arg+8;
+    else if (!strncmp(arg,"--frames=",9)) rb_demo_frame_limit=atoi(arg+9);
+    else if (!strncmp(arg,"--rate=",7)) rb_demo_rate=atoi(arg+7);
+    else if (!strcmp(arg,"--hash")) rb_demo_hash=1;
+    else if (!strcmp(arg,"--no-audio")) rb_demo_no_audio=1;
+    else if (!strncmp(arg,"--threads=",10)) rb_demo_threads=atoi(arg+10);
+    else if (!strncmp(arg,"--capture=",10)) rb_demo_capture=arg+10;
+    else if ((arg[0]!='-')&&!namec++) name=arg;
+    else {
+      rb_demo_print_usage(argv[0]);
+      return 1;
+    }
   }
   if (!(rb_demo=rb_get_demo_by_name(name))) return 1;
   fprintf(stderr,"%s: Starting demo...\n",rb_demo->name);
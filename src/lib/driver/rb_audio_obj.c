@@ -68,11 +68,11 @@ int rb_audio_update(struct rb_audio *audio) {
 }
 
 int rb_audio_lock(struct rb_audio *audio) {
-  if (!audio->type->lock) return 0;
+  if (!audio||!audio->type->lock) return 0;
   return audio->type->lock(audio);
 }
 
 int rb_audio_unlock(struct rb_audio *audio) {
-  if (!audio->type->unlock) return 0;
+  if (!audio||!audio->type->unlock) return 0;
   return audio->type->unlock(audio);
 }
@@ -0,0 +1,242 @@
+#include "rabbit/rb_internal.h"
+#include "rabbit/rb_present.h"
+#include "rabbit/rb_video.h"
+#include "rabbit/rb_image.h"
+
+/* Fold (src)'s damage into (dst), for when (src) won't be presented.
+ */
+
+static void rb_present_frame_merge(struct rb_present_frame *dst,const struct rb_present_frame *src) {
+  if (dst->full) return;
+  if (src->full) {
+    dst->full=1;
+    return;
+  }
+  const struct rb_dirty_rect *rect=src->dirty.rectv;
+  int i=src->dirty.rectc;
+  for (;i-->0;rect++) rb_dirty_add(&dst->dirty,rect->x,rect->y,rect->w,rect->h);
+}
+
+/* Remove queued frame at position (p) from the head, keeping its damage.
+ * Caller must hold the mutex.
+ */
+
+static void rb_present_drop(struct rb_present *present,int p) {
+  struct rb_present_frame *frame=present->queuev+(present->queuep+p)%RB_PRESENT_QUEUE_LIMIT;
+  if (p<present->queuec-1) {
+    struct rb_present_frame *next=present->queuev+(present->queuep+p+1)%RB_PRESENT_QUEUE_LIMIT;
+    rb_present_frame_merge(next,frame);
+  } else if (present->carryc) {
+    rb_present_frame_merge(&present->carry,frame);
+  } else {
+    present->carry=*frame;
+    present->carryc=1;
+  }
+  for (;p<present->queuec-1;p++) {
+    present->queuev[(present->queuep+p)%RB_PRESENT_QUEUE_LIMIT]=present->queuev[(present->queuep+p+1)%RB_PRESENT_QUEUE_LIMIT];
+  }
+  present->queuec--;
+  present->dropc++;
+}
+
+/* Present thread.
+ */
+
+static void *rb_present_thread(void *arg) {
+  struct rb_present *present=arg;
+  int err=rb_video_bind_thread(present->video,1);
+  if (pthread_mutex_lock(&present->mutex)) return 0;
+  if (err<0) present->status=-1;
+  for (;;) {
+    if (!present->queuec) {
+      if (present->quit) break;
+      pthread_cond_wait(&present->cond,&present->mutex);
+      continue;
+    }
+    struct rb_present_frame frame=present->queuev[present->queuep];
+    if (++(present->queuep)>=RB_PRESENT_QUEUE_LIMIT) present->queuep=0;
+    present->queuec--;
+    present->busy=frame.fb;
+    pthread_cond_broadcast(&present->cond);
+    pthread_mutex_unlock(&present->mutex);
+
+    if (frame.full) err=rb_video_swap(present->video,frame.fb);
+    else err=rb_video_swap_dirty(present->video,frame.fb,&frame.dirty);
+
+    if (pthread_mutex_lock(&present->mutex)) return 0;
+    present->busy=0;
+    if (err<0) present->status=-1;
+    present->framec++;
+    pthread_cond_broadcast(&present->cond);
+  }
+  pthread_mutex_unlock(&present->mutex);
+  rb_video_bind_thread(present->video,0);
+  return 0;
+}
+
+/* New.
+ */
+
+struct rb_present *rb_present_new(struct rb_video *video,int queuelimit,int policy) {
+  if (!video) return 0;
+  if ((queuelimit<1)||(queuelimit>RB_PRESENT_QUEUE_LIMIT)) return 0;
+  switch (policy) {
+    case RB_PRESENT_POLICY_BLOCK:
+    case RB_PRESENT_POLICY_DROP_OLDEST:
+      break;
+    default: return 0;
+  }
+  struct rb_present *present=calloc(1,sizeof(struct rb_present));
+  if (!present) return 0;
+
+  present->refc=1;
+  present->policy=policy;
+  present->queuelimit=queuelimit;
+
+  if (pthread_mutex_init(&present->mutex,0)) {
+    free(present);
+    return 0;
+  }
+  if (pthread_cond_init(&present->cond,0)) {
+    pthread_mutex_destroy(&present->mutex);
+    free(present);
+    return 0;
+  }
+
+  if (rb_video_ref(video)<0) {
+    rb_present_del(present);
+    return 0;
+  }
+  present->video=video;
+
+  if (rb_video_bind_thread(video,0)<0) {
+    rb_present_del(present);
+    return 0;
+  }
+  if (pthread_create(&present->thread,0,rb_present_thread,present)) {
+    rb_present_del(present);
+    return 0;
+  }
+  present->thread_running=1;
+
+  return present;
+}
+
+/* Delete.
+ */
+
+void rb_present_del(struct rb_present *present) {
+  if (!present) return;
+  if (present->refc-->1) return;
+
+  if (present->thread_running) {
+    pthread_mutex_lock(&present->mutex);
+    present->quit=1;
+    pthread_cond_broadcast(&present->cond);
+    pthread_mutex_unlock(&present->mutex);
+    pthread_join(present->thread,0);
+  }
+  if (present->video) {
+    rb_video_bind_thread(present->video,1);
+    rb_video_del(present->video);
+  }
+
+  pthread_cond_destroy(&present->cond);
+  pthread_mutex_destroy(&present->mutex);
+
+  free(present);
+}
+
+/* Retain.
+ */
+
+int rb_present_ref(struct rb_present *present) {
+  if (!present) return -1;
+  if (present->refc<1) return -1;
+  if (present->refc==INT_MAX) return -1;
+  present->refc++;
+  return 0;
+}
+
+/* Submit.
+ */
+
+int rb_present_submit(struct rb_present *present,struct rb_image *fb,const struct rb_dirty *dirty) {
+  if (!present||!fb) return -1;
+  if (pthread_mutex_lock(&present->mutex)) return -1;
+
+  while (present->queuec>=present->queuelimit) {
+    if (present->status<0) break;
+    if (present->policy==RB_PRESENT_POLICY_DROP_OLDEST) {
+      rb_present_drop(present,0);
+    } else {
+      pthread_cond_wait(&present->cond,&present->mutex);
+    }
+  }
+  if (present->status<0) {
+    pthread_mutex_unlock(&present->mutex);
+    return -1;
+  }
+
+  struct rb_present_frame *frame=present->queuev+(present->queuep+present->queuec)%RB_PRESENT_QUEUE_LIMIT;
+  frame->fb=fb;
+  if (dirty) {
+    frame->full=0;
+    frame->dirty=*dirty;
+  } else {
+    frame->full=1;
+    rb_dirty_clear(&frame->dirty);
+  }
+  if (present->carryc) {
+    rb_present_frame_merge(frame,&present->carry);
+    present->carryc=0;
+  }
+  present->queuec++;
+
+  pthread_cond_broadcast(&present->cond);
+  pthread_mutex_unlock(&present->mutex);
+  return 0;
+}
+
+/* Reclaim.
+ */
+
+static int rb_present_find(const struct rb_present *present,const struct rb_image *fb) {
+  int p=0; for (;p<present->queuec;p++) {
+    if (present->queuev[(present->queuep+p)%RB_PRESENT_QUEUE_LIMIT].fb==fb) return p;
+  }
+  return -1;
+}
+
+int rb_present_reclaim(struct rb_present *present,struct rb_image *fb) {
+  if (!present||!fb) return -1;
+  if (pthread_mutex_lock(&present->mutex)) return -1;
+  for (;;) {
+    int p=rb_present_find(present,fb);
+    if (p>=0) {
+      if (present->policy==RB_PRESENT_POLICY_DROP_OLDEST) {
+        rb_present_drop(present,p);
+        continue;
+      }
+    } else if (present->busy!=fb) {
+      break;
+    }
+    pthread_cond_wait(&present->cond,&present->mutex);
+  }
+  pthread_mutex_unlock(&present->mutex);
+  return 0;
+}
+
+/* Flush.
+ */
+
+int rb_present_flush(struct rb_present *present) {
+  if (!present) return -1;
+  if (pthread_mutex_lock(&present->mutex)) return -1;
+  while (present->queuec||present->busy) {
+    pthread_cond_wait(&present->cond,&present->mutex);
+  }
+  int status=present->status;
+  pthread_mutex_unlock(&present->mutex);
+  return status;
+}
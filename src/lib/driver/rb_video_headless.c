@@ -0,0 +1,224 @@
+#include "rabbit/rb_internal.h"
+#include "rabbit/rb_video_headless.h"
+#include "rabbit/rb_image.h"
+#include "rabbit/rb_serial.h"
+#include "rabbit/rb_fs.h"
+#include <unistd.h>
+#include <time.h>
+
+#define RB_HEADLESS_FNV_BASIS 0xcbf29ce484222325ull
+#define RB_HEADLESS_FNV_PRIME 0x00000100000001b3ull
+
+#define VIDEO ((struct rb_video_headless*)video)
+
+/* Current time.
+ */
+
+static double rb_headless_now() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return (double)tv.tv_sec+tv.tv_nsec/1000000000.0;
+}
+
+/* Cleanup.
+ */
+
+static void rb_headless_drop_ring(struct rb_video *video) {
+  int i=RB_VIDEO_HEADLESS_RING_LIMIT; while (i-->0) {
+    rb_image_del(VIDEO->ringv[i]);
+    VIDEO->ringv[i]=0;
+  }
+  VIDEO->ringp=0;
+  VIDEO->ringfillc=0;
+}
+
+static void _rb_headless_del(struct rb_video *video) {
+  rb_headless_drop_ring(video);
+  if (VIDEO->capture_path) free(VIDEO->capture_path);
+}
+
+/* Init.
+ */
+
+static int _rb_headless_init(struct rb_video *video) {
+  VIDEO->rate=60;
+  VIDEO->hash=RB_HEADLESS_FNV_BASIS;
+  VIDEO->hashsum=RB_HEADLESS_FNV_BASIS;
+  if (rb_video_headless_set_ring(video,1)<0) return -1;
+  VIDEO->starttime=rb_headless_now();
+  return 0;
+}
+
+/* Hash one frame.
+ */
+
+static uint64_t rb_headless_hash(const struct rb_image *fb) {
+  uint64_t hash=RB_HEADLESS_FNV_BASIS;
+  const uint32_t *p=fb->pixels;
+  int i=fb->w*fb->h;
+  for (;i-->0;p++) {
+    hash=(hash^(((*p)>>16)&0xff))*RB_HEADLESS_FNV_PRIME;
+    hash=(hash^(((*p)>>8)&0xff))*RB_HEADLESS_FNV_PRIME;
+    hash=(hash^((*p)&0xff))*RB_HEADLESS_FNV_PRIME;
+  }
+  return hash;
+}
+
+/* Write one frame to disk.
+ * Create directories only when the first attempt fails, since rb_mkdir_for_file() fails if it already exists.
+ */
+
+static int rb_headless_capture(struct rb_video *video,struct rb_image *fb) {
+  char path[1024];
+  int pathc=snprintf(path,sizeof(path),VIDEO->capture_path,VIDEO->framec);
+  if ((pathc<1)||(pathc>=sizeof(path))) return -1;
+  struct rb_encoder encoder={0};
+  const void *src=fb->pixels;
+  int srcc=fb->w*fb->h*4;
+  if (VIDEO->capture_format==RB_VIDEO_HEADLESS_CAPTURE_PNG) {
+    if (rb_image_encode_png(&encoder,fb)<0) {
+      rb_encoder_cleanup(&encoder);
+      return -1;
+    }
+    src=encoder.v;
+    srcc=encoder.c;
+  }
+  int err=rb_file_write(path,src,srcc);
+  if (err<0) {
+    rb_mkdir_for_file(path);
+    err=rb_file_write(path,src,srcc);
+  }
+  rb_encoder_cleanup(&encoder);
+  return err;
+}
+
+/* Simulated vsync.
+ * Ticks are fixed relative to (starttime), like a real display: A late frame waits for the next one, not a full period.
+ */
+
+static void rb_headless_vsync(struct rb_video *video) {
+  double period=1.0/VIDEO->rate;
+  double now=rb_headless_now();
+  int64_t tick=(int64_t)((now-VIDEO->starttime)/period)+1;
+  if (tick<=VIDEO->tick) {
+    tick=VIDEO->tick+1;
+  } else if (VIDEO->framec>1) {
+    VIDEO->latec+=tick-VIDEO->tick-1;
+  }
+  VIDEO->tick=tick;
+  double wait=VIDEO->starttime+tick*period-now;
+  if (wait>0.0) usleep((useconds_t)(wait*1000000.0));
+}
+
+/* Swap.
+ */
+
+static int _rb_headless_swap(struct rb_video *video,struct rb_image *fb) {
+  double start=rb_headless_now();
+
+  if (VIDEO->hash_enable) {
+    VIDEO->hash=rb_headless_hash(fb);
+    uint64_t h=VIDEO->hash;
+    int i=8; for (;i-->0;h>>=8) {
+      VIDEO->hashsum=(VIDEO->hashsum^(h&0xff))*RB_HEADLESS_FNV_PRIME;
+    }
+  }
+
+  if (VIDEO->ringc) {
+    memcpy(VIDEO->ringv[VIDEO->ringp]->pixels,fb->pixels,RB_FB_SIZE_BYTES);
+    if (++(VIDEO->ringp)>=VIDEO->ringc) VIDEO->ringp=0;
+    if (VIDEO->ringfillc<VIDEO->ringc) VIDEO->ringfillc++;
+  }
+
+  if (VIDEO->capture_path) {
+    if (rb_headless_capture(video,fb)<0) return -1;
+  }
+
+  VIDEO->framec++;
+  VIDEO->swaptime+=rb_headless_now()-start;
+
+  if (VIDEO->rate>0) rb_headless_vsync(video);
+  return 0;
+}
+
+/* Type definition.
+ */
+
+const struct rb_video_type rb_video_type_headless={
+  .name="headless",
+  .desc="No output. Keeps frames in memory, optionally hashes or writes them to disk.",
+  .objlen=sizeof(struct rb_video_headless),
+  .by_name_only=1,
+  .del=_rb_headless_del,
+  .init=_rb_headless_init,
+  .swap=_rb_headless_swap,
+};
+
+/* Ring of frames.
+ */
+
+int rb_video_headless_set_ring(struct rb_video *video,int ringc) {
+  if (!video||(video->type!=&rb_video_type_headless)) return -1;
+  if ((ringc<0)||(ringc>RB_VIDEO_HEADLESS_RING_LIMIT)) return -1;
+  rb_headless_drop_ring(video);
+  int i=0; for (;i<ringc;i++) {
+    if (!(VIDEO->ringv[i]=rb_framebuffer_new())) {
+      rb_headless_drop_ring(video);
+      VIDEO->ringc=0;
+      return -1;
+    }
+  }
+  VIDEO->ringc=ringc;
+  return 0;
+}
+
+struct rb_image *rb_video_headless_get_frame(const struct rb_video *video,int age) {
+  if (!video||(video->type!=&rb_video_type_headless)) return 0;
+  if ((age<0)||(age>=VIDEO->ringfillc)) return 0;
+  int p=VIDEO->ringp-1-age;
+  if (p<0) p+=VIDEO->ringc;
+  return VIDEO->ringv[p];
+}
+
+/* Capture.
+ * We require exactly one integer conversion in the pattern; anything else would make snprintf read garbage.
+ */
+
+static int rb_headless_validate_pattern(const char *src) {
+  int convc=0;
+  for (;*src;src++) {
+    if (*src!='%') continue;
+    src++;
+    if (*src=='%') continue;
+    while ((*src=='0')||(*src=='-')||(*src=='+')||(*src==' ')||(*src=='#')) src++;
+    while ((*src>='0')&&(*src<='9')) src++;
+    switch (*src) {
+      case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': convc++; break;
+      default: return -1;
+    }
+  }
+  return (convc==1)?0:-1;
+}
+
+int rb_video_headless_set_capture(struct rb_video *video,const char *path,int format) {
+  if (!video||(video->type!=&rb_video_type_headless)) return -1;
+  if (!path||!path[0]||(format==RB_VIDEO_HEADLESS_CAPTURE_NONE)) {
+    if (VIDEO->capture_path) free(VIDEO->capture_path);
+    VIDEO->capture_path=0;
+    VIDEO->capture_format=RB_VIDEO_HEADLESS_CAPTURE_NONE;
+    return 0;
+  }
+  switch (format) {
+    case RB_VIDEO_HEADLESS_CAPTURE_RAW:
+    case RB_VIDEO_HEADLESS_CAPTURE_PNG:
+      break;
+    default: return -1;
+  }
+  if (rb_headless_validate_pattern(path)<0) return -1;
+  char *nv=strdup(path);
+  if (!nv) return -1;
+  if (VIDEO->capture_path) free(VIDEO->capture_path);
+  VIDEO->capture_path=nv;
+  VIDEO->capture_format=format;
+  return 0;
+}
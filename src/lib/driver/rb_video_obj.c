@@ -12,6 +12,7 @@ struct rb_video *rb_video_new(
   if (!type) {
     int p=0; for (;;p++) {
       if (!(type=rb_video_type_by_index(p))) return 0;
+      if (type->by_name_only) continue;
       struct rb_video *video=rb_video_new(type,delegate);
       if (video) return video;
     }
@@ -83,6 +84,12 @@ int rb_video_swap(struct rb_video *video,struct rb_image *fb) {
   return video->type->swap(video,fb);
 }
 
+int rb_video_swap_dirty(struct rb_video *video,struct rb_image *fb,const struct rb_dirty *dirty) {
+  if (!fb||(fb->alphamode!=RB_ALPHAMODE_OPAQUE)||(fb->w!=RB_FB_W)||(fb->h!=RB_FB_H)) return -1;
+  if (!dirty||!video->type->swap_dirty) return video->type->swap(video,fb);
+  return video->type->swap_dirty(video,fb,dirty);
+}
+
 int rb_video_set_fullscreen(struct rb_video *video,int fullscreen) {
   if (fullscreen<0) return video->fullscreen;
   if (video->type->set_fullscreen) {
@@ -96,3 +103,8 @@ void rb_video_suppress_screensaver(struct rb_video *video) {
     video->type->suppress_screensaver(video);
   }
 }
+
+int rb_video_bind_thread(struct rb_video *video,int bind) {
+  if (!video->type->bind_thread) return 0;
+  return video->type->bind_thread(video,bind);
+}
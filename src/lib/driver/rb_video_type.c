@@ -7,6 +7,7 @@
 extern const struct rb_video_type rb_video_type_glx;
 extern const struct rb_video_type rb_video_type_drmgx;
 extern const struct rb_video_type rb_video_type_bcm;
+extern const struct rb_video_type rb_video_type_headless;
  
 static const struct rb_video_type *rb_video_typev[]={
 #if RB_USE_glx
@@ -18,6 +19,7 @@ static const struct rb_video_type *rb_video_typev[]={
 #if RB_USE_bcm
   &rb_video_type_bcm,
 #endif
+  &rb_video_type_headless, // by_name_only: Default selection never falls back to it.
 };
 
 /* Get type by name.
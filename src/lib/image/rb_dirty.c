@@ -0,0 +1,89 @@
+#include "rabbit/rb_internal.h"
+#include "rabbit/rb_image.h"
+#include "rabbit/rb_dirty.h"
+
+/* Whole framebuffer.
+ */
+ 
+void rb_dirty_all(struct rb_dirty *dirty) {
+  dirty->rectc=1;
+  dirty->rectv[0].x=0;
+  dirty->rectv[0].y=0;
+  dirty->rectv[0].w=RB_FB_W;
+  dirty->rectv[0].h=RB_FB_H;
+}
+
+/* Add rect.
+ */
+ 
+void rb_dirty_add(struct rb_dirty *dirty,int x,int y,int w,int h) {
+  if (x<0) { w+=x; x=0; }
+  if (y<0) { h+=y; y=0; }
+  if (x>RB_FB_W-w) w=RB_FB_W-x;
+  if (y>RB_FB_H-h) h=RB_FB_H-y;
+  if ((w<1)||(h<1)) return;
+  
+  // Absorb any rect we overlap, and start over each time we grow.
+  int i=0;
+  while (i<dirty->rectc) {
+    struct rb_dirty_rect *rect=dirty->rectv+i;
+    if (!rb_dirty_rect_intersects(rect,x,y,w,h)) {
+      i++;
+      continue;
+    }
+    int r=x+w,b=y+h;
+    if (rect->x<x) x=rect->x;
+    if (rect->y<y) y=rect->y;
+    if (rect->x+rect->w>r) r=rect->x+rect->w;
+    if (rect->y+rect->h>b) b=rect->y+rect->h;
+    w=r-x;
+    h=b-y;
+    dirty->rectc--;
+    *rect=dirty->rectv[dirty->rectc];
+    i=0;
+  }
+  
+  // If we're full, everything collapses into one bounding rect.
+  if (dirty->rectc>=RB_DIRTY_LIMIT) {
+    int r=x+w,b=y+h;
+    for (i=dirty->rectc;i-->0;) {
+      const struct rb_dirty_rect *rect=dirty->rectv+i;
+      if (rect->x<x) x=rect->x;
+      if (rect->y<y) y=rect->y;
+      if (rect->x+rect->w>r) r=rect->x+rect->w;
+      if (rect->y+rect->h>b) b=rect->y+rect->h;
+    }
+    w=r-x;
+    h=b-y;
+    dirty->rectc=0;
+  }
+  
+  struct rb_dirty_rect *rect=dirty->rectv+dirty->rectc++;
+  rect->x=x;
+  rect->y=y;
+  rect->w=w;
+  rect->h=h;
+}
+
+/* Shift.
+ */
+ 
+void rb_dirty_shift(struct rb_dirty *dirty,int dx,int dy) {
+  struct rb_dirty_rect *rect=dirty->rectv;
+  int i=0;
+  while (i<dirty->rectc) {
+    rect->x+=dx;
+    rect->y+=dy;
+    if (rect->x<0) { rect->w+=rect->x; rect->x=0; }
+    if (rect->y<0) { rect->h+=rect->y; rect->y=0; }
+    if (rect->x>RB_FB_W-rect->w) rect->w=RB_FB_W-rect->x;
+    if (rect->y>RB_FB_H-rect->h) rect->h=RB_FB_H-rect->y;
+    if ((rect->w<1)||(rect->h<1)) {
+      dirty->rectc--;
+      *rect=dirty->rectv[dirty->rectc];
+    } else {
+      i++;
+      rect++;
+    }
+  }
+}
@@ -33,33 +33,20 @@ int rb_image_blit_safe(
   return 0;
 }
 
-/* Blit to image.
+/* Per-pixel blit, for whatever has no row kernel: blend hooks, and PREMUL onto BLEND.
+ * Everything else must produce exactly what this would.
+ * Source is bare pixels with a stride, so callers can blit from scratch buffers too.
  */
  
-void rb_image_blit_unchecked(
+static void rb_image_blit_general(
   struct rb_image *dst,int dstx,int dsty,
-  const struct rb_image *src,int srcx,int srcy,
+  const uint32_t *srcpixels,int srcstride,int srcalphamode,int srcx,int srcy,
   int w,int h,
   uint8_t xform,
   uint32_t (*blend)(uint32_t dst,uint32_t src,void *userdata),
   void *userdata
 ) {
 
-  // Opaque and no alpha or xform? Use rowwise memcpy.
-  if (
-    !xform&&!blend&&
-    (src->alphamode==RB_ALPHAMODE_OPAQUE)&&
-    (dst->alphamode!=RB_ALPHAMODE_COLORKEY)
-  ) {
-    int cpc=w<<2;
-    uint32_t *dstrow=dst->pixels+dsty*dst->w+dstx;
-    const uint32_t *srcrow=src->pixels+srcy*src->w+srcx;
-    for (;h-->0;dstrow+=dst->w,srcrow+=src->w) {
-      memcpy(dstrow,srcrow,cpc);
-    }
-    return;
-  }
-
   /* Iterate LRTB in (dst).
    * So dst delta minor is always one, and major is basically stride minus width.
    * (ddstmajor) changes based on RB_XFORM_SWAP, since that changes the meaning of (w,h).
@@ -76,46 +63,46 @@ void rb_image_blit_unchecked(
   }
   int ddstmajor=dst->w-dstminorc;
   
-  const uint32_t *srcp=src->pixels+srcy*src->w+srcx;
+  const uint32_t *srcp=srcpixels+srcy*srcstride+srcx;
   int dsrcminor,dsrcmajor;
   switch (xform) {
     case RB_XFORM_NONE: {
         dsrcminor=1;
-        dsrcmajor=src->w-w;
+        dsrcmajor=srcstride-w;
       } break;
     case RB_XFORM_XREV: {
         srcp+=w-1;
         dsrcminor=-1;
-        dsrcmajor=src->w+w;
+        dsrcmajor=srcstride+w;
       } break;
     case RB_XFORM_YREV: {
-        srcp+=src->w*(h-1);
+        srcp+=srcstride*(h-1);
         dsrcminor=1;
-        dsrcmajor=-src->w-w;
+        dsrcmajor=-srcstride-w;
       } break;
     case RB_XFORM_XREV|RB_XFORM_YREV: {
-        srcp+=src->w*(h-1)+w-1;
+        srcp+=srcstride*(h-1)+w-1;
         dsrcminor=-1;
-        dsrcmajor=w-src->w;
+        dsrcmajor=w-srcstride;
       } break;
     case RB_XFORM_SWAP: {
-        dsrcminor=src->w;
-        dsrcmajor=1-(src->w*h);
+        dsrcminor=srcstride;
+        dsrcmajor=1-(srcstride*h);
       } break;
     case RB_XFORM_SWAP|RB_XFORM_XREV: {
         srcp+=w-1;
-        dsrcminor=src->w;
-        dsrcmajor=-(src->w*h)-1;
+        dsrcminor=srcstride;
+        dsrcmajor=-(srcstride*h)-1;
       } break;
     case RB_XFORM_SWAP|RB_XFORM_YREV: {
-        srcp+=src->w*(h-1);
-        dsrcminor=-src->w;
-        dsrcmajor=src->w*h+1;
+        srcp+=srcstride*(h-1);
+        dsrcminor=-srcstride;
+        dsrcmajor=srcstride*h+1;
       } break;
     case RB_XFORM_SWAP|RB_XFORM_XREV|RB_XFORM_YREV: {
-        srcp+=src->w*(h-1)+w-1;
-        dsrcminor=-src->w;
-        dsrcmajor=src->w*h-1;
+        srcp+=srcstride*(h-1)+w-1;
+        dsrcminor=-srcstride;
+        dsrcmajor=srcstride*h-1;
       } break;
     default: return; // invalid xform
   }
@@ -139,7 +126,7 @@ void rb_image_blit_unchecked(
    */
   if (
     (dst->alphamode==RB_ALPHAMODE_BLEND)&&
-    (src->alphamode==RB_ALPHAMODE_BLEND)
+    (srcalphamode==RB_ALPHAMODE_BLEND)
   ) {
     if (blend) ITERATE({
       *dstp=blend(*dstp,*srcp,userdata);
@@ -162,13 +149,47 @@ void rb_image_blit_unchecked(
     return;
   }
   
+  /* PREMUL onto BLEND: As above, but the source is already multiplied.
+   * Onto a transparent pixel, the source is copied, so it must be unpremultiplied first.
+   * That costs a divide, but blitting onto BLEND images is rare.
+   */
+  if (
+    (dst->alphamode==RB_ALPHAMODE_BLEND)&&
+    (srcalphamode==RB_ALPHAMODE_PREMUL)
+  ) {
+    if (blend) ITERATE({
+      *dstp=blend(*dstp,*srcp,userdata);
+    }) else ITERATE({
+      uint8_t srca=(*srcp)>>24;
+      uint8_t dsta=(*dstp)>>24;
+      if (srca==0x00) ;
+      else if (srca==0xff) {
+        *dstp=*srcp;
+      } else if (!dsta) {
+        int r=((((*srcp)>>16)&0xff)*256+(srca>>1))/srca; if (r>0xff) r=0xff;
+        int g=((((*srcp)>>8)&0xff)*256+(srca>>1))/srca; if (g>0xff) g=0xff;
+        int b=(((*srcp)&0xff)*256+(srca>>1))/srca; if (b>0xff) b=0xff;
+        *dstp=(srca<<24)|(r<<16)|(g<<8)|b;
+      } else {
+        int suma=dsta+srca;
+        if (suma>0xff) suma=0xff;
+        dsta=(dsta*(0xff-srca))>>8;
+        uint8_t r=(((((*dstp)>>16)&0xff)*dsta)>>8)+(((*srcp)>>16)&0xff);
+        uint8_t g=(((((*dstp)>>8)&0xff)*dsta)>>8)+(((*srcp)>>8)&0xff);
+        uint8_t b=((((*dstp)&0xff)*dsta)>>8)+((*srcp)&0xff);
+        *dstp=(suma<<24)|(r<<16)|(g<<8)|b;
+      }
+    })
+    return;
+  }
+  
   /* Another special case when output is COLORKEY and input is OPAQUE.
    * We must check for zeroes in the input and force them nonzero.
    * By definition our output can not contain zeroes.
    */
   if (
     (dst->alphamode==RB_ALPHAMODE_COLORKEY)&&
-    (src->alphamode==RB_ALPHAMODE_OPAQUE)
+    (srcalphamode==RB_ALPHAMODE_OPAQUE)
   ) {
     if (blend) ITERATE({
       // Allow zeroes from the blend hook; caller takes responsibility for this.
@@ -181,7 +202,7 @@ void rb_image_blit_unchecked(
     
   /* Likelier cases, where we pick a strategy based on (src) alone.
    */
-  switch (src->alphamode) {
+  switch (srcalphamode) {
   
     case RB_ALPHAMODE_BLEND: if (blend) ITERATE({
         *dstp=blend(*dstp,*srcp,userdata);
@@ -199,6 +220,22 @@ void rb_image_blit_unchecked(
         }
       }) break;
     
+    case RB_ALPHAMODE_PREMUL: if (blend) ITERATE({
+        *dstp=blend(*dstp,*srcp,userdata);
+      }) else ITERATE({
+        uint8_t a=(*srcp)>>24;
+        if (a==0x00) ;
+        else if (a==0xff) {
+          *dstp=*srcp;
+        } else {
+          uint8_t dsta=0xff-a;
+          uint8_t r=(((((*dstp)>>16)&0xff)*dsta)>>8)+(((*srcp)>>16)&0xff);
+          uint8_t g=(((((*dstp)>>8)&0xff)*dsta)>>8)+(((*srcp)>>8)&0xff);
+          uint8_t b=((((*dstp)&0xff)*dsta)>>8)+((*srcp)&0xff);
+          *dstp=(r<<16)|(g<<8)|b;
+        }
+      }) break;
+    
     case RB_ALPHAMODE_COLORKEY: if (blend) ITERATE({
         if (*srcp) *dstp=blend(*dstp,*srcp,userdata);
       }) else ITERATE({
@@ -223,6 +260,123 @@ void rb_image_blit_unchecked(
   //...and that's all there is to it!
 }
 
+/* Row kernel for blits without a blend hook, or null if the general path must do it.
+ */
+ 
+static void rb_image_row_copy(uint32_t *dst,const uint32_t *src,int c) {
+  memcpy(dst,src,c<<2);
+}
+
+static void (*rb_image_blit_row_kernel(
+  int dstalphamode,
+  int srcalphamode
+))(uint32_t *dst,const uint32_t *src,int c) {
+  if (dstalphamode==RB_ALPHAMODE_BLEND) switch (srcalphamode) {
+    case RB_ALPHAMODE_BLEND: return rb_image_row_blend_blend;
+    case RB_ALPHAMODE_PREMUL: return 0;
+  }
+  if (dstalphamode==RB_ALPHAMODE_COLORKEY) {
+    if (srcalphamode==RB_ALPHAMODE_OPAQUE) return rb_image_row_nonzero;
+  }
+  switch (srcalphamode) {
+    case RB_ALPHAMODE_OPAQUE: return rb_image_row_copy;
+    case RB_ALPHAMODE_BLEND: return rb_image_row_blend;
+    case RB_ALPHAMODE_PREMUL: return rb_image_row_premul;
+    case RB_ALPHAMODE_COLORKEY: return rb_image_row_colorkey;
+    case RB_ALPHAMODE_DISCRETE: return rb_image_row_discrete;
+  }
+  return 0;
+}
+
+/* Transformed blit through a row kernel.
+ * Without SWAP, each output row is one source row, maybe reversed, maybe from the bottom up.
+ * With SWAP, output rows are source columns. Reading those directly would touch a new cache line per pixel,
+ * so we go in blocks: Transpose one into a scratch buffer, then run the row kernel on each of its rows.
+ * Straight copies transpose directly into (dst).
+ */
+ 
+#define RB_BLIT_BLOCK 16
+ 
+static void rb_image_blit_xform(
+  struct rb_image *dst,int dstx,int dsty,
+  const struct rb_image *src,int srcx,int srcy,
+  int w,int h,
+  uint8_t xform,
+  void (*row)(uint32_t *dst,const uint32_t *src,int c)
+) {
+  uint32_t scratch[RB_BLIT_BLOCK*RB_BLIT_BLOCK];
+  uint32_t *dstrow=dst->pixels+dsty*dst->w+dstx;
+  const uint32_t *srcp=src->pixels+srcy*src->w+srcx;
+  int srcstride=src->w,srcstep=1;
+  if (xform&RB_XFORM_XREV) {
+    srcp+=w-1;
+    srcstep=-1;
+  }
+  if (xform&RB_XFORM_YREV) {
+    srcp+=src->w*(h-1);
+    srcstride=-src->w;
+  }
+  
+  if (!(xform&RB_XFORM_SWAP)) {
+    if (srcstep>0) {
+      for (;h-->0;dstrow+=dst->w,srcp+=srcstride) row(dstrow,srcp,w);
+    } else {
+      for (;h-->0;dstrow+=dst->w,srcp+=srcstride) {
+        int x=0; for (;x<w;x+=RB_BLIT_BLOCK*RB_BLIT_BLOCK) {
+          int c=w-x;
+          if (c>RB_BLIT_BLOCK*RB_BLIT_BLOCK) c=RB_BLIT_BLOCK*RB_BLIT_BLOCK;
+          rb_image_row_reverse(scratch,srcp-x,c);
+          row(dstrow+x,scratch,c);
+        }
+      }
+    }
+    return;
+  }
+  
+  // Output is (h) wide and (w) tall. Output (x,y) is at (srcp+x*srcstride+y*srcstep).
+  int by=0; for (;by<w;by+=RB_BLIT_BLOCK) {
+    int bh=w-by;
+    if (bh>RB_BLIT_BLOCK) bh=RB_BLIT_BLOCK;
+    int bx=0; for (;bx<h;bx+=RB_BLIT_BLOCK) {
+      int bw=h-bx;
+      if (bw>RB_BLIT_BLOCK) bw=RB_BLIT_BLOCK;
+      uint32_t *dstp=dstrow+by*dst->w+bx;
+      const uint32_t *blocksrc=srcp+bx*srcstride+by*srcstep;
+      if (row==rb_image_row_copy) {
+        rb_image_block_transpose(dstp,dst->w,blocksrc,srcstride,srcstep,bw,bh);
+      } else {
+        rb_image_block_transpose(scratch,RB_BLIT_BLOCK,blocksrc,srcstride,srcstep,bw,bh);
+        const uint32_t *scratchrow=scratch;
+        int yi=bh; for (;yi-->0;dstp+=dst->w,scratchrow+=RB_BLIT_BLOCK) row(dstp,scratchrow,bw);
+      }
+    }
+  }
+}
+
+/* Blit to image.
+ */
+ 
+void rb_image_blit_unchecked(
+  struct rb_image *dst,int dstx,int dsty,
+  const struct rb_image *src,int srcx,int srcy,
+  int w,int h,
+  uint8_t xform,
+  uint32_t (*blend)(uint32_t dst,uint32_t src,void *userdata),
+  void *userdata
+) {
+  void (*row)(uint32_t *dst,const uint32_t *src,int c)=0;
+  if (!blend&&!(xform&~7)) row=rb_image_blit_row_kernel(dst->alphamode,src->alphamode);
+  if (!row) {
+    rb_image_blit_general(dst,dstx,dsty,src->pixels,src->w,src->alphamode,srcx,srcy,w,h,xform,blend,userdata);
+  } else if (xform) {
+    rb_image_blit_xform(dst,dstx,dsty,src,srcx,srcy,w,h,xform,row);
+  } else {
+    uint32_t *dstrow=dst->pixels+dsty*dst->w+dstx;
+    const uint32_t *srcrow=src->pixels+srcy*src->w+srcx;
+    for (;h-->0;dstrow+=dst->w,srcrow+=src->w) row(dstrow,srcrow,w);
+  }
+}
+
 /* Blit to image: Assert bounds.
  */
  
@@ -249,11 +403,12 @@ int rb_image_blit(
 }
 
 /* Check blit bounds.
+ * The real work only needs dimensions, so indexed images can share it.
  */
  
-int rb_image_check_bounds(
-  const struct rb_image *dst,int *dstx,int *dsty,
-  const struct rb_image *src,int *srcx,int *srcy,
+static int rb_image_clip(
+  int dstw,int dsth,int *dstx,int *dsty,
+  int srcw,int srch,int *srcx,int *srcy,
   int *w,int *h,
   uint8_t xform
 ) {
@@ -264,10 +419,10 @@ int rb_image_check_bounds(
     if (*dsty<0) { (*srcy)-=(*dsty); (*h)+=(*dsty); (*dsty)=0; }
     if (*srcx<0) { (*dstx)-=(*srcx); (*w)+=(*srcx); (*srcx)=0; }
     if (*srcy<0) { (*dsty)-=(*srcy); (*h)+=(*srcy); (*srcy)=0; }
-    if ((*dstx)>dst->w-(*w)) (*w)=dst->w-(*dstx);
-    if ((*dsty)>dst->h-(*h)) (*h)=dst->h-(*dsty);
-    if ((*srcx)>src->w-(*w)) (*w)=src->w-(*srcx);
-    if ((*srcy)>src->h-(*h)) (*h)=src->h-(*srcy);
+    if ((*dstx)>dstw-(*w)) (*w)=dstw-(*dstx);
+    if ((*dsty)>dsth-(*h)) (*h)=dsth-(*dsty);
+    if ((*srcx)>srcw-(*w)) (*w)=srcw-(*srcx);
+    if ((*srcy)>srch-(*h)) (*h)=srch-(*srcy);
     if ((*w)<1) return 0;
     if ((*h)<1) return 0;
     return 1;
@@ -316,41 +471,41 @@ int rb_image_check_bounds(
   }
   
   if (xform&RB_XFORM_SWAP) {
-    if (*dstx>RB_FB_W-*h) {
-      if (xform&RB_XFORM_YREV) (*srcy)+=(*dstx)+(*h)-dst->w;
-      *h=dst->w-*dstx;
+    if (*dstx>dstw-*h) {
+      if (xform&RB_XFORM_YREV) (*srcy)+=(*dstx)+(*h)-dstw;
+      *h=dstw-*dstx;
     }
-    if (*dsty>RB_FB_H-*w) {
-      if (xform&RB_XFORM_XREV) (*srcx)+=(*dsty)+(*w)-dst->h;
-      *w=dst->h-*dsty;
+    if (*dsty>dsth-*w) {
+      if (xform&RB_XFORM_XREV) (*srcx)+=(*dsty)+(*w)-dsth;
+      *w=dsth-*dsty;
     }
   } else {
-    if (*dstx>RB_FB_W-*w) {
-      if (xform&RB_XFORM_XREV) (*srcx)+=(*dstx)+(*w)-dst->w;
-      *w=dst->w-*dstx;
+    if (*dstx>dstw-*w) {
+      if (xform&RB_XFORM_XREV) (*srcx)+=(*dstx)+(*w)-dstw;
+      *w=dstw-*dstx;
     }
-    if (*dsty>RB_FB_H-*h) {
-      if (xform&RB_XFORM_YREV) (*srcy)+=(*dsty)+(*h)-dst->h;
-      *h=dst->h-*dsty;
+    if (*dsty>dsth-*h) {
+      if (xform&RB_XFORM_YREV) (*srcy)+=(*dsty)+(*h)-dsth;
+      *h=dsth-*dsty;
     }
   }
   
-  if (*srcx>src->w-*w) {
+  if (*srcx>srcw-*w) {
     if (xform&RB_XFORM_SWAP) {
-      if (xform&RB_XFORM_XREV) (*dsty)+=(*srcx)+(*w)-src->w;
+      if (xform&RB_XFORM_XREV) (*dsty)+=(*srcx)+(*w)-srcw;
     } else {
-      if (xform&RB_XFORM_XREV) (*dstx)+=(*srcx)+(*w)-src->w;
+      if (xform&RB_XFORM_XREV) (*dstx)+=(*srcx)+(*w)-srcw;
     }
-    *w=src->w-*srcx;
+    *w=srcw-*srcx;
   }
   
-  if (*srcy>src->h-*h) {
+  if (*srcy>srch-*h) {
     if (xform&RB_XFORM_SWAP) {
-      if (xform&RB_XFORM_YREV) (*dstx)+=(*srcy)+(*h)-src->h;
+      if (xform&RB_XFORM_YREV) (*dstx)+=(*srcy)+(*h)-srch;
     } else {
-      if (xform&RB_XFORM_YREV) (*dsty)+=(*srcy)+(*h)-src->h;
+      if (xform&RB_XFORM_YREV) (*dsty)+=(*srcy)+(*h)-srch;
     }
-    *h=src->h-*srcy;
+    *h=srch-*srcy;
   }
   
   if (*w<1) return 0;
@@ -358,6 +513,189 @@ int rb_image_check_bounds(
   return 1;
 }
 
+int rb_image_check_bounds(
+  const struct rb_image *dst,int *dstx,int *dsty,
+  const struct rb_image *src,int *srcx,int *srcy,
+  int *w,int *h,
+  uint8_t xform
+) {
+  return rb_image_clip(dst->w,dst->h,dstx,dsty,src->w,src->h,srcx,srcy,w,h,xform);
+}
+
+/* Indexed blits.
+ * Look colors up into a scratch buffer, then run the same row kernel an ARGB image would get,
+ * blocked and transposed the same way for xforms. Straight copies look up directly into (dst).
+ * PREMUL onto BLEND has no row kernel, so it expands one scratch block at a time for the general path.
+ */
+ 
+/* Lookups go four at a time, all loads before any stores.
+ * Otherwise each store might alias (colors) as far as the compiler knows, and the next load waits for it.
+ */
+ 
+static void rb_image8_lookup(uint32_t *dst,const uint8_t *src,int srcstep,int c,const uint32_t *colors) {
+  for (;c>=4;c-=4,dst+=4,src+=srcstep<<2) {
+    uint32_t a=colors[src[0]];
+    uint32_t b=colors[src[srcstep]];
+    uint32_t d=colors[src[srcstep<<1]];
+    uint32_t e=colors[src[srcstep*3]];
+    dst[0]=a;
+    dst[1]=b;
+    dst[2]=d;
+    dst[3]=e;
+  }
+  for (;c-->0;dst++,src+=srcstep) *dst=colors[*src];
+}
+
+// (dst[y*dststride+x]=colors[src[x*srcstride+y*srcstep]]), walking source rows so reads stay sequential.
+static void rb_image8_lookup_transpose(
+  uint32_t *dst,int dststride,
+  const uint8_t *src,int srcstride,int srcstep,
+  int w,int h,
+  const uint32_t *colors
+) {
+  int x=0; for (;x<w;x++,src+=srcstride) {
+    uint32_t *dstp=dst+x;
+    const uint8_t *srcp=src;
+    int yi=h;
+    for (;yi>=4;yi-=4,dstp+=dststride<<2,srcp+=srcstep<<2) {
+      uint32_t a=colors[srcp[0]];
+      uint32_t b=colors[srcp[srcstep]];
+      uint32_t d=colors[srcp[srcstep<<1]];
+      uint32_t e=colors[srcp[srcstep*3]];
+      dstp[0]=a;
+      dstp[dststride]=b;
+      dstp[dststride<<1]=d;
+      dstp[dststride*3]=e;
+    }
+    for (;yi-->0;dstp+=dststride,srcp+=srcstep) *dstp=colors[*srcp];
+  }
+}
+
+// Source block (sx,sy,bw,bh) lands at (ox,oy) in the (w,h) output, transformed by rb_image_blit_general().
+static void rb_image8_blit_expanded(
+  struct rb_image *dst,int dstx,int dsty,
+  const struct rb_image8 *src,int srcx,int srcy,
+  int w,int h,
+  uint8_t xform,
+  const struct rb_palette *palette
+) {
+  uint32_t scratch[RB_BLIT_BLOCK*RB_BLIT_BLOCK];
+  int sy=0; for (;sy<h;sy+=RB_BLIT_BLOCK) {
+    int bh=h-sy;
+    if (bh>RB_BLIT_BLOCK) bh=RB_BLIT_BLOCK;
+    int sx=0; for (;sx<w;sx+=RB_BLIT_BLOCK) {
+      int bw=w-sx;
+      if (bw>RB_BLIT_BLOCK) bw=RB_BLIT_BLOCK;
+      uint32_t *dstrow=scratch;
+      const uint8_t *srcrow=src->pixels+(srcy+sy)*src->w+srcx+sx;
+      int yi=bh; for (;yi-->0;dstrow+=bw,srcrow+=src->w) rb_image8_lookup(dstrow,srcrow,1,bw,palette->v);
+      int ox=(xform&RB_XFORM_XREV)?(w-sx-bw):sx;
+      int oy=(xform&RB_XFORM_YREV)?(h-sy-bh):sy;
+      if (xform&RB_XFORM_SWAP) {
+        int tmp=ox; ox=oy; oy=tmp;
+      }
+      rb_image_blit_general(dst,dstx+ox,dsty+oy,scratch,bw,palette->alphamode,0,0,bw,bh,xform,0,0);
+    }
+  }
+}
+
+void rb_image8_blit_unchecked(
+  struct rb_image *dst,int dstx,int dsty,
+  const struct rb_image8 *src,int srcx,int srcy,
+  int w,int h,
+  uint8_t xform,
+  const struct rb_palette *palette
+) {
+  if (xform&~7) return;
+  void (*row)(uint32_t *dst,const uint32_t *src,int c)=rb_image_blit_row_kernel(dst->alphamode,palette->alphamode);
+  if (!row) {
+    rb_image8_blit_expanded(dst,dstx,dsty,src,srcx,srcy,w,h,xform,palette);
+    return;
+  }
+  int direct=(row==rb_image_row_copy);
+  const uint32_t *colors=palette->v;
+  uint32_t scratch[RB_BLIT_BLOCK*RB_BLIT_BLOCK];
+  uint32_t *dstrow=dst->pixels+dsty*dst->w+dstx;
+  const uint8_t *srcp=src->pixels+srcy*src->w+srcx;
+  int srcstride=src->w,srcstep=1;
+  if (xform&RB_XFORM_XREV) {
+    srcp+=w-1;
+    srcstep=-1;
+  }
+  if (xform&RB_XFORM_YREV) {
+    srcp+=src->w*(h-1);
+    srcstride=-src->w;
+  }
+  
+  if (!(xform&RB_XFORM_SWAP)) {
+    for (;h-->0;dstrow+=dst->w,srcp+=srcstride) {
+      if (direct) {
+        rb_image8_lookup(dstrow,srcp,srcstep,w,colors);
+        continue;
+      }
+      int x=0; for (;x<w;x+=RB_BLIT_BLOCK*RB_BLIT_BLOCK) {
+        int c=w-x;
+        if (c>RB_BLIT_BLOCK*RB_BLIT_BLOCK) c=RB_BLIT_BLOCK*RB_BLIT_BLOCK;
+        rb_image8_lookup(scratch,srcp+x*srcstep,srcstep,c,colors);
+        row(dstrow+x,scratch,c);
+      }
+    }
+    return;
+  }
+  
+  // Output is (h) wide and (w) tall, as in rb_image_blit_xform().
+  int by=0; for (;by<w;by+=RB_BLIT_BLOCK) {
+    int bh=w-by;
+    if (bh>RB_BLIT_BLOCK) bh=RB_BLIT_BLOCK;
+    int bx=0; for (;bx<h;bx+=RB_BLIT_BLOCK) {
+      int bw=h-bx;
+      if (bw>RB_BLIT_BLOCK) bw=RB_BLIT_BLOCK;
+      uint32_t *dstp=dstrow+by*dst->w+bx;
+      const uint8_t *blocksrc=srcp+bx*srcstride+by*srcstep;
+      if (direct) {
+        rb_image8_lookup_transpose(dstp,dst->w,blocksrc,srcstride,srcstep,bw,bh,colors);
+      } else {
+        rb_image8_lookup_transpose(scratch,RB_BLIT_BLOCK,blocksrc,srcstride,srcstep,bw,bh,colors);
+        const uint32_t *scratchrow=scratch;
+        int yi=bh; for (;yi-->0;dstp+=dst->w,scratchrow+=RB_BLIT_BLOCK) row(dstp,scratchrow,bw);
+      }
+    }
+  }
+}
+
+#undef RB_BLIT_BLOCK
+
+int rb_image8_blit_safe(
+  struct rb_image *dst,int dstx,int dsty,
+  const struct rb_image8 *src,int srcx,int srcy,
+  int w,int h,
+  uint8_t xform,
+  const struct rb_palette *palette
+) {
+  if (!dst||!src) return -1;
+  if (!palette&&!(palette=src->palette)) return -1;
+  if (rb_image_clip(dst->w,dst->h,&dstx,&dsty,src->w,src->h,&srcx,&srcy,&w,&h,xform)>0) {
+    rb_image8_blit_unchecked(dst,dstx,dsty,src,srcx,srcy,w,h,xform,palette);
+  }
+  return 0;
+}
+
+int rb_image8_copy_safe(
+  struct rb_image *dst,int dstx,int dsty,
+  const struct rb_image8 *src,int srcx,int srcy,
+  int w,int h,
+  const struct rb_palette *palette
+) {
+  if (!dst||!src) return -1;
+  if (!palette&&!(palette=src->palette)) return -1;
+  if (rb_image_clip(dst->w,dst->h,&dstx,&dsty,src->w,src->h,&srcx,&srcy,&w,&h,0)>0) {
+    uint32_t *dstrow=dst->pixels+dsty*dst->w+dstx;
+    const uint8_t *srcrow=src->pixels+srcy*src->w+srcx;
+    for (;h-->0;dstrow+=dst->w,srcrow+=src->w) rb_image8_lookup(dstrow,srcrow,1,w,palette->v);
+  }
+  return 0;
+}
+
 /* Scroll image content.
  */
  
@@ -372,7 +710,7 @@ int rb_image_scroll(struct rb_image *image,int dx,int dy) {
   
   /* Self-copy:
    *  - If y changes, we can memcpy rowwise. Just need to go the right direction.
-   *  - Constant y, we need to transfer one pixel at a time.
+   *  - Constant y, rows overlap, so memmove each.
    */
   if (dsty>srcy) { // rowwise memcpy, bottom to top
     int cpc=w<<2;
@@ -390,25 +728,13 @@ int rb_image_scroll(struct rb_image *image,int dx,int dy) {
     for (;i-->0;dst+=image->w,src+=image->w) {
       memcpy(dst,src,cpc);
     }
-  } else if (dstx>srcx) { // pixelwise copy, right to left
-    uint32_t *dstrow=image->pixels+dsty*image->w+dstx+w-1;
-    uint32_t *srcrow=image->pixels+srcy*image->w+srcx+w-1;
-    int yi=h;
-    for (;yi-->0;dstrow+=image->w,srcrow+=image->w) {
-      uint32_t *dstp=dstrow;
-      uint32_t *srcp=srcrow;
-      int xi=w;
-      for (;xi-->0;dstp--,srcp--) *dstp=*srcp;
-    }
-  } else if (dstx<srcx) { // pixelwise copy, left to right
-    uint32_t *dstrow=image->pixels+dsty*image->w+dstx;
-    uint32_t *srcrow=image->pixels+srcy*image->w+srcx;
-    int yi=h;
-    for (;yi-->0;dstrow+=image->w,srcrow+=image->w) {
-      uint32_t *dstp=dstrow;
-      uint32_t *srcp=srcrow;
-      int xi=w;
-      for (;xi-->0;dstp++,srcp++) *dstp=*srcp;
+  } else { // rowwise memmove
+    int cpc=w<<2;
+    uint32_t *dst=image->pixels+dsty*image->w+dstx;
+    uint32_t *src=image->pixels+srcy*image->w+srcx;
+    int i=h;
+    for (;i-->0;dst+=image->w,src+=image->w) {
+      memmove(dst,src,cpc);
     }
   }
   
@@ -0,0 +1,499 @@
+#include "rabbit/rb_internal.h"
+#include "rabbit/rb_image.h"
+#include "rabbit/rb_simd.h"
+
+/* AVX2 is either assumed by the build, or compiled separately and checked at runtime.
+ */
+
+#if RB_SIMD_AVX2
+  #define RB_BLIT_AVX2 1
+  #define RB_BLIT_TARGET_AVX2
+  #define rb_blit_use_avx2() 1
+#elif RB_SIMD_AVX2_DISPATCH
+  #define RB_BLIT_AVX2 1
+  #define RB_BLIT_TARGET_AVX2 RB_SIMD_TARGET_AVX2
+  #define rb_blit_use_avx2() rb_simd_have_avx2()
+#endif
+
+/* Single pixels.
+ * These are the reference: Vector paths must produce exactly the same thing.
+ * Same formulas as the general case in rb_image_blit_unchecked().
+ */
+
+static inline uint32_t rb_blit_blend1(uint32_t dst,uint32_t src) {
+  uint8_t a=src>>24;
+  if (a==0x00) return dst;
+  if (a==0xff) return src;
+  uint8_t dsta=0xff-a;
+  uint8_t r=(((dst>>16)&0xff)*dsta+((src>>16)&0xff)*a)>>8;
+  uint8_t g=(((dst>>8)&0xff)*dsta+((src>>8)&0xff)*a)>>8;
+  uint8_t b=((dst&0xff)*dsta+(src&0xff)*a)>>8;
+  return (r<<16)|(g<<8)|b;
+}
+
+static inline uint32_t rb_blit_premul1(uint32_t dst,uint32_t src) {
+  uint8_t a=src>>24;
+  if (a==0x00) return dst;
+  if (a==0xff) return src;
+  uint8_t dsta=0xff-a;
+  uint8_t r=((((dst>>16)&0xff)*dsta)>>8)+((src>>16)&0xff);
+  uint8_t g=((((dst>>8)&0xff)*dsta)>>8)+((src>>8)&0xff);
+  uint8_t b=(((dst&0xff)*dsta)>>8)+(src&0xff);
+  return (r<<16)|(g<<8)|b;
+}
+
+static inline uint32_t rb_blit_blend_blend1(uint32_t dst,uint32_t src) {
+  uint8_t srca=src>>24;
+  uint8_t dsta=dst>>24;
+  if (srca==0x00) return dst;
+  if (!dsta||(srca==0xff)) return src;
+  int suma=dsta+srca;
+  if (suma>0xff) suma=0xff;
+  dsta=(dsta*(0xff-srca))>>8;
+  uint8_t r=(((dst>>16)&0xff)*dsta+((src>>16)&0xff)*srca)>>8;
+  uint8_t g=(((dst>>8)&0xff)*dsta+((src>>8)&0xff)*srca)>>8;
+  uint8_t b=((dst&0xff)*dsta+(src&0xff)*srca)>>8;
+  return (suma<<24)|(r<<16)|(g<<8)|b;
+}
+
+/* SSE2 blocks, 4 pixels.
+ * Channels are widened to 16 bits for the multiplies; (d*(255-a)+s*a) can't exceed 0xffff.
+ */
+
+#if RB_SIMD_SSE2
+
+// Copy each pixel's alpha into all four of its 16-bit channels.
+static inline __m128i rb_blit_alpha16(__m128i v) {
+  return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v,0xff),0xff);
+}
+
+static inline __m128i rb_blit_select(__m128i mask,__m128i a,__m128i b) {
+  return _mm_or_si128(_mm_and_si128(mask,a),_mm_andnot_si128(mask,b));
+}
+
+static inline __m128i rb_blit_blend4(__m128i d,__m128i s) {
+  __m128i zero=_mm_setzero_si128();
+  __m128i v255=_mm_set1_epi16(0xff);
+  __m128i sa=_mm_srli_epi32(s,24);
+  __m128i slo=_mm_unpacklo_epi8(s,zero),shi=_mm_unpackhi_epi8(s,zero);
+  __m128i dlo=_mm_unpacklo_epi8(d,zero),dhi=_mm_unpackhi_epi8(d,zero);
+  __m128i alo=rb_blit_alpha16(slo),ahi=rb_blit_alpha16(shi);
+  __m128i lo=_mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(dlo,_mm_sub_epi16(v255,alo)),_mm_mullo_epi16(slo,alo)),8);
+  __m128i hi=_mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(dhi,_mm_sub_epi16(v255,ahi)),_mm_mullo_epi16(shi,ahi)),8);
+  __m128i mixed=_mm_and_si128(_mm_packus_epi16(lo,hi),_mm_set1_epi32(0x00ffffff));
+  mixed=rb_blit_select(_mm_cmpeq_epi32(sa,_mm_set1_epi32(0xff)),s,mixed);
+  return rb_blit_select(_mm_cmpeq_epi32(sa,zero),d,mixed);
+}
+
+static inline __m128i rb_blit_premul4(__m128i d,__m128i s) {
+  __m128i zero=_mm_setzero_si128();
+  __m128i v255=_mm_set1_epi16(0xff);
+  __m128i sa=_mm_srli_epi32(s,24);
+  __m128i dlo=_mm_unpacklo_epi8(d,zero),dhi=_mm_unpackhi_epi8(d,zero);
+  __m128i ialo=_mm_sub_epi16(v255,rb_blit_alpha16(_mm_unpacklo_epi8(s,zero)));
+  __m128i iahi=_mm_sub_epi16(v255,rb_blit_alpha16(_mm_unpackhi_epi8(s,zero)));
+  __m128i lo=_mm_srli_epi16(_mm_mullo_epi16(dlo,ialo),8);
+  __m128i hi=_mm_srli_epi16(_mm_mullo_epi16(dhi,iahi),8);
+  // Can't carry: (d*(255-a))>>8 plus (s*a)>>8 is at most 254.
+  __m128i mixed=_mm_and_si128(_mm_add_epi8(_mm_packus_epi16(lo,hi),s),_mm_set1_epi32(0x00ffffff));
+  mixed=rb_blit_select(_mm_cmpeq_epi32(sa,_mm_set1_epi32(0xff)),s,mixed);
+  return rb_blit_select(_mm_cmpeq_epi32(sa,zero),d,mixed);
+}
+
+static inline __m128i rb_blit_blend_blend4(__m128i d,__m128i s) {
+  __m128i zero=_mm_setzero_si128();
+  __m128i v255=_mm_set1_epi16(0xff);
+  __m128i sa=_mm_srli_epi32(s,24);
+  __m128i da=_mm_srli_epi32(d,24);
+  __m128i slo=_mm_unpacklo_epi8(s,zero),shi=_mm_unpackhi_epi8(s,zero);
+  __m128i dlo=_mm_unpacklo_epi8(d,zero),dhi=_mm_unpackhi_epi8(d,zero);
+  __m128i alo=rb_blit_alpha16(slo),ahi=rb_blit_alpha16(shi);
+  __m128i dklo=_mm_srli_epi16(_mm_mullo_epi16(rb_blit_alpha16(dlo),_mm_sub_epi16(v255,alo)),8);
+  __m128i dkhi=_mm_srli_epi16(_mm_mullo_epi16(rb_blit_alpha16(dhi),_mm_sub_epi16(v255,ahi)),8);
+  __m128i lo=_mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(dlo,dklo),_mm_mullo_epi16(slo,alo)),8);
+  __m128i hi=_mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(dhi,dkhi),_mm_mullo_epi16(shi,ahi)),8);
+  __m128i amask=_mm_set1_epi32(0xff000000);
+  __m128i mixed=_mm_or_si128(
+    _mm_andnot_si128(amask,_mm_packus_epi16(lo,hi)),
+    _mm_and_si128(amask,_mm_adds_epu8(s,d))
+  );
+  __m128i copy=_mm_or_si128(_mm_cmpeq_epi32(da,zero),_mm_cmpeq_epi32(sa,_mm_set1_epi32(0xff)));
+  mixed=rb_blit_select(copy,s,mixed);
+  return rb_blit_select(_mm_cmpeq_epi32(sa,zero),d,mixed);
+}
+
+static inline __m128i rb_blit_colorkey4(__m128i d,__m128i s) {
+  return rb_blit_select(_mm_cmpeq_epi32(s,_mm_setzero_si128()),d,s);
+}
+
+static inline __m128i rb_blit_discrete4(__m128i d,__m128i s) {
+  return rb_blit_select(_mm_cmplt_epi32(s,_mm_setzero_si128()),s,d);
+}
+
+static inline __m128i rb_blit_nonzero4(__m128i d,__m128i s) {
+  __m128i zero=_mm_cmpeq_epi32(s,_mm_setzero_si128());
+  return _mm_or_si128(s,_mm_and_si128(zero,_mm_set1_epi32(0xff000000)));
+}
+
+#define RB_BLIT_ROW4(fn,dst,src,c) { \
+  for (;c>=4;c-=4,dst+=4,src+=4) { \
+    __m128i d=_mm_loadu_si128((__m128i*)dst); \
+    __m128i s=_mm_loadu_si128((const __m128i*)src); \
+    _mm_storeu_si128((__m128i*)dst,fn(d,s)); \
+  } \
+}
+
+#endif
+
+/* AVX2 blocks, 8 pixels.
+ * Same as SSE2 but wider. Unpack and pack both work within 128-bit lanes, so they still pair up.
+ */
+
+#if RB_BLIT_AVX2
+
+static inline RB_BLIT_TARGET_AVX2 __m256i rb_blit_alpha16_avx2(__m256i v) {
+  return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v,0xff),0xff);
+}
+
+static inline RB_BLIT_TARGET_AVX2 __m256i rb_blit_select_avx2(__m256i mask,__m256i a,__m256i b) {
+  return _mm256_or_si256(_mm256_and_si256(mask,a),_mm256_andnot_si256(mask,b));
+}
+
+static inline RB_BLIT_TARGET_AVX2 __m256i rb_blit_blend8(__m256i d,__m256i s) {
+  __m256i zero=_mm256_setzero_si256();
+  __m256i v255=_mm256_set1_epi16(0xff);
+  __m256i sa=_mm256_srli_epi32(s,24);
+  __m256i slo=_mm256_unpacklo_epi8(s,zero),shi=_mm256_unpackhi_epi8(s,zero);
+  __m256i dlo=_mm256_unpacklo_epi8(d,zero),dhi=_mm256_unpackhi_epi8(d,zero);
+  __m256i alo=rb_blit_alpha16_avx2(slo),ahi=rb_blit_alpha16_avx2(shi);
+  __m256i lo=_mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(dlo,_mm256_sub_epi16(v255,alo)),_mm256_mullo_epi16(slo,alo)),8);
+  __m256i hi=_mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(dhi,_mm256_sub_epi16(v255,ahi)),_mm256_mullo_epi16(shi,ahi)),8);
+  __m256i mixed=_mm256_and_si256(_mm256_packus_epi16(lo,hi),_mm256_set1_epi32(0x00ffffff));
+  mixed=rb_blit_select_avx2(_mm256_cmpeq_epi32(sa,_mm256_set1_epi32(0xff)),s,mixed);
+  return rb_blit_select_avx2(_mm256_cmpeq_epi32(sa,zero),d,mixed);
+}
+
+static inline RB_BLIT_TARGET_AVX2 __m256i rb_blit_premul8(__m256i d,__m256i s) {
+  __m256i zero=_mm256_setzero_si256();
+  __m256i v255=_mm256_set1_epi16(0xff);
+  __m256i sa=_mm256_srli_epi32(s,24);
+  __m256i dlo=_mm256_unpacklo_epi8(d,zero),dhi=_mm256_unpackhi_epi8(d,zero);
+  __m256i ialo=_mm256_sub_epi16(v255,rb_blit_alpha16_avx2(_mm256_unpacklo_epi8(s,zero)));
+  __m256i iahi=_mm256_sub_epi16(v255,rb_blit_alpha16_avx2(_mm256_unpackhi_epi8(s,zero)));
+  __m256i lo=_mm256_srli_epi16(_mm256_mullo_epi16(dlo,ialo),8);
+  __m256i hi=_mm256_srli_epi16(_mm256_mullo_epi16(dhi,iahi),8);
+  __m256i mixed=_mm256_and_si256(_mm256_add_epi8(_mm256_packus_epi16(lo,hi),s),_mm256_set1_epi32(0x00ffffff));
+  mixed=rb_blit_select_avx2(_mm256_cmpeq_epi32(sa,_mm256_set1_epi32(0xff)),s,mixed);
+  return rb_blit_select_avx2(_mm256_cmpeq_epi32(sa,zero),d,mixed);
+}
+
+static inline RB_BLIT_TARGET_AVX2 __m256i rb_blit_blend_blend8(__m256i d,__m256i s) {
+  __m256i zero=_mm256_setzero_si256();
+  __m256i v255=_mm256_set1_epi16(0xff);
+  __m256i sa=_mm256_srli_epi32(s,24);
+  __m256i da=_mm256_srli_epi32(d,24);
+  __m256i slo=_mm256_unpacklo_epi8(s,zero),shi=_mm256_unpackhi_epi8(s,zero);
+  __m256i dlo=_mm256_unpacklo_epi8(d,zero),dhi=_mm256_unpackhi_epi8(d,zero);
+  __m256i alo=rb_blit_alpha16_avx2(slo),ahi=rb_blit_alpha16_avx2(shi);
+  __m256i dklo=_mm256_srli_epi16(_mm256_mullo_epi16(rb_blit_alpha16_avx2(dlo),_mm256_sub_epi16(v255,alo)),8);
+  __m256i dkhi=_mm256_srli_epi16(_mm256_mullo_epi16(rb_blit_alpha16_avx2(dhi),_mm256_sub_epi16(v255,ahi)),8);
+  __m256i lo=_mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(dlo,dklo),_mm256_mullo_epi16(slo,alo)),8);
+  __m256i hi=_mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(dhi,dkhi),_mm256_mullo_epi16(shi,ahi)),8);
+  __m256i amask=_mm256_set1_epi32(0xff000000);
+  __m256i mixed=_mm256_or_si256(
+    _mm256_andnot_si256(amask,_mm256_packus_epi16(lo,hi)),
+    _mm256_and_si256(amask,_mm256_adds_epu8(s,d))
+  );
+  __m256i copy=_mm256_or_si256(_mm256_cmpeq_epi32(da,zero),_mm256_cmpeq_epi32(sa,_mm256_set1_epi32(0xff)));
+  mixed=rb_blit_select_avx2(copy,s,mixed);
+  return rb_blit_select_avx2(_mm256_cmpeq_epi32(sa,zero),d,mixed);
+}
+
+static inline RB_BLIT_TARGET_AVX2 __m256i rb_blit_colorkey8(__m256i d,__m256i s) {
+  return rb_blit_select_avx2(_mm256_cmpeq_epi32(s,_mm256_setzero_si256()),d,s);
+}
+
+static inline RB_BLIT_TARGET_AVX2 __m256i rb_blit_discrete8(__m256i d,__m256i s) {
+  return rb_blit_select_avx2(_mm256_cmpgt_epi32(_mm256_setzero_si256(),s),s,d);
+}
+
+static inline RB_BLIT_TARGET_AVX2 __m256i rb_blit_nonzero8(__m256i d,__m256i s) {
+  __m256i zero=_mm256_cmpeq_epi32(s,_mm256_setzero_si256());
+  return _mm256_or_si256(s,_mm256_and_si256(zero,_mm256_set1_epi32(0xff000000)));
+}
+
+/* Each AVX2 row function does only the multiple-of-8 prefix; caller finishes the tail.
+ */
+
+#define RB_BLIT_ROW8(name,fn) \
+  static RB_BLIT_TARGET_AVX2 int name(uint32_t *dst,const uint32_t *src,int c) { \
+    int n=c&~7; \
+    for (;c>=8;c-=8,dst+=8,src+=8) { \
+      __m256i d=_mm256_loadu_si256((__m256i*)dst); \
+      __m256i s=_mm256_loadu_si256((const __m256i*)src); \
+      _mm256_storeu_si256((__m256i*)dst,fn(d,s)); \
+    } \
+    return n; \
+  }
+
+RB_BLIT_ROW8(rb_image_row_blend_avx2,rb_blit_blend8)
+RB_BLIT_ROW8(rb_image_row_premul_avx2,rb_blit_premul8)
+RB_BLIT_ROW8(rb_image_row_blend_blend_avx2,rb_blit_blend_blend8)
+RB_BLIT_ROW8(rb_image_row_colorkey_avx2,rb_blit_colorkey8)
+RB_BLIT_ROW8(rb_image_row_discrete_avx2,rb_blit_discrete8)
+RB_BLIT_ROW8(rb_image_row_nonzero_avx2,rb_blit_nonzero8)
+
+#undef RB_BLIT_ROW8
+
+#define RB_BLIT_AVX2_PREFIX(name,dst,src,c) \
+  if (rb_blit_use_avx2()) { \
+    int n=name(dst,src,c); \
+    dst+=n; \
+    src+=n; \
+    c-=n; \
+  }
+
+#else
+  #define RB_BLIT_AVX2_PREFIX(name,dst,src,c)
+#endif
+
+/* NEON blocks.
+ * The blends load 8 pixels deinterleaved, one register per channel, which suits NEON's widening multiplies.
+ * The straight copies take 4 pixels as words.
+ */
+
+#if RB_SIMD_NEON
+
+static inline void rb_blit_blend8_neon(uint32_t *dst,const uint32_t *src) {
+  uint8x8x4_t s=vld4_u8((const uint8_t*)src);
+  uint8x8x4_t d=vld4_u8((uint8_t*)dst);
+  uint8x8_t a=s.val[3];
+  uint8x8_t ia=vmvn_u8(a);
+  uint8x8_t m0=vceq_u8(a,vdup_n_u8(0x00));
+  uint8x8_t mff=vceq_u8(a,vdup_n_u8(0xff));
+  uint8x8x4_t o;
+  int i=0; for (;i<3;i++) {
+    o.val[i]=vshrn_n_u16(vmlal_u8(vmull_u8(d.val[i],ia),s.val[i],a),8);
+  }
+  o.val[3]=vdup_n_u8(0);
+  for (i=0;i<4;i++) {
+    o.val[i]=vbsl_u8(m0,d.val[i],vbsl_u8(mff,s.val[i],o.val[i]));
+  }
+  vst4_u8((uint8_t*)dst,o);
+}
+
+static inline void rb_blit_premul8_neon(uint32_t *dst,const uint32_t *src) {
+  uint8x8x4_t s=vld4_u8((const uint8_t*)src);
+  uint8x8x4_t d=vld4_u8((uint8_t*)dst);
+  uint8x8_t a=s.val[3];
+  uint8x8_t ia=vmvn_u8(a);
+  uint8x8_t m0=vceq_u8(a,vdup_n_u8(0x00));
+  uint8x8_t mff=vceq_u8(a,vdup_n_u8(0xff));
+  uint8x8x4_t o;
+  int i=0; for (;i<3;i++) {
+    o.val[i]=vadd_u8(vshrn_n_u16(vmull_u8(d.val[i],ia),8),s.val[i]);
+  }
+  o.val[3]=vdup_n_u8(0);
+  for (i=0;i<4;i++) {
+    o.val[i]=vbsl_u8(m0,d.val[i],vbsl_u8(mff,s.val[i],o.val[i]));
+  }
+  vst4_u8((uint8_t*)dst,o);
+}
+
+static inline void rb_blit_blend_blend8_neon(uint32_t *dst,const uint32_t *src) {
+  uint8x8x4_t s=vld4_u8((const uint8_t*)src);
+  uint8x8x4_t d=vld4_u8((uint8_t*)dst);
+  uint8x8_t sa=s.val[3],da=d.val[3];
+  uint8x8_t dk=vshrn_n_u16(vmull_u8(da,vmvn_u8(sa)),8);
+  uint8x8_t m0=vceq_u8(sa,vdup_n_u8(0x00));
+  uint8x8_t copy=vorr_u8(vceq_u8(da,vdup_n_u8(0x00)),vceq_u8(sa,vdup_n_u8(0xff)));
+  uint8x8x4_t o;
+  int i=0; for (;i<3;i++) {
+    o.val[i]=vshrn_n_u16(vmlal_u8(vmull_u8(d.val[i],dk),s.val[i],sa),8);
+  }
+  o.val[3]=vqadd_u8(da,sa);
+  for (i=0;i<4;i++) {
+    o.val[i]=vbsl_u8(m0,d.val[i],vbsl_u8(copy,s.val[i],o.val[i]));
+  }
+  vst4_u8((uint8_t*)dst,o);
+}
+
+static inline uint32x4_t rb_blit_colorkey4(uint32x4_t d,uint32x4_t s) {
+  return vbslq_u32(vceqq_u32(s,vdupq_n_u32(0)),d,s);
+}
+
+static inline uint32x4_t rb_blit_discrete4(uint32x4_t d,uint32x4_t s) {
+  return vbslq_u32(vcgeq_u32(s,vdupq_n_u32(0x80000000)),s,d);
+}
+
+static inline uint32x4_t rb_blit_nonzero4(uint32x4_t d,uint32x4_t s) {
+  return vorrq_u32(s,vandq_u32(vceqq_u32(s,vdupq_n_u32(0)),vdupq_n_u32(0xff000000)));
+}
+
+#define RB_BLIT_ROW4(fn,dst,src,c) { \
+  for (;c>=4;c-=4,dst+=4,src+=4) { \
+    vst1q_u32(dst,fn(vld1q_u32(dst),vld1q_u32(src))); \
+  } \
+}
+
+#endif
+
+/* Row kernels.
+ */
+
+void rb_image_row_blend(uint32_t *dst,const uint32_t *src,int c) {
+  RB_BLIT_AVX2_PREFIX(rb_image_row_blend_avx2,dst,src,c)
+  #if RB_SIMD_SSE2
+    RB_BLIT_ROW4(rb_blit_blend4,dst,src,c)
+  #elif RB_SIMD_NEON
+    for (;c>=8;c-=8,dst+=8,src+=8) rb_blit_blend8_neon(dst,src);
+  #endif
+  for (;c-->0;dst++,src++) *dst=rb_blit_blend1(*dst,*src);
+}
+
+void rb_image_row_premul(uint32_t *dst,const uint32_t *src,int c) {
+  RB_BLIT_AVX2_PREFIX(rb_image_row_premul_avx2,dst,src,c)
+  #if RB_SIMD_SSE2
+    RB_BLIT_ROW4(rb_blit_premul4,dst,src,c)
+  #elif RB_SIMD_NEON
+    for (;c>=8;c-=8,dst+=8,src+=8) rb_blit_premul8_neon(dst,src);
+  #endif
+  for (;c-->0;dst++,src++) *dst=rb_blit_premul1(*dst,*src);
+}
+
+void rb_image_row_blend_blend(uint32_t *dst,const uint32_t *src,int c) {
+  RB_BLIT_AVX2_PREFIX(rb_image_row_blend_blend_avx2,dst,src,c)
+  #if RB_SIMD_SSE2
+    RB_BLIT_ROW4(rb_blit_blend_blend4,dst,src,c)
+  #elif RB_SIMD_NEON
+    for (;c>=8;c-=8,dst+=8,src+=8) rb_blit_blend_blend8_neon(dst,src);
+  #endif
+  for (;c-->0;dst++,src++) *dst=rb_blit_blend_blend1(*dst,*src);
+}
+
+void rb_image_row_colorkey(uint32_t *dst,const uint32_t *src,int c) {
+  RB_BLIT_AVX2_PREFIX(rb_image_row_colorkey_avx2,dst,src,c)
+  #if RB_SIMD_SSE2||RB_SIMD_NEON
+    RB_BLIT_ROW4(rb_blit_colorkey4,dst,src,c)
+  #endif
+  for (;c-->0;dst++,src++) if (*src) *dst=*src;
+}
+
+void rb_image_row_discrete(uint32_t *dst,const uint32_t *src,int c) {
+  RB_BLIT_AVX2_PREFIX(rb_image_row_discrete_avx2,dst,src,c)
+  #if RB_SIMD_SSE2||RB_SIMD_NEON
+    RB_BLIT_ROW4(rb_blit_discrete4,dst,src,c)
+  #endif
+  for (;c-->0;dst++,src++) if (*src>=0x80000000) *dst=*src;
+}
+
+void rb_image_row_nonzero(uint32_t *dst,const uint32_t *src,int c) {
+  RB_BLIT_AVX2_PREFIX(rb_image_row_nonzero_avx2,dst,src,c)
+  #if RB_SIMD_SSE2||RB_SIMD_NEON
+    RB_BLIT_ROW4(rb_blit_nonzero4,dst,src,c)
+  #endif
+  for (;c-->0;dst++,src++) if (!(*dst=*src)) (*dst)=0xff000000;
+}
+
+/* Reordering without blending, for transformed blits.
+ * We reorder a block of the source into dst orientation, then blend it with a row kernel.
+ */
+
+#if RB_SIMD_SSE2
+
+// Transpose a 4x4 block: dst row (j) gets word (j) of each of (a,b,c,d).
+#define RB_BLIT_TRANSPOSE4(a,b,c,d) { \
+  __m128i t0=_mm_unpacklo_epi32(a,b); \
+  __m128i t1=_mm_unpacklo_epi32(c,d); \
+  __m128i t2=_mm_unpackhi_epi32(a,b); \
+  __m128i t3=_mm_unpackhi_epi32(c,d); \
+  a=_mm_unpacklo_epi64(t0,t1); \
+  b=_mm_unpackhi_epi64(t0,t1); \
+  c=_mm_unpacklo_epi64(t2,t3); \
+  d=_mm_unpackhi_epi64(t2,t3); \
+}
+
+static inline void rb_blit_transpose4(uint32_t *dst,int dststride,const uint32_t *src,int srcstride,int srcstep) {
+  if (srcstep<0) src-=3;
+  __m128i a=_mm_loadu_si128((const __m128i*)src);
+  __m128i b=_mm_loadu_si128((const __m128i*)(src+srcstride));
+  __m128i c=_mm_loadu_si128((const __m128i*)(src+srcstride*2));
+  __m128i d=_mm_loadu_si128((const __m128i*)(src+srcstride*3));
+  RB_BLIT_TRANSPOSE4(a,b,c,d)
+  if (srcstep<0) {
+    __m128i t=a; a=d; d=t;
+    t=b; b=c; c=t;
+  }
+  _mm_storeu_si128((__m128i*)dst,a);
+  _mm_storeu_si128((__m128i*)(dst+dststride),b);
+  _mm_storeu_si128((__m128i*)(dst+dststride*2),c);
+  _mm_storeu_si128((__m128i*)(dst+dststride*3),d);
+}
+
+#undef RB_BLIT_TRANSPOSE4
+
+static inline void rb_blit_reverse4(uint32_t *dst,const uint32_t *src) {
+  _mm_storeu_si128((__m128i*)dst,_mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(src-3)),0x1b));
+}
+
+#elif RB_SIMD_NEON
+
+static inline void rb_blit_transpose4(uint32_t *dst,int dststride,const uint32_t *src,int srcstride,int srcstep) {
+  if (srcstep<0) src-=3;
+  uint32x4x2_t ab=vtrnq_u32(vld1q_u32(src),vld1q_u32(src+srcstride));
+  uint32x4x2_t cd=vtrnq_u32(vld1q_u32(src+srcstride*2),vld1q_u32(src+srcstride*3));
+  uint32x4_t r0=vcombine_u32(vget_low_u32(ab.val[0]),vget_low_u32(cd.val[0]));
+  uint32x4_t r1=vcombine_u32(vget_low_u32(ab.val[1]),vget_low_u32(cd.val[1]));
+  uint32x4_t r2=vcombine_u32(vget_high_u32(ab.val[0]),vget_high_u32(cd.val[0]));
+  uint32x4_t r3=vcombine_u32(vget_high_u32(ab.val[1]),vget_high_u32(cd.val[1]));
+  if (srcstep<0) {
+    uint32x4_t t=r0; r0=r3; r3=t;
+    t=r1; r1=r2; r2=t;
+  }
+  vst1q_u32(dst,r0);
+  vst1q_u32(dst+dststride,r1);
+  vst1q_u32(dst+dststride*2,r2);
+  vst1q_u32(dst+dststride*3,r3);
+}
+
+static inline void rb_blit_reverse4(uint32_t *dst,const uint32_t *src) {
+  uint32x4_t v=vrev64q_u32(vld1q_u32(src-3));
+  vst1q_u32(dst,vcombine_u32(vget_high_u32(v),vget_low_u32(v)));
+}
+
+#endif
+
+void rb_image_row_reverse(uint32_t *dst,const uint32_t *src,int c) {
+  #if RB_SIMD_SSE2||RB_SIMD_NEON
+    for (;c>=4;c-=4,dst+=4,src-=4) rb_blit_reverse4(dst,src);
+  #endif
+  for (;c-->0;dst++,src--) *dst=*src;
+}
+
+void rb_image_block_transpose(
+  uint32_t *dst,int dststride,
+  const uint32_t *src,int srcstride,int srcstep,
+  int w,int h
+) {
+  int y=0;
+  #if RB_SIMD_SSE2||RB_SIMD_NEON
+    int w4=w&~3;
+    for (;y<=h-4;y+=4) {
+      uint32_t *dstp=dst+y*dststride;
+      const uint32_t *srcp=src+y*srcstep;
+      int x=0;
+      for (;x<w4;x+=4,dstp+=4,srcp+=srcstride*4) rb_blit_transpose4(dstp,dststride,srcp,srcstride,srcstep);
+      for (;x<w;x++,dstp++,srcp+=srcstride) {
+        dstp[0]=srcp[0];
+        dstp[dststride]=srcp[srcstep];
+        dstp[dststride*2]=srcp[srcstep*2];
+        dstp[dststride*3]=srcp[srcstep*3];
+      }
+    }
+  #endif
+  for (;y<h;y++) {
+    uint32_t *dstp=dst+y*dststride;
+    const uint32_t *srcp=src+y*srcstep;
+    int x=0; for (;x<w;x++,srcp+=srcstride) dstp[x]=*srcp;
+  }
+}
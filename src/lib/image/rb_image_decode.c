@@ -34,6 +34,71 @@ static void rb_image_decode_row_A1(uint32_t *dst,const uint8_t *src,int c) {
   }
 }
 
+/* Palette.
+ */
+ 
+int rb_palette_measure(const void *src,int srcc) {
+  if (!src||(srcc<1)) return -1;
+  int len=1+(((const uint8_t*)src)[0]+1)*4;
+  if (len>srcc) return -1;
+  return len;
+}
+ 
+struct rb_palette *rb_palette_new_decode(const void *src,int srcc) {
+  if (rb_palette_measure(src,srcc)<0) return 0;
+  const uint8_t *SRC=src;
+  struct rb_palette *palette=rb_palette_new();
+  if (!palette) return 0;
+  
+  int c=SRC[0]+1,have_zero=0,have_partial=0;
+  uint32_t *dst=palette->v;
+  const uint8_t *p=SRC+1;
+  for (;c-->0;dst++,p+=4) {
+    if (p[3]==0x00) have_zero=1;
+    else if (p[3]!=0xff) have_partial=1;
+    *dst=(p[3]<<24)|(p[0]<<16)|(p[1]<<8)|p[2];
+  }
+  
+  if (have_partial) {
+    palette->alphamode=RB_ALPHAMODE_BLEND;
+    rb_palette_premultiply(palette);
+  } else if (have_zero) {
+    palette->alphamode=RB_ALPHAMODE_COLORKEY;
+    int i=256; while (i-->0) {
+      if (!(palette->v[i]&0xff000000)) palette->v[i]=0;
+    }
+  } else {
+    palette->alphamode=RB_ALPHAMODE_OPAQUE;
+  }
+  return palette;
+}
+
+/* Indexed image.
+ */
+ 
+struct rb_image8 *rb_image8_new_decode(const void *src,int srcc) {
+  if (!src||(srcc<4)) return 0;
+  const uint8_t *SRC=src;
+  if (SRC[0]!=RB_IMAGE_FORMAT_I8) return 0;
+  int w=((SRC[1]<<4)|(SRC[2]>>4))+1;
+  int h=(((SRC[2]&0x0f)<<8)|SRC[3])+1;
+  int srcp=4;
+  
+  int palettec=rb_palette_measure(SRC+srcp,srcc-srcp);
+  if (palettec<0) return 0;
+  if (srcp+palettec>srcc-w*h) return 0;
+  
+  struct rb_image8 *image=rb_image8_new(w,h);
+  if (!image) return 0;
+  if (!(image->palette=rb_palette_new_decode(SRC+srcp,palettec))) {
+    rb_image8_del(image);
+    return 0;
+  }
+  srcp+=palettec;
+  memcpy(image->pixels,SRC+srcp,w*h);
+  return image;
+}
+
 /* Decode, main entry point.
  */
  
@@ -43,6 +108,13 @@ struct rb_image *rb_image_new_decode(const void *src,int srcc) {
   int srcp=0;
   
   int format=SRC[srcp++];
+  if (format==RB_IMAGE_FORMAT_I8) {
+    struct rb_image8 *image8=rb_image8_new_decode(src,srcc);
+    if (!image8) return 0;
+    struct rb_image *image=rb_image8_expand(image8,0);
+    rb_image8_del(image8);
+    return image;
+  }
   int w=((SRC[srcp]<<4)|(SRC[srcp+1]>>4))+1;
   int h=(((SRC[srcp+1]&0x0f)<<8)|SRC[srcp+2])+1;
   srcp+=3;
@@ -75,6 +147,7 @@ struct rb_image *rb_image_new_decode(const void *src,int srcc) {
     case RB_IMAGE_FORMAT_A8: image->alphamode=RB_ALPHAMODE_BLEND; break;
     case RB_IMAGE_FORMAT_A1: image->alphamode=RB_ALPHAMODE_COLORKEY; break;
   }
+  rb_image_premultiply(image);
   
   return image;
 }
@@ -0,0 +1,102 @@
+#include "rabbit/rb_internal.h"
+#include "rabbit/rb_image.h"
+#include "rabbit/rb_serial.h"
+#include <zlib.h>
+
+/* Big-endian 32-bit integer.
+ */
+
+static int rb_png_encode_u32(struct rb_encoder *dst,uint32_t v) {
+  if (rb_encoder_require(dst,4)<0) return -1;
+  dst->v[dst->c++]=v>>24;
+  dst->v[dst->c++]=v>>16;
+  dst->v[dst->c++]=v>>8;
+  dst->v[dst->c++]=v;
+  return 0;
+}
+
+/* One chunk: Length, type, body, and CRC of type+body.
+ */
+
+static int rb_png_encode_chunk(struct rb_encoder *dst,const char *type,const void *src,int srcc) {
+  if (rb_png_encode_u32(dst,srcc)<0) return -1;
+  int crcp=dst->c;
+  if (rb_encode_raw(dst,type,4)<0) return -1;
+  if (rb_encode_raw(dst,src,srcc)<0) return -1;
+  uint32_t crc=crc32(crc32(0,0,0),(uint8_t*)dst->v+crcp,dst->c-crcp);
+  return rb_png_encode_u32(dst,crc);
+}
+
+/* Filtered image data, before compression.
+ * Filter NONE on every row; our framebuffers compress fine without, and capture should be cheap.
+ */
+
+static void rb_png_filter_rows(uint8_t *dst,const struct rb_image *image,int chanc) {
+  const uint32_t *src=image->pixels;
+  int yi=image->h;
+  for (;yi-->0;) {
+    *dst++=0;
+    int xi=image->w;
+    if (chanc==3) {
+      for (;xi-->0;src++) {
+        *dst++=(*src)>>16;
+        *dst++=(*src)>>8;
+        *dst++=*src;
+      }
+    } else if (image->alphamode==RB_ALPHAMODE_COLORKEY) {
+      for (;xi-->0;src++) {
+        *dst++=(*src)>>16;
+        *dst++=(*src)>>8;
+        *dst++=*src;
+        *dst++=(*src)?0xff:0x00;
+      }
+    } else {
+      for (;xi-->0;src++) {
+        *dst++=(*src)>>16;
+        *dst++=(*src)>>8;
+        *dst++=*src;
+        *dst++=(*src)>>24;
+      }
+    }
+  }
+}
+
+/* Encode PNG, main entry point.
+ */
+
+int rb_image_encode_png(struct rb_encoder *dst,const struct rb_image *image) {
+  if (!dst||!image) return -1;
+  int chanc=(image->alphamode==RB_ALPHAMODE_OPAQUE)?3:4;
+
+  uint8_t ihdr[13]={
+    image->w>>24,image->w>>16,image->w>>8,image->w,
+    image->h>>24,image->h>>16,image->h>>8,image->h,
+    8,(chanc==3)?2:6,0,0,0,
+  };
+
+  uLong rawc=(uLong)image->h*(1+image->w*chanc);
+  uLong zc=compressBound(rawc);
+  uint8_t *raw=malloc(rawc);
+  if (!raw) return -1;
+  uint8_t *z=malloc(zc);
+  if (!z) { free(raw); return -1; }
+  rb_png_filter_rows(raw,image,chanc);
+  if (compress2(z,&zc,raw,rawc,Z_BEST_SPEED)!=Z_OK) {
+    free(raw);
+    free(z);
+    return -1;
+  }
+  free(raw);
+
+  if (
+    (rb_encode_raw(dst,"\x89PNG\r\n\x1a\n",8)<0)||
+    (rb_png_encode_chunk(dst,"IHDR",ihdr,sizeof(ihdr))<0)||
+    (rb_png_encode_chunk(dst,"IDAT",z,zc)<0)||
+    (rb_png_encode_chunk(dst,"IEND",0,0)<0)
+  ) {
+    free(z);
+    return -1;
+  }
+  free(z);
+  return 0;
+}
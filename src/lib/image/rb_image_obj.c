@@ -46,3 +46,106 @@ int rb_image_ref(struct rb_image *image) {
   image->refc++;
   return 0;
 }
+
+/* Premultiply.
+ * Same rounding as the BLEND blitter: (c*a)>>8. Except alpha 0xff, which blits as a plain copy.
+ */
+ 
+static void rb_premultiply_pixels(uint32_t *p,int c) {
+  for (;c-->0;p++) {
+    uint32_t a=(*p)>>24;
+    if (a==0xff) continue;
+    uint32_t r=((((*p)>>16)&0xff)*a)>>8;
+    uint32_t g=((((*p)>>8)&0xff)*a)>>8;
+    uint32_t b=(((*p)&0xff)*a)>>8;
+    *p=(a<<24)|(r<<16)|(g<<8)|b;
+  }
+}
+ 
+void rb_image_premultiply(struct rb_image *image) {
+  if (!image||(image->alphamode!=RB_ALPHAMODE_BLEND)) return;
+  rb_premultiply_pixels(image->pixels,image->w*image->h);
+  image->alphamode=RB_ALPHAMODE_PREMUL;
+}
+
+void rb_palette_premultiply(struct rb_palette *palette) {
+  if (!palette||(palette->alphamode!=RB_ALPHAMODE_BLEND)) return;
+  rb_premultiply_pixels(palette->v,256);
+  palette->alphamode=RB_ALPHAMODE_PREMUL;
+}
+
+/* Palette.
+ */
+ 
+struct rb_palette *rb_palette_new() {
+  struct rb_palette *palette=calloc(1,sizeof(struct rb_palette));
+  if (!palette) return 0;
+  palette->refc=1;
+  palette->alphamode=RB_ALPHAMODE_BLEND;
+  return palette;
+}
+
+void rb_palette_del(struct rb_palette *palette) {
+  if (!palette) return;
+  if (palette->refc-->1) return;
+  free(palette);
+}
+
+int rb_palette_ref(struct rb_palette *palette) {
+  if (!palette) return -1;
+  if (palette->refc<1) return -1;
+  if (palette->refc==INT_MAX) return -1;
+  palette->refc++;
+  return 0;
+}
+
+/* Indexed image.
+ */
+ 
+struct rb_image8 *rb_image8_new(int w,int h) {
+  if ((w<1)||(w>RB_IMAGE_SIZE_LIMIT)) return 0;
+  if ((h<1)||(h>RB_IMAGE_SIZE_LIMIT)) return 0;
+  struct rb_image8 *image=calloc(1,sizeof(struct rb_image8)+w*h);
+  if (!image) return 0;
+  image->refc=1;
+  image->w=w;
+  image->h=h;
+  return image;
+}
+
+void rb_image8_del(struct rb_image8 *image) {
+  if (!image) return;
+  if (image->refc-->1) return;
+  rb_palette_del(image->palette);
+  free(image);
+}
+
+int rb_image8_ref(struct rb_image8 *image) {
+  if (!image) return -1;
+  if (image->refc<1) return -1;
+  if (image->refc==INT_MAX) return -1;
+  image->refc++;
+  return 0;
+}
+
+int rb_image8_set_palette(struct rb_image8 *image,struct rb_palette *palette) {
+  if (!image) return -1;
+  if (image->palette==palette) return 0;
+  if (palette&&(rb_palette_ref(palette)<0)) return -1;
+  rb_palette_del(image->palette);
+  image->palette=palette;
+  return 0;
+}
+
+/* Expand indexed image to ARGB.
+ */
+ 
+struct rb_image *rb_image8_expand(const struct rb_image8 *src,const struct rb_palette *palette) {
+  if (!src) return 0;
+  if (!palette&&!(palette=src->palette)) return 0;
+  struct rb_image *image=rb_image_new(src->w,src->h);
+  if (!image) return 0;
+  image->alphamode=palette->alphamode;
+  rb_image8_copy_safe(image,0,0,src,0,0,src->w,src->h,palette);
+  return image;
+}
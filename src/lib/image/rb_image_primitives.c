@@ -289,6 +289,7 @@ void rb_image_replace_by_alpha(struct rb_image *image,uint32_t opaque,uint32_t t
   int i=image->w*image->h;
   switch (image->alphamode) {
     case RB_ALPHAMODE_BLEND:
+    case RB_ALPHAMODE_PREMUL:
     case RB_ALPHAMODE_DISCRETE: {
         for (;i-->0;p++) {
            if ((*p)&0x80000000) *p=opaque;
@@ -341,7 +342,7 @@ void rb_image_darken(struct rb_image *image,uint8_t brightness) {
       for (;i-->0;dst++) {
         if (*dst) *dst=0x01000000;
       }
-    } else { // DISCRETE,BLEND
+    } else { // DISCRETE,BLEND,PREMUL
       for (;i-->0;dst++) {
         *dst=(*dst)&0xff000000;
       }
@@ -1,5 +1,6 @@
 #include "rabbit/rb_internal.h"
 #include "rabbit/rb_image.h"
+#include "rabbit/rb_simd.h"
 #include <math.h>
 #if RB_ARCH==RB_ARCH_macos
   #include <machine/endian.h>
@@ -13,6 +14,9 @@
 void rb_lights_cleanup(struct rb_lights *lights) {
   if (lights->lightv) free(lights->lightv);
   rb_image_del(lights->scratch);
+  if (lights->lutv) free(lights->lutv);
+  if (lights->mapv) free(lights->mapv);
+  if (lights->extentv) free(lights->extentv);
   memset(lights,0,sizeof(struct rb_lights));
 }
 
@@ -42,6 +46,7 @@ struct rb_light *rb_lights_add(struct rb_lights *lights,int id) {
   }
   struct rb_light *light=lights->lightv+lights->lightc++;
   memset(light,0,sizeof(struct rb_light));
+  light->rgb=0xffffff;
   if (id>0) light->id=id;
   else light->id=rb_lights_unused_id(lights);
   return light;
@@ -76,149 +81,643 @@ int rb_lights_clear(struct rb_lights *lights) {
   return 0;
 }
 
+/* Channels of a color map entry, which is laid out like a pixel.
+ */
+ 
+#if BYTE_ORDER==BIG_ENDIAN
+  #define RB_LIGHTS_CHANNEL_R 1
+  #define RB_LIGHTS_CHANNEL_G 2
+  #define RB_LIGHTS_CHANNEL_B 3
+#else
+  #define RB_LIGHTS_CHANNEL_R 2
+  #define RB_LIGHTS_CHANNEL_G 1
+  #define RB_LIGHTS_CHANNEL_B 0
+#endif
+
+// Spans are rasterized and upsampled in pieces this long, with a buffer on the stack.
+#define RB_LIGHTS_CHUNK 256
+
+// rb_lights_draw() does this many rows of each stage at a time.
+#define RB_LIGHTS_BAND 16
+
 /* Darken one pixel.
+ * This is the reference; vector paths must match it exactly.
  */
  
 static inline uint32_t rb_lights_darken_pixel(uint32_t src,uint8_t brightness) {
   uint8_t *v=(uint8_t*)&src;
-  #if BYTE_ORDER==BIG_ENDIAN
-    v[1]=(v[1]*brightness)>>8;
-    v[2]=(v[2]*brightness)>>8;
-    v[3]=(v[3]*brightness)>>8;
-  #else
-    v[0]=(v[0]*brightness)>>8;
-    v[1]=(v[1]*brightness)>>8;
-    v[2]=(v[2]*brightness)>>8;
-  #endif
+  v[RB_LIGHTS_CHANNEL_R]=(v[RB_LIGHTS_CHANNEL_R]*brightness)>>8;
+  v[RB_LIGHTS_CHANNEL_G]=(v[RB_LIGHTS_CHANNEL_G]*brightness)>>8;
+  v[RB_LIGHTS_CHANNEL_B]=(v[RB_LIGHTS_CHANNEL_B]*brightness)>>8;
   return src;
 }
 
-static inline void rb_lights_darken(
-  uint32_t *v,int c,uint8_t brightness
-) {
+// Same, but each channel by the same channel of (brightness). 0xff in a channel leaves it alone.
+static inline uint32_t rb_lights_darken_pixel_rgb(uint32_t src,uint32_t brightness) {
+  uint8_t *v=(uint8_t*)&src;
+  const uint8_t *b=(uint8_t*)&brightness;
+  if (b[RB_LIGHTS_CHANNEL_R]!=0xff) v[RB_LIGHTS_CHANNEL_R]=(v[RB_LIGHTS_CHANNEL_R]*b[RB_LIGHTS_CHANNEL_R])>>8;
+  if (b[RB_LIGHTS_CHANNEL_G]!=0xff) v[RB_LIGHTS_CHANNEL_G]=(v[RB_LIGHTS_CHANNEL_G]*b[RB_LIGHTS_CHANNEL_G])>>8;
+  if (b[RB_LIGHTS_CHANNEL_B]!=0xff) v[RB_LIGHTS_CHANNEL_B]=(v[RB_LIGHTS_CHANNEL_B]*b[RB_LIGHTS_CHANNEL_B])>>8;
+  return src;
+}
+
+/* Darken a run of pixels: uniformly, by a mono map, or by a color map.
+ * Alpha is preserved. For vectors, brightness 0xff becomes a multiplier of 0x100, ie noop.
+ */
+
+#if RB_SIMD_SSE2
+
+// Force each pixel's alpha multiplier to 0x100.
+static inline __m128i rb_lights_keep_alpha(__m128i m) {
+  return _mm_or_si128(
+    _mm_and_si128(m,_mm_set_epi16(0,-1,-1,-1,0,-1,-1,-1)),
+    _mm_set_epi16(0x100,0,0,0,0x100,0,0,0)
+  );
+}
+
+// 16-bit multipliers for two pixels, from the low two 16-bit lanes of (b).
+static inline __m128i rb_lights_mul2(__m128i b) {
+  b=_mm_unpacklo_epi16(b,b);
+  return rb_lights_keep_alpha(_mm_unpacklo_epi32(b,b));
+}
+
+// 0xff to 0x100 in each 16-bit lane.
+static inline __m128i rb_lights_widen255(__m128i b) {
+  return _mm_sub_epi16(b,_mm_cmpeq_epi16(b,_mm_set1_epi16(0xff)));
+}
+
+static inline __m128i rb_lights_darken4(__m128i v,__m128i mlo,__m128i mhi) {
+  __m128i zero=_mm_setzero_si128();
+  __m128i lo=_mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v,zero),mlo),8);
+  __m128i hi=_mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v,zero),mhi),8);
+  return _mm_packus_epi16(lo,hi);
+}
+
+#endif
+
+#if RB_SIMD_NEON
+
+static inline void rb_lights_darken8_neon(uint32_t *v,uint8x8_t r,uint8x8_t g,uint8x8_t b) {
+  uint8x8x4_t p=vld4_u8((uint8_t*)v);
+  #define CHANNEL(ch,m) \
+    p.val[ch]=vshrn_n_u16(vaddw_u8(vmull_u8(p.val[ch],m),vand_u8(p.val[ch],vceq_u8(m,vdup_n_u8(0xff)))),8);
+  CHANNEL(RB_LIGHTS_CHANNEL_R,r)
+  CHANNEL(RB_LIGHTS_CHANNEL_G,g)
+  CHANNEL(RB_LIGHTS_CHANNEL_B,b)
+  #undef CHANNEL
+  vst4_u8((uint8_t*)v,p);
+}
+
+#endif
+ 
+static void rb_lights_darken(uint32_t *v,int c,uint8_t brightness) {
+  if (brightness==0xff) return;
+  #if RB_SIMD_SSE2
+    __m128i m=rb_lights_mul2(_mm_set1_epi16(brightness));
+    for (;c>=4;c-=4,v+=4) {
+      _mm_storeu_si128((__m128i*)v,rb_lights_darken4(_mm_loadu_si128((__m128i*)v),m,m));
+    }
+  #elif RB_SIMD_NEON
+    uint8x8_t b=vdup_n_u8(brightness);
+    for (;c>=8;c-=8,v+=8) rb_lights_darken8_neon(v,b,b,b);
+  #endif
   for (;c-->0;v++) *v=rb_lights_darken_pixel(*v,brightness);
 }
 
-/* Draw.
+static void rb_lights_darken_each(uint32_t *v,const uint8_t *brightv,int c) {
+  #if RB_SIMD_SSE2
+    for (;c>=4;c-=4,v+=4,brightv+=4) {
+      int32_t b4;
+      memcpy(&b4,brightv,4);
+      if (b4==-1) continue;
+      __m128i b=rb_lights_widen255(_mm_unpacklo_epi8(_mm_cvtsi32_si128(b4),_mm_setzero_si128()));
+      __m128i mlo=rb_lights_mul2(b);
+      __m128i mhi=rb_lights_mul2(_mm_srli_si128(b,4));
+      _mm_storeu_si128((__m128i*)v,rb_lights_darken4(_mm_loadu_si128((__m128i*)v),mlo,mhi));
+    }
+  #elif RB_SIMD_NEON
+    for (;c>=8;c-=8,v+=8,brightv+=8) {
+      uint8x8_t b=vld1_u8(brightv);
+      rb_lights_darken8_neon(v,b,b,b);
+    }
+  #endif
+  for (;c-->0;v++,brightv++) {
+    if (*brightv!=0xff) *v=rb_lights_darken_pixel(*v,*brightv);
+  }
+}
+
+static void rb_lights_darken_each_rgb(uint32_t *v,const uint32_t *brightv,int c) {
+  #if RB_SIMD_SSE2
+    __m128i zero=_mm_setzero_si128();
+    for (;c>=4;c-=4,v+=4,brightv+=4) {
+      __m128i b=_mm_loadu_si128((const __m128i*)brightv);
+      __m128i mlo=rb_lights_keep_alpha(rb_lights_widen255(_mm_unpacklo_epi8(b,zero)));
+      __m128i mhi=rb_lights_keep_alpha(rb_lights_widen255(_mm_unpackhi_epi8(b,zero)));
+      _mm_storeu_si128((__m128i*)v,rb_lights_darken4(_mm_loadu_si128((__m128i*)v),mlo,mhi));
+    }
+  #elif RB_SIMD_NEON
+    for (;c>=8;c-=8,v+=8,brightv+=8) {
+      uint8x8x4_t b=vld4_u8((const uint8_t*)brightv);
+      rb_lights_darken8_neon(v,b.val[RB_LIGHTS_CHANNEL_R],b.val[RB_LIGHTS_CHANNEL_G],b.val[RB_LIGHTS_CHANNEL_B]);
+    }
+  #endif
+  for (;c-->0;v++,brightv++) *v=rb_lights_darken_pixel_rgb(*v,*brightv);
+}
+
+/* Integer square root, rounding down.
  */
  
-int rb_lights_draw(
-  struct rb_image *dst,
-  struct rb_lights *lights,
-  int scrollx,int scrolly
+static inline int rb_lights_isqrt(int n) {
+  int r=(int)sqrtf((float)n);
+  while (r*r>n) r--;
+  while ((r+1)*(r+1)<=n) r++;
+  return r;
+}
+
+/* Falloff table for one light, at the end of (lutv).
+ * Gradient is linear in squared distance, so a table over squared distance suits it, one entry per unit.
+ * Gradients too big for that get a 24-bit reciprocal instead, and multiply per pixel.
+ */
+ 
+static int rb_lights_build_lut(struct rb_lights *lights,struct rb_light *light,int *lutc) {
+  int span=light->outer-light->inner;
+  if (span>RB_LIGHTS_LUT_SIZE) {
+    light->lutp=-1;
+    light->lutrecip=(int)((1ll<<40)/span);
+    return 0;
+  }
+  if (*lutc>lights->luta-span) {
+    int na=(*lutc+span+RB_LIGHTS_LUT_SIZE)&~(RB_LIGHTS_LUT_SIZE-1);
+    void *nv=realloc(lights->lutv,sizeof(uint16_t)*na);
+    if (!nv) return -1;
+    lights->lutv=nv;
+    lights->luta=na;
+  }
+  light->lutp=*lutc;
+  uint16_t *dst=lights->lutv+light->lutp;
+  dst[0]=0xffff; // distance**2==inner, never looked up.
+  int i=1; for (;i<span;i++) {
+    dst[i]=((span-i)<<16)/span;
+  }
+  (*lutc)+=span;
+  return 0;
+}
+
+/* Horizontal extent of one light on one map row, in map pixels, clipped.
+ * Returns zero if it doesn't touch the row.
+ * Map pixel (x) is at framebuffer column (x<<shift).
+ */
+ 
+static int rb_lights_span(int *x0,int *x1,const struct rb_light *light,int lx,int dy2,int shift,int mapw) {
+  int lim=(light->outer>light->inner)?(light->outer-1):light->inner;
+  if (dy2>lim) return 0;
+  int hw=rb_lights_isqrt(lim-dy2);
+  *x0=-((hw-lx)>>shift); // ceil((lx-hw)/step)
+  *x1=(lx+hw)>>shift;
+  if (*x0<0) *x0=0;
+  if (*x1>=mapw) *x1=mapw-1;
+  return (*x0<=*x1);
+}
+
+/* Intensity of one light across (c) map pixels starting at (x), into (dst): 0..0x10000.
+ * Walk (d2) incrementally, by second differences: Map pixels are (step) apart, and (dx+step)**2 = dx**2+2*dx*step+step**2.
+ */
+ 
+static void rb_lights_intensity(
+  uint32_t *dst,int c,
+  const struct rb_lights *lights,const struct rb_light *light,
+  int x,int lx,int dy2,int shift
 ) {
-  if (!dst||(dst->alphamode!=RB_ALPHAMODE_OPAQUE)) return -1;
+  int dx=(x<<shift)-lx;
+  int d2=dx*dx+dy2;
+  int stepstep=1<<(shift<<1);
+  int dd2=2*dx*(1<<shift)+stepstep;
+  int inner=light->inner;
+  if (light->outer<=inner) {
+    for (;c-->0;dst++) *dst=0x10000;
+  } else if (light->lutp>=0) {
+    const uint16_t *lut=lights->lutv+light->lutp;
+    for (;c-->0;dst++) {
+      *dst=(d2<=inner)?0x10000:lut[d2-inner];
+      d2+=dd2;
+      dd2+=stepstep<<1;
+    }
+  } else {
+    int64_t recip=light->lutrecip;
+    int outer=light->outer;
+    for (;c-->0;dst++) {
+      *dst=(d2<=inner)?0x10000:(((outer-d2)*recip)>>24);
+      d2+=dd2;
+      dd2+=stepstep<<1;
+    }
+  }
+}
+
+/* Combine one channel of one light into the map.
+ * (level) is the channel's color, scaled so 0xff is 0x10000.
+ */
+ 
+static void rb_lights_combine(uint8_t *dst,int stride,const uint32_t *intensityv,int c,uint32_t level,int blend) {
+  
+  // Scale intensity by the channel level. White is common and needs nothing.
+  uint32_t scaled[RB_LIGHTS_CHUNK];
+  if (level<0x10000) {
+    int i=0; for (;i<c;i++) scaled[i]=((uint64_t)intensityv[i]*level)>>16;
+    intensityv=scaled;
+  }
+  
+  switch (blend) {
+    case RB_LIGHTS_BLEND_ADD: {
+        for (;c-->0;dst+=stride,intensityv++) {
+          int v=*dst+(((*intensityv)*0xff)>>16);
+          *dst=(v>0xff)?0xff:v;
+        }
+      } break;
+    case RB_LIGHTS_BLEND_MAX: {
+        for (;c-->0;dst+=stride,intensityv++) {
+          int v=((*intensityv)*0xff)>>16;
+          if (v>*dst) *dst=v;
+        }
+      } break;
+    default: {
+        for (;c-->0;dst+=stride,intensityv++) {
+          int b=*dst;
+          *dst=b+(((0xff-b)*(*intensityv))>>16);
+        }
+      }
+  }
+}
+
+/* Rasterize one white light onto one row of a mono map.
+ * White saturates in every blend mode, so the inner circle is a memset, and the gradient combines as it goes.
+ */
+
+#define RB_LIGHTS_GRADIENT(combine) { \
+  int dx=(xstart<<shift)-lx; \
+  int d2=dx*dx+dy2; \
+  int dd2=2*dx*(1<<shift)+stepstep; \
+  uint8_t *p=row+xstart; \
+  int x=xstart; \
+  if (light->lutp>=0) { \
+    const uint16_t *lut=lights->lutv+light->lutp; \
+    for (;x<=xstop;x++,p++) { \
+      uint32_t n=lut[d2-inner]; \
+      combine \
+      d2+=dd2; \
+      dd2+=stepstep<<1; \
+    } \
+  } else { \
+    int64_t recip=light->lutrecip; \
+    for (;x<=xstop;x++,p++) { \
+      uint32_t n=((outer-d2)*recip)>>24; \
+      combine \
+      d2+=dd2; \
+      dd2+=stepstep<<1; \
+    } \
+  } \
+}
+ 
+static void rb_lights_rasterize_mono(
+  uint8_t *row,int x0,int x1,
+  const struct rb_lights *lights,const struct rb_light *light,
+  int lx,int dy2
+) {
+  int shift=lights->shift;
+  int ia=x1+1,iz=x1;
+  if (dy2<=light->inner) {
+    int ha=rb_lights_isqrt(light->inner-dy2);
+    ia=-((ha-lx)>>shift);
+    iz=(lx+ha)>>shift;
+    if (ia<x0) ia=x0;
+    if (iz>x1) iz=x1;
+    if (ia<=iz) memset(row+ia,0xff,iz-ia+1);
+    else { ia=x1+1; iz=x1; }
+  }
+  if (light->outer<=light->inner) return;
+  
+  // Gradient on each side of the inner span, which might be empty.
+  int inner=light->inner,outer=light->outer;
+  int stepstep=1<<(shift<<1);
+  int side=0; for (;side<2;side++) {
+    int xstart=side?(iz+1):x0;
+    int xstop=side?x1:(ia-1);
+    if (xstart>xstop) continue;
+    switch (lights->blend) {
+      case RB_LIGHTS_BLEND_ADD: RB_LIGHTS_GRADIENT({
+          int v=*p+((n*0xff)>>16);
+          *p=(v>0xff)?0xff:v;
+        }) break;
+      case RB_LIGHTS_BLEND_MAX: RB_LIGHTS_GRADIENT({
+          int v=(n*0xff)>>16;
+          if (v>*p) *p=v;
+        }) break;
+      default: RB_LIGHTS_GRADIENT({
+          int b=*p;
+          *p=b+(((0xff-b)*n)>>16);
+        })
+    }
+  }
+}
+
+#undef RB_LIGHTS_GRADIENT
+
+/* Rasterize one light onto one map row.
+ * Color lights go through an intensity buffer, then combine one channel at a time.
+ */
+ 
+static void rb_lights_rasterize_light(
+  uint8_t *row,int x0,int x1,
+  const struct rb_lights *lights,const struct rb_light *light,
+  int lx,int dy2
+) {
+  if (!lights->mapcolor) {
+    rb_lights_rasterize_mono(row,x0,x1,lights,light,lx,dy2);
+    return;
+  }
+  uint32_t intensityv[RB_LIGHTS_CHUNK];
+  uint32_t levelr=(((light->rgb>>16)&0xff)*0x10000+0x7f)/0xff;
+  uint32_t levelg=(((light->rgb>>8)&0xff)*0x10000+0x7f)/0xff;
+  uint32_t levelb=((light->rgb&0xff)*0x10000+0x7f)/0xff;
+  while (x0<=x1) {
+    int c=x1-x0+1;
+    if (c>RB_LIGHTS_CHUNK) c=RB_LIGHTS_CHUNK;
+    rb_lights_intensity(intensityv,c,lights,light,x0,lx,dy2,lights->shift);
+    uint8_t *p=row+(x0<<2);
+    rb_lights_combine(p+RB_LIGHTS_CHANNEL_R,4,intensityv,c,levelr,lights->blend);
+    rb_lights_combine(p+RB_LIGHTS_CHANNEL_G,4,intensityv,c,levelg,lights->blend);
+    rb_lights_combine(p+RB_LIGHTS_CHANNEL_B,4,intensityv,c,levelb,lights->blend);
+    x0+=c;
+  }
+}
 
+/* Prepare.
+ */
+ 
+int rb_lights_prepare(struct rb_lights *lights,int w,int h,int scrollx,int scrolly) {
+  if ((w<1)||(h<1)) return -1;
+  lights->fbw=w;
+  lights->fbh=h;
+  lights->scrollx=scrollx;
+  lights->scrolly=scrolly;
+  lights->shift=lights->halfres?1:0;
+  lights->visiblec=0;
+  lights->mapcolor=0;
+  
   // A background of 0xff is no-op: You can't see a light in a bright room.
   if (lights->bg==0xff) return 0;
   
   // Precalculate a few things for each light, and count how many are visible.
   struct rb_light *light=lights->lightv;
   int i=lights->lightc;
-  int visiblec=0;
+  int lutc=0;
   for (;i-->0;light++) {
     // Invalid radii, not visible.
-    if ((light->radius<0)||(light->gradius<0)||(!light->radius&&!light->gradius)) {
-      light->visible=0;
-      continue;
-    }
+    light->visible=0;
+    if ((light->radius<0)||(light->gradius<0)||(!light->radius&&!light->gradius)) continue;
+    if (light->radius>RB_LIGHT_EXTENT_LIMIT-light->gradius) continue;
+    // Black lights add nothing in any blend mode.
+    if (!(light->rgb&0xffffff)) continue;
     // Determine extents. Invisible if offscreen. Preserve the (y) ones, and the (x) ones we don't need.
     light->ya=light->y-scrolly;
     light->yz=light->ya+light->radius+light->gradius;
     light->ya-=light->radius+light->gradius;
-    if ((light->yz<0)||(light->ya>=dst->h)) {
-      light->visible=0;
-      continue;
-    }
+    if ((light->yz<0)||(light->ya>=h)) continue;
     int xa=light->x-scrollx;
     int xz=xa+light->radius+light->gradius;
     xa-=light->radius+light->gradius;
-    if ((xz<0)||(xa>=dst->w)) {
-      light->visible=0;
-      continue;
-    }
-    // Calculate the square radii.
+    if ((xz<0)||(xa>=w)) continue;
+    // Squared radii, and the falloff table if there's a gradient.
     light->inner=light->radius*light->radius;
+    light->outer=(light->radius+light->gradius)*(light->radius+light->gradius);
     if (light->gradius) {
-      light->outer=(light->radius+light->gradius)*(light->radius+light->gradius);
-      light->adjust=1.0/(light->outer-light->inner);
-    } else {
-      light->outer=light->inner;
-      light->adjust=1.0; // irrelevant
+      if (rb_lights_build_lut(lights,light,&lutc)<0) return -1;
     }
+    if ((light->rgb&0xffffff)!=0xffffff) lights->mapcolor=1;
     light->visible=1;
-    visiblec++;
+    lights->visiblec++;
   }
+  if (!lights->visiblec) return 0;
   
-  // If no lights are visible, keep it simple.
-  // This is a common case: Maybe using lights for overall fade-out.
-  if (!visiblec) {
-    rb_image_darken(dst,lights->bg);
-    return 0;
+  // Map is the size of the output, or at half resolution, one sample per even pixel, plus one past the end.
+  if (lights->shift) {
+    lights->mapw=(w>>1)+1;
+    lights->maph=(h>>1)+1;
+  } else {
+    lights->mapw=w;
+    lights->maph=h;
   }
-  
-  // Walk rows and track one visible light that we know intersects.
-  // (so we can avoid a lot of rechecking when there's a lot of lights).
-  struct rb_light *currentlight=0;
-  int pendingvacant=0;
-  uint32_t *row=dst->pixels;
-  int y=0; for (;y<dst->h;y++,row+=dst->w) {
-
-    // Update (currentlight,pendingvacant), and handle vacant rows.
-    if (currentlight) {
-      if (y>currentlight->yz) {
-        currentlight->visible=0;
-        currentlight=0;
-      }
+  int mapsize=lights->mapw*lights->maph;
+  if (lights->mapcolor) mapsize<<=2;
+  if (mapsize>lights->mapa) {
+    void *nv=realloc(lights->mapv,mapsize);
+    if (!nv) return -1;
+    lights->mapv=nv;
+    lights->mapa=mapsize;
+  }
+  if (lights->maph>lights->extenta) {
+    void *nv=realloc(lights->extentv,sizeof(int)*2*lights->maph);
+    if (!nv) return -1;
+    lights->extentv=nv;
+    lights->extenta=lights->maph;
+  }
+  return 0;
+}
+
+/* Rasterize.
+ * We own map rows whose first pixel is in (y0..y1-1), and the bottom band also owns the extra half-res row.
+ */
+ 
+void rb_lights_rasterize(struct rb_lights *lights,int y0,int y1) {
+  if ((lights->bg==0xff)||!lights->visiblec) return;
+  int step=1<<lights->shift;
+  int mya=-((-y0)>>lights->shift);
+  int myz=(y1>=lights->fbh)?lights->maph:(-((-y1)>>lights->shift));
+  if (mya<0) mya=0;
+  if (myz>lights->maph) myz=lights->maph;
+  int rowsize=lights->mapcolor?(lights->mapw<<2):lights->mapw;
+  uint8_t *row=lights->mapv+mya*rowsize;
+  int *extent=lights->extentv+(mya<<1);
+  int my=mya; for (;my<myz;my++,row+=rowsize,extent+=2) {
+    int y=my*step;
+    memset(row,lights->bg,rowsize);
+    extent[0]=lights->mapw;
+    extent[1]=-1;
+    const struct rb_light *light=lights->lightv;
+    int i=lights->lightc;
+    for (;i-->0;light++) {
+      if (!light->visible) continue;
+      if ((y<light->ya)||(y>light->yz)) continue;
+      int lx=light->x-lights->scrollx;
+      int dy=light->y-lights->scrolly-y;
+      int x0,x1;
+      if (!rb_lights_span(&x0,&x1,light,lx,dy*dy,lights->shift,lights->mapw)) continue;
+      if (x0<extent[0]) extent[0]=x0;
+      if (x1>extent[1]) extent[1]=x1;
+      rb_lights_rasterize_light(row,x0,x1,lights,light,lx,dy*dy);
     }
-    if (!currentlight) {
-      int ylo=dst->h;
-      for (light=lights->lightv,i=lights->lightc;i-->0;light++) {
-        if (!light->visible) continue;
-        if (light->yz<y) {
-          light->visible=0;
-          continue;
-        }
-        if ((light->ya<=y)&&(light->yz>=y)) {
-          currentlight=light;
-          break;
-        }
-        if (light->ya<ylo) ylo=light->ya;
+  }
+}
+
+/* Upsample part of a half-res map row, (bpp) bytes per pixel, 1 or 4.
+ * (a,b) are the map rows above and below, the same row for even output rows.
+ * Output pixel (x) is map pixel (x/2) if even, or halfway to the next if odd.
+ * Averages round up, in two steps: vertical then horizontal.
+ */
+ 
+static void rb_lights_upsample(uint8_t *dst,const uint8_t *a,const uint8_t *b,int x,int c,int bpp) {
+
+  // Vertical, into (v). We need map pixels (x/2) through ((x+c)/2) inclusive.
+  uint8_t v[(RB_LIGHTS_CHUNK/2+2)*4];
+  int m0=x>>1;
+  int vc=(((x+c)>>1)-m0+1)*bpp;
+  a+=m0*bpp;
+  if (a==b+m0*bpp) {
+    memcpy(v,a,vc);
+  } else {
+    b+=m0*bpp;
+    int i=0;
+    #if RB_SIMD_SSE2
+      for (;i+16<=vc;i+=16) {
+        _mm_storeu_si128((__m128i*)(v+i),_mm_avg_epu8(_mm_loadu_si128((__m128i*)(a+i)),_mm_loadu_si128((__m128i*)(b+i))));
       }
-      if (!currentlight) pendingvacant=ylo-y;
-    }
-    if (pendingvacant>0) {
-      pendingvacant--;
-      rb_lights_darken(row,dst->w,lights->bg);
-      continue;
-    }
+    #elif RB_SIMD_NEON
+      for (;i+16<=vc;i+=16) vst1q_u8(v+i,vrhaddq_u8(vld1q_u8(a+i),vld1q_u8(b+i)));
+    #endif
+    for (;i<vc;i++) v[i]=(a[i]+b[i]+1)>>1;
+  }
   
-    // Drawing a row with at least one light intersecting...
-    uint32_t *p=row;
-    int x=0; for (;x<dst->w;x++,p++) {
-      uint8_t brightness=lights->bg;
-      for (i=lights->lightc,light=lights->lightv;i-->0;light++) {
-        if (!light->visible) continue;
-        double dx=light->x-x,dy=light->y-y;
-        double distance=dx*dx+dy*dy;
-        if (distance<=light->inner) {
-          brightness=0xff;
-          break;
-        }
-        if (distance>=light->outer) continue;
-        double norm=1.0-(distance-light->inner)*light->adjust;
-        int inorm=brightness+(norm*(0xff-brightness));
-        if (inorm<=brightness) continue;
-        if (inorm>=0xff) {
-          brightness=0xff;
-          break;
-        }
-        brightness=inorm;
+  // Horizontal: Copy even pixels, average odd ones. If (x) is odd, the first output is an average.
+  const uint8_t *src=v;
+  if (x&1) {
+    int i=0; for (;i<bpp;i++) *(dst++)=(src[i]+src[i+bpp]+1)>>1;
+    src+=bpp;
+    c--;
+  }
+  if (bpp==1) {
+    #if RB_SIMD_SSE2
+      for (;c>=32;c-=32,src+=16,dst+=32) {
+        __m128i even=_mm_loadu_si128((__m128i*)src);
+        __m128i odd=_mm_avg_epu8(even,_mm_loadu_si128((__m128i*)(src+1)));
+        _mm_storeu_si128((__m128i*)dst,_mm_unpacklo_epi8(even,odd));
+        _mm_storeu_si128((__m128i*)(dst+16),_mm_unpackhi_epi8(even,odd));
+      }
+    #elif RB_SIMD_NEON
+      for (;c>=32;c-=32,src+=16,dst+=32) {
+        uint8x16x2_t pair;
+        pair.val[0]=vld1q_u8(src);
+        pair.val[1]=vrhaddq_u8(pair.val[0],vld1q_u8(src+1));
+        vst2q_u8(dst,pair);
+      }
+    #endif
+  } else {
+    #if RB_SIMD_SSE2
+      for (;c>=8;c-=8,src+=16,dst+=32) {
+        __m128i even=_mm_loadu_si128((__m128i*)src);
+        __m128i odd=_mm_avg_epu8(even,_mm_loadu_si128((__m128i*)(src+4)));
+        _mm_storeu_si128((__m128i*)dst,_mm_unpacklo_epi32(even,odd));
+        _mm_storeu_si128((__m128i*)(dst+16),_mm_unpackhi_epi32(even,odd));
       }
-      if (!brightness) *p=0;
-      else if (brightness!=0xff) *p=rb_lights_darken_pixel(*p,brightness);
+    #elif RB_SIMD_NEON
+      for (;c>=8;c-=8,src+=16,dst+=32) {
+        uint32x4x2_t pair;
+        uint8x16_t even=vld1q_u8(src);
+        pair.val[0]=vreinterpretq_u32_u8(even);
+        pair.val[1]=vreinterpretq_u32_u8(vrhaddq_u8(even,vld1q_u8(src+4)));
+        vst2q_u32((uint32_t*)dst,pair);
+      }
+    #endif
+  }
+  for (;c>=2;c-=2,src+=bpp,dst+=bpp<<1) {
+    int i=0; for (;i<bpp;i++) {
+      dst[i]=src[i];
+      dst[bpp+i]=(src[i]+src[bpp+i]+1)>>1;
     }
   }
+  if (c) memcpy(dst,src,bpp);
+}
+
+/* Apply one lit row: (bg) outside (xa..xz), and the map inside.
+ */
+ 
+static void rb_lights_apply_row(uint32_t *row,const struct rb_lights *lights,const uint8_t *map,int xa,int xz) {
+  rb_lights_darken(row,xa,lights->bg);
+  if (lights->mapcolor) rb_lights_darken_each_rgb(row+xa,(const uint32_t*)map+xa,xz-xa+1);
+  else rb_lights_darken_each(row+xa,map+xa,xz-xa+1);
+  rb_lights_darken(row+xz+1,lights->fbw-xz-1,lights->bg);
+}
+
+static void rb_lights_apply_row_halfres(uint32_t *row,const struct rb_lights *lights,const uint8_t *a,const uint8_t *b,int xa,int xz) {
+  uint32_t tmp[RB_LIGHTS_CHUNK];
+  int bpp=lights->mapcolor?4:1;
+  rb_lights_darken(row,xa,lights->bg);
+  int x=xa; while (x<=xz) {
+    int c=xz-x+1;
+    if (c>RB_LIGHTS_CHUNK) c=RB_LIGHTS_CHUNK;
+    rb_lights_upsample((uint8_t*)tmp,a,b,x,c,bpp);
+    if (bpp==4) rb_lights_darken_each_rgb(row+x,tmp,c);
+    else rb_lights_darken_each(row+x,(uint8_t*)tmp,c);
+    x+=c;
+  }
+  rb_lights_darken(row+xz+1,lights->fbw-xz-1,lights->bg);
+}
 
+/* Apply.
+ */
+ 
+int rb_lights_apply(struct rb_image *dst,const struct rb_lights *lights,int y0,int y1) {
+  if (!dst||(dst->alphamode!=RB_ALPHAMODE_OPAQUE)) return -1;
+  if ((dst->w!=lights->fbw)||(dst->h!=lights->fbh)) return -1;
+  if (lights->bg==0xff) return 0;
+  if (y0<0) y0=0;
+  if (y1>dst->h) y1=dst->h;
+  if (y0>=y1) return 0;
+  uint32_t *row=dst->pixels+y0*dst->w;
+  
+  // If no lights are visible, keep it simple.
+  // This is a common case: Maybe using lights for overall fade-out.
+  if (!lights->visiblec) {
+    rb_lights_darken(row,dst->w*(y1-y0),lights->bg);
+    return 0;
+  }
+  
+  int rowsize=lights->mapcolor?(lights->mapw<<2):lights->mapw;
+  int y=y0; for (;y<y1;y++,row+=dst->w) {
+    if (lights->shift) {
+      int my=y>>1,mynext=my+(y&1);
+      const int *ea=lights->extentv+(my<<1),*eb=lights->extentv+(mynext<<1);
+      int xa=((ea[0]<eb[0])?ea[0]:eb[0])*2-1;
+      int xz=((ea[1]>eb[1])?ea[1]:eb[1])*2+1;
+      if (xa<0) xa=0;
+      if (xz>=dst->w) xz=dst->w-1;
+      if (xa>xz) rb_lights_darken(row,dst->w,lights->bg);
+      else rb_lights_apply_row_halfres(row,lights,lights->mapv+my*rowsize,lights->mapv+mynext*rowsize,xa,xz);
+    } else {
+      const int *extent=lights->extentv+(y<<1);
+      if (extent[0]>extent[1]) rb_lights_darken(row,dst->w,lights->bg);
+      else rb_lights_apply_row(row,lights,lights->mapv+y*rowsize,extent[0],extent[1]);
+    }
+  }
   return 0;
 }
+
+/* Draw.
+ */
+ 
+int rb_lights_draw(
+  struct rb_image *dst,
+  struct rb_lights *lights,
+  int scrollx,int scrolly
+) {
+  if (!dst||(dst->alphamode!=RB_ALPHAMODE_OPAQUE)) return -1;
+  if (lights->bg==0xff) return 0;
+  if (rb_lights_prepare(lights,dst->w,dst->h,scrollx,scrolly)<0) return -1;
+  
+  // Interleave the stages a few rows at a time, so map rows are still in cache when we apply them.
+  // Applying trails by a band, since half-res rows read the next map row.
+  int y=0; for (;y<dst->h;y+=RB_LIGHTS_BAND) {
+    rb_lights_rasterize(lights,y,y+RB_LIGHTS_BAND);
+    if (y) rb_lights_apply(dst,lights,y-RB_LIGHTS_BAND,y);
+  }
+  return rb_lights_apply(dst,lights,y-RB_LIGHTS_BAND,dst->h);
+}
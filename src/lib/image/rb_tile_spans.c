@@ -0,0 +1,172 @@
+#include "rabbit/rb_internal.h"
+#include "rabbit/rb_image.h"
+#include "rabbit/rb_tile_spans.h"
+
+/* Classify one source pixel: 0=transparent, 1=copy, 2=blend.
+ */
+ 
+static inline int rb_tile_spans_classify(int alphamode,uint32_t pixel) {
+  switch (alphamode) {
+    case RB_ALPHAMODE_COLORKEY: return pixel?1:0;
+    case RB_ALPHAMODE_DISCRETE: return (pixel>=0x80000000)?1:0;
+    case RB_ALPHAMODE_OPAQUE: return 1;
+  }
+  uint8_t a=pixel>>24;
+  if (!a) return 0;
+  if (a==0xff) return 1;
+  return 2;
+}
+
+/* Walk the spans of one row.
+ * Records each in (dst), or just counts them if null.
+ */
+ 
+static int rb_tile_spans_scan_row(
+  struct rb_tile_span *dst,
+  const uint32_t *src,int w,int alphamode
+) {
+  int spanc=0,x=0;
+  while (x<w) {
+    int kind=rb_tile_spans_classify(alphamode,src[x]);
+    int c=1;
+    while ((x+c<w)&&(rb_tile_spans_classify(alphamode,src[x+c])==kind)) c++;
+    if (kind) {
+      if (dst) {
+        dst->x=x;
+        dst->w=c;
+        dst->translucent=(kind==2);
+        dst++;
+      }
+      spanc++;
+    }
+    x+=c;
+  }
+  return spanc;
+}
+
+/* Copy source pixels verbatim, for transforming.
+ */
+ 
+static uint32_t rb_tile_spans_copy_pixel(uint32_t dst,uint32_t src,void *userdata) {
+  return src;
+}
+
+/* New.
+ */
+ 
+struct rb_tile_spans *rb_tile_spans_new(
+  const struct rb_image *src,int srcx,int srcy,
+  int w,int h,
+  uint8_t xform
+) {
+  if (!src) return 0;
+  if ((srcx<0)||(srcy<0)||(w<1)||(h<1)) return 0;
+  if ((srcx>src->w-w)||(srcy>src->h-h)) return 0;
+  
+  // Let the general blitter do the transform, into a scratch image.
+  int outw=w,outh=h;
+  if (xform&RB_XFORM_SWAP) {
+    outw=h;
+    outh=w;
+  }
+  struct rb_image *scratch=rb_image_new(outw,outh);
+  if (!scratch) return 0;
+  scratch->alphamode=RB_ALPHAMODE_OPAQUE;
+  rb_image_blit_unchecked(scratch,0,0,src,srcx,srcy,w,h,xform,rb_tile_spans_copy_pixel,0);
+  
+  int spanc=0,y=0;
+  const uint32_t *row=scratch->pixels;
+  for (;y<outh;y++,row+=outw) {
+    spanc+=rb_tile_spans_scan_row(0,row,outw,src->alphamode);
+  }
+  
+  int objlen=sizeof(struct rb_tile_spans)+sizeof(int)*(outh+1)+sizeof(struct rb_tile_span)*spanc+4*outw*outh;
+  struct rb_tile_spans *spans=calloc(1,objlen);
+  if (!spans) {
+    rb_image_del(scratch);
+    return 0;
+  }
+  spans->w=outw;
+  spans->h=outh;
+  spans->alphamode=src->alphamode;
+  spans->rowv=(int*)(spans+1);
+  spans->spanv=(struct rb_tile_span*)(spans->rowv+outh+1);
+  spans->pixels=(uint32_t*)(spans->spanv+spanc);
+  memcpy(spans->pixels,scratch->pixels,4*outw*outh);
+  rb_image_del(scratch);
+  
+  for (y=0,row=spans->pixels;y<outh;y++,row+=outw) {
+    spans->rowv[y]=spans->spanc;
+    spans->spanc+=rb_tile_spans_scan_row(spans->spanv+spans->spanc,row,outw,spans->alphamode);
+  }
+  spans->rowv[outh]=spans->spanc;
+  
+  return spans;
+}
+
+/* Delete.
+ */
+ 
+void rb_tile_spans_del(struct rb_tile_spans *spans) {
+  if (!spans) return;
+  free(spans);
+}
+
+void rb_tile_cache_del(struct rb_tile_cache *cache) {
+  if (!cache) return;
+  int i=RB_TILE_CACHE_SIZE;
+  while (i-->0) rb_tile_spans_del(cache->v[i]);
+  free(cache);
+}
+
+/* Blit.
+ */
+ 
+void rb_tile_spans_blit(
+  struct rb_image *dst,int dstx,int dsty,
+  const struct rb_tile_spans *spans
+) {
+  if (!dst) return;
+  rb_tile_spans_blit_clip(dst,dstx,dsty,spans,0,0,dst->w,dst->h);
+}
+
+void rb_tile_spans_blit_clip(
+  struct rb_image *dst,int dstx,int dsty,
+  const struct rb_tile_spans *spans,
+  int clipx,int clipy,int clipw,int cliph
+) {
+  if (!dst||!spans||!spans->spanc) return;
+  if (clipx<0) { clipw+=clipx; clipx=0; }
+  if (clipy<0) { cliph+=clipy; clipy=0; }
+  if (clipx>dst->w-clipw) clipw=dst->w-clipx;
+  if (clipy>dst->h-cliph) cliph=dst->h-clipy;
+  if ((clipw<1)||(cliph<1)) return;
+  
+  // Row and span limits in tile space.
+  int ya=clipy-dsty,yz=clipy+cliph-dsty;
+  if (ya<0) ya=0;
+  if (yz>spans->h) yz=spans->h;
+  if (ya>=yz) return;
+  int xlo=clipx-dstx,xhi=clipx+clipw-dstx;
+  if ((xlo>=spans->w)||(xhi<=0)) return;
+  
+  void (*blend)(uint32_t *dst,const uint32_t *src,int c);
+  if (spans->alphamode==RB_ALPHAMODE_PREMUL) blend=rb_image_row_premul;
+  else blend=rb_image_row_blend;
+  
+  int y=ya;
+  for (;y<yz;y++) {
+    uint32_t *dstrow=dst->pixels+(dsty+y)*dst->w+dstx;
+    const uint32_t *srcrow=spans->pixels+y*spans->w;
+    const struct rb_tile_span *span=spans->spanv+spans->rowv[y];
+    int i=spans->rowv[y+1]-spans->rowv[y];
+    for (;i-->0;span++) {
+      int x=span->x,w=span->w;
+      if (x<xlo) { w-=xlo-x; x=xlo; }
+      if (x+w>xhi) w=xhi-x;
+      if (w<1) continue;
+      if (span->translucent) blend(dstrow+x,srcrow+x,w);
+      else memcpy(dstrow+x,srcrow+x,w<<2);
+    }
+  }
+}
@@ -2,6 +2,23 @@
 #include "rabbit/rb_vmgr.h"
 #include "rabbit/rb_sprite.h"
 #include "rabbit/rb_grid.h"
+#include "rabbit/rb_tile_spans.h"
+#include "rabbit/rb_present.h"
+
+/* Offscreen image for one grid layer.
+ */
+ 
+static struct rb_image *rb_vmgr_bgbits_new() {
+  const int bgbits_extra_x=32;
+  const int bgbits_extra_y=32;
+  struct rb_image *bgbits=rb_image_new(
+    RB_FB_W+bgbits_extra_x,
+    RB_FB_H+bgbits_extra_y
+  );
+  if (!bgbits) return 0;
+  bgbits->alphamode=RB_ALPHAMODE_OPAQUE;
+  return bgbits;
+}
 
 /* New.
  */
@@ -20,18 +37,17 @@ struct rb_vmgr *rb_vmgr_new() {
     rb_vmgr_del(vmgr);
     return 0;
   }
+  vmgr->fbv[0]=vmgr->fb;
+  vmgr->fbc=1;
   
-  const int bgbits_extra_x=32;
-  const int bgbits_extra_y=32;
-  if (!(vmgr->bgbits=rb_image_new(
-    RB_FB_W+bgbits_extra_x,
-    RB_FB_H+bgbits_extra_y
-  ))) {
+  if (!(vmgr->layerv[0].bgbits=rb_vmgr_bgbits_new())) {
     rb_vmgr_del(vmgr);
     return 0;
   }
-  vmgr->bgbits->alphamode=RB_ALPHAMODE_OPAQUE;
-  vmgr->bgbitsdirty=1;
+  vmgr->layerv[0].bgbitsdirty=1;
+  vmgr->layerv[0].parallax=0x100;
+  vmgr->layerc=1;
+  vmgr->fbdirty=1;
   
   return vmgr;
 }
@@ -43,17 +59,29 @@ void rb_vmgr_del(struct rb_vmgr *vmgr) {
   if (!vmgr) return;
   if (vmgr->refc-->1) return;
   
-  rb_grid_del(vmgr->grid);
+  rb_vmgr_set_threads(vmgr,1);
   rb_sprite_group_clear(vmgr->sprites);
   rb_sprite_group_del(vmgr->sprites);
   
   int i=RB_VMGR_IMAGE_COUNT;
   while (i-->0) {
     if (vmgr->imagev[i]) rb_image_del(vmgr->imagev[i]);
+    rb_image8_del(vmgr->image8v[i]);
+    rb_palette_del(vmgr->palettev[i]);
+    rb_tile_cache_del(vmgr->tilecachev[i]);
+  }
+  
+  for (i=RB_VMGR_LAYER_LIMIT;i-->0;) {
+    rb_grid_del(vmgr->layerv[i].grid);
+    rb_image_del(vmgr->layerv[i].bgbits);
   }
   
-  rb_image_del(vmgr->fb);
-  rb_image_del(vmgr->bgbits);
+  rb_vmgr_set_present(vmgr,0);
+  for (i=RB_VMGR_FB_LIMIT;i-->0;) rb_image_del(vmgr->fbv[i]);
+  if (vmgr->snapv) free(vmgr->snapv);
+  if (vmgr->nsnapv) free(vmgr->nsnapv);
+  if (vmgr->snaporderv) free(vmgr->snaporderv);
+  if (vmgr->cullv) free(vmgr->cullv);
   
   free(vmgr);
 }
@@ -69,17 +97,106 @@ int rb_vmgr_ref(struct rb_vmgr *vmgr) {
   return 0;
 }
 
+/* Framebuffer rotation.
+ */
+
+static void rb_vmgr_reclaim_buffers(struct rb_vmgr *vmgr) {
+  if (!vmgr->present) return;
+  int i=vmgr->fbc;
+  while (i-->0) rb_present_reclaim(vmgr->present,vmgr->fbv[i]);
+}
+
+int rb_vmgr_set_buffers(struct rb_vmgr *vmgr,int fbc) {
+  if (!vmgr) return -1;
+  if ((fbc<1)||(fbc>RB_VMGR_FB_LIMIT)) return -1;
+  if (fbc==vmgr->fbc) return 0;
+  rb_vmgr_reclaim_buffers(vmgr);
+  
+  // The current one stays current, at position zero.
+  if (vmgr->fbp) {
+    vmgr->fbv[vmgr->fbp]=vmgr->fbv[0];
+    vmgr->fbv[0]=vmgr->fb;
+    vmgr->fbp=0;
+  }
+  while (vmgr->fbc>fbc) {
+    vmgr->fbc--;
+    rb_image_del(vmgr->fbv[vmgr->fbc]);
+    vmgr->fbv[vmgr->fbc]=0;
+  }
+  while (vmgr->fbc<fbc) {
+    if (!(vmgr->fbv[vmgr->fbc]=rb_framebuffer_new())) return -1;
+    vmgr->fbc++;
+  }
+  return 0;
+}
+
+int rb_vmgr_set_present(struct rb_vmgr *vmgr,struct rb_present *present) {
+  if (!vmgr) return -1;
+  if (vmgr->present==present) return 0;
+  if (present&&(rb_present_ref(present)<0)) return -1;
+  rb_vmgr_reclaim_buffers(vmgr);
+  rb_present_del(vmgr->present);
+  vmgr->present=present;
+  return 0;
+}
+
 /* Install image.
  */
 
+static void rb_vmgr_image_changed(struct rb_vmgr *vmgr,uint8_t imageid) {
+  rb_tile_cache_del(vmgr->tilecachev[imageid]);
+  vmgr->tilecachev[imageid]=0;
+  vmgr->fbdirty=1;
+  int i=vmgr->layerc;
+  while (i-->0) {
+    struct rb_vmgr_layer *layer=vmgr->layerv+i;
+    if (layer->grid&&(layer->grid->imageid==imageid)) layer->bgbitsdirty=1;
+  }
+}
+
 int rb_vmgr_set_image(struct rb_vmgr *vmgr,uint8_t imageid,struct rb_image *image) {
   if (!vmgr) return -1;
   if (imageid>=RB_VMGR_IMAGE_COUNT) return -1;
   struct rb_image **dst=vmgr->imagev+imageid;
-  if (*dst==image) return 0;
+  if ((*dst==image)&&!vmgr->image8v[imageid]) return 0;
   if (image&&(rb_image_ref(image)<0)) return -1;
+  rb_image_premultiply(image);
   rb_image_del(*dst);
   *dst=image;
+  rb_image8_del(vmgr->image8v[imageid]);
+  vmgr->image8v[imageid]=0;
+  rb_vmgr_image_changed(vmgr,imageid);
+  return 0;
+}
+
+int rb_vmgr_set_image8(struct rb_vmgr *vmgr,uint8_t imageid,struct rb_image8 *image) {
+  if (!vmgr) return -1;
+  if (imageid>=RB_VMGR_IMAGE_COUNT) return -1;
+  struct rb_image8 **dst=vmgr->image8v+imageid;
+  if ((*dst==image)&&!vmgr->imagev[imageid]) return 0;
+  if (image&&(rb_image8_ref(image)<0)) return -1;
+  if (image) rb_palette_premultiply(image->palette);
+  rb_image8_del(*dst);
+  *dst=image;
+  rb_image_del(vmgr->imagev[imageid]);
+  vmgr->imagev[imageid]=0;
+  rb_vmgr_image_changed(vmgr,imageid);
+  return 0;
+}
+
+/* Palette override.
+ */
+
+int rb_vmgr_set_palette(struct rb_vmgr *vmgr,uint8_t imageid,struct rb_palette *palette) {
+  if (!vmgr) return -1;
+  if (imageid>=RB_VMGR_IMAGE_COUNT) return -1;
+  struct rb_palette **dst=vmgr->palettev+imageid;
+  if (*dst==palette) return 0;
+  if (palette&&(rb_palette_ref(palette)<0)) return -1;
+  rb_palette_premultiply(palette);
+  rb_palette_del(*dst);
+  *dst=palette;
+  if (vmgr->image8v[imageid]) rb_vmgr_image_changed(vmgr,imageid);
   return 0;
 }
 
@@ -87,6 +204,13 @@ int rb_vmgr_set_image(struct rb_vmgr *vmgr,uint8_t imageid,struct rb_image *imag
  */
 
 int rb_vmgr_set_image_serial(struct rb_vmgr *vmgr,uint8_t imageid,const void *src,int srcc) {
+  if ((srcc>=1)&&(((const uint8_t*)src)[0]==RB_IMAGE_FORMAT_I8)) {
+    struct rb_image8 *image8=rb_image8_new_decode(src,srcc);
+    if (!image8) return -1;
+    int err=rb_vmgr_set_image8(vmgr,imageid,image8);
+    rb_image8_del(image8);
+    return err;
+  }
   struct rb_image *image=rb_image_new_decode(src,srcc);
   if (!image) return -1;
   int err=rb_vmgr_set_image(vmgr,imageid,image);
@@ -98,12 +222,31 @@ int rb_vmgr_set_image_serial(struct rb_vmgr *vmgr,uint8_t imageid,const void *sr
  */
 
 int rb_vmgr_set_grid(struct rb_vmgr *vmgr,struct rb_grid *grid) {
+  return rb_vmgr_set_layer(vmgr,0,grid,0x100);
+}
+
+int rb_vmgr_set_layer(struct rb_vmgr *vmgr,int layerid,struct rb_grid *grid,int parallax) {
   if (!vmgr) return -1;
-  if (vmgr->grid==grid) return 0;
-  if (grid&&(rb_grid_ref(grid)<0)) return -1;
-  rb_grid_del(vmgr->grid);
-  vmgr->grid=grid;
-  vmgr->bgbitsdirty=1;
+  if ((layerid<0)||(layerid>=RB_VMGR_LAYER_LIMIT)) return -1;
+  struct rb_vmgr_layer *layer=vmgr->layerv+layerid;
+  if (!layerid) parallax=0x100;
+  if ((layer->grid==grid)&&(layer->parallax==parallax)) return 0;
+  if (grid&&!layer->bgbits) {
+    if (!(layer->bgbits=rb_vmgr_bgbits_new())) return -1;
+  }
+  if (layer->grid!=grid) {
+    if (grid&&(rb_grid_ref(grid)<0)) return -1;
+    rb_grid_del(layer->grid);
+    layer->grid=grid;
+  }
+  layer->parallax=parallax;
+  layer->bgbitsdirty=1;
+  vmgr->fbdirty=1;
+  if (grid) {
+    if (layerid>=vmgr->layerc) vmgr->layerc=layerid+1;
+  } else {
+    while ((vmgr->layerc>1)&&!vmgr->layerv[vmgr->layerc-1].grid) vmgr->layerc--;
+  }
   return 0;
 }
 
@@ -117,6 +260,7 @@ int rb_vmgr_set_sprites(struct rb_vmgr *vmgr,struct rb_sprite_group *group) {
   rb_sprite_group_clear(vmgr->sprites);
   rb_sprite_group_del(vmgr->sprites);
   vmgr->sprites=group;
+  vmgr->fbdirty=1;
   return 0;
 }
 
@@ -138,3 +282,30 @@ void rb_vmgr_filter_sprites(
 ) {
   rb_sprite_group_filter(vmgr->sprites,filter,userdata);
 }
+
+/* Dirty-rect tracking.
+ */
+ 
+void rb_vmgr_set_dirty_tracking(struct rb_vmgr *vmgr,int enable) {
+  if (!vmgr) return;
+  enable=enable?1:0;
+  if (vmgr->dirtytracking==enable) return;
+  vmgr->dirtytracking=enable;
+  vmgr->fbdirty=1;
+}
+
+void rb_vmgr_invalidate(struct rb_vmgr *vmgr,int x,int y,int w,int h) {
+  if (!vmgr) return;
+  rb_dirty_add(&vmgr->invalid,x,y,w,h);
+}
+
+/* Lights.
+ */
+
+int rb_vmgr_set_lights(struct rb_vmgr *vmgr,struct rb_lights *lights) {
+  if (!vmgr) return -1;
+  if (vmgr->lights==lights) return 0;
+  vmgr->lights=lights;
+  vmgr->fbdirty=1;
+  return 0;
+}
@@ -2,160 +2,900 @@
 #include "rabbit/rb_vmgr.h"
 #include "rabbit/rb_grid.h"
 #include "rabbit/rb_sprite.h"
+#include "rabbit/rb_tile_spans.h"
+#include "rabbit/rb_present.h"
+
+/* Dirty rects smaller than this many pixels composite serially even with workers.
+ */
+#define RB_VMGR_BAND_MIN_AREA (RB_FB_W*32)
  
 /* Fill framebuffer with black.
  */
  
-static void rb_vmgr_color_background(struct rb_vmgr *vmgr) {
-  memset(vmgr->fb->pixels,0,RB_FB_SIZE_BYTES);
+static void rb_vmgr_color_background(struct rb_vmgr *vmgr,const struct rb_dirty_rect *rect) {
+  if ((rect->w==RB_FB_W)&&(rect->h==RB_FB_H)) {
+    memset(vmgr->fb->pixels,0,RB_FB_SIZE_BYTES);
+    return;
+  }
+  uint32_t *row=vmgr->fb->pixels+rect->y*RB_FB_W+rect->x;
+  int yi=rect->h;
+  for (;yi-->0;row+=RB_FB_W) memset(row,0,rect->w<<2);
 }
 
-/* Redraw bgbits from scratch.
+/* One of our images, whether ARGB or indexed.
  */
  
-static inline void rb_vmgr_refresh_bgbits(
-  struct rb_vmgr *vmgr,
-  struct rb_image *tilesheet,
-  int colw,int rowh,
-  int worldw,int worldh
+struct rb_vmgr_source {
+  const struct rb_image *image; // Exactly one of (image,image8).
+  const struct rb_image8 *image8;
+  const struct rb_palette *palette; // With (image8), the one it draws with.
+  int w,h;
+  int alphamode;
+};
+
+static int rb_vmgr_get_source(struct rb_vmgr_source *source,const struct rb_vmgr *vmgr,int imageid) {
+  if ((imageid<0)||(imageid>=RB_VMGR_IMAGE_COUNT)) return 0;
+  if ((source->image=vmgr->imagev[imageid])) {
+    source->image8=0;
+    source->palette=0;
+    source->w=source->image->w;
+    source->h=source->image->h;
+    source->alphamode=source->image->alphamode;
+    return 1;
+  }
+  if ((source->image8=vmgr->image8v[imageid])) {
+    if (!(source->palette=vmgr->palettev[imageid])&&!(source->palette=source->image8->palette)) return 0;
+    source->w=source->image8->w;
+    source->h=source->image8->h;
+    source->alphamode=source->palette->alphamode;
+    return 1;
+  }
+  return 0;
+}
+
+static int rb_vmgr_source_blit(
+  struct rb_image *dst,int dstx,int dsty,
+  const struct rb_vmgr_source *src,int srcx,int srcy,
+  int w,int h,
+  uint8_t xform
 ) {
+  if (src->image8) return rb_image8_blit_safe(dst,dstx,dsty,src->image8,srcx,srcy,w,h,xform,src->palette);
+  return rb_image_blit_safe(dst,dstx,dsty,src->image,srcx,srcy,w,h,xform,0,0);
+}
 
-  // Line up bgbits on a cell boundary within world limits, containing the current view.
-  // It will never exceed the left or top world bounds but may exceed right or bottom (if the world is tiny).
-  vmgr->bgbitsx=vmgr->scrollx-colw;
-  if (vmgr->bgbitsx>worldw-vmgr->bgbits->w) vmgr->bgbitsx=worldw-vmgr->bgbits->w;
-  if (vmgr->bgbitsx<0) vmgr->bgbitsx=0;
-  vmgr->bgbitsx-=vmgr->bgbitsx%colw;
-  vmgr->bgbitsy=vmgr->scrolly-rowh;
-  if (vmgr->bgbitsy>worldh-vmgr->bgbits->h) vmgr->bgbitsy=worldh-vmgr->bgbits->h;
-  if (vmgr->bgbitsy<0) vmgr->bgbitsy=0;
-  vmgr->bgbitsy-=vmgr->bgbitsy%rowh;
-  
-  int cola=vmgr->bgbitsx/colw;
-  int colz=(vmgr->bgbitsx+vmgr->bgbits->w-1)/colw;
-  if (colz>=vmgr->grid->w) colz=vmgr->grid->w-1;
-  int rowa=vmgr->bgbitsy/rowh;
-  int rowz=(vmgr->bgbitsy+vmgr->bgbits->h-1)/rowh;
-  if (rowz>=vmgr->grid->h) rowz=vmgr->grid->h-1;
-  
-  const uint8_t *src=vmgr->grid->v+rowa*vmgr->grid->w+cola;
-  int dsty=0,row=rowa;
-  for (;row<=rowz;row++,src+=vmgr->grid->w,dsty+=rowh) {
+/* Copy source pixels verbatim, for filling bgbits from tilesheets with transparency.
+ */
+ 
+static uint32_t rb_vmgr_copy_pixel(uint32_t dst,uint32_t src,void *userdata) {
+  return src;
+}
+
+/* Draw grid cells (cola..colz,rowa..rowz) into bgbits, wherever they land relative to (bgbitsx,bgbitsy).
+ * Opaque tiles copy. Others keep their alpha, so bgbits can go over the layers behind it.
+ * Caller must clamp to the grid.
+ */
+ 
+static void rb_vmgr_draw_bgbits_cells(
+  struct rb_vmgr_layer *layer,
+  const struct rb_vmgr_source *tilesheet,
+  int colw,int rowh,
+  int cola,int colz,int rowa,int rowz
+) {
+  uint32_t (*blend)(uint32_t dst,uint32_t src,void *userdata)=0;
+  if (tilesheet->alphamode!=RB_ALPHAMODE_OPAQUE) blend=rb_vmgr_copy_pixel;
+  const uint8_t *src=layer->grid->v+rowa*layer->grid->w+cola;
+  int dsty=rowa*rowh-layer->bgbitsy,row=rowa;
+  for (;row<=rowz;row++,src+=layer->grid->w,dsty+=rowh) {
     const uint8_t *p=src;
-    int dstx=0,col=cola;
+    int dstx=cola*colw-layer->bgbitsx,col=cola;
     for (;col<=colz;col++,p++,dstx+=colw) {
       int srcx=((*p)&15)*colw;
       int srcy=((*p)>>4)*rowh;
+      if (tilesheet->image8) {
+        rb_image8_copy_safe(layer->bgbits,dstx,dsty,tilesheet->image8,srcx,srcy,colw,rowh,tilesheet->palette);
+        continue;
+      }
+      // COLORKEY and DISCRETE skip their transparent pixels even with a blend hook, so start from transparent.
+      if (blend) rb_image_fill_rect(layer->bgbits,dstx,dsty,colw,rowh,0);
       rb_image_blit_safe(
-        vmgr->bgbits,dstx,dsty,
-        tilesheet,srcx,srcy,
+        layer->bgbits,dstx,dsty,
+        tilesheet->image,srcx,srcy,
         colw,rowh,
-        0,0,0
+        0,blend,0
       );
     }
   }
 }
 
+/* Line up bgbits on a cell boundary within world limits, containing the layer's view at (scrollx,scrolly).
+ * It will never exceed the left or top world bounds but may exceed right or bottom:
+ * If the world is tiny, or by less than a cell if cells don't divide bgbits evenly.
+ * Start half the margin before the view and round down. If that loses the far edge (cells wider than half the margin),
+ * step one cell forward.
+ */
+ 
+static inline void rb_vmgr_place_bgbits(
+  struct rb_vmgr_layer *layer,
+  int scrollx,int scrolly,
+  int colw,int rowh,
+  int worldw,int worldh
+) {
+  layer->bgbitsx=scrollx-((layer->bgbits->w-RB_FB_W)>>1);
+  if (layer->bgbitsx>worldw-layer->bgbits->w) layer->bgbitsx=worldw-layer->bgbits->w;
+  if (layer->bgbitsx<0) layer->bgbitsx=0;
+  layer->bgbitsx-=layer->bgbitsx%colw;
+  if (
+    (layer->bgbitsx+layer->bgbits->w<scrollx+RB_FB_W)&&
+    (layer->bgbitsx+colw<=scrollx)
+  ) layer->bgbitsx+=colw;
+  layer->bgbitsy=scrolly-((layer->bgbits->h-RB_FB_H)>>1);
+  if (layer->bgbitsy>worldh-layer->bgbits->h) layer->bgbitsy=worldh-layer->bgbits->h;
+  if (layer->bgbitsy<0) layer->bgbitsy=0;
+  layer->bgbitsy-=layer->bgbitsy%rowh;
+  if (
+    (layer->bgbitsy+layer->bgbits->h<scrolly+RB_FB_H)&&
+    (layer->bgbitsy+rowh<=scrolly)
+  ) layer->bgbitsy+=rowh;
+}
+
+/* Draw the cells covering world pixels (xa..xz-1,ya..yz-1), clamped to the grid.
+ */
+ 
+static void rb_vmgr_draw_bgbits_region(
+  struct rb_vmgr_layer *layer,
+  const struct rb_vmgr_source *tilesheet,
+  int colw,int rowh,
+  int xa,int ya,int xz,int yz
+) {
+  if ((xa>=xz)||(ya>=yz)) return;
+  
+  // Anything past the world's right or bottom edge is black, or transparent.
+  int worldw=layer->grid->w*colw;
+  int worldh=layer->grid->h*rowh;
+  if (xz>worldw) {
+    rb_image_fill_rect(layer->bgbits,worldw-layer->bgbitsx,ya-layer->bgbitsy,xz-worldw,yz-ya,0);
+  }
+  if (yz>worldh) {
+    rb_image_fill_rect(layer->bgbits,xa-layer->bgbitsx,worldh-layer->bgbitsy,xz-xa,yz-worldh,0);
+  }
+  
+  int cola=xa/colw;
+  int colz=(xz-1)/colw;
+  if (colz>=layer->grid->w) colz=layer->grid->w-1;
+  int rowa=ya/rowh;
+  int rowz=(yz-1)/rowh;
+  if (rowz>=layer->grid->h) rowz=layer->grid->h-1;
+  if ((cola>colz)||(rowa>rowz)) return;
+  rb_vmgr_draw_bgbits_cells(layer,tilesheet,colw,rowh,cola,colz,rowa,rowz);
+}
+
+/* Redraw bgbits from scratch.
+ */
+ 
+static inline void rb_vmgr_refresh_bgbits(
+  struct rb_vmgr_layer *layer,
+  const struct rb_vmgr_source *tilesheet,
+  int scrollx,int scrolly,
+  int colw,int rowh,
+  int worldw,int worldh
+) {
+  rb_vmgr_place_bgbits(layer,scrollx,scrolly,colw,rowh,worldw,worldh);
+  rb_vmgr_draw_bgbits_region(
+    layer,tilesheet,colw,rowh,
+    layer->bgbitsx,layer->bgbitsy,
+    layer->bgbitsx+layer->bgbits->w,layer->bgbitsy+layer->bgbits->h
+  );
+}
+
 /* Check whether bgbits still contains the view.
- * If not, make it so.
+ * If not, move it: Shift what we already have, and draw only the cells that weren't in it before.
  */
  
 static inline void rb_vmgr_update_bgbits(
-  struct rb_vmgr *vmgr,
-  struct rb_image *tilesheet,
+  struct rb_vmgr_layer *layer,
+  const struct rb_vmgr_source *tilesheet,
+  int scrollx,int scrolly,
   int colw,int rowh,
   int worldw,int worldh
 ) {
-  //TODO We could optimize this even further with rb_image_scroll(), and draw only the necessary part.
-  // I feel like that's overkill; copying opaque tiles is pretty cheap.
-  // Our main interest here is don't redraw the grid while the camera stands still.
-  // Experimentally, this not-quite-optimal approach reduces load about 7x in a worst-case test.
-  // I estimate balls-to-the-wall optimization would yield more like 10x.
   if (
-    (vmgr->scrollx<vmgr->bgbitsx)||
-    (vmgr->scrolly<vmgr->bgbitsy)||
-    (vmgr->scrollx+RB_FB_W>vmgr->bgbitsx+vmgr->bgbits->w)||
-    (vmgr->scrolly+RB_FB_H>vmgr->bgbitsy+vmgr->bgbits->h)
-  ) {
-    rb_vmgr_refresh_bgbits(vmgr,tilesheet,colw,rowh,worldw,worldh);
+    (scrollx>=layer->bgbitsx)&&
+    (scrolly>=layer->bgbitsy)&&
+    (scrollx+RB_FB_W<=layer->bgbitsx+layer->bgbits->w)&&
+    (scrolly+RB_FB_H<=layer->bgbitsy+layer->bgbits->h)
+  ) return;
+  
+  int ox=layer->bgbitsx,oy=layer->bgbitsy;
+  int w=layer->bgbits->w,h=layer->bgbits->h;
+  rb_vmgr_place_bgbits(layer,scrollx,scrolly,colw,rowh,worldw,worldh);
+  int dx=ox-layer->bgbitsx;
+  int dy=oy-layer->bgbitsy;
+  if (!dx&&!dy) return;
+  
+  // A big jump, just redraw it all.
+  if ((dx<=-w)||(dx>=w)||(dy<=-h)||(dy>=h)) {
+    rb_vmgr_draw_bgbits_region(
+      layer,tilesheet,colw,rowh,
+      layer->bgbitsx,layer->bgbitsy,
+      layer->bgbitsx+w,layer->bgbitsy+h
+    );
+    return;
+  }
+  
+  rb_image_scroll(layer->bgbits,dx,dy);
+  
+  // Exposed columns, full height.
+  if (dx>0) {
+    rb_vmgr_draw_bgbits_region(layer,tilesheet,colw,rowh,layer->bgbitsx,layer->bgbitsy,ox,layer->bgbitsy+h);
+  } else if (dx<0) {
+    rb_vmgr_draw_bgbits_region(layer,tilesheet,colw,rowh,ox+w,layer->bgbitsy,layer->bgbitsx+w,layer->bgbitsy+h);
+  }
+  
+  // Exposed rows, full width. Corners get drawn twice, no big deal.
+  if (dy>0) {
+    rb_vmgr_draw_bgbits_region(layer,tilesheet,colw,rowh,layer->bgbitsx,layer->bgbitsy,layer->bgbitsx+w,oy);
+  } else if (dy<0) {
+    rb_vmgr_draw_bgbits_region(layer,tilesheet,colw,rowh,layer->bgbitsx,oy+h,layer->bgbitsx+w,layer->bgbitsy+h);
   }
 }
 
-/* Background: Grid or black.
+/* Layer's tilesheet, or zero if it shouldn't draw.
+ */
+ 
+static int rb_vmgr_layer_tilesheet(
+  struct rb_vmgr_source *tilesheet,
+  const struct rb_vmgr *vmgr,
+  const struct rb_vmgr_layer *layer
+) {
+  if (!layer->grid||!layer->bgbits) return 0;
+  if (!rb_vmgr_get_source(tilesheet,vmgr,layer->grid->imageid)) return 0;
+  if ((tilesheet->w<16)||(tilesheet->h<16)) return 0;
+  return 1;
+}
+
+/* Layer's view position, ie camera scroll scaled by parallax.
  */
  
-static void rb_vmgr_render_background(struct rb_vmgr *vmgr) {
+static inline int rb_vmgr_layer_scroll(const struct rb_vmgr_layer *layer,int scroll) {
+  return (scroll*layer->parallax)>>8;
+}
 
-  // No grid or no tilesheet, black out and return.
-  struct rb_image *tilesheet=0;
-  if (vmgr->grid&&(vmgr->grid->imageid<RB_VMGR_IMAGE_COUNT)) {
-    tilesheet=vmgr->imagev[vmgr->grid->imageid];
+/* Bring every layer's bgbits up to date for this frame.
+ * Returns the index of the rearmost layer we need to composite, or -1 if none.
+ * That's the frontmost one fully opaque over the view, and nothing behind it matters.
+ * If none of them is, we also set (*black) to clear the framebuffer first.
+ */
+ 
+static int rb_vmgr_prepare_layers(struct rb_vmgr *vmgr,int *black) {
+  int rearmost=-1,layerid=0;
+  *black=1;
+  for (;layerid<vmgr->layerc;layerid++) {
+    struct rb_vmgr_layer *layer=vmgr->layerv+layerid;
+    struct rb_vmgr_source tilesheet;
+    if (!rb_vmgr_layer_tilesheet(&tilesheet,vmgr,layer)) continue;
+    int colw=tilesheet.w>>4;
+    int rowh=tilesheet.h>>4;
+    int worldw=layer->grid->w*colw;
+    int worldh=layer->grid->h*rowh;
+    int scrollx=rb_vmgr_layer_scroll(layer,vmgr->scrollx);
+    int scrolly=rb_vmgr_layer_scroll(layer,vmgr->scrolly);
+    
+    // If our view exceeds bgbits, or if forced, refresh it.
+    if (layer->bgbitsdirty) {
+      rb_vmgr_refresh_bgbits(layer,&tilesheet,scrollx,scrolly,colw,rowh,worldw,worldh);
+      layer->bgbitsdirty=0;
+    } else {
+      rb_vmgr_update_bgbits(layer,&tilesheet,scrollx,scrolly,colw,rowh,worldw,worldh);
+    }
+    // Set here rather than at compositing, which might be on several threads at once.
+    layer->bgbits->alphamode=tilesheet.alphamode;
+    
+    rearmost=layerid;
+    if (
+      (tilesheet.alphamode==RB_ALPHAMODE_OPAQUE)&&
+      (scrollx>=0)&&(scrollx<=worldw-RB_FB_W)&&
+      (scrolly>=0)&&(scrolly<=worldh-RB_FB_H)
+    ) {
+      *black=0;
+      // Layers behind this one don't draw, and don't need to track the view.
+      // But finish any forced refresh, so the next render isn't forced too.
+      for (layerid++;layerid<vmgr->layerc;layerid++) {
+        layer=vmgr->layerv+layerid;
+        if (!layer->bgbitsdirty) continue;
+        if (!rb_vmgr_layer_tilesheet(&tilesheet,vmgr,layer)) continue;
+        colw=tilesheet.w>>4;
+        rowh=tilesheet.h>>4;
+        rb_vmgr_refresh_bgbits(
+          layer,&tilesheet,
+          rb_vmgr_layer_scroll(layer,vmgr->scrollx),rb_vmgr_layer_scroll(layer,vmgr->scrolly),
+          colw,rowh,layer->grid->w*colw,layer->grid->h*rowh
+        );
+        layer->bgbitsdirty=0;
+      }
+      break;
+    }
   }
-  if (!tilesheet) {
-    rb_vmgr_color_background(vmgr);
-    return;
+  return rearmost;
+}
+
+/* Background: Grid layers back to front, black if they don't cover it.
+ */
+ 
+static void rb_vmgr_render_background(
+  struct rb_vmgr *vmgr,
+  const struct rb_dirty_rect *rect,
+  int rearmost,int black
+) {
+  if (black) rb_vmgr_color_background(vmgr,rect);
+  int layerid=rearmost;
+  for (;layerid>=0;layerid--) {
+    struct rb_vmgr_layer *layer=vmgr->layerv+layerid;
+    struct rb_vmgr_source tilesheet;
+    if (!rb_vmgr_layer_tilesheet(&tilesheet,vmgr,layer)) continue;
+    int scrollx=rb_vmgr_layer_scroll(layer,vmgr->scrollx);
+    int scrolly=rb_vmgr_layer_scroll(layer,vmgr->scrolly);
+    
+    // Copy or blend from bgbits, only where it's inside the world.
+    int x=rect->x,y=rect->y,w=rect->w,h=rect->h;
+    int worldw=layer->grid->w*(tilesheet.w>>4);
+    int worldh=layer->grid->h*(tilesheet.h>>4);
+    if (x<-scrollx) { w+=x+scrollx; x=-scrollx; }
+    if (y<-scrolly) { h+=y+scrolly; y=-scrolly; }
+    if (x+w>worldw-scrollx) w=worldw-scrollx-x;
+    if (y+h>worldh-scrolly) h=worldh-scrolly-y;
+    if ((w<1)||(h<1)) continue;
+    rb_image_blit_safe(
+      vmgr->fb,x,y,
+      layer->bgbits,scrollx-layer->bgbitsx+x,scrolly-layer->bgbitsy+y,
+      w,h,
+      0,0,0
+    );
+  }
+}
+
+/* Compiled spans for one tile, compiling it the first time we see it.
+ * Null if that fails, or if (fb) can't take spans. Caller checks that the image exists.
+ * Indexed tiles expand to ARGB first, spans always hold their own pixels.
+ */
+ 
+static struct rb_tile_spans *rb_vmgr_tile_spans(
+  struct rb_vmgr *vmgr,
+  uint8_t imageid,uint8_t tileid,uint8_t xform
+) {
+  if (vmgr->fb->alphamode!=RB_ALPHAMODE_OPAQUE) return 0;
+  struct rb_tile_cache *cache=vmgr->tilecachev[imageid];
+  if (!cache) {
+    if (!(cache=vmgr->tilecachev[imageid]=calloc(1,sizeof(struct rb_tile_cache)))) return 0;
+  }
+  struct rb_tile_spans **spans=cache->v+((tileid<<3)|(xform&7));
+  if (!*spans) {
+    struct rb_vmgr_source src;
+    if (!rb_vmgr_get_source(&src,vmgr,imageid)) return 0;
+    int colw=src.w>>4;
+    int rowh=src.h>>4;
+    int srcx=(tileid&15)*colw;
+    int srcy=(tileid>>4)*rowh;
+    if (src.image8) {
+      struct rb_image *tile=rb_image_new(colw,rowh);
+      if (!tile) return 0;
+      tile->alphamode=src.alphamode;
+      rb_image8_copy_safe(tile,0,0,src.image8,srcx,srcy,colw,rowh,src.palette);
+      *spans=rb_tile_spans_new(tile,0,0,colw,rowh,xform&7);
+      rb_image_del(tile);
+    } else {
+      *spans=rb_tile_spans_new(src.image,srcx,srcy,colw,rowh,xform&7);
+    }
   }
+  return *spans;
+}
+
+/* Draw one tile, touching only (clip).
+ * Null (clip) for the whole framebuffer, and then we may fall back to the general blitter.
+ */
+ 
+static int rb_vmgr_render_tile_clip(
+  struct rb_vmgr *vmgr,
+  uint8_t imageid,uint8_t tileid,uint8_t xform,
+  int x,int y,
+  const struct rb_dirty_rect *clip
+) {
+  struct rb_vmgr_source src;
+  if (!rb_vmgr_get_source(&src,vmgr,imageid)) return -1;
   
-  // Take some measurements.
-  int colw=tilesheet->w>>4;
-  int rowh=tilesheet->h>>4;
-  int worldw=vmgr->grid->w*colw;
-  int worldh=vmgr->grid->h*rowh;
+  int colw=src.w>>4;
+  int rowh=src.h>>4;
+  int col=tileid&15;
+  int row=tileid>>4;
+  int srcx=col*colw;
+  int srcy=row*rowh;
+  int dstx=x-(colw>>1);
+  int dsty=y-(rowh>>1);
+  if ((colw<1)||(rowh<1)) return 0;
   
-  // If our view exceeds the world bounds or tiles have transparency, black out first.
-  if (
-    (vmgr->scrollx<0)||(vmgr->scrollx>worldw-RB_FB_W)||
-    (vmgr->scrolly<0)||(vmgr->scrolly>worldh-RB_FB_H)||
-    (tilesheet->alphamode!=RB_ALPHAMODE_OPAQUE)
-  ) {
-    rb_vmgr_color_background(vmgr);
+  if (clip) {
+    if (xform&RB_XFORM_SWAP) {
+      if (!rb_dirty_rect_intersects(clip,dstx,dsty,rowh,colw)) return 0;
+    } else {
+      if (!rb_dirty_rect_intersects(clip,dstx,dsty,colw,rowh)) return 0;
+    }
   }
   
-  // If our view exceeds bgbits, or if forced, refresh it.
-  if (vmgr->bgbitsdirty) {
-    rb_vmgr_refresh_bgbits(vmgr,tilesheet,colw,rowh,worldw,worldh);
-    vmgr->bgbitsdirty=0;
-  } else {
-    rb_vmgr_update_bgbits(vmgr,tilesheet,colw,rowh,worldw,worldh);
+  // Tiles get compiled to spans the first time we see them, and that's what we blit thereafter.
+  // Our framebuffer is OPAQUE, which is what rb_tile_spans_blit() needs to match rb_image_blit_safe().
+  // If anything fails, the general blitter is still correct, just slower. But it can't clip.
+  struct rb_tile_spans *spans=rb_vmgr_tile_spans(vmgr,imageid,tileid,xform);
+  if (spans) {
+    if (clip) rb_tile_spans_blit_clip(vmgr->fb,dstx,dsty,spans,clip->x,clip->y,clip->w,clip->h);
+    else rb_tile_spans_blit(vmgr->fb,dstx,dsty,spans);
+    return 0;
   }
+  if (clip) return -1;
   
-  // Copy from bgbits.
-  rb_image_blit_safe(
-    vmgr->fb,0,0,
-    vmgr->bgbits,vmgr->scrollx-vmgr->bgbitsx,vmgr->scrolly-vmgr->bgbitsy,
-    RB_FB_W,RB_FB_H,
-    0,0,0
+  return rb_vmgr_source_blit(
+    vmgr->fb,dstx,dsty,
+    &src,srcx,srcy,
+    colw,rowh,
+    xform
   );
 }
 
-/* Foreground: Sprites.
+/* Can we cull sprites with the spatial index?
+ * Only if the group is meant to be in render order, and nothing draws outside its tile.
+ */
+ 
+static inline int rb_vmgr_can_cull(const struct rb_vmgr *vmgr) {
+  const struct rb_sprite_group *group=vmgr->sprites;
+  if (!group->index) return 0;
+  if (group->order!=RB_SPRITE_GROUP_ORDER_RENDER) return 0;
+  if (group->index->renderc) return 0;
+  return 1;
+}
+
+static void rb_vmgr_measure_cull_margin(struct rb_vmgr *vmgr) {
+  vmgr->cullmargin=0;
+  int i=RB_VMGR_IMAGE_COUNT;
+  while (i-->0) {
+    struct rb_vmgr_source image;
+    if (!rb_vmgr_get_source(&image,vmgr,i)) continue;
+    int colw=image.w>>4;
+    int rowh=image.h>>4;
+    if (colw>vmgr->cullmargin) vmgr->cullmargin=colw;
+    if (rowh>vmgr->cullmargin) vmgr->cullmargin=rowh;
+  }
+}
+
+static int rb_vmgr_cull_cb(struct rb_sprite *sprite,void *userdata) {
+  struct rb_vmgr *vmgr=userdata;
+  if (vmgr->cullc>=vmgr->culla) {
+    int na=(vmgr->culla+256)&~255;
+    if (na>INT_MAX/sizeof(void*)) return -1;
+    void *nv=realloc(vmgr->cullv,sizeof(void*)*na);
+    if (!nv) return -1;
+    vmgr->cullv=nv;
+    vmgr->culla=na;
+  }
+  vmgr->cullv[vmgr->cullc++]=sprite;
+  return 0;
+}
+
+static int rb_vmgr_cull_cmp(const void *a,const void *b) {
+  return rb_sprite_cmp_render(*(struct rb_sprite*const*)a,*(struct rb_sprite*const*)b);
+}
+
+/* Sprites that might touch (rect), in exact render order, into (vmgr->cullv).
+ * That can differ from the group's best-effort order, but dirty tracking doesn't mind:
+ * Sprites it considers unchanged have the same (layer,y) as before, so they can't have swapped.
+ */
+ 
+static int rb_vmgr_cull_sprites(struct rb_vmgr *vmgr,const struct rb_dirty_rect *rect) {
+  vmgr->cullc=0;
+  if (rb_sprite_group_query(
+    vmgr->sprites,
+    vmgr->scrollx+rect->x-vmgr->cullmargin,
+    vmgr->scrolly+rect->y-vmgr->cullmargin,
+    rect->w+(vmgr->cullmargin<<1),
+    rect->h+(vmgr->cullmargin<<1),
+    rb_vmgr_cull_cb,vmgr
+  )<0) return -1;
+  if (vmgr->cullc>1) qsort(vmgr->cullv,vmgr->cullc,sizeof(void*),rb_vmgr_cull_cmp);
+  return 0;
+}
+
+/* Sprites to draw for (rect), in order.
+ * Points into (vmgr->cullv) if we can cull, or the group itself.
  */
  
-static int rb_vmgr_render_sprites(struct rb_vmgr *vmgr) {
+static int rb_vmgr_list_sprites(
+  struct rb_sprite ***spritev,int *spritec,
+  struct rb_vmgr *vmgr,const struct rb_dirty_rect *rect
+) {
+  if (rb_vmgr_can_cull(vmgr)) {
+    if (rb_vmgr_cull_sprites(vmgr,rect)<0) return -1;
+    *spritev=vmgr->cullv;
+    *spritec=vmgr->cullc;
+  } else {
+    *spritev=vmgr->sprites->v;
+    *spritec=vmgr->sprites->c;
+  }
+  return 0;
+}
+
+/* Draw sprites, touching only (rect), or null for the whole framebuffer.
+ * Render hooks can't be clipped, so (rect) must be null if there are any.
+ */
+ 
+static int rb_vmgr_draw_sprites(
+  struct rb_vmgr *vmgr,
+  struct rb_sprite **spritev,int spritec,
+  const struct rb_dirty_rect *rect
+) {
   int i=0;
-  for (;i<vmgr->sprites->c;i++) {
-    struct rb_sprite *sprite=vmgr->sprites->v[i];
+  for (;i<spritec;i++) {
+    struct rb_sprite *sprite=spritev[i];
     int x=sprite->x-vmgr->scrollx;
     int y=sprite->y-vmgr->scrolly;
     
     if (sprite->type->render) {
       if (sprite->type->render(vmgr->fb,sprite,x,y)<0) return -1;
+    } else if (rect) {
+      if (rb_vmgr_render_tile_clip(vmgr,sprite->imageid,sprite->tileid,sprite->xform,x,y,rect)<0) {
+        struct rb_vmgr_source src;
+        if (rb_vmgr_get_source(&src,vmgr,sprite->imageid)) return -1;
+      }
+    } else {
+      rb_vmgr_render_tile_clip(vmgr,sprite->imageid,sprite->tileid,sprite->xform,x,y,0);
+    }
+  }
+  return 0;
+}
+
+/* Foreground: Sprites.
+ */
+ 
+static int rb_vmgr_render_sprites(struct rb_vmgr *vmgr,const struct rb_dirty_rect *rect) {
+  struct rb_sprite **spritev;
+  int spritec;
+  if (rb_vmgr_list_sprites(&spritev,&spritec,vmgr,rect)<0) return -1;
+  if ((rect->w==RB_FB_W)&&(rect->h==RB_FB_H)) rect=0;
+  return rb_vmgr_draw_sprites(vmgr,spritev,spritec,rect);
+}
+
+/* Band-parallel compositing.
+ * Workers only read shared state, so everything that gets built lazily must be built first, here.
+ * That's the tile cache: We compile every tile we're about to draw.
+ * Returns 0 if something can't go to the workers: a render hook, or a tile that won't compile.
+ */
+ 
+struct rb_vmgr_band_job {
+  const struct rb_dirty_rect *rect; // Null if we're only doing lights.
+  struct rb_sprite **spritev;
+  int spritec;
+  int rearmost,black;
+  int lights; // RB_VMGR_BAND_LIGHTS_*
+};
+
+#define RB_VMGR_BAND_LIGHTS_NONE      0
+#define RB_VMGR_BAND_LIGHTS_RASTERIZE 1
+#define RB_VMGR_BAND_LIGHTS_APPLY     2
+
+static int rb_vmgr_compile_sprites(struct rb_vmgr *vmgr,struct rb_sprite **spritev,int spritec) {
+  for (;spritec-->0;spritev++) {
+    const struct rb_sprite *sprite=*spritev;
+    if (sprite->type->render) return 0;
+    struct rb_vmgr_source image;
+    if (!rb_vmgr_get_source(&image,vmgr,sprite->imageid)) continue;
+    if ((image.w<16)||(image.h<16)) continue;
+    if (!rb_vmgr_tile_spans(vmgr,sprite->imageid,sprite->tileid,sprite->xform)) return 0;
+  }
+  return 1;
+}
+
+static int rb_vmgr_render_band(struct rb_vmgr *vmgr,int bandp,void *arg) {
+  const struct rb_vmgr_band_job *job=arg;
+  int y0=(RB_FB_H*bandp)/vmgr->workers->bandc;
+  int y1=(RB_FB_H*(bandp+1))/vmgr->workers->bandc;
+  if (job->rect) {
+    struct rb_dirty_rect clip=*job->rect;
+    if (clip.y<y0) { clip.h-=y0-clip.y; clip.y=y0; }
+    if (clip.y+clip.h>y1) clip.h=y1-clip.y;
+    if (clip.h>0) {
+      rb_vmgr_render_background(vmgr,&clip,job->rearmost,job->black);
+      if (rb_vmgr_draw_sprites(vmgr,job->spritev,job->spritec,&clip)<0) return -1;
+    }
+  }
+  switch (job->lights) {
+    case RB_VMGR_BAND_LIGHTS_RASTERIZE: rb_lights_rasterize(vmgr->lights,y0,y1); break;
+    case RB_VMGR_BAND_LIGHTS_APPLY: if (rb_lights_apply(vmgr->fb,vmgr->lights,y0,y1)<0) return -1; break;
+  }
+  return 0;
+}
+
+/* Composite (rect) in bands if we can.
+ * Returns >0 if done, 0 if caller should do it serially, or <0 on errors.
+ */
+ 
+static int rb_vmgr_render_bands(
+  struct rb_vmgr *vmgr,
+  const struct rb_dirty_rect *rect,
+  int rearmost,int black
+) {
+  if (rect->w*rect->h<RB_VMGR_BAND_MIN_AREA) return 0;
+  struct rb_vmgr_band_job job={
+    .rect=rect,
+    .rearmost=rearmost,
+    .black=black,
+  };
+  if (rb_vmgr_list_sprites(&job.spritev,&job.spritec,vmgr,rect)<0) return -1;
+  if (!rb_vmgr_compile_sprites(vmgr,job.spritev,job.spritec)) return 0;
+  if (rb_vmgr_workers_run(vmgr,rb_vmgr_render_band,&job)<0) return -1;
+  return 1;
+}
+
+/* Lights, after everything is composited.
+ * Every map row must be rasterized before any gets applied, since half-res rows read their neighbors.
+ */
+ 
+static int rb_vmgr_render_lights(struct rb_vmgr *vmgr) {
+  if (!vmgr->workers) return rb_lights_draw(vmgr->fb,vmgr->lights,vmgr->scrollx,vmgr->scrolly);
+  if (vmgr->fb->alphamode!=RB_ALPHAMODE_OPAQUE) return -1;
+  if (vmgr->lights->bg==0xff) return 0;
+  if (rb_lights_prepare(vmgr->lights,RB_FB_W,RB_FB_H,vmgr->scrollx,vmgr->scrolly)<0) return -1;
+  struct rb_vmgr_band_job job={
+    .lights=RB_VMGR_BAND_LIGHTS_RASTERIZE,
+  };
+  if (rb_vmgr_workers_run(vmgr,rb_vmgr_render_band,&job)<0) return -1;
+  job.lights=RB_VMGR_BAND_LIGHTS_APPLY;
+  if (rb_vmgr_workers_run(vmgr,rb_vmgr_render_band,&job)<0) return -1;
+  return 0;
+}
+
+/* Take a snapshot of the sprites, in render order.
+ * Returns >0 if all sprites can be tracked, 0 if something needs the whole framebuffer, or <0 on errors.
+ */
+ 
+static int rb_vmgr_snapshot_sprites(struct rb_vmgr *vmgr) {
+  int c=vmgr->sprites->c;
+  if (c>vmgr->snapa) {
+    int na=(c+64)&~63;
+    void *nv=realloc(vmgr->snapv,sizeof(struct rb_vmgr_sprite_snap)*na);
+    if (!nv) return -1;
+    vmgr->snapv=nv;
+    if (!(nv=realloc(vmgr->nsnapv,sizeof(struct rb_vmgr_sprite_snap)*na))) return -1;
+    vmgr->nsnapv=nv;
+    if (!(nv=realloc(vmgr->snaporderv,sizeof(int)*na))) return -1;
+    vmgr->snaporderv=nv;
+    vmgr->snapa=na;
+  }
+  int trackable=1,i=0;
+  struct rb_vmgr_sprite_snap *snap=vmgr->nsnapv;
+  for (;i<c;i++,snap++) {
+    struct rb_sprite *sprite=vmgr->sprites->v[i];
+    snap->sprite=sprite;
+    snap->imageid=sprite->imageid;
+    snap->tileid=sprite->tileid;
+    snap->xform=sprite->xform;
+    snap->layer=sprite->layer;
+    snap->order=i;
+    snap->changed=0;
+    snap->x=snap->y=snap->w=snap->h=0;
+    if (sprite->type->render) {
+      trackable=0;
     } else {
-      rb_vmgr_render_tile(vmgr,sprite->imageid,sprite->tileid,sprite->xform,x,y);
+      struct rb_vmgr_source image;
+      if (rb_vmgr_get_source(&image,vmgr,sprite->imageid)) {
+        int colw=image.w>>4;
+        int rowh=image.h>>4;
+        snap->x=sprite->x-(colw>>1);
+        snap->y=sprite->y-(rowh>>1);
+        if (sprite->xform&RB_XFORM_SWAP) {
+          snap->w=rowh;
+          snap->h=colw;
+        } else {
+          snap->w=colw;
+          snap->h=rowh;
+        }
+      }
     }
   }
+  return trackable;
+}
+
+static int rb_vmgr_snap_cmp(const void *a,const void *b) {
+  const struct rb_vmgr_sprite_snap *A=a,*B=b;
+  if (A->sprite<B->sprite) return -1;
+  if (A->sprite>B->sprite) return 1;
   return 0;
 }
 
+/* Compare the new snapshot against the previous, and add the world rects of whatever changed.
+ * Both lists end up sorted by sprite, and the new one becomes current.
+ */
+ 
+static void rb_vmgr_diff_sprites(struct rb_vmgr *vmgr) {
+  int oldc=vmgr->snapc,newc=vmgr->sprites->c;
+  struct rb_vmgr_sprite_snap *oldv=vmgr->snapv,*newv=vmgr->nsnapv;
+  qsort(newv,newc,sizeof(struct rb_vmgr_sprite_snap),rb_vmgr_snap_cmp);
+  
+  // Pair them up. (snaporderv) maps old render order to new, or -1 if changed or gone.
+  int *orderv=vmgr->snaporderv;
+  int i=0,j=0;
+  for (;i<oldc;i++) orderv[oldv[i].order]=-1;
+  for (i=0;i<oldc;i++) oldv[i].changed=1;
+  for (j=0;j<newc;j++) newv[j].changed=1;
+  for (i=j=0;(i<oldc)&&(j<newc);) {
+    struct rb_vmgr_sprite_snap *o=oldv+i,*n=newv+j;
+    if (o->sprite<n->sprite) { i++; continue; }
+    if (o->sprite>n->sprite) { j++; continue; }
+    if (
+      (o->x==n->x)&&(o->y==n->y)&&(o->w==n->w)&&(o->h==n->h)&&
+      (o->imageid==n->imageid)&&(o->tileid==n->tileid)&&(o->xform==n->xform)&&(o->layer==n->layer)
+    ) {
+      o->changed=n->changed=0;
+      orderv[o->order]=n->order;
+    }
+    i++;
+    j++;
+  }
+  
+  // Unchanged sprites must keep their relative order, or they might have swapped where they overlap.
+  // Any that don't are redrawn too.
+  int last=-1;
+  for (i=0;i<oldc;i++) {
+    if (orderv[i]<0) continue;
+    if (orderv[i]>last) last=orderv[i];
+    else orderv[i]=-2;
+  }
+  
+  for (i=0;i<oldc;i++) {
+    struct rb_vmgr_sprite_snap *o=oldv+i;
+    if (o->changed||(orderv[o->order]==-2)) {
+      rb_dirty_add(&vmgr->dirty,o->x-vmgr->scrollx,o->y-vmgr->scrolly,o->w,o->h);
+    }
+  }
+  for (j=0;j<newc;j++) {
+    struct rb_vmgr_sprite_snap *n=newv+j;
+    if (n->changed) {
+      rb_dirty_add(&vmgr->dirty,n->x-vmgr->scrollx,n->y-vmgr->scrolly,n->w,n->h);
+    }
+  }
+  
+  vmgr->snapv=newv;
+  vmgr->nsnapv=oldv;
+  vmgr->snapc=newc;
+}
+
+/* Start a new buffer from the previous frame, moved by the scroll delta.
+ * Strips exposed by scrolling are left alone, they're dirty anyway.
+ */
+
+static void rb_vmgr_inherit_fb(struct rb_image *dst,const struct rb_image *src,int dx,int dy) {
+  int srcx=0,srcy=0,dstx=dx,dsty=dy,w=RB_FB_W,h=RB_FB_H;
+  if (dstx<0) { w+=dstx; srcx=-dstx; dstx=0; } else w-=dstx;
+  if (dsty<0) { h+=dsty; srcy=-dsty; dsty=0; } else h-=dsty;
+  if ((w<1)||(h<1)) return;
+  uint32_t *dstrow=dst->pixels+dsty*RB_FB_W+dstx;
+  const uint32_t *srcrow=src->pixels+srcy*RB_FB_W+srcx;
+  if (w==RB_FB_W) {
+    memcpy(dstrow,srcrow,(h*RB_FB_W)<<2);
+  } else {
+    int cpc=w<<2;
+    for (;h-->0;dstrow+=RB_FB_W,srcrow+=RB_FB_W) memcpy(dstrow,srcrow,cpc);
+  }
+}
+
+/* Decide what to recomposite, into (vmgr->dirty).
+ * If the scroll position changed, we move (fb) content along with it first.
+ * If (prev) is a different buffer, we start from its content instead of (fb)'s.
+ * Returns >0 if (fb) moved, ie the whole thing is dirty as far as the video driver is concerned.
+ */
+ 
+static int rb_vmgr_gather_dirty(struct rb_vmgr *vmgr,const struct rb_image *prev) {
+  int dx=vmgr->fbscrollx-vmgr->scrollx;
+  int dy=vmgr->fbscrolly-vmgr->scrolly;
+  vmgr->fbscrollx=vmgr->scrollx;
+  vmgr->fbscrolly=vmgr->scrolly;
+  rb_dirty_clear(&vmgr->dirty);
+  
+  // Lights touch everything, and (fb) no longer holds what we composited.
+  if (!vmgr->dirtytracking||vmgr->lights) {
+    rb_dirty_clear(&vmgr->invalid);
+    rb_dirty_all(&vmgr->dirty);
+    return 0;
+  }
+  
+  int trackable=rb_vmgr_snapshot_sprites(vmgr);
+  if (trackable<0) return -1;
+  
+  // Layers that don't move with the camera defeat scrolling (fb) in place.
+  int layerid=vmgr->layerc;
+  while (layerid-->0) {
+    const struct rb_vmgr_layer *layer=vmgr->layerv+layerid;
+    if (!layer->grid) continue;
+    if (layer->bgbitsdirty) trackable=0;
+    if ((dx||dy)&&(layer->parallax!=0x100)) trackable=0;
+  }
+  
+  if (
+    !trackable||vmgr->fbdirty||
+    (dx<=-RB_FB_W)||(dx>=RB_FB_W)||(dy<=-RB_FB_H)||(dy>=RB_FB_H)
+  ) {
+    vmgr->fbdirty=0;
+    rb_dirty_clear(&vmgr->invalid);
+    qsort(vmgr->nsnapv,vmgr->sprites->c,sizeof(struct rb_vmgr_sprite_snap),rb_vmgr_snap_cmp);
+    struct rb_vmgr_sprite_snap *tmp=vmgr->snapv;
+    vmgr->snapv=vmgr->nsnapv;
+    vmgr->nsnapv=tmp;
+    vmgr->snapc=vmgr->sprites->c;
+    rb_dirty_all(&vmgr->dirty);
+    return 0;
+  }
+  
+  // Move what we already have, then the exposed strips are dirty.
+  if (prev!=vmgr->fb) rb_vmgr_inherit_fb(vmgr->fb,prev,dx,dy);
+  else if (dx||dy) rb_image_scroll(vmgr->fb,dx,dy);
+  if (dx||dy) {
+    if (dx<0) rb_dirty_add(&vmgr->dirty,RB_FB_W+dx,0,-dx,RB_FB_H);
+    else if (dx>0) rb_dirty_add(&vmgr->dirty,0,0,dx,RB_FB_H);
+    if (dy<0) rb_dirty_add(&vmgr->dirty,0,RB_FB_H+dy,RB_FB_W,-dy);
+    else if (dy>0) rb_dirty_add(&vmgr->dirty,0,0,RB_FB_W,dy);
+  }
+  
+  int i=vmgr->invalid.rectc;
+  if (i) {
+    rb_dirty_shift(&vmgr->invalid,dx,dy);
+    const struct rb_dirty_rect *rect=vmgr->invalid.rectv;
+    for (i=vmgr->invalid.rectc;i-->0;rect++) rb_dirty_add(&vmgr->dirty,rect->x,rect->y,rect->w,rect->h);
+    rb_dirty_clear(&vmgr->invalid);
+  }
+  
+  rb_vmgr_diff_sprites(vmgr);
+  
+  return (dx||dy)?1:0;
+}
+
 /* Render, main entry point.
  */
  
 struct rb_image *rb_vmgr_render(struct rb_vmgr *vmgr) {
   if (!vmgr) return 0;
   
-  rb_vmgr_render_background(vmgr);
-  rb_sprite_group_sort(vmgr->sprites);
-  if (rb_vmgr_render_sprites(vmgr)<0) return 0;
+  const struct rb_image *prev=vmgr->fb;
+  if (vmgr->fbc>1) {
+    if (++(vmgr->fbp)>=vmgr->fbc) vmgr->fbp=0;
+    vmgr->fb=vmgr->fbv[vmgr->fbp];
+  }
+  if (vmgr->present) rb_present_reclaim(vmgr->present,vmgr->fb);
+  
+  // Culled sprites get sorted exactly, so sorting the whole group would be wasted.
+  if (rb_vmgr_can_cull(vmgr)) {
+    rb_sprite_group_index_update(vmgr->sprites);
+    rb_vmgr_measure_cull_margin(vmgr);
+  } else {
+    rb_sprite_group_sort(vmgr->sprites);
+  }
+  int moved=rb_vmgr_gather_dirty(vmgr,prev);
+  if (moved<0) return 0;
+  
+  int black=0;
+  int rearmost=rb_vmgr_prepare_layers(vmgr,&black);
+  
+  const struct rb_dirty_rect *rect=vmgr->dirty.rectv;
+  int i=vmgr->dirty.rectc;
+  for (;i-->0;rect++) {
+    if (vmgr->workers) {
+      int err=rb_vmgr_render_bands(vmgr,rect,rearmost,black);
+      if (err<0) return 0;
+      if (err>0) continue;
+    }
+    rb_vmgr_render_background(vmgr,rect,rearmost,black);
+    if (rb_vmgr_render_sprites(vmgr,rect)<0) return 0;
+  }
+  
+  if (vmgr->lights) {
+    if (rb_vmgr_render_lights(vmgr)<0) return 0;
+  }
+  
+  if (moved) rb_dirty_all(&vmgr->dirty);
   
   return vmgr->fb;
 }
@@ -168,23 +908,5 @@ int rb_vmgr_render_tile(
   uint8_t imageid,uint8_t tileid,uint8_t xform,
   int x,int y
 ) {
-  if (imageid>=RB_VMGR_IMAGE_COUNT) return -1;
-  struct rb_image *src=vmgr->imagev[imageid];
-  if (!src) return -1;
-  
-  int colw=src->w>>4;
-  int rowh=src->h>>4;
-  int col=tileid&15;
-  int row=tileid>>4;
-  int srcx=col*colw;
-  int srcy=row*rowh;
-  int dstx=x-(colw>>1);
-  int dsty=y-(rowh>>1);
-  
-  return rb_image_blit_safe(
-    vmgr->fb,dstx,dsty,
-    src,srcx,srcy,
-    colw,rowh,
-    xform,0,0
-  );
+  return rb_vmgr_render_tile_clip(vmgr,imageid,tileid,xform,x,y,0);
 }
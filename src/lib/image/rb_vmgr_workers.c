@@ -0,0 +1,137 @@
+#include "rabbit/rb_internal.h"
+#include "rabbit/rb_vmgr.h"
+
+/* Worker thread.
+ * We start with job serial zero, so a worker that starts late still runs the job it was counted for.
+ */
+
+static void *rb_vmgr_worker(void *arg) {
+  struct rb_vmgr_workers *workers=arg;
+  if (pthread_mutex_lock(&workers->mutex)) return 0;
+  int bandp=++(workers->idnext);
+  int serial=0;
+  for (;;) {
+    if (workers->quit) break;
+    if (workers->jobserial==serial) {
+      pthread_cond_wait(&workers->cond,&workers->mutex);
+      continue;
+    }
+    serial=workers->jobserial;
+    int (*job)(struct rb_vmgr *vmgr,int bandp,void *arg)=workers->job;
+    void *jobarg=workers->arg;
+    pthread_mutex_unlock(&workers->mutex);
+
+    int err=job(workers->vmgr,bandp,jobarg);
+
+    if (pthread_mutex_lock(&workers->mutex)) return 0;
+    if (err<0) workers->status=-1;
+    if (!--(workers->busyc)) pthread_cond_signal(&workers->donecond);
+  }
+  pthread_mutex_unlock(&workers->mutex);
+  return 0;
+}
+
+/* Delete.
+ */
+
+static void rb_vmgr_workers_del(struct rb_vmgr_workers *workers) {
+  if (!workers) return;
+  if (workers->threadc) {
+    pthread_mutex_lock(&workers->mutex);
+    workers->quit=1;
+    pthread_cond_broadcast(&workers->cond);
+    pthread_mutex_unlock(&workers->mutex);
+    while (workers->threadc>0) {
+      workers->threadc--;
+      pthread_join(workers->threadv[workers->threadc],0);
+    }
+  }
+  pthread_cond_destroy(&workers->donecond);
+  pthread_cond_destroy(&workers->cond);
+  pthread_mutex_destroy(&workers->mutex);
+  free(workers);
+}
+
+/* New.
+ */
+
+static struct rb_vmgr_workers *rb_vmgr_workers_new(struct rb_vmgr *vmgr,int bandc) {
+  struct rb_vmgr_workers *workers=calloc(1,sizeof(struct rb_vmgr_workers));
+  if (!workers) return 0;
+  workers->vmgr=vmgr;
+  workers->bandc=bandc;
+
+  if (pthread_mutex_init(&workers->mutex,0)) {
+    free(workers);
+    return 0;
+  }
+  if (pthread_cond_init(&workers->cond,0)) {
+    pthread_mutex_destroy(&workers->mutex);
+    free(workers);
+    return 0;
+  }
+  if (pthread_cond_init(&workers->donecond,0)) {
+    pthread_cond_destroy(&workers->cond);
+    pthread_mutex_destroy(&workers->mutex);
+    free(workers);
+    return 0;
+  }
+
+  while (workers->threadc<bandc-1) {
+    if (pthread_create(workers->threadv+workers->threadc,0,rb_vmgr_worker,workers)) {
+      rb_vmgr_workers_del(workers);
+      return 0;
+    }
+    workers->threadc++;
+  }
+
+  return workers;
+}
+
+/* Set thread count.
+ */
+
+int rb_vmgr_set_threads(struct rb_vmgr *vmgr,int threadc) {
+  if (!vmgr) return -1;
+  if ((threadc<1)||(threadc>RB_VMGR_THREAD_LIMIT)) return -1;
+  if (vmgr->workers) {
+    if (vmgr->workers->bandc==threadc) return 0;
+  } else if (threadc==1) {
+    return 0;
+  }
+  rb_vmgr_workers_del(vmgr->workers);
+  vmgr->workers=0;
+  if (threadc==1) return 0;
+  if (!(vmgr->workers=rb_vmgr_workers_new(vmgr,threadc))) return -1;
+  return 0;
+}
+
+/* Run a job.
+ */
+
+int rb_vmgr_workers_run(
+  struct rb_vmgr *vmgr,
+  int (*job)(struct rb_vmgr *vmgr,int bandp,void *arg),
+  void *arg
+) {
+  if (!vmgr||!job) return -1;
+  struct rb_vmgr_workers *workers=vmgr->workers;
+  if (!workers) return -1;
+
+  if (pthread_mutex_lock(&workers->mutex)) return -1;
+  workers->job=job;
+  workers->arg=arg;
+  workers->status=0;
+  workers->busyc=workers->threadc;
+  workers->jobserial++;
+  pthread_cond_broadcast(&workers->cond);
+  pthread_mutex_unlock(&workers->mutex);
+
+  int err=job(vmgr,0,arg);
+
+  if (pthread_mutex_lock(&workers->mutex)) return -1;
+  while (workers->busyc) pthread_cond_wait(&workers->donecond,&workers->mutex);
+  if (workers->status<0) err=-1;
+  pthread_mutex_unlock(&workers->mutex);
+  return err;
+}
@@ -1,6 +1,7 @@
 #include "rabbit/rb_internal.h"
 #include "rabbit/rb_video.h"
 #include "rabbit/rb_image.h"
+#include "rabbit/rb_dirty.h"
 #include <bcm_host.h>
 
 // Screen size sanity limit.
@@ -19,6 +20,7 @@ struct rb_video_bcm {
   
   int screenw,screenh;
   void *fb;
+  uint32_t *stage; // RB_FB_W*RB_FB_H, what we upload from. Never write into the caller's framebuffer.
   int vsync_seq;
 };
 
@@ -29,6 +31,7 @@ struct rb_video_bcm {
 
 static void _rb_bcm_del(struct rb_video *video) {
   if (VIDEO->fb) free(VIDEO->fb);
+  if (VIDEO->stage) free(VIDEO->stage);
   bcm_host_deinit();
 }
 
@@ -57,6 +60,7 @@ static int _rb_bcm_init(struct rb_video *video) {
   VC_RECT_T dstr={0,0,VIDEO->screenw,VIDEO->screenh};
 
   if (!(VIDEO->fb=malloc(4*RB_FB_W*RB_FB_H))) return -1;
+  if (!(VIDEO->stage=malloc(4*RB_FB_W*RB_FB_H))) return -1;
   if (!(VIDEO->vcresource=vc_dispmanx_resource_create(
     VC_IMAGE_XRGB8888,RB_FB_W,RB_FB_H,VIDEO->fb
   ))) return -1;
@@ -73,22 +77,31 @@ static int _rb_bcm_init(struct rb_video *video) {
   return 0;
 }
 
-/* Swap buffers.
+/* Upload rows (y..y+h-1) of the framebuffer.
+ * Dispmanx only looks at the rect's vertical extent, it always takes full rows.
+ * (fb) is read-only to us: vmgr may be copying from it on another thread. So clear the MSBs while copying into (stage).
  */
-
-static int _rb_bcm_swap(struct rb_video *video,struct rb_image *fb) {
-  int wait_vsync_seq=VIDEO->vsync_seq+1;
+ 
+static void rb_bcm_upload_rows(struct rb_video *video,struct rb_image *fb,int y,int h) {
 
   // getting a bunch of red in the output... do we need to clear the MSBs?
   {
-    uint32_t *v=fb->pixels;
-    int i=fb->w*fb->h;
-    for (;i-->0;v++) (*v)&=0x00ffffff;
+    const uint32_t *src=fb->pixels+y*fb->w;
+    uint32_t *dst=VIDEO->stage+y*RB_FB_W;
+    int i=RB_FB_W*h;
+    for (;i-->0;src++,dst++) *dst=(*src)&0x00ffffff;
   }
   
   // This is enough to replace the screen content and make it live. Cool!
-  VC_RECT_T fbr={0,0,RB_FB_W,RB_FB_H};
-  vc_dispmanx_resource_write_data(VIDEO->vcresource,VC_IMAGE_XRGB8888,RB_FB_W<<2,fb->pixels,&fbr);
+  VC_RECT_T fbr={0,y,RB_FB_W,h};
+  vc_dispmanx_resource_write_data(VIDEO->vcresource,VC_IMAGE_XRGB8888,RB_FB_W<<2,VIDEO->stage,&fbr);
+}
+
+/* Block until the next vsync.
+ */
+
+static int rb_bcm_wait_vsync(struct rb_video *video) {
+  int wait_vsync_seq=VIDEO->vsync_seq+1;
 
   /* Block manually until vsync. */
   int panic=100;
@@ -106,6 +119,34 @@ static int _rb_bcm_swap(struct rb_video *video,struct rb_image *fb) {
   return 0;
 }
 
+/* Swap buffers.
+ */
+
+static int _rb_bcm_swap(struct rb_video *video,struct rb_image *fb) {
+  rb_bcm_upload_rows(video,fb,0,RB_FB_H);
+  return rb_bcm_wait_vsync(video);
+}
+
+/* Swap with dirty rects.
+ * Since we upload full rows anyway, merge the rects into vertical bands first.
+ */
+
+static int _rb_bcm_swap_dirty(struct rb_video *video,struct rb_image *fb,const struct rb_dirty *dirty) {
+  uint8_t rowv[RB_FB_H]={0};
+  const struct rb_dirty_rect *rect=dirty->rectv;
+  int i=dirty->rectc;
+  for (;i-->0;rect++) memset(rowv+rect->y,1,rect->h);
+  int y=0;
+  while (y<RB_FB_H) {
+    if (!rowv[y]) { y++; continue; }
+    int h=1;
+    while ((y+h<RB_FB_H)&&rowv[y+h]) h++;
+    rb_bcm_upload_rows(video,fb,y,h);
+    y+=h;
+  }
+  return rb_bcm_wait_vsync(video);
+}
+
 /* Type.
  */
 
@@ -119,4 +160,5 @@ const struct rb_video_type rb_video_type_bcm={
   .del=_rb_bcm_del,
   .init=_rb_bcm_init,
   .swap=_rb_bcm_swap,
+  .swap_dirty=_rb_bcm_swap_dirty,
 };
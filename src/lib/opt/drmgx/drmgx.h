@@ -28,4 +28,9 @@ struct drmgx *drmgx_new(const char *device,int rate,int w,int h,int filter,int g
  */
 int drmgx_swap(struct drmgx *drmgx,const void *fb,int w,int h,int fmt);
 
+/* Our EGL context is current on one thread at a time.
+ * Release it (bind=0) on the old thread before binding it on the one that will swap.
+ */
+int drmgx_bind_thread(struct drmgx *drmgx,int bind);
+
 #endif
@@ -162,6 +162,15 @@ static int drmgx_swap_egl(struct drmgx *drmgx,uint32_t *fbid) {
   return 0;
 }
 
+int drmgx_bind_thread(struct drmgx *drmgx,int bind) {
+  if (bind) {
+    if (!eglMakeCurrent(drmgx->egldisplay,drmgx->eglsurface,drmgx->eglsurface,drmgx->eglcontext)) return -1;
+  } else {
+    if (!eglMakeCurrent(drmgx->egldisplay,EGL_NO_SURFACE,EGL_NO_SURFACE,EGL_NO_CONTEXT)) return -1;
+  }
+  return 0;
+}
+
 int drmgx_swap(struct drmgx *drmgx,const void *fb,int w,int h,int fmt) {
 
   if (!fb||(w<1)||(w>4096)||(h<1)||(h>4096)) return -1;
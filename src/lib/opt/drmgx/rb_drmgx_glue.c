@@ -35,6 +35,10 @@ static int _drmgx_swap(struct rb_video *video,struct rb_image *fb) {
   return drmgx_swap(VIDEO->drmgx,fb->pixels,fb->w,fb->h,DRMGX_FMT_RGBX);
 }
 
+static int _drmgx_bind_thread(struct rb_video *video,int bind) {
+  return drmgx_bind_thread(VIDEO->drmgx,bind);
+}
+
 const struct rb_video_type rb_video_type_drmgx={
   .name="drmgx",
   .desc="DRM with OpenGL ES, for Linux without a window manager.",
@@ -43,4 +47,5 @@ const struct rb_video_type rb_video_type_drmgx={
   .init=_drmgx_init,
   .del=_drmgx_del,
   .swap=_drmgx_swap,
+  .bind_thread=_drmgx_bind_thread,
 };
@@ -81,7 +81,11 @@ static int rb_glx_evt_configure(struct rb_video *video,XConfigureEvent *evt) {
   if ((nw!=video->winw)||(nh!=video->winh)) {
     video->winw=nw;
     video->winh=nh;
+    pthread_mutex_lock(&VIDEO->sizemtx);
+    VIDEO->sizew=nw;
+    VIDEO->sizeh=nh;
     VIDEO->dstdirty=1;
+    pthread_mutex_unlock(&VIDEO->sizemtx);
     if (video->delegate.cb_resize) {
       if (video->delegate.cb_resize(video)<0) {
         return -1;
@@ -106,8 +106,14 @@ static int _rb_glx_init(struct rb_video *video) {
 
   VIDEO->cursor_visible=1;
   VIDEO->focus=1;
+  if (pthread_mutex_init(&VIDEO->sizemtx,0)) return -1;
+  VIDEO->sizew=video->winw;
+  VIDEO->sizeh=video->winh;
   VIDEO->dstdirty=1;
   
+  // In case rb_present swaps from another thread. Must precede any other Xlib call.
+  XInitThreads();
+  
   if (!(VIDEO->dpy=XOpenDisplay(0))) {
     return -1;
   }
@@ -145,6 +151,7 @@ static void _rb_glx_del(struct rb_video *video) {
   if (VIDEO->dpy) {
     XCloseDisplay(VIDEO->dpy);
   }
+  pthread_mutex_destroy(&VIDEO->sizemtx);
 }
 
 /* Select framebuffer's output bounds.
@@ -152,20 +159,20 @@ static void _rb_glx_del(struct rb_video *video) {
  
 static void rb_glx_recalculate_output_bounds(struct rb_video *video) {
   
-  if ((video->winw<1)||(video->winh<1)) {
+  if ((VIDEO->glw<1)||(VIDEO->glh<1)) {
     VIDEO->dstx=0;
     VIDEO->dsty=0;
-    VIDEO->dstw=video->winw;
-    VIDEO->dsth=video->winh;
+    VIDEO->dstw=VIDEO->glw;
+    VIDEO->dsth=VIDEO->glh;
   } else {
   
-    int wforh=(video->winh*RB_FB_W)/RB_FB_H;
-    if (wforh<=video->winw) {
+    int wforh=(VIDEO->glh*RB_FB_W)/RB_FB_H;
+    if (wforh<=VIDEO->glw) {
       VIDEO->dstw=wforh;
-      VIDEO->dsth=video->winh;
+      VIDEO->dsth=VIDEO->glh;
     } else {
-      VIDEO->dstw=video->winw;
-      VIDEO->dsth=(video->winw*RB_FB_H)/RB_FB_W;
+      VIDEO->dstw=VIDEO->glw;
+      VIDEO->dsth=(VIDEO->glw*RB_FB_H)/RB_FB_W;
     }
     
     // If we're scaling up between 1x and 3x, snap down to the nearest integer multiple, to avoid ugly scaling artifacts.
@@ -184,43 +191,49 @@ static void rb_glx_recalculate_output_bounds(struct rb_video *video) {
     // This shouldn't be a big deal aesthetically, but it lets us avoid clearing GL's framebuffer before each copy.
     if (prop>=3.0) {
       const double CHEESE_FACTOR=0.02;
-      int xdiff=video->winw-VIDEO->dstw;
-      int ydiff=video->winh-VIDEO->dsth;
+      int xdiff=VIDEO->glw-VIDEO->dstw;
+      int ydiff=VIDEO->glh-VIDEO->dsth;
       if (xdiff) {
-        double relmargin=(double)xdiff/(double)video->winw;
+        double relmargin=(double)xdiff/(double)VIDEO->glw;
         if (relmargin<=CHEESE_FACTOR) {
-          VIDEO->dstw=video->winw;
+          VIDEO->dstw=VIDEO->glw;
         }
       } else if (ydiff) {
-        double relmargin=(double)ydiff/(double)video->winh;
+        double relmargin=(double)ydiff/(double)VIDEO->glh;
         if (relmargin<=CHEESE_FACTOR) {
-          VIDEO->dsth=video->winh;
+          VIDEO->dsth=VIDEO->glh;
         }
       }
     }
     
-    VIDEO->dstx=(video->winw>>1)-(VIDEO->dstw>>1);
-    VIDEO->dsty=(video->winh>>1)-(VIDEO->dsth>>1);
+    VIDEO->dstx=(VIDEO->glw>>1)-(VIDEO->dstw>>1);
+    VIDEO->dsty=(VIDEO->glh>>1)-(VIDEO->dsth>>1);
   }
 }
 
 /* Frame control.
  */
 
-static int _rb_glx_swap(struct rb_video *video,struct rb_image *fb) {
+static int rb_glx_present(struct rb_video *video) {
 
-  if (VIDEO->dstdirty) {
-    rb_glx_recalculate_output_bounds(video);
+  pthread_mutex_lock(&VIDEO->sizemtx);
+  int dstdirty=VIDEO->dstdirty;
+  if (dstdirty) {
+    VIDEO->glw=VIDEO->sizew;
+    VIDEO->glh=VIDEO->sizeh;
     VIDEO->dstdirty=0;
   }
+  pthread_mutex_unlock(&VIDEO->sizemtx);
+  if (dstdirty) {
+    rb_glx_recalculate_output_bounds(video);
+  }
   if ((VIDEO->dstx>0)||(VIDEO->dsty>0)) {
-    glViewport(0,0,video->winw,video->winh);
+    glViewport(0,0,VIDEO->glw,VIDEO->glh);
     glClearColor(0.0f,0.0f,0.0f,1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
   }
   glViewport(VIDEO->dstx,VIDEO->dsty,VIDEO->dstw,VIDEO->dsth);
 
-  glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA,RB_FB_W,RB_FB_H,0,GL_BGRA,GL_UNSIGNED_BYTE,fb->pixels);
   glBegin(GL_TRIANGLE_STRIP);
     glTexCoord2i(0,1); glVertex2i(-1,-1);
     glTexCoord2i(0,0); glVertex2i(-1, 1);
@@ -233,6 +246,42 @@ static int _rb_glx_swap(struct rb_video *video,struct rb_image *fb) {
   return 0;
 }
 
+static int _rb_glx_swap(struct rb_video *video,struct rb_image *fb) {
+  glTexImage2D(GL_TEXTURE_2D,0,GL_RGBA,RB_FB_W,RB_FB_H,0,GL_BGRA,GL_UNSIGNED_BYTE,fb->pixels);
+  VIDEO->texready=1;
+  return rb_glx_present(video);
+}
+
+/* Swap with dirty rects: Upload only the changed regions.
+ */
+
+static int _rb_glx_swap_dirty(struct rb_video *video,struct rb_image *fb,const struct rb_dirty *dirty) {
+  if (!VIDEO->texready) return _rb_glx_swap(video,fb);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH,RB_FB_W);
+  const struct rb_dirty_rect *rect=dirty->rectv;
+  int i=dirty->rectc;
+  for (;i-->0;rect++) {
+    glTexSubImage2D(
+      GL_TEXTURE_2D,0,rect->x,rect->y,rect->w,rect->h,GL_BGRA,GL_UNSIGNED_BYTE,
+      fb->pixels+rect->y*RB_FB_W+rect->x
+    );
+  }
+  glPixelStorei(GL_UNPACK_ROW_LENGTH,0);
+  return rb_glx_present(video);
+}
+
+/* Move GL context between threads.
+ */
+
+static int _rb_glx_bind_thread(struct rb_video *video,int bind) {
+  if (bind) {
+    if (!glXMakeCurrent(VIDEO->dpy,VIDEO->win,VIDEO->ctx)) return -1;
+  } else {
+    if (!glXMakeCurrent(VIDEO->dpy,None,0)) return -1;
+  }
+  return 0;
+}
+
 /* Toggle fullscreen.
  */
 
@@ -387,6 +436,8 @@ const struct rb_video_type rb_video_type_glx={
   .init=_rb_glx_init,
   .update=_rb_glx_update,
   .swap=_rb_glx_swap,
+  .swap_dirty=_rb_glx_swap_dirty,
   .set_fullscreen=_rb_glx_set_fullscreen,
   .suppress_screensaver=_rb_glx_suppress_screensaver,
+  .bind_thread=_rb_glx_bind_thread,
 };
@@ -4,7 +4,9 @@
 #include "rabbit/rb_internal.h"
 #include "rabbit/rb_video.h"
 #include "rabbit/rb_image.h"
+#include "rabbit/rb_dirty.h"
 #include <stdio.h>
+#include <pthread.h>
 #include <X11/X.h>
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
@@ -38,9 +40,17 @@ struct rb_video_glx {
   int focus;
   
   GLuint texid;
+  int texready; // nonzero once (texid) holds a full framebuffer, so we can update just parts of it
   
+  // rb_present may swap on another thread, while the main thread pumps events.
+  // The event side posts the new window size under (sizemtx), and the swapping side consumes it.
+  pthread_mutex_t sizemtx;
+  int sizew,sizeh; // Guarded by (sizemtx).
+  int dstdirty; // Guarded by (sizemtx).
+  
+  // Swapping thread only:
   int dstx,dsty,dstw,dsth;
-  int dstdirty;
+  int glw,glh;
 };
 
 #define VIDEO ((struct rb_video_glx*)video)
@@ -1,5 +1,4 @@
-#include "rabbit/rb_internal.h"
-#include "rabbit/rb_sprite.h"
+#include "rb_sprite_internal.h"
 
 /* New.
  */
@@ -26,6 +25,9 @@ void rb_sprite_group_del(struct rb_sprite_group *group) {
     fprintf(stderr,"!!! Deleting group %p with c==%d, should have been zero !!!\n",group,group->c);
   }
   if (group->v) free(group->v);
+  rb_sprite_index_del(group->index);
+  if (group->sortv) free(group->sortv);
+  if (group->posv) free(group->posv);
   
   free(group);
 }
@@ -60,6 +62,12 @@ static int _rb_group_find_sprite(const struct rb_sprite_group *group,const struc
       }
       
     case RB_SPRITE_GROUP_ORDER_RENDER: {
+        // SORT_FULL doesn't care where new sprites go, the next sort will place them.
+        if (group->sortmode==RB_SPRITE_SORT_FULL) {
+          int p=rb_sprite_group_pos_get((struct rb_sprite_group*)group,sprite);
+          if (p>=0) return p;
+          if (p==-1) return -group->c-1;
+        }
         // This is the same brute-force approach as default,
         // but we'll try to return a sane insertion point when not found.
         int i=group->c,insp=0;
@@ -113,10 +121,16 @@ static int _rb_group_add_sprite(struct rb_sprite_group *group,int p,struct rb_sp
     group->v=nv;
     group->a=na;
   }
-  if (rb_sprite_ref(sprite)<0) return -1;
+  if (group->index&&(rb_sprite_index_add(group->index,sprite)<0)) return -1;
+  if (rb_sprite_ref(sprite)<0) {
+    rb_sprite_index_remove(group->index,sprite);
+    return -1;
+  }
   memmove(group->v+p+1,group->v+p,sizeof(void*)*(group->c-p));
   group->c++;
   group->v[p]=sprite;
+  if (p==group->c-1) rb_sprite_group_pos_set(group,sprite,p);
+  else rb_sprite_group_pos_invalidate(group);
   return 0;
 }
 
@@ -141,7 +155,17 @@ static void _rb_group_remove_sprite(struct rb_sprite_group *group,int p) {
   if ((p<0)||(p>=group->c)) return;
   struct rb_sprite *sprite=group->v[p];
   group->c--;
-  memmove(group->v+p,group->v+p+1,sizeof(void*)*(group->c-p));
+  rb_sprite_group_pos_unset(group,sprite);
+  if (p<group->c) {
+    if ((group->order==RB_SPRITE_GROUP_ORDER_RENDER)&&(group->sortmode==RB_SPRITE_SORT_FULL)) {
+      group->v[p]=group->v[group->c];
+      rb_sprite_group_pos_set(group,group->v[p],p);
+    } else {
+      memmove(group->v+p,group->v+p+1,sizeof(void*)*(group->c-p));
+      rb_sprite_group_pos_invalidate(group);
+    }
+  }
+  rb_sprite_index_remove(group->index,sprite);
   rb_sprite_del(sprite);
 }
 
@@ -174,12 +198,18 @@ static int _rb_sprite_group_add_single(struct rb_sprite_group *group,struct rb_s
     if (grpp>=0) return -1;
     grpp=-grpp-1;
     
-    if (_rb_sprite_add_group(sprite,grpp,group)<0) return -1;
+    if (group->index&&(rb_sprite_index_add(group->index,sprite)<0)) return -1;
+    if (_rb_sprite_add_group(sprite,grpp,group)<0) {
+      rb_sprite_index_remove(group->index,sprite);
+      return -1;
+    }
     if (rb_sprite_ref(sprite)<0) {
       _rb_sprite_remove_group(sprite,grpp);
+      rb_sprite_index_remove(group->index,sprite);
       return -1;
     }
     group->v[0]=sprite;
+    rb_sprite_index_remove(group->index,prior);
     
     if ((grpp=_rb_sprite_find_group(prior,group))>=0) {
       _rb_sprite_remove_group(prior,grpp);
@@ -243,6 +273,8 @@ int rb_sprite_group_clear(struct rb_sprite_group *group) {
   if (!group) return -1;
   if (group->c<1) return 0;
   if (rb_sprite_group_ref(group)<0) return -1;
+  rb_sprite_index_clear(group->index);
+  rb_sprite_group_pos_invalidate(group);
   while (group->c>0) {
     group->c--;
     struct rb_sprite *sprite=group->v[group->c];
@@ -283,9 +315,11 @@ int rb_sprite_group_kill(struct rb_sprite_group *group) {
   if (!group) return -1;
   if (group->c<1) return 0;
   if (rb_sprite_group_ref(group)<0) return -1;
+  rb_sprite_index_clear(group->index);
   while (group->c>0) {
     group->c--;
     struct rb_sprite *sprite=group->v[group->c];
+    rb_sprite_group_pos_unset(group,sprite);
     rb_sprite_kill(sprite); // owing to the (group->c--) above, our reference stays alive
     rb_sprite_del(sprite);
   }
@@ -352,49 +386,11 @@ void rb_sprite_group_filter(
     if (!filter(sprite,userdata)) {
       group->c--;
       memmove(group->v+i,group->v+i+1,sizeof(void*)*(group->c-i));
+      rb_sprite_group_pos_invalidate(group);
+      rb_sprite_index_remove(group->index,sprite);
       int grpp=_rb_sprite_find_group(sprite,group);
       if (grpp>=0) _rb_sprite_remove_group(sprite,grpp);
       rb_sprite_del(sprite);
     }
   }
 }
-
-/* Sort.
- */
- 
-static int rb_sprite_cmp_render(const struct rb_sprite *a,const struct rb_sprite *b) {
-  if (a->layer<b->layer) return -1;
-  if (a->layer>b->layer) return 1;
-  if (a->y<b->y) return -1;
-  if (a->y>b->y) return 1;
-  return 0;
-}
- 
-void rb_sprite_group_sort(struct rb_sprite_group *group) {
-  if (group->order!=RB_SPRITE_GROUP_ORDER_RENDER) return;
-  if (group->c<2) return;
-  int first,last,i;
-  if (group->sortd==1) {
-    first=0;
-    last=group->c-1;
-  } else {
-    first=group->c-1;
-    last=0;
-  }
-  for (i=first;i!=last;i+=group->sortd) {
-    struct rb_sprite *a=group->v[i];
-    struct rb_sprite *b=group->v[i+group->sortd];
-    if (rb_sprite_cmp_render(a,b)==group->sortd) {
-      group->v[i]=b;
-      group->v[i+group->sortd]=a;
-    }
-  }
-  if (group->sortd==1) group->sortd=-1;
-  else group->sortd=1;
-}
-
-void rb_sprite_group_sort_fully(struct rb_sprite_group *group) {
-  if (group->order!=RB_SPRITE_GROUP_ORDER_RENDER) return;
-  if (group->c<2) return;
-  qsort(group->v,group->c,sizeof(void*),(int(*)(const void*,const void*))rb_sprite_cmp_render);
-}
@@ -0,0 +1,337 @@
+#include "rb_sprite_internal.h"
+
+#define RB_SPRITE_INDEX_BUCKETS_MIN 64
+
+/* Cells and buckets.
+ */
+ 
+static inline int rb_sprite_index_bucketp(const struct rb_sprite_index *index,int col,int row) {
+  uint32_t h=(uint32_t)col*0x9e3779b1u+(uint32_t)row*0x85ebca77u;
+  h^=h>>15;
+  return h&(index->bucketc-1);
+}
+
+static int rb_sprite_index_bucket_append(
+  struct rb_sprite_index_bucket *bucket,
+  struct rb_sprite *sprite,int col,int row
+) {
+  if (bucket->c>=bucket->a) {
+    int na=bucket->a?(bucket->a<<1):4;
+    if (na>INT_MAX/sizeof(struct rb_sprite_index_entry)) return -1;
+    void *nv=realloc(bucket->v,sizeof(struct rb_sprite_index_entry)*na);
+    if (!nv) return -1;
+    bucket->v=nv;
+    bucket->a=na;
+  }
+  struct rb_sprite_index_entry *entry=bucket->v+bucket->c++;
+  entry->sprite=sprite;
+  entry->col=col;
+  entry->row=row;
+  return 0;
+}
+
+/* New.
+ */
+ 
+struct rb_sprite_index *rb_sprite_index_new(int cellshift) {
+  if ((cellshift<1)||(cellshift>16)) return 0;
+  struct rb_sprite_index *index=calloc(1,sizeof(struct rb_sprite_index));
+  if (!index) return 0;
+  index->cellshift=cellshift;
+  index->bucketc=RB_SPRITE_INDEX_BUCKETS_MIN;
+  if (!(index->bucketv=calloc(index->bucketc,sizeof(struct rb_sprite_index_bucket)))) {
+    free(index);
+    return 0;
+  }
+  return index;
+}
+
+/* Delete.
+ */
+ 
+void rb_sprite_index_del(struct rb_sprite_index *index) {
+  if (!index) return;
+  if (index->bucketv) {
+    struct rb_sprite_index_bucket *bucket=index->bucketv;
+    int i=index->bucketc;
+    for (;i-->0;bucket++) {
+      if (bucket->v) free(bucket->v);
+    }
+    free(index->bucketv);
+  }
+  free(index);
+}
+
+/* Clear.
+ */
+ 
+void rb_sprite_index_clear(struct rb_sprite_index *index) {
+  if (!index) return;
+  struct rb_sprite_index_bucket *bucket=index->bucketv;
+  int i=index->bucketc;
+  for (;i-->0;bucket++) bucket->c=0;
+  index->c=0;
+  index->renderc=0;
+}
+
+/* Double the bucket count, when it's getting crowded.
+ * Failure is fine, we just stay crowded.
+ */
+ 
+static void rb_sprite_index_grow(struct rb_sprite_index *index) {
+  int nc=index->bucketc<<1;
+  if (nc>INT_MAX/sizeof(struct rb_sprite_index_bucket)) return;
+  struct rb_sprite_index_bucket *nv=calloc(nc,sizeof(struct rb_sprite_index_bucket));
+  if (!nv) return;
+  struct rb_sprite_index_bucket *ov=index->bucketv;
+  int oc=index->bucketc;
+  index->bucketv=nv;
+  index->bucketc=nc;
+  int i=0;
+  for (;i<oc;i++) {
+    const struct rb_sprite_index_entry *entry=ov[i].v;
+    int j=ov[i].c;
+    for (;j-->0;entry++) {
+      struct rb_sprite_index_bucket *bucket=nv+rb_sprite_index_bucketp(index,entry->col,entry->row);
+      if (rb_sprite_index_bucket_append(bucket,entry->sprite,entry->col,entry->row)<0) {
+        // Put everything back how it was.
+        for (i=0;i<nc;i++) if (nv[i].v) free(nv[i].v);
+        free(nv);
+        index->bucketv=ov;
+        index->bucketc=oc;
+        return;
+      }
+    }
+  }
+  for (i=0;i<oc;i++) if (ov[i].v) free(ov[i].v);
+  free(ov);
+}
+
+/* Add.
+ */
+ 
+int rb_sprite_index_add(struct rb_sprite_index *index,struct rb_sprite *sprite) {
+  if (!index||!sprite) return -1;
+  if (index->c>=index->bucketc<<1) rb_sprite_index_grow(index);
+  int col=sprite->x>>index->cellshift;
+  int row=sprite->y>>index->cellshift;
+  struct rb_sprite_index_bucket *bucket=index->bucketv+rb_sprite_index_bucketp(index,col,row);
+  if (rb_sprite_index_bucket_append(bucket,sprite,col,row)<0) return -1;
+  index->c++;
+  if (sprite->type->render) index->renderc++;
+  return 0;
+}
+
+/* Remove.
+ */
+ 
+static int rb_sprite_index_remove_from_bucket(
+  struct rb_sprite_index *index,
+  struct rb_sprite_index_bucket *bucket,
+  struct rb_sprite *sprite
+) {
+  int i=bucket->c;
+  while (i-->0) {
+    if (bucket->v[i].sprite!=sprite) continue;
+    bucket->c--;
+    if (i<bucket->c) bucket->v[i]=bucket->v[bucket->c];
+    index->c--;
+    if (sprite->type->render) index->renderc--;
+    return 1;
+  }
+  return 0;
+}
+ 
+void rb_sprite_index_remove(struct rb_sprite_index *index,struct rb_sprite *sprite) {
+  if (!index||!sprite) return;
+  
+  // Usually it hasn't moved since the last update. If it did, we have to look everywhere.
+  int col=sprite->x>>index->cellshift;
+  int row=sprite->y>>index->cellshift;
+  int bucketp=rb_sprite_index_bucketp(index,col,row);
+  if (rb_sprite_index_remove_from_bucket(index,index->bucketv+bucketp,sprite)) return;
+  int i=0;
+  for (;i<index->bucketc;i++) {
+    if (i==bucketp) continue;
+    if (rb_sprite_index_remove_from_bucket(index,index->bucketv+i,sprite)) return;
+  }
+}
+
+/* Enable or disable for a group.
+ */
+ 
+int rb_sprite_group_set_index(struct rb_sprite_group *group,int cellshift) {
+  if (!group) return -1;
+  if (!cellshift) {
+    rb_sprite_index_del(group->index);
+    group->index=0;
+    return 0;
+  }
+  struct rb_sprite_index *index=rb_sprite_index_new(cellshift);
+  if (!index) return -1;
+  int i=0;
+  for (;i<group->c;i++) {
+    if (rb_sprite_index_add(index,group->v[i])<0) {
+      rb_sprite_index_del(index);
+      return -1;
+    }
+  }
+  rb_sprite_index_del(group->index);
+  group->index=index;
+  return 0;
+}
+
+/* Update.
+ */
+ 
+void rb_sprite_group_index_update(struct rb_sprite_group *group) {
+  if (!group) return;
+  struct rb_sprite_index *index=group->index;
+  if (!index) return;
+  if (index->tracked) return;
+  int bucketp=0;
+  for (;bucketp<index->bucketc;bucketp++) {
+    struct rb_sprite_index_bucket *bucket=index->bucketv+bucketp;
+    int i=0;
+    while (i<bucket->c) {
+      struct rb_sprite_index_entry *entry=bucket->v+i;
+      int col=entry->sprite->x>>index->cellshift;
+      int row=entry->sprite->y>>index->cellshift;
+      if ((col==entry->col)&&(row==entry->row)) { i++; continue; }
+      int nbucketp=rb_sprite_index_bucketp(index,col,row);
+      if (nbucketp==bucketp) {
+        entry->col=col;
+        entry->row=row;
+        i++;
+        continue;
+      }
+      // Moving to a later bucket means we'll visit it again, but then it will be current. That's fine.
+      if (rb_sprite_index_bucket_append(index->bucketv+nbucketp,entry->sprite,col,row)<0) { i++; continue; }
+      bucket->c--;
+      if (i<bucket->c) bucket->v[i]=bucket->v[bucket->c];
+    }
+  }
+}
+
+/* Move one sprite.
+ */
+ 
+static void rb_sprite_index_move(struct rb_sprite_index *index,struct rb_sprite *sprite,int x,int y) {
+  int col=x>>index->cellshift;
+  int row=y>>index->cellshift;
+  int bucketp=rb_sprite_index_bucketp(index,sprite->x>>index->cellshift,sprite->y>>index->cellshift);
+  struct rb_sprite_index_bucket *bucket=index->bucketv+bucketp;
+  struct rb_sprite_index_entry *entry=0;
+  int i=bucket->c;
+  while (i-->0) {
+    if (bucket->v[i].sprite==sprite) {
+      entry=bucket->v+i;
+      break;
+    }
+  }
+  if (!entry) { // Moved by assignment since the last update. Look everywhere.
+    for (bucketp=0,bucket=index->bucketv;bucketp<index->bucketc;bucketp++,bucket++) {
+      for (i=bucket->c;i-->0;) {
+        if (bucket->v[i].sprite==sprite) {
+          entry=bucket->v+i;
+          break;
+        }
+      }
+      if (entry) break;
+    }
+    if (!entry) return;
+  }
+  if ((entry->col==col)&&(entry->row==row)) return;
+  int nbucketp=rb_sprite_index_bucketp(index,col,row);
+  if (nbucketp!=bucketp) {
+    if (rb_sprite_index_bucket_append(index->bucketv+nbucketp,sprite,col,row)<0) return;
+    bucket->c--;
+    if (i<bucket->c) bucket->v[i]=bucket->v[bucket->c];
+  } else {
+    entry->col=col;
+    entry->row=row;
+  }
+}
+ 
+void rb_sprite_move(struct rb_sprite *sprite,int x,int y) {
+  if (!sprite) return;
+  int i=sprite->grpc;
+  while (i-->0) {
+    struct rb_sprite_index *index=sprite->grpv[i]->index;
+    if (index) rb_sprite_index_move(index,sprite,x,y);
+  }
+  sprite->x=x;
+  sprite->y=y;
+}
+
+/* Query.
+ */
+ 
+static inline int rb_sprite_index_entry_in_rect(
+  const struct rb_sprite_index_entry *entry,
+  int x,int y,int w,int h
+) {
+  const struct rb_sprite *sprite=entry->sprite;
+  if (sprite->x<x) return 0;
+  if (sprite->y<y) return 0;
+  if (sprite->x-w>=x) return 0;
+  if (sprite->y-h>=y) return 0;
+  return 1;
+}
+ 
+int rb_sprite_group_query(
+  const struct rb_sprite_group *group,
+  int x,int y,int w,int h,
+  int (*cb)(struct rb_sprite *sprite,void *userdata),
+  void *userdata
+) {
+  if (!group||!cb) return -1;
+  if ((w<1)||(h<1)) return 0;
+  int err,i;
+  
+  const struct rb_sprite_index *index=group->index;
+  if (!index) {
+    for (i=0;i<group->c;i++) {
+      struct rb_sprite *sprite=group->v[i];
+      if ((sprite->x<x)||(sprite->y<y)||(sprite->x-w>=x)||(sprite->y-h>=y)) continue;
+      if ((err=cb(sprite,userdata))) return err;
+    }
+    return 0;
+  }
+  
+  int cola=x>>index->cellshift;
+  int rowa=y>>index->cellshift;
+  int colz=(int)(((int64_t)x+w-1)>>index->cellshift);
+  int rowz=(int)(((int64_t)y+h-1)>>index->cellshift);
+  int64_t cellc=(int64_t)(colz-cola+1)*(rowz-rowa+1);
+  
+  // More cells than buckets, it's cheaper to just visit everything.
+  if (cellc>=index->bucketc) {
+    const struct rb_sprite_index_bucket *bucket=index->bucketv;
+    int bi=index->bucketc;
+    for (;bi-->0;bucket++) {
+      const struct rb_sprite_index_entry *entry=bucket->v;
+      for (i=bucket->c;i-->0;entry++) {
+        if (!rb_sprite_index_entry_in_rect(entry,x,y,w,h)) continue;
+        if ((err=cb(entry->sprite,userdata))) return err;
+      }
+    }
+    return 0;
+  }
+  
+  // Cells can share a bucket, so check the cell too, or we'd report some twice.
+  int row=rowa;
+  for (;row<=rowz;row++) {
+    int col=cola;
+    for (;col<=colz;col++) {
+      const struct rb_sprite_index_bucket *bucket=index->bucketv+rb_sprite_index_bucketp(index,col,row);
+      const struct rb_sprite_index_entry *entry=bucket->v;
+      for (i=bucket->c;i-->0;entry++) {
+        if ((entry->col!=col)||(entry->row!=row)) continue;
+        if (!rb_sprite_index_entry_in_rect(entry,x,y,w,h)) continue;
+        if ((err=cb(entry->sprite,userdata))) return err;
+      }
+    }
+  }
+  return 0;
+}
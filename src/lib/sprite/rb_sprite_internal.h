@@ -0,0 +1,45 @@
+#ifndef RB_SPRITE_INTERNAL_H
+#define RB_SPRITE_INTERNAL_H
+
+#include "rabbit/rb_internal.h"
+#include "rabbit/rb_sprite.h"
+
+/* Spatial index maintenance, for rb_sprite_group.
+ * The index holds no references; the group's own list does.
+ */
+struct rb_sprite_index *rb_sprite_index_new(int cellshift);
+void rb_sprite_index_del(struct rb_sprite_index *index);
+int rb_sprite_index_add(struct rb_sprite_index *index,struct rb_sprite *sprite);
+void rb_sprite_index_remove(struct rb_sprite_index *index,struct rb_sprite *sprite);
+void rb_sprite_index_clear(struct rb_sprite_index *index);
+
+/* Render order as one 64-bit key: (layer) then (y). Ties still break on address.
+ */
+struct rb_sprite_sortkey {
+  uint64_t k;
+  struct rb_sprite *sprite;
+};
+
+static inline uint64_t rb_sprite_sortkey_k(const struct rb_sprite *sprite) {
+  return ((uint64_t)((uint32_t)sprite->layer^0x80000000u)<<32)|((uint32_t)sprite->y^0x80000000u);
+}
+
+/* Position map, for SORT_FULL groups.
+ * rb_sprite_group_pos_get() returns the sprite's index in (group->v), -1 if absent, or -2 if we couldn't build the map.
+ * The others quietly do nothing if the map isn't built.
+ * Anything that shifts (group->v) wholesale must invalidate it.
+ */
+struct rb_sprite_group_pos {
+  struct rb_sprite *sprite;
+  int p;
+};
+
+int rb_sprite_group_pos_get(struct rb_sprite_group *group,const struct rb_sprite *sprite);
+void rb_sprite_group_pos_set(struct rb_sprite_group *group,struct rb_sprite *sprite,int p);
+void rb_sprite_group_pos_unset(struct rb_sprite_group *group,const struct rb_sprite *sprite);
+
+static inline void rb_sprite_group_pos_invalidate(struct rb_sprite_group *group) {
+  group->posvalid=0;
+}
+
+#endif
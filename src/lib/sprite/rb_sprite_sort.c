@@ -0,0 +1,346 @@
+#include "rb_sprite_internal.h"
+
+/* Compare.
+ */
+ 
+int rb_sprite_cmp_render(const struct rb_sprite *a,const struct rb_sprite *b) {
+  if (a->layer<b->layer) return -1;
+  if (a->layer>b->layer) return 1;
+  if (a->y<b->y) return -1;
+  if (a->y>b->y) return 1;
+  if (a<b) return -1;
+  if (a>b) return 1;
+  return 0;
+}
+
+static int rb_sprite_cmp_render_qsort(const void *a,const void *b) {
+  return rb_sprite_cmp_render(*(struct rb_sprite*const*)a,*(struct rb_sprite*const*)b);
+}
+
+static int rb_sprite_sortkey_qsort(const void *a,const void *b) {
+  const struct rb_sprite_sortkey *A=a,*B=b;
+  if (A->k<B->k) return -1;
+  if (A->k>B->k) return 1;
+  if (A->sprite<B->sprite) return -1;
+  if (A->sprite>B->sprite) return 1;
+  return 0;
+}
+
+static inline int rb_sprite_sortkey_le(const struct rb_sprite_sortkey *a,const struct rb_sprite_sortkey *b) {
+  if (a->k<b->k) return 1;
+  if (a->k>b->k) return 0;
+  return (a->sprite<=b->sprite)?1:0;
+}
+
+/* One bubble pass.
+ */
+ 
+void rb_sprite_group_sort(struct rb_sprite_group *group) {
+  if (group->order!=RB_SPRITE_GROUP_ORDER_RENDER) return;
+  if (group->sortmode==RB_SPRITE_SORT_FULL) {
+    rb_sprite_group_sort_fully(group);
+    return;
+  }
+  if (group->c<2) return;
+  rb_sprite_group_pos_invalidate(group);
+  int first,last,i;
+  if (group->sortd==1) {
+    first=0;
+    last=group->c-1;
+  } else {
+    first=group->c-1;
+    last=0;
+  }
+  for (i=first;i!=last;i+=group->sortd) {
+    struct rb_sprite *a=group->v[i];
+    struct rb_sprite *b=group->v[i+group->sortd];
+    if (rb_sprite_cmp_render(a,b)==group->sortd) {
+      group->v[i]=b;
+      group->v[i+group->sortd]=a;
+    }
+  }
+  if (group->sortd==1) group->sortd=-1;
+  else group->sortd=1;
+}
+
+/* Insertion sort, for when things have only moved a little.
+ * Anything that would have to move more than a few places goes to (aside) instead.
+ * Returns the count sorted in place at the front of (v). (v) and (aside) together still contain everything.
+ * If it's taking too long, we stop and return <0, with everything back in (v) unsorted.
+ */
+ 
+#define RB_SPRITE_SETTLE_LIMIT 16
+ 
+static int rb_sprite_sortkey_settle(
+  struct rb_sprite_sortkey *v,int c,
+  struct rb_sprite_sortkey *aside,int *asidec
+) {
+  int w=0,i=0,budget=c<<2;
+  for (;i<c;i++) {
+    if (budget<0) {
+      memmove(v+w,v+i,sizeof(struct rb_sprite_sortkey)*(c-i));
+      memcpy(v+w+c-i,aside,sizeof(struct rb_sprite_sortkey)*(*asidec));
+      *asidec=0;
+      return -1;
+    }
+    struct rb_sprite_sortkey tmp=v[i];
+    if (!w||rb_sprite_sortkey_le(v+w-1,&tmp)) {
+      // In order so far, but if it's above the next two, and they aren't, it jumped forward and everything after would have to get past it.
+      if (
+        (i<c-2)&&
+        !rb_sprite_sortkey_le(&tmp,v+i+1)&&!rb_sprite_sortkey_le(&tmp,v+i+2)&&
+        (!w||rb_sprite_sortkey_le(v+w-1,v+i+1))
+      ) {
+        aside[(*asidec)++]=tmp;
+        continue;
+      }
+      v[w++]=tmp;
+      continue;
+    }
+    int j=w-1,lo=w-RB_SPRITE_SETTLE_LIMIT;
+    if (lo<0) lo=0;
+    while ((j>lo)&&!rb_sprite_sortkey_le(v+j-1,&tmp)) j--;
+    if ((j>0)&&!rb_sprite_sortkey_le(v+j-1,&tmp)) {
+      // Either (tmp) jumped backward, or the end of (v) jumped forward, eg filling a hole from rb_sprite_group_remove().
+      // If the next one is stuck too, and not much is in the way, it's probably the latter: Those go aside instead.
+      if ((i<c-1)&&!rb_sprite_sortkey_le(v+w-1,v+i+1)) {
+        const struct rb_sprite_sortkey *lim=rb_sprite_sortkey_le(&tmp,v+i+1)?&tmp:(v+i+1);
+        int lo=0,hi=w;
+        while (lo<hi) {
+          int ck=(lo+hi)>>1;
+          if (rb_sprite_sortkey_le(v+ck,lim)) lo=ck+1;
+          else hi=ck;
+        }
+        if (w-lo<=RB_SPRITE_SETTLE_LIMIT*4) {
+          while (w>lo) aside[(*asidec)++]=v[--w];
+          v[w++]=tmp;
+          continue;
+        }
+      }
+      aside[(*asidec)++]=tmp;
+      continue;
+    }
+    int k=w;
+    for (;k>j;k--) v[k]=v[k-1];
+    v[j]=tmp;
+    w++;
+    budget-=w-j;
+  }
+  return w;
+}
+
+/* Sort (aside) and merge it into the sorted (v), which has room for all (c).
+ * Back to front, so it can happen in place.
+ */
+ 
+static void rb_sprite_sortkey_merge_aside(
+  struct rb_sprite_sortkey *v,int w,int c,
+  struct rb_sprite_sortkey *aside,int asidec
+) {
+  if (asidec>1) qsort(aside,asidec,sizeof(struct rb_sprite_sortkey),rb_sprite_sortkey_qsort);
+  int i=w-1,j=asidec-1,k=c-1;
+  while (j>=0) {
+    if ((i>=0)&&!rb_sprite_sortkey_le(v+i,aside+j)) v[k--]=v[i--];
+    else v[k--]=aside[j--];
+  }
+}
+
+/* LSD radix sort on (layer,y), for when insertion sort gives up.
+ * We sort on a compact key, (layer-layermin)*yspan+(y-ymin), 11 bits at a time.
+ * For a few layers and a world a few thousand pixels tall, that's two passes.
+ * Ties come out in their input order, caller must fix them.
+ * Returns whichever of (src,dst) has the result.
+ */
+ 
+#define RB_SPRITE_RADIX_BITS 11
+#define RB_SPRITE_RADIX_SIZE (1<<RB_SPRITE_RADIX_BITS)
+ 
+static struct rb_sprite_sortkey *rb_sprite_sortkey_radix(
+  struct rb_sprite_sortkey *src,
+  struct rb_sprite_sortkey *dst,
+  int c
+) {
+  uint32_t layerlo=src[0].k>>32,layerhi=layerlo;
+  uint32_t ylo=(uint32_t)src[0].k,yhi=ylo;
+  int i=1;
+  for (;i<c;i++) {
+    uint32_t layer=src[i].k>>32,y=(uint32_t)src[i].k;
+    if (layer<layerlo) layerlo=layer; else if (layer>layerhi) layerhi=layer;
+    if (y<ylo) ylo=y; else if (y>yhi) yhi=y;
+  }
+  uint64_t yspan=(uint64_t)yhi-ylo+1;
+  uint64_t range=((uint64_t)layerhi-layerlo+1)*yspan;
+  if ((layerhi-layerlo>=0x10000)||(range>0xffffffffull)) { // Don't bother, just be slow.
+    qsort(src,c,sizeof(struct rb_sprite_sortkey),rb_sprite_sortkey_qsort);
+    return src;
+  }
+  
+  int shift=0;
+  for (;(shift<32)&&(((range-1)>>shift)||!shift);shift+=RB_SPRITE_RADIX_BITS) {
+    int countv[RB_SPRITE_RADIX_SIZE]={0};
+    #define DIGIT(key) (int)((((uint32_t)(((key).k>>32)-layerlo)*(uint32_t)yspan+((uint32_t)(key).k-ylo))>>shift)&(RB_SPRITE_RADIX_SIZE-1))
+    for (i=0;i<c;i++) countv[DIGIT(src[i])]++;
+    int p=0,b=0;
+    for (;b<RB_SPRITE_RADIX_SIZE;b++) {
+      int n=countv[b];
+      countv[b]=p;
+      p+=n;
+    }
+    for (i=0;i<c;i++) dst[countv[DIGIT(src[i])]++]=src[i];
+    #undef DIGIT
+    struct rb_sprite_sortkey *tmp=src;
+    src=dst;
+    dst=tmp;
+  }
+  return src;
+}
+
+/* Sort (group->v) exactly, near-linear in practice.
+ * Frame to frame, most sprites stay put relative to their neighbours, and insertion sort handles that in about one pass.
+ * The few that jumped, or were added at the end, get sorted on their own and merged back in.
+ * If that's more than a few, or a crowd is shuffling a lot, radix sort everything instead.
+ * We sort keys rather than sprites, so the comparisons don't go chasing pointers.
+ */
+ 
+static int rb_sprite_group_sort_keys(struct rb_sprite_group *group) {
+  int c=group->c;
+  if (c>group->sorta) {
+    int na=(c+256)&~255;
+    if (na>INT_MAX/(2*sizeof(struct rb_sprite_sortkey))) return -1;
+    void *nv=realloc(group->sortv,sizeof(struct rb_sprite_sortkey)*2*na);
+    if (!nv) return -1;
+    group->sortv=nv;
+    group->sorta=na;
+  }
+  struct rb_sprite_sortkey *v=group->sortv;
+  
+  int sorted=1,i=0;
+  for (;i<c;i++) {
+    v[i].sprite=group->v[i];
+    v[i].k=rb_sprite_sortkey_k(group->v[i]);
+    if (i&&sorted&&!rb_sprite_sortkey_le(v+i-1,v+i)) sorted=0;
+  }
+  if (sorted) return 0;
+  
+  struct rb_sprite_sortkey *aside=v+group->sorta;
+  int asidec=0;
+  int w=rb_sprite_sortkey_settle(v,c,aside,&asidec);
+  if ((w<0)||(asidec>(c>>3))) {
+    // Too much moved too far. Radix sort everything, then settle again just to put ties in address order.
+    if (w>=0) memcpy(v+w,aside,sizeof(struct rb_sprite_sortkey)*asidec);
+    v=rb_sprite_sortkey_radix(v,aside,c);
+    aside=(v==group->sortv)?(v+group->sorta):group->sortv;
+    asidec=0;
+    if ((w=rb_sprite_sortkey_settle(v,c,aside,&asidec))<0) { // Lots of ties. Unusual, but possible.
+      qsort(v,c,sizeof(struct rb_sprite_sortkey),rb_sprite_sortkey_qsort);
+      w=c;
+    }
+  }
+  rb_sprite_sortkey_merge_aside(v,w,c,aside,asidec);
+  
+  for (i=0;i<c;i++) group->v[i]=v[i].sprite;
+  rb_sprite_group_pos_invalidate(group);
+  return 0;
+}
+
+/* Sort fully.
+ */
+
+void rb_sprite_group_sort_fully(struct rb_sprite_group *group) {
+  if (group->order!=RB_SPRITE_GROUP_ORDER_RENDER) return;
+  if (group->c<2) return;
+  if (rb_sprite_group_sort_keys(group)<0) {
+    qsort(group->v,group->c,sizeof(void*),rb_sprite_cmp_render_qsort);
+    rb_sprite_group_pos_invalidate(group);
+  }
+}
+
+/* Position map.
+ * Open addressing with linear probing, at most half full.
+ */
+ 
+static inline int rb_sprite_group_pos_slot(const struct rb_sprite_group *group,const struct rb_sprite *sprite) {
+  uint64_t h=(uintptr_t)sprite;
+  h*=0x9e3779b97f4a7c15ull;
+  return (int)(h>>32)&(group->posa-1);
+}
+
+static int rb_sprite_group_pos_build(struct rb_sprite_group *group) {
+  int na=64;
+  while (na<group->c<<1) {
+    if (na>INT_MAX>>1) return -1;
+    na<<=1;
+  }
+  if (na>group->posa) {
+    if (na>INT_MAX/sizeof(struct rb_sprite_group_pos)) return -1;
+    void *nv=realloc(group->posv,sizeof(struct rb_sprite_group_pos)*na);
+    if (!nv) return -1;
+    group->posv=nv;
+    group->posa=na;
+  }
+  memset(group->posv,0,sizeof(struct rb_sprite_group_pos)*group->posa);
+  int i=0;
+  for (;i<group->c;i++) {
+    int slot=rb_sprite_group_pos_slot(group,group->v[i]);
+    while (group->posv[slot].sprite) slot=(slot+1)&(group->posa-1);
+    group->posv[slot].sprite=group->v[i];
+    group->posv[slot].p=i;
+  }
+  group->posc=group->c;
+  group->posvalid=1;
+  return 0;
+}
+
+int rb_sprite_group_pos_get(struct rb_sprite_group *group,const struct rb_sprite *sprite) {
+  if (!group->posvalid&&(rb_sprite_group_pos_build(group)<0)) return -2;
+  int slot=rb_sprite_group_pos_slot(group,sprite);
+  while (group->posv[slot].sprite) {
+    if (group->posv[slot].sprite==sprite) return group->posv[slot].p;
+    slot=(slot+1)&(group->posa-1);
+  }
+  return -1;
+}
+
+void rb_sprite_group_pos_set(struct rb_sprite_group *group,struct rb_sprite *sprite,int p) {
+  if (!group->posvalid) return;
+  int slot=rb_sprite_group_pos_slot(group,sprite);
+  while (group->posv[slot].sprite) {
+    if (group->posv[slot].sprite==sprite) {
+      group->posv[slot].p=p;
+      return;
+    }
+    slot=(slot+1)&(group->posa-1);
+  }
+  if (group->posc+1>group->posa>>1) { // Getting crowded, rebuild bigger next time we need it.
+    group->posvalid=0;
+    return;
+  }
+  group->posv[slot].sprite=sprite;
+  group->posv[slot].p=p;
+  group->posc++;
+}
+
+void rb_sprite_group_pos_unset(struct rb_sprite_group *group,const struct rb_sprite *sprite) {
+  if (!group->posvalid) return;
+  int mask=group->posa-1;
+  int slot=rb_sprite_group_pos_slot(group,sprite);
+  while (group->posv[slot].sprite!=sprite) {
+    if (!group->posv[slot].sprite) return;
+    slot=(slot+1)&mask;
+  }
+  group->posc--;
+  
+  // Shift back anything in the same cluster that would no longer be reachable past the hole.
+  int hole=slot;
+  for (;;) {
+    slot=(slot+1)&mask;
+    struct rb_sprite *q=group->posv[slot].sprite;
+    if (!q) break;
+    int home=rb_sprite_group_pos_slot(group,q);
+    if (((slot-home)&mask)>=((slot-hole)&mask)) {
+      group->posv[hole]=group->posv[slot];
+      hole=slot;
+    }
+  }
+  group->posv[hole].sprite=0;
+}
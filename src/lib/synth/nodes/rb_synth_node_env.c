@@ -80,56 +80,86 @@ static int _rb_env_config_ready(struct rb_synth_node_config *config) {
   return 0;
 }
 
+/* Advance to the next leg.
+ * Returns zero if the envelope is finished.
+ */
+ 
+static int rb_env_next_leg(struct rb_synth_node_runner *runner) {
+  RUNNER->pointp++;
+  if (RUNNER->pointp>=RCONFIG->pointc) {
+    RUNNER->pointp=RCONFIG->pointc;
+    RUNNER->point=0;
+    return 0;
+  }
+  RUNNER->level=RUNNER->point->level;
+  RUNNER->point++;
+  RUNNER->time=RUNNER->point->time;
+  if (RUNNER->point->levelm>1.0f) RUNNER->levelf=RUNNER->point->levelm;
+  else RUNNER->levelf=RUNNER->point->levelk;
+  RUNNER->legbase=RUNNER->level;
+  return 1;
+}
+
 /* Update.
+ * We run a whole leg (or what's left of the buffer) per pass, with the leg's state in locals.
+ * Levels are still accumulated one sample at a time, in exactly the order they always were.
+ * Flat legs don't accumulate anything, so those are a plain scalar operation.
  */
  
-#define RB_ENV_UPDATE_COMMON(apply) \
+#define RB_ENV_UPDATE_COMMON(apply,applyflat) \
   rb_sample_t *v=RUNNER->mainv; \
-  for (;c-->0;v++) { \
+  while (c>0) { \
    \
     if (RUNNER->time<=0) { \
-      RUNNER->pointp++; \
-      if (RUNNER->pointp>=RCONFIG->pointc) { \
-        RUNNER->pointp=RCONFIG->pointc; \
-        RUNNER->point=0; \
+      if (!rb_env_next_leg(runner)) { \
         if ((RCONFIG->mode==0)||(RCONFIG->mode==1)) { \
           /* mlt or set, zero the remainder. add, do nothing */ \
-          memset(v,0,sizeof(rb_sample_t)*(c+1)); \
+          memset(v,0,sizeof(rb_sample_t)*c); \
         } \
         return; \
       } \
-      RUNNER->level=RUNNER->point->level; \
-      RUNNER->point++; \
-      RUNNER->time=RUNNER->point->time; \
-      if (RUNNER->point->levelm>1.0f) RUNNER->levelf=RUNNER->point->levelm; \
-      else RUNNER->levelf=RUNNER->point->levelk; \
-      RUNNER->legbase=RUNNER->level; \
     } \
     \
-    apply; \
+    const struct rb_env_point *point=RUNNER->point; \
+    int n=RUNNER->time; \
+    if (n>c) n=c; \
+    RUNNER->time-=n; \
+    c-=n; \
+    rb_sample_t level=RUNNER->level; \
     \
-    RUNNER->time--; \
-    if (RUNNER->point->iscurve>0) { \
-      RUNNER->levelf*=RUNNER->point->levelm; \
-      RUNNER->level=RUNNER->point->level+(RUNNER->levelf-RUNNER->point->levelm)*RUNNER->point->dlevel; \
-    } else if (RUNNER->point->iscurve<0) { \
-      RUNNER->levelf*=RUNNER->point->levelm; \
-      RUNNER->level=(RUNNER->levelf-RUNNER->point->levelm)*RUNNER->point->dlevel+RUNNER->legbase; \
+    if (point->iscurve) { \
+      rb_sample_t levelf=RUNNER->levelf; \
+      const rb_sample_t m=point->levelm,d=point->dlevel; \
+      const rb_sample_t base=(point->iscurve>0)?point->level:RUNNER->legbase; \
+      for (;n-->0;v++) { \
+        apply; \
+        levelf*=m; \
+        level=base+(levelf-m)*d; \
+      } \
+      RUNNER->levelf=levelf; \
+    } else if (point->dlevel==0.0f) { \
+      applyflat(v,n,level); \
+      v+=n; \
     } else { \
-      RUNNER->level+=RUNNER->point->dlevel; \
+      const rb_sample_t d=point->dlevel; \
+      for (;n-->0;v++) { \
+        apply; \
+        level+=d; \
+      } \
     } \
+    RUNNER->level=level; \
   }
  
 static void _rb_env_update_mlt(struct rb_synth_node_runner *runner,int c) {
-  RB_ENV_UPDATE_COMMON((*v)*=RUNNER->level)
+  RB_ENV_UPDATE_COMMON((*v)*=level,rb_signal_mlt_s)
 }
 
 static void _rb_env_update_set(struct rb_synth_node_runner *runner,int c) {
-  RB_ENV_UPDATE_COMMON((*v)=RUNNER->level)
+  RB_ENV_UPDATE_COMMON((*v)=level,rb_signal_set_s)
 }
 
 static void _rb_env_update_add(struct rb_synth_node_runner *runner,int c) {
-  RB_ENV_UPDATE_COMMON((*v)+=RUNNER->level)
+  RB_ENV_UPDATE_COMMON((*v)+=level,rb_signal_add_s)
 }
 
 #undef RB_ENV_UPDATE_COMMON
@@ -1,6 +1,7 @@
 #include "rabbit/rb_internal.h"
 #include "rabbit/rb_synth_node.h"
 #include "rabbit/rb_synth.h"
+#include "rabbit/rb_wave.h"
 #include <math.h>
 
 #define RB_HARM_FLDID_main 0x01
@@ -11,6 +12,12 @@
 #define RB_HARM_COEF_LIMIT 16
 #define RB_HARM_SERIAL_LIMIT (RB_HARM_COEF_LIMIT*2)
 
+/* We print the whole wave into a single-cycle table at ready time.
+ * Size it to give each harmonic the same resolution: Linear interpolation error is about 1e-4 of full scale at worst.
+ */
+#define RB_HARM_TABLE_PER_HARMONIC 256
+#define RB_HARM_TABLE_LIMIT 4096
+
 /* Instance definition.
  */
  
@@ -21,6 +28,8 @@ struct rb_synth_node_config_harm {
   rb_sample_t coefv[RB_HARM_COEF_LIMIT];
   uint8_t serial[RB_HARM_SERIAL_LIMIT];
   int coefc;
+  rb_sample_t *tablev; // (tablec+1), the last repeats the first.
+  int tablec;
 };
 
 struct rb_synth_node_runner_harm {
@@ -28,8 +37,8 @@ struct rb_synth_node_runner_harm {
   rb_sample_t *mainv;
   rb_sample_t *ratev; // hz
   rb_sample_t *phasev; // 0..1
-  rb_sample_t rate; // dp per frame
-  rb_sample_t p; // 0..2pi; position of fundamental, and the others are trivially derived
+  rb_sample_t rate; // hz
+  uint32_t p,dp; // Fixed-point position in the table, and step per frame.
 };
 
 #define CONFIG ((struct rb_synth_node_config_harm*)config)
@@ -46,6 +55,42 @@ static int _rb_harm_config_init(struct rb_synth_node_config *config) {
   return 0;
 }
 
+/* Delete config.
+ */
+ 
+static void _rb_harm_config_del(struct rb_synth_node_config *config) {
+  if (CONFIG->tablev) free(CONFIG->tablev);
+}
+
+/* Print the table.
+ * This is where we pay for each coefficient, just once.
+ */
+ 
+static int _rb_harm_print_table(struct rb_synth_node_config *config) {
+  int tablec=RB_HARM_TABLE_PER_HARMONIC;
+  while ((tablec<CONFIG->coefc*RB_HARM_TABLE_PER_HARMONIC)&&(tablec<RB_HARM_TABLE_LIMIT)) tablec<<=1;
+  rb_sample_t *tablev=calloc(tablec+1,sizeof(rb_sample_t));
+  if (!tablev) return -1;
+  
+  const rb_sample_t *coef=CONFIG->coefv;
+  int n=1;
+  for (;n<=CONFIG->coefc;n++,coef++) {
+    if (*coef<=0.0f) continue;
+    rb_sample_t *dst=tablev;
+    int i=0;
+    for (;i<tablec;i++,dst++) {
+      // Index arithmetic in integers, so each harmonic stays exactly periodic.
+      (*dst)+=sin(((i*n)&(tablec-1))*(M_PI*2.0)/tablec)*(*coef); // SAMPLETYPE
+    }
+  }
+  tablev[tablec]=tablev[0];
+  
+  if (CONFIG->tablev) free(CONFIG->tablev);
+  CONFIG->tablev=tablev;
+  CONFIG->tablec=tablec;
+  return 0;
+}
+
 /* Ready config.
  */
  
@@ -66,6 +111,10 @@ static int _rb_harm_config_ready(struct rb_synth_node_config *config) {
   for (;i-->0;dst++,src++) {
     *dst=(*src)/255.0f;
   }
+  
+  if (CONFIG->coefc) {
+    if (_rb_harm_print_table(config)<0) return -1;
+  }
 
   return 0;
 }
@@ -78,63 +127,17 @@ static void _rb_harm_update_silent(struct rb_synth_node_runner *runner,int c) {
 }
  
 static void _rb_harm_update_phasev(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t scale=M_PI*2.0f;
-  rb_sample_t *dst=RUNNER->mainv;
-  const rb_sample_t *phase=RUNNER->phasev;
-  for (;c-->0;dst++,phase++) {
-    *dst=0.0f;
-    
-    rb_sample_t phase1=(*phase)*scale;
-    rb_sample_t p=phase1;
-    const rb_sample_t *coef=RCONFIG->coefv;
-    int i=RCONFIG->coefc;
-    for (;i-->0;coef++,p+=phase1) {
-      if (*coef>0.0f) {
-        (*dst)+=sinf(p)*(*coef); // SAMPLETYPE
-      }
-    }
-  }
+  rb_wave_table(RUNNER->mainv,RUNNER->phasev,c,RCONFIG->tablev,RCONFIG->tablec);
 }
  
 static void _rb_harm_update_ratev(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t scale=(M_PI*2.0f)/runner->config->synth->rate;
-  rb_sample_t *dst=RUNNER->mainv;
-  const rb_sample_t *rate=RUNNER->ratev;
-  for (;c-->0;dst++,rate++) {
-    *dst=0.0f;
-    
-    rb_sample_t p=RUNNER->p;
-    const rb_sample_t *coef=RCONFIG->coefv;
-    int i=RCONFIG->coefc;
-    for (;i-->0;coef++,p+=RUNNER->p) {
-      if (*coef>0.0f) {
-        (*dst)+=sinf(p)*(*coef); // SAMPLETYPE
-      }
-    }
-    
-    RUNNER->p+=(*rate)*scale;
-    if (RUNNER->p>=M_PI*2.0f) RUNNER->p-=M_PI*2.0f;
-    else if (RUNNER->p<0.0f) RUNNER->p+=M_PI*2.0f;
-  }
+  RUNNER->p=rb_wave_phase_ratev(RUNNER->mainv,RUNNER->ratev,c,RUNNER->p,1.0f/runner->config->synth->rate);
+  rb_wave_table(RUNNER->mainv,RUNNER->mainv,c,RCONFIG->tablev,RCONFIG->tablec);
 }
  
 static void _rb_harm_update_fixed(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t *dst=RUNNER->mainv;
-  for (;c-->0;dst++) {
-    *dst=0.0f;
-    
-    rb_sample_t p=RUNNER->p;
-    const rb_sample_t *coef=RCONFIG->coefv;
-    int i=RCONFIG->coefc;
-    for (;i-->0;coef++,p+=RUNNER->p) {
-      if (*coef>0.0f) {
-        (*dst)+=sinf(p)*(*coef); // SAMPLETYPE
-      }
-    }
-    
-    RUNNER->p+=RUNNER->rate;
-    if (RUNNER->p>=M_PI*2.0f) RUNNER->p-=M_PI*2.0f;
-  }
+  RUNNER->p=rb_wave_phase_const(RUNNER->mainv,c,RUNNER->p,RUNNER->dp);
+  rb_wave_table(RUNNER->mainv,RUNNER->mainv,c,RCONFIG->tablev,RCONFIG->tablec);
 }
 
 /* Init runner.
@@ -146,9 +149,9 @@ static int _rb_harm_runner_init(struct rb_synth_node_runner *runner,uint8_t note
   if (rb_synth_node_config_find_link(runner->config,RB_HARM_FLDID_rate)<0) {
     RUNNER->rate=RCONFIG->rate;
   }
-  RUNNER->rate=(RUNNER->rate*M_PI*2.0f)/runner->config->synth->rate;
+  RUNNER->dp=rb_wave_phase_fixed(RUNNER->rate/runner->config->synth->rate);
   
-  RUNNER->p=RCONFIG->phase*M_PI*2.0f;
+  RUNNER->p=rb_wave_phase_fixed(RCONFIG->phase);
   
   if (!RCONFIG->coefc) runner->update=_rb_harm_update_silent;
   else if (RUNNER->phasev) runner->update=_rb_harm_update_phasev;
@@ -216,6 +219,7 @@ const struct rb_synth_node_type rb_synth_node_type_harm={
   .runner_objlen=sizeof(struct rb_synth_node_runner_harm),
   .fieldv=_rb_harm_fieldv,
   .fieldc=sizeof(_rb_harm_fieldv)/sizeof(struct rb_synth_node_field),
+  .config_del=_rb_harm_config_del,
   .config_init=_rb_harm_config_init,
   .config_ready=_rb_harm_config_ready,
   .runner_init=_rb_harm_runner_init,
@@ -1,6 +1,7 @@
 #include "rabbit/rb_internal.h"
 #include "rabbit/rb_synth_node.h"
 #include "rabbit/rb_synth.h"
+#include "rabbit/rb_wave.h"
 #include <math.h>
 
 #define RB_OSC_FLDID_main 0x01
@@ -30,6 +31,8 @@ struct rb_synth_node_runner_osc {
   rb_sample_t p;
   rb_sample_t dp;
   rb_sample_t k; // for update hook's use, no fixed meaning
+  rb_sample_t base; // ''
+  uint32_t fp,fdp; // Fixed-point (p,dp) for the shapes that use rb_wave.
 };
 
 #define CONFIG ((struct rb_synth_node_config_osc*)config)
@@ -59,170 +62,69 @@ static int _rb_osc_config_ready(struct rb_synth_node_config *config) {
  */
  
 static void _rb_osc_update_sine_phasev(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t level=RCONFIG->level;
-  rb_sample_t *v=RUNNER->mainv;
-  const rb_sample_t *phase=RUNNER->phasev;
-  for (;c-->0;v++,phase++) {
-    *v=sinf((*phase)*M_PI*2.0f)*level; // SAMPLETYPE
-  }
+  rb_wave_sine(RUNNER->mainv,RUNNER->phasev,c,RCONFIG->level);
 }
  
 static void _rb_osc_update_sine_ratev(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t level=RCONFIG->level;
-  rb_sample_t *v=RUNNER->mainv;
-  const rb_sample_t *rate=RUNNER->ratev;
-  for (;c-->0;v++,rate++) {
-    *v=sinf(RUNNER->p)*level; // SAMPLETYPE
-    RUNNER->p+=(*rate)*RUNNER->k;
-    if (RUNNER->p>=M_PI) RUNNER->p-=M_PI*2.0f;
-  }
+  RUNNER->fp=rb_wave_phase_ratev(RUNNER->mainv,RUNNER->ratev,c,RUNNER->fp,RCONFIG->invrate);
+  rb_wave_sine(RUNNER->mainv,RUNNER->mainv,c,RCONFIG->level);
 }
  
 static void _rb_osc_update_sine_const(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t level=RCONFIG->level;
-  rb_sample_t *v=RUNNER->mainv;
-  for (;c-->0;v++) {
-    *v=sinf(RUNNER->p)*level; // SAMPLETYPE
-    RUNNER->p+=RUNNER->dp;
-    if (RUNNER->p>=M_PI) RUNNER->p-=M_PI*2.0f;
-  }
+  RUNNER->fp=rb_wave_phase_const(RUNNER->mainv,c,RUNNER->fp,RUNNER->fdp);
+  rb_wave_sine(RUNNER->mainv,RUNNER->mainv,c,RCONFIG->level);
 }
 
 /* SQUARE
  */
  
 static void _rb_osc_update_square_phasev(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t level=RCONFIG->level;
-  rb_sample_t *v=RUNNER->mainv;
-  const rb_sample_t *phase=RUNNER->phasev;
-  for (;c-->0;v++,phase++) {
-    if (*phase>=0.5f) *v=-level;
-    else *v=level;
-  }
+  rb_wave_square(RUNNER->mainv,RUNNER->phasev,c,RCONFIG->level);
 }
  
 static void _rb_osc_update_square_ratev(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t level=RCONFIG->level;
-  rb_sample_t *v=RUNNER->mainv;
-  const rb_sample_t *rate=RUNNER->ratev;
-  for (;c-->0;v++,rate++) {
-    if (RUNNER->p>=0.5f) *v=-level;
-    else *v=level;
-    RUNNER->p+=(*rate)*RCONFIG->invrate;
-    if (RUNNER->p>=1.0f) RUNNER->p-=1.0f;
-  }
+  RUNNER->fp=rb_wave_phase_ratev(RUNNER->mainv,RUNNER->ratev,c,RUNNER->fp,RCONFIG->invrate);
+  rb_wave_square(RUNNER->mainv,RUNNER->mainv,c,RCONFIG->level);
 }
  
 static void _rb_osc_update_square_const(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t level=RCONFIG->level;
-  rb_sample_t *v=RUNNER->mainv;
-  for (;c-->0;v++) {
-    //TODO Get smarter about this, use a single rb_signal_set_s() for each half-period.
-    if (RUNNER->p>=0.5f) *v=-level;
-    else *v=level;
-    RUNNER->p+=RUNNER->dp;
-    if (RUNNER->p>=1.0f) RUNNER->p-=1.0f;
-  }
-}
-
-/* SAWUP
- */
- 
-static void _rb_osc_update_sawup_phasev(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t base=-RCONFIG->level;
-  rb_sample_t *v=RUNNER->mainv;
-  const rb_sample_t *phase=RUNNER->phasev;
-  for (;c-->0;v++,phase++) {
-    *v=base+(*phase)*RUNNER->k;
-  }
-}
- 
-static void _rb_osc_update_sawup_ratev(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t base=-RCONFIG->level;
-  rb_sample_t *v=RUNNER->mainv;
-  const rb_sample_t *rate=RUNNER->ratev;
-  for (;c-->0;v++,rate++) {
-    *v=base+RUNNER->p*RUNNER->k;
-    RUNNER->p+=(*rate)*RCONFIG->invrate;
-    if (RUNNER->p>=1.0f) RUNNER->p-=1.0f;
-  }
-}
- 
-static void _rb_osc_update_sawup_const(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t base=-RCONFIG->level;
-  rb_sample_t *v=RUNNER->mainv;
-  for (;c-->0;v++) {
-    *v=base+RUNNER->p*RUNNER->k;
-    RUNNER->p+=RUNNER->dp;
-    if (RUNNER->p>=1.0f) RUNNER->p-=1.0f;
-  }
+  RUNNER->fp=rb_wave_phase_const(RUNNER->mainv,c,RUNNER->fp,RUNNER->fdp);
+  rb_wave_square(RUNNER->mainv,RUNNER->mainv,c,RCONFIG->level);
 }
 
-/* SAWDOWN
+/* SAWUP, SAWDOWN
+ * Same thing with different constants. (base) is -level for up, level for down.
  */
  
-static void _rb_osc_update_sawdown_phasev(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t base=RCONFIG->level;
-  rb_sample_t *v=RUNNER->mainv;
-  const rb_sample_t *phase=RUNNER->phasev;
-  for (;c-->0;v++,phase++) {
-    *v=base+(*phase)*RUNNER->k;
-  }
+static void _rb_osc_update_saw_phasev(struct rb_synth_node_runner *runner,int c) {
+  rb_wave_saw(RUNNER->mainv,RUNNER->phasev,c,RUNNER->base,RUNNER->k);
 }
  
-static void _rb_osc_update_sawdown_ratev(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t base=RCONFIG->level;
-  rb_sample_t *v=RUNNER->mainv;
-  const rb_sample_t *rate=RUNNER->ratev;
-  for (;c-->0;v++,rate++) {
-    *v=base+RUNNER->p*RUNNER->k;
-    RUNNER->p+=(*rate)*RCONFIG->invrate;
-    if (RUNNER->p>=1.0f) RUNNER->p-=1.0f;
-  }
+static void _rb_osc_update_saw_ratev(struct rb_synth_node_runner *runner,int c) {
+  RUNNER->fp=rb_wave_phase_ratev(RUNNER->mainv,RUNNER->ratev,c,RUNNER->fp,RCONFIG->invrate);
+  rb_wave_saw(RUNNER->mainv,RUNNER->mainv,c,RUNNER->base,RUNNER->k);
 }
  
-static void _rb_osc_update_sawdown_const(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t base=RCONFIG->level;
-  rb_sample_t *v=RUNNER->mainv;
-  for (;c-->0;v++) {
-    *v=base+RUNNER->p*RUNNER->k;
-    RUNNER->p+=RUNNER->dp;
-    if (RUNNER->p>=1.0f) RUNNER->p-=1.0f;
-  }
+static void _rb_osc_update_saw_const(struct rb_synth_node_runner *runner,int c) {
+  RUNNER->fp=rb_wave_phase_const(RUNNER->mainv,c,RUNNER->fp,RUNNER->fdp);
+  rb_wave_saw(RUNNER->mainv,RUNNER->mainv,c,RUNNER->base,RUNNER->k);
 }
 
 /* TRIANGLE
  */
  
 static void _rb_osc_update_triangle_phasev(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t *v=RUNNER->mainv;
-  const rb_sample_t *phase=RUNNER->phasev;
-  for (;c-->0;v++,phase++) {
-    if (*phase>=0.5f) *v=RCONFIG->level-((*phase)-0.5f)*RUNNER->k;
-    else *v=(*phase)*RUNNER->k-RCONFIG->level;
-  }
+  rb_wave_triangle(RUNNER->mainv,RUNNER->phasev,c,RCONFIG->level);
 }
  
 static void _rb_osc_update_triangle_ratev(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t *v=RUNNER->mainv;
-  const rb_sample_t *rate=RUNNER->ratev;
-  for (;c-->0;v++,rate++) {
-    if (RUNNER->p>=0.5f) *v=RCONFIG->level-(RUNNER->p-0.5f)*RUNNER->k;
-    else *v=RUNNER->p*RUNNER->k-RCONFIG->level;
-    RUNNER->p+=(*rate)*RCONFIG->invrate;
-    if (RUNNER->p>=1.0f) RUNNER->p-=1.0f;
-    else if (RUNNER->p<0.0f) RUNNER->p+=1.0f;
-  }
+  RUNNER->fp=rb_wave_phase_ratev(RUNNER->mainv,RUNNER->ratev,c,RUNNER->fp,RCONFIG->invrate);
+  rb_wave_triangle(RUNNER->mainv,RUNNER->mainv,c,RCONFIG->level);
 }
  
 static void _rb_osc_update_triangle_const(struct rb_synth_node_runner *runner,int c) {
-  rb_sample_t *v=RUNNER->mainv;
-  for (;c-->0;v++) {
-    if (RUNNER->p>=0.5f) *v=RCONFIG->level-(RUNNER->p-0.5f)*RUNNER->k;
-    else *v=RUNNER->p*RUNNER->k-RCONFIG->level;
-    RUNNER->p+=RUNNER->dp;
-    if (RUNNER->p>=1.0f) RUNNER->p-=1.0f;
-  }
+  RUNNER->fp=rb_wave_phase_const(RUNNER->mainv,c,RUNNER->fp,RUNNER->fdp);
+  rb_wave_triangle(RUNNER->mainv,RUNNER->mainv,c,RCONFIG->level);
 }
 
 /* IMPULSE
@@ -239,30 +141,37 @@ static void _rb_osc_update_impulse_phasev(struct rb_synth_node_runner *runner,in
 }
  
 static void _rb_osc_update_impulse_ratev(struct rb_synth_node_runner *runner,int c) {
+  rb_sample_t level=RCONFIG->level;
+  rb_sample_t invrate=RCONFIG->invrate;
+  rb_sample_t p=RUNNER->p;
   rb_sample_t *v=RUNNER->mainv;
   const rb_sample_t *rate=RUNNER->ratev;
   for (;c-->0;v++,rate++) {
-    if (RUNNER->p>=1.0f) {
-      *v=RCONFIG->level;
-      RUNNER->p-=1.0f;
+    if (p>=1.0f) {
+      *v=level;
+      p-=1.0f;
     } else {
       *v=0.0f;
     }
-    RUNNER->p+=(*rate)*RCONFIG->invrate;
+    p+=(*rate)*invrate;
   }
+  RUNNER->p=p;
 }
  
 static void _rb_osc_update_impulse_const(struct rb_synth_node_runner *runner,int c) {
+  rb_sample_t level=RCONFIG->level;
+  rb_sample_t p=RUNNER->p,dp=RUNNER->dp;
   rb_sample_t *v=RUNNER->mainv;
   for (;c-->0;v++) {
-    if (RUNNER->p>=1.0f) {
-      *v=RCONFIG->level;
-      RUNNER->p-=1.0f;
+    if (p>=1.0f) {
+      *v=level;
+      p-=1.0f;
     } else {
       *v=0.0f;
     }
-    RUNNER->p+=RUNNER->dp;
+    p+=dp;
   }
+  RUNNER->p=p;
 }
 
 /* NOISE
@@ -297,13 +206,13 @@ static int _rb_osc_runner_init(struct rb_synth_node_runner *runner,uint8_t notei
   rb_sample_t dummy;
   RUNNER->p=modff(RCONFIG->phase,&dummy); // SAMPLETYPE
   RUNNER->dp=RUNNER->rate/runner->config->synth->rate;
+  RUNNER->fp=rb_wave_phase_fixed(RUNNER->p);
+  RUNNER->fdp=rb_wave_phase_fixed(RUNNER->dp);
   
   // Tons of (update) hooks, each dialed in to a very specific setup.
+  // The periodic shapes all generate phase into (mainv), then shape it in place. See rb_wave.h.
   switch (RCONFIG->shape) {
     case RB_OSC_SHAPE_SINE: {
-        RUNNER->p*=M_PI*2.0f;
-        RUNNER->dp*=M_PI*2.0f;
-        RUNNER->k=(M_PI*2.0f)/runner->config->synth->rate;
         if (RUNNER->phasev) runner->update=_rb_osc_update_sine_phasev;
         else if (RUNNER->ratev) runner->update=_rb_osc_update_sine_ratev;
         else runner->update=_rb_osc_update_sine_const;
@@ -313,20 +222,20 @@ static int _rb_osc_runner_init(struct rb_synth_node_runner *runner,uint8_t notei
         else if (RUNNER->ratev) runner->update=_rb_osc_update_square_ratev;
         else runner->update=_rb_osc_update_square_const;
       } break;
-    case RB_OSC_SHAPE_SAWUP: {
-        RUNNER->k=RCONFIG->level*2.0f;
-        if (RUNNER->phasev) runner->update=_rb_osc_update_sawup_phasev;
-        else if (RUNNER->ratev) runner->update=_rb_osc_update_sawup_ratev;
-        else runner->update=_rb_osc_update_sawup_const;
-      } break;
+    case RB_OSC_SHAPE_SAWUP:
     case RB_OSC_SHAPE_SAWDOWN: {
-        RUNNER->k=RCONFIG->level*-2.0f;
-        if (RUNNER->phasev) runner->update=_rb_osc_update_sawdown_phasev;
-        else if (RUNNER->ratev) runner->update=_rb_osc_update_sawdown_ratev;
-        else runner->update=_rb_osc_update_sawdown_const;
+        if (RCONFIG->shape==RB_OSC_SHAPE_SAWUP) {
+          RUNNER->base=-RCONFIG->level;
+          RUNNER->k=RCONFIG->level*2.0f;
+        } else {
+          RUNNER->base=RCONFIG->level;
+          RUNNER->k=RCONFIG->level*-2.0f;
+        }
+        if (RUNNER->phasev) runner->update=_rb_osc_update_saw_phasev;
+        else if (RUNNER->ratev) runner->update=_rb_osc_update_saw_ratev;
+        else runner->update=_rb_osc_update_saw_const;
       } break;
     case RB_OSC_SHAPE_TRIANGLE: {
-        RUNNER->k=RCONFIG->level*4.0f;
         if (RUNNER->phasev) runner->update=_rb_osc_update_triangle_phasev;
         else if (RUNNER->ratev) runner->update=_rb_osc_update_triangle_ratev;
         else runner->update=_rb_osc_update_triangle_const;
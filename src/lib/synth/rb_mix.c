@@ -0,0 +1,210 @@
+#include "rabbit/rb_internal.h"
+#include "rabbit/rb_mix.h"
+#include "rabbit/rb_simd.h"
+
+/* AVX2 is either assumed by the build, or compiled separately and checked at runtime.
+ */
+
+#if RB_SIMD_AVX2
+  #define RB_MIX_AVX2 1
+  #define RB_MIX_TARGET_AVX2
+  #define rb_mix_use_avx2() 1
+#elif RB_SIMD_AVX2_DISPATCH
+  #define RB_MIX_AVX2 1
+  #define RB_MIX_TARGET_AVX2 RB_SIMD_TARGET_AVX2
+  #define rb_mix_use_avx2() rb_simd_have_avx2()
+#endif
+
+/* Mono to interleaved.
+ */
+ 
+void rb_mix_expand_s16(int16_t *dst,const int16_t *src,int framec,int chanc) {
+  if (chanc==1) {
+    memcpy(dst,src,framec<<1);
+    return;
+  }
+  if (chanc==2) {
+    #if RB_SIMD_SSE2
+      for (;framec>=8;framec-=8,dst+=16,src+=8) {
+        __m128i a=_mm_loadu_si128((const __m128i*)src);
+        _mm_storeu_si128((__m128i*)dst,_mm_unpacklo_epi16(a,a));
+        _mm_storeu_si128((__m128i*)(dst+8),_mm_unpackhi_epi16(a,a));
+      }
+    #elif RB_SIMD_NEON
+      for (;framec>=8;framec-=8,dst+=16,src+=8) {
+        int16x8x2_t pair;
+        pair.val[0]=pair.val[1]=vld1q_s16(src);
+        vst2q_s16(dst,pair);
+      }
+    #endif
+    for (;framec-->0;src++) {
+      *dst++=*src;
+      *dst++=*src;
+    }
+    return;
+  }
+  for (;framec-->0;src++) {
+    int i=chanc;
+    while (i-->0) *dst++=*src;
+  }
+}
+
+/* Widening add.
+ */
+
+#if RB_MIX_AVX2
+
+// Multiple-of-8 prefix only; returns how many it did.
+static RB_MIX_TARGET_AVX2 int rb_mix_add_s16_s32_avx2(int32_t *dst,const int16_t *src,int c) {
+  int n=c&~7;
+  for (;c>=8;c-=8,dst+=8,src+=8) {
+    __m256i b=_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)src));
+    __m256i a=_mm256_loadu_si256((__m256i*)dst);
+    _mm256_storeu_si256((__m256i*)dst,_mm256_add_epi32(a,b));
+  }
+  return n;
+}
+
+#endif
+ 
+void rb_mix_add_s16_s32(int32_t *dst,const int16_t *src,int c) {
+  #if RB_MIX_AVX2
+    if (rb_mix_use_avx2()) {
+      int n=rb_mix_add_s16_s32_avx2(dst,src,c);
+      dst+=n;
+      src+=n;
+      c-=n;
+    }
+  #endif
+  #if RB_SIMD_SSE2
+    for (;c>=8;c-=8,dst+=8,src+=8) {
+      __m128i b=_mm_loadu_si128((const __m128i*)src);
+      // Sign-extend by putting each sample in the high half, then shifting down.
+      __m128i blo=_mm_srai_epi32(_mm_unpacklo_epi16(b,b),16);
+      __m128i bhi=_mm_srai_epi32(_mm_unpackhi_epi16(b,b),16);
+      __m128i alo=_mm_loadu_si128((__m128i*)dst);
+      __m128i ahi=_mm_loadu_si128((__m128i*)(dst+4));
+      _mm_storeu_si128((__m128i*)dst,_mm_add_epi32(alo,blo));
+      _mm_storeu_si128((__m128i*)(dst+4),_mm_add_epi32(ahi,bhi));
+    }
+  #elif RB_SIMD_NEON
+    for (;c>=8;c-=8,dst+=8,src+=8) {
+      int16x8_t b=vld1q_s16(src);
+      vst1q_s32(dst,vaddw_s16(vld1q_s32(dst),vget_low_s16(b)));
+      vst1q_s32(dst+4,vaddw_s16(vld1q_s32(dst+4),vget_high_s16(b)));
+    }
+  #endif
+  for (;c-->0;dst++,src++) (*dst)+=(*src);
+}
+
+/* Peak.
+ */
+ 
+int32_t rb_mix_peak_s32(const int32_t *src,int c) {
+  int32_t lo=0,hi=0;
+  #if RB_SIMD_SSE2
+    if (c>=4) {
+      __m128i vlo=_mm_setzero_si128(),vhi=_mm_setzero_si128();
+      for (;c>=4;c-=4,src+=4) {
+        __m128i n=_mm_loadu_si128((const __m128i*)src);
+        // No min/max for int32 until SSE4.1, so compare and select.
+        __m128i gt=_mm_cmpgt_epi32(n,vhi);
+        vhi=_mm_or_si128(_mm_and_si128(gt,n),_mm_andnot_si128(gt,vhi));
+        __m128i lt=_mm_cmplt_epi32(n,vlo);
+        vlo=_mm_or_si128(_mm_and_si128(lt,n),_mm_andnot_si128(lt,vlo));
+      }
+      int32_t tmp[4];
+      int i;
+      _mm_storeu_si128((__m128i*)tmp,vhi);
+      for (i=0;i<4;i++) if (tmp[i]>hi) hi=tmp[i];
+      _mm_storeu_si128((__m128i*)tmp,vlo);
+      for (i=0;i<4;i++) if (tmp[i]<lo) lo=tmp[i];
+    }
+  #elif RB_SIMD_NEON
+    if (c>=4) {
+      int32x4_t vlo=vdupq_n_s32(0),vhi=vdupq_n_s32(0);
+      for (;c>=4;c-=4,src+=4) {
+        int32x4_t n=vld1q_s32(src);
+        vhi=vmaxq_s32(vhi,n);
+        vlo=vminq_s32(vlo,n);
+      }
+      int32_t tmp[4];
+      int i;
+      vst1q_s32(tmp,vhi);
+      for (i=0;i<4;i++) if (tmp[i]>hi) hi=tmp[i];
+      vst1q_s32(tmp,vlo);
+      for (i=0;i<4;i++) if (tmp[i]<lo) lo=tmp[i];
+    }
+  #endif
+  for (;c-->0;src++) {
+    if (*src>hi) hi=*src;
+    else if (*src<lo) lo=*src;
+  }
+  if (lo<=-INT32_MAX) return INT32_MAX;
+  if (-lo>hi) return -lo;
+  return hi;
+}
+
+/* Narrow with gain.
+ */
+ 
+void rb_mix_finish_s32(int16_t *dst,const int32_t *src,int c,float gain0,float gain1) {
+  if (c<1) return;
+  if ((gain0==1.0f)&&(gain1==1.0f)) {
+    #if RB_SIMD_SSE2
+      for (;c>=8;c-=8,dst+=8,src+=8) {
+        __m128i lo=_mm_loadu_si128((const __m128i*)src);
+        __m128i hi=_mm_loadu_si128((const __m128i*)(src+4));
+        _mm_storeu_si128((__m128i*)dst,_mm_packs_epi32(lo,hi));
+      }
+    #elif RB_SIMD_NEON
+      for (;c>=8;c-=8,dst+=8,src+=8) {
+        vst1q_s16(dst,vcombine_s16(vqmovn_s32(vld1q_s32(src)),vqmovn_s32(vld1q_s32(src+4))));
+      }
+    #endif
+    for (;c-->0;dst++,src++) {
+      if (*src>32767) *dst=32767;
+      else if (*src<-32768) *dst=-32768;
+      else *dst=*src;
+    }
+    return;
+  }
+  
+  float gain=gain0;
+  float dgain=(gain1-gain0)/c;
+  #if RB_SIMD_SSE2
+    if (c>=8) {
+      __m128i lo,hi;
+      __m128 vgain=_mm_setr_ps(gain,gain+dgain,gain+dgain*2.0f,gain+dgain*3.0f);
+      __m128 vdgain=_mm_set1_ps(dgain*4.0f);
+      for (;c>=8;c-=8,dst+=8,src+=8) {
+        lo=_mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)src)),vgain));
+        vgain=_mm_add_ps(vgain,vdgain);
+        hi=_mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(src+4))),vgain));
+        vgain=_mm_add_ps(vgain,vdgain);
+        _mm_storeu_si128((__m128i*)dst,_mm_packs_epi32(lo,hi));
+        gain+=dgain*8.0f;
+      }
+    }
+  #elif RB_SIMD_NEON
+    if (c>=8) {
+      float init[4]={gain,gain+dgain,gain+dgain*2.0f,gain+dgain*3.0f};
+      float32x4_t vgain=vld1q_f32(init);
+      float32x4_t vdgain=vdupq_n_f32(dgain*4.0f);
+      for (;c>=8;c-=8,dst+=8,src+=8) {
+        int32x4_t lo=vcvtq_s32_f32(vmulq_f32(vcvtq_f32_s32(vld1q_s32(src)),vgain));
+        vgain=vaddq_f32(vgain,vdgain);
+        int32x4_t hi=vcvtq_s32_f32(vmulq_f32(vcvtq_f32_s32(vld1q_s32(src+4)),vgain));
+        vgain=vaddq_f32(vgain,vdgain);
+        vst1q_s16(dst,vcombine_s16(vqmovn_s32(lo),vqmovn_s32(hi)));
+        gain+=dgain*8.0f;
+      }
+    }
+  #endif
+  for (;c-->0;dst++,src++,gain+=dgain) {
+    float n=(*src)*gain;
+    if (n>=32767.0f) *dst=32767;
+    else if (n<=-32768.0f) *dst=-32768;
+    else *dst=(int16_t)n;
+  }
+}
@@ -2,6 +2,8 @@
 #include "rabbit/rb_pcm.h"
 #include "rabbit/rb_synth_node.h"
 #include "rabbit/rb_synth.h"
+#include "rabbit/rb_mix.h"
+#include "rabbit/rb_pcm_cache.h"
 
 /* PCM dump object.
  */
@@ -16,12 +18,32 @@ struct rb_pcm *rb_pcm_new(int c) {
   if (!pcm) return 0;
   pcm->refc=1;
   pcm->c=c;
+  pcm->readyc=c;
+  pcm->v=(int16_t*)(pcm+1);
+  return pcm;
+}
+
+struct rb_pcm *rb_pcm_new_view(struct rb_pcm_map *map,const int16_t *v,int c) {
+  if (!v||(c<1)) return 0;
+  if (c>RB_PCM_SIZE_LIMIT) return 0;
+  struct rb_pcm *pcm=calloc(1,sizeof(struct rb_pcm));
+  if (!pcm) return 0;
+  if (rb_pcm_map_ref(map)<0) {
+    free(pcm);
+    return 0;
+  }
+  pcm->refc=1;
+  pcm->c=c;
+  pcm->readyc=c;
+  pcm->v=(int16_t*)v;
+  pcm->map=map;
   return pcm;
 }
   
 void rb_pcm_del(struct rb_pcm *pcm) {
   if (!pcm) return;
   if (pcm->refc-->1) return;
+  rb_pcm_map_del(pcm->map);
   free(pcm);
 }
 
@@ -53,15 +75,13 @@ void rb_pcmrun_cleanup(struct rb_pcmrun *pcmrun) {
 /* Update runner.
  */
  
-int rb_pcmrun_update(int16_t *v,int c,struct rb_pcmrun *pcmrun) {
-  int cpc=pcmrun->pcm->c-pcmrun->p;
+int rb_pcmrun_update(int32_t *v,int c,struct rb_pcmrun *pcmrun) {
+  if (pcmrun->p>=pcmrun->pcm->c) return 0;
+  int cpc=__atomic_load_n(&pcmrun->pcm->readyc,__ATOMIC_ACQUIRE)-pcmrun->p;
   if (cpc>c) cpc=c;
-  if (cpc<1) return 0;
-  const int16_t *src=pcmrun->pcm->v+pcmrun->p;
+  if (cpc<1) return 1;
+  rb_mix_add_s16_s32(v,pcmrun->pcm->v+pcmrun->p,cpc);
   pcmrun->p+=cpc;
-  for (;cpc-->0;v++,src++) {
-    (*v)+=(*src);
-  }
   if (pcmrun->p>=pcmrun->pcm->c) return 0;
   return 1;
 }
@@ -111,6 +131,7 @@ struct rb_pcmprint *rb_pcmprint_new(
     rb_pcmprint_del(pcmprint);
     return 0;
   }
+  pcmprint->pcm->readyc=0;
   
   /**
   rb_pcm_total+=samplec;
@@ -155,9 +176,48 @@ int rb_pcmprint_update(struct rb_pcmprint *pcmprint,int c) {
     pcmprint->node->update(pcmprint->node,runc);
     
     rb_signal_quantize(pcmprint->pcm->v+pcmprint->p,pcmprint->buf,runc,pcmprint->qlevel);
-    pcmprint->p+=runc;
+    __atomic_store_n(&pcmprint->pcm->readyc,pcmprint->p+runc,__ATOMIC_RELEASE);
+    __atomic_store_n(&pcmprint->p,pcmprint->p+runc,__ATOMIC_RELEASE);
     c-=runc;
   }
   if (pcmprint->p>=pcmprint->pcm->c) return 0;
   return 1;
 }
+
+/* Claim printer.
+ */
+ 
+int rb_pcmprint_try_claim(struct rb_pcmprint *pcmprint) {
+  if (__atomic_exchange_n(&pcmprint->claim,1,__ATOMIC_ACQUIRE)) return 0;
+  return 1;
+}
+
+void rb_pcmprint_claim(struct rb_pcmprint *pcmprint) {
+  // Workers hold the claim for one chunk at a time, so this won't spin long.
+  while (__atomic_exchange_n(&pcmprint->claim,1,__ATOMIC_ACQUIRE)) ;
+}
+
+void rb_pcmprint_release(struct rb_pcmprint *pcmprint) {
+  __atomic_store_n(&pcmprint->claim,0,__ATOMIC_RELEASE);
+}
+
+/* Require some amount printed.
+ */
+ 
+int rb_pcmprint_require(struct rb_pcmprint *pcmprint,int c) {
+  if (!pcmprint->pcm) return 0;
+  int due=pcmprint->due+c;
+  if (due>pcmprint->pcm->c) due=pcmprint->pcm->c;
+  __atomic_store_n(&pcmprint->due,due,__ATOMIC_RELAXED);
+  int p=rb_pcmprint_get_position(pcmprint);
+  if ((p<due)&&rb_pcmprint_try_claim(pcmprint)) {
+    p=pcmprint->p;
+    if (p<due) {
+      rb_pcmprint_update(pcmprint,due-p);
+      p=pcmprint->p;
+    }
+    rb_pcmprint_release(pcmprint);
+  }
+  if (p>=pcmprint->pcm->c) return 0;
+  return 1;
+}
@@ -0,0 +1,388 @@
+#include "rabbit/rb_internal.h"
+#include "rabbit/rb_pcm_cache.h"
+#include "rabbit/rb_pcm.h"
+#include "rabbit/rb_fs.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#define RB_PCM_CACHE_HEADER_LEN 16
+#define RB_PCM_CACHE_RECORD_HEADER_LEN 16
+#define RB_PCM_CACHE_BYTE_ORDER 0x01020304
+#define RB_PCM_CACHE_VERSION 2
+
+static inline size_t rb_pcm_cache_padded_len(int samplec) {
+  return ((size_t)samplec*2+15)&~(size_t)15;
+}
+
+/* Mapping.
+ */
+ 
+static struct rb_pcm_map *rb_pcm_map_new(int fd,size_t c) {
+  struct rb_pcm_map *map=calloc(1,sizeof(struct rb_pcm_map));
+  if (!map) return 0;
+  int flags=MAP_SHARED;
+  #ifdef MAP_POPULATE
+    flags|=MAP_POPULATE;
+  #endif
+  void *v=mmap(0,c,PROT_READ,flags,fd,0);
+  if (v==MAP_FAILED) {
+    free(map);
+    return 0;
+  }
+  #ifndef MAP_POPULATE
+    madvise(v,c,MADV_WILLNEED);
+  #endif
+  map->refc=1;
+  map->v=v;
+  map->c=c;
+  return map;
+}
+
+void rb_pcm_map_del(struct rb_pcm_map *map) {
+  if (!map) return;
+  if (map->refc-->1) return;
+  munmap(map->v,map->c);
+  free(map);
+}
+
+int rb_pcm_map_ref(struct rb_pcm_map *map) {
+  if (!map) return -1;
+  if (map->refc<1) return -1;
+  if (map->refc==INT_MAX) return -1;
+  map->refc++;
+  return 0;
+}
+
+/* Delete.
+ */
+ 
+void rb_pcm_cache_del(struct rb_pcm_cache *cache) {
+  if (!cache) return;
+  if (cache->refc-->1) return;
+  rb_pcm_map_del(cache->map);
+  if (cache->fd>=0) close(cache->fd);
+  if (cache->entryv) free(cache->entryv);
+  if (cache->path) free(cache->path);
+  pthread_mutex_destroy(&cache->writelock);
+  free(cache);
+}
+
+/* Retain.
+ */
+ 
+int rb_pcm_cache_ref(struct rb_pcm_cache *cache) {
+  if (!cache) return -1;
+  if (cache->refc<1) return -1;
+  if (cache->refc==INT_MAX) return -1;
+  cache->refc++;
+  return 0;
+}
+
+/* Search index.
+ */
+ 
+int rb_pcm_cache_search(const struct rb_pcm_cache *cache,uint64_t key) {
+  int lo=0,hi=cache->entryc;
+  while (lo<hi) {
+    int ck=(lo+hi)>>1;
+    const struct rb_pcm_cache_entry *entry=cache->entryv+ck;
+         if (key<entry->key) hi=ck;
+    else if (key>entry->key) lo=ck+1;
+    else return ck;
+  }
+  return -lo-1;
+}
+
+/* Add to index, or replace existing entry.
+ */
+ 
+static int rb_pcm_cache_index(struct rb_pcm_cache *cache,uint64_t key,size_t p,int c) {
+  int ix=rb_pcm_cache_search(cache,key);
+  if (ix<0) {
+    ix=-ix-1;
+    if (cache->entryc>=cache->entrya) {
+      int na=cache->entrya+64;
+      if (na>INT_MAX/sizeof(struct rb_pcm_cache_entry)) return -1;
+      void *nv=realloc(cache->entryv,sizeof(struct rb_pcm_cache_entry)*na);
+      if (!nv) return -1;
+      cache->entryv=nv;
+      cache->entrya=na;
+    }
+    memmove(cache->entryv+ix+1,cache->entryv+ix,sizeof(struct rb_pcm_cache_entry)*(cache->entryc-ix));
+    cache->entryc++;
+  }
+  struct rb_pcm_cache_entry *entry=cache->entryv+ix;
+  entry->key=key;
+  entry->p=p;
+  entry->c=c;
+  return 0;
+}
+
+/* Tell the reader about a record in the file, from the writer's side.
+ * While opening, there's no mapping yet and we're both, so index it directly.
+ * Otherwise it goes through (donev), and only if it's in the file we mapped.
+ * If the ring is full, we drop it; that record just misses until the next open.
+ */
+ 
+static int rb_pcm_cache_report(struct rb_pcm_cache *cache,uint64_t key,size_t p,int c) {
+  if (!cache->map) return rb_pcm_cache_index(cache,key,p,c);
+  if (!cache->orig) return 0;
+  if (p+((size_t)c<<1)>cache->map->c) return 0;
+  unsigned int head=cache->donehead;
+  if (head-__atomic_load_n(&cache->donetail,__ATOMIC_ACQUIRE)>=RB_PCM_CACHE_DONE_LIMIT) return 0;
+  struct rb_pcm_cache_entry *entry=cache->donev+head%RB_PCM_CACHE_DONE_LIMIT;
+  entry->key=key;
+  entry->p=p;
+  entry->c=c;
+  __atomic_store_n(&cache->donehead,head+1,__ATOMIC_RELEASE);
+  return 0;
+}
+
+/* Index whatever the writers reported.
+ */
+ 
+void rb_pcm_cache_collect(struct rb_pcm_cache *cache) {
+  unsigned int tail=cache->donetail;
+  unsigned int head=__atomic_load_n(&cache->donehead,__ATOMIC_ACQUIRE);
+  for (;tail!=head;tail++) {
+    const struct rb_pcm_cache_entry *entry=cache->donev+tail%RB_PCM_CACHE_DONE_LIMIT;
+    rb_pcm_cache_index(cache,entry->key,entry->p,entry->c);
+  }
+  __atomic_store_n(&cache->donetail,tail,__ATOMIC_RELEASE);
+}
+
+/* Forget what the writer knew about the file, eg because somebody replaced it.
+ * The reader keeps its mapping and index: The old file lives on, and everything it indexed is still there.
+ */
+ 
+static void rb_pcm_cache_forget(struct rb_pcm_cache *cache) {
+  cache->filelen=0;
+  cache->orig=0;
+}
+
+/* Lock the file against other processes.
+ * Caller must hold (writelock), which keeps out our own other threads.
+ * Somebody may have replaced it since we opened it; if so, open the new one and forget the old.
+ */
+ 
+static int rb_pcm_cache_lock(struct rb_pcm_cache *cache) {
+  while (1) {
+    if (flock(cache->fd,LOCK_EX)<0) return -1;
+    struct stat fdst,pathst;
+    if (fstat(cache->fd,&fdst)<0) {
+      flock(cache->fd,LOCK_UN);
+      return -1;
+    }
+    if ((stat(cache->path,&pathst)>=0)&&(pathst.st_dev==fdst.st_dev)&&(pathst.st_ino==fdst.st_ino)) return 0;
+    close(cache->fd); // releases the lock
+    if ((cache->fd=open(cache->path,O_RDWR|O_CREAT,0666))<0) return -1;
+    rb_pcm_cache_forget(cache);
+  }
+}
+
+static void rb_pcm_cache_unlock(struct rb_pcm_cache *cache) {
+  flock(cache->fd,LOCK_UN);
+}
+
+/* Put a fresh file with just the header in place, and switch to it.
+ * Never truncate: Other processes may have the old one mapped, and would fault.
+ * Instead write a new file and rename it over; the old one lives on for anyone still using it.
+ * Caller must hold the lock, and still does after.
+ */
+ 
+static int rb_pcm_cache_replace(struct rb_pcm_cache *cache) {
+  char tmppath[1100];
+  int tmppathc=snprintf(tmppath,sizeof(tmppath),"%s.%d",cache->path,(int)getpid());
+  if ((tmppathc<1)||(tmppathc>=sizeof(tmppath))) return -1;
+  int fd=open(tmppath,O_RDWR|O_CREAT|O_TRUNC,0666);
+  if (fd<0) return -1;
+  uint32_t header[4]={0,RB_PCM_CACHE_BYTE_ORDER,cache->rate,RB_PCM_CACHE_VERSION};
+  memcpy(header,"rPCM",4);
+  if (
+    (pwrite(fd,header,sizeof(header),0)!=sizeof(header))||
+    (flock(fd,LOCK_EX)<0)||
+    (rename(tmppath,cache->path)<0)
+  ) {
+    close(fd);
+    unlink(tmppath);
+    return -1;
+  }
+  close(cache->fd); // releases the old file's lock; anyone waiting on it will find the new one
+  cache->fd=fd;
+  rb_pcm_cache_forget(cache);
+  cache->filelen=RB_PCM_CACHE_HEADER_LEN;
+  return 0;
+}
+
+/* Index any records past (filelen), eg appended by another process.
+ * A truncated or zeroed record ends the scan (eg somebody crashed while writing it).
+ * We leave it in place, and the next append overwrites it.
+ * Starts over with a fresh file if the header is wrong or the file is over the size limit.
+ * Caller must hold the lock.
+ */
+ 
+static int rb_pcm_cache_sync(struct rb_pcm_cache *cache) {
+  struct stat st;
+  if (fstat(cache->fd,&st)<0) return -1;
+  size_t srcc=st.st_size;
+  
+  if (cache->filelen<RB_PCM_CACHE_HEADER_LEN) {
+    uint32_t header[4];
+    if (
+      (srcc>RB_PCM_CACHE_SIZE_LIMIT)||
+      (pread(cache->fd,header,sizeof(header),0)!=sizeof(header))||
+      memcmp(header,"rPCM",4)||
+      (header[1]!=RB_PCM_CACHE_BYTE_ORDER)||
+      (header[2]!=cache->rate)||
+      (header[3]!=RB_PCM_CACHE_VERSION)
+    ) {
+      return rb_pcm_cache_replace(cache);
+    }
+    cache->filelen=RB_PCM_CACHE_HEADER_LEN;
+  }
+  
+  size_t srcp=cache->filelen;
+  while ((srcp<srcc)&&(srcc-srcp>=RB_PCM_CACHE_RECORD_HEADER_LEN)) {
+    uint8_t header[RB_PCM_CACHE_RECORD_HEADER_LEN];
+    if (pread(cache->fd,header,sizeof(header),srcp)!=sizeof(header)) return -1;
+    uint64_t key;
+    uint32_t samplec;
+    memcpy(&key,header,8);
+    memcpy(&samplec,header+8,4);
+    if (!samplec||(samplec>INT_MAX)) break;
+    size_t bodylen=rb_pcm_cache_padded_len(samplec);
+    if (bodylen>srcc-srcp-RB_PCM_CACHE_RECORD_HEADER_LEN) break;
+    if (rb_pcm_cache_report(cache,key,srcp+RB_PCM_CACHE_RECORD_HEADER_LEN,samplec)<0) return -1;
+    srcp+=RB_PCM_CACHE_RECORD_HEADER_LEN+bodylen;
+  }
+  cache->filelen=srcp;
+  return 0;
+}
+
+/* Open.
+ */
+ 
+struct rb_pcm_cache *rb_pcm_cache_open(const char *root,int rate) {
+  if (!root||!root[0]) return 0;
+  char path[1024];
+  int pathc=snprintf(path,sizeof(path),"%s/%d.pcm",root,rate);
+  if ((pathc<1)||(pathc>=sizeof(path))) return 0;
+  rb_mkdir_for_file(path);
+  
+  struct rb_pcm_cache *cache=calloc(1,sizeof(struct rb_pcm_cache));
+  if (!cache) return 0;
+  if (pthread_mutex_init(&cache->writelock,0)) {
+    free(cache);
+    return 0;
+  }
+  cache->refc=1;
+  cache->rate=rate;
+  cache->fd=-1;
+  if (!(cache->path=strdup(path))) {
+    rb_pcm_cache_del(cache);
+    return 0;
+  }
+  if ((cache->fd=open(path,O_RDWR|O_CREAT,0666))<0) {
+    rb_pcm_cache_del(cache);
+    return 0;
+  }
+  
+  if (rb_pcm_cache_lock(cache)<0) {
+    rb_pcm_cache_del(cache);
+    return 0;
+  }
+  if (rb_pcm_cache_sync(cache)<0) {
+    rb_pcm_cache_unlock(cache);
+    rb_pcm_cache_del(cache);
+    return 0;
+  }
+  rb_pcm_cache_unlock(cache);
+  
+  // Map the whole size limit, not just what's there now. Appends land inside it, so we never map again.
+  if (!(cache->map=rb_pcm_map_new(cache->fd,RB_PCM_CACHE_SIZE_LIMIT))) {
+    rb_pcm_cache_del(cache);
+    return 0;
+  }
+  cache->orig=1;
+  
+  return cache;
+}
+
+/* Get PCM.
+ */
+ 
+struct rb_pcm *rb_pcm_cache_get(struct rb_pcm_cache *cache,uint64_t key) {
+  rb_pcm_cache_collect(cache);
+  int ix=rb_pcm_cache_search(cache,key);
+  if (ix<0) return 0;
+  const struct rb_pcm_cache_entry *entry=cache->entryv+ix;
+  return rb_pcm_new_view(cache->map,(const int16_t*)((char*)cache->map->v+entry->p),entry->c);
+}
+
+/* Add PCM.
+ */
+ 
+static int rb_pcm_cache_add_locked(struct rb_pcm_cache *cache,uint64_t key,const struct rb_pcm *pcm) {
+
+  // Pick up whatever other processes wrote, so we append after it.
+  if (rb_pcm_cache_sync(cache)<0) return -1;
+  
+  uint8_t header[RB_PCM_CACHE_RECORD_HEADER_LEN]={0};
+  size_t datalen=(size_t)pcm->c<<1;
+  size_t padlen=rb_pcm_cache_padded_len(pcm->c)-datalen;
+  size_t reclen=sizeof(header)+datalen+padlen;
+  if (reclen>RB_PCM_CACHE_SIZE_LIMIT-RB_PCM_CACHE_HEADER_LEN) return -1;
+  if (cache->filelen+reclen>RB_PCM_CACHE_SIZE_LIMIT) {
+    if (rb_pcm_cache_replace(cache)<0) return -1;
+  }
+  
+  // (filelen) is the end of the last good record. Anything after it is garbage from a crashed writer, overwrite it.
+  // Zero header first, then the body, then the real header: A reader never sees a header before its samples.
+  // If the file runs on past our record, terminate it with a zero header.
+  struct stat st;
+  if (fstat(cache->fd,&st)<0) return -1;
+  const char zeroes[16]={0};
+  size_t p=cache->filelen;
+  if (
+    (pwrite(cache->fd,zeroes,sizeof(header),p)!=sizeof(header))||
+    (pwrite(cache->fd,pcm->v,datalen,p+sizeof(header))!=datalen)||
+    (padlen&&(pwrite(cache->fd,zeroes,padlen,p+sizeof(header)+datalen)!=padlen))||
+    ((st.st_size>p+reclen)&&(pwrite(cache->fd,zeroes,sizeof(header),p+reclen)!=sizeof(header)))
+  ) return -1;
+  uint32_t samplec=pcm->c;
+  memcpy(header,&key,8);
+  memcpy(header+8,&samplec,4);
+  if (pwrite(cache->fd,header,sizeof(header),p)!=sizeof(header)) return -1;
+  cache->filelen=p+reclen;
+  
+  return rb_pcm_cache_report(cache,key,p+sizeof(header),pcm->c);
+}
+ 
+int rb_pcm_cache_add(struct rb_pcm_cache *cache,uint64_t key,const struct rb_pcm *pcm) {
+  if (!key||!pcm||(pcm->c<1)) return -1;
+  if (pthread_mutex_lock(&cache->writelock)) return -1;
+  int err=-1;
+  if (rb_pcm_cache_lock(cache)>=0) {
+    err=rb_pcm_cache_add_locked(cache,key,pcm);
+    rb_pcm_cache_unlock(cache);
+  }
+  pthread_mutex_unlock(&cache->writelock);
+  return err;
+}
+
+/* Hash, FNV-1a.
+ */
+ 
+uint32_t rb_pcm_cache_hash(const void *src,int srcc) {
+  const uint8_t *SRC=src;
+  uint32_t hash=0x811c9dc5;
+  for (;srcc-->0;SRC++) {
+    hash^=*SRC;
+    hash*=0x01000193;
+  }
+  if (!hash) hash=1;
+  return hash;
+}
@@ -2,7 +2,8 @@
 #include "rabbit/rb_pcm_store.h"
 #include "rabbit/rb_pcm.h"
 #include "rabbit/rb_synth.h"
-#include "rabbit/rb_fs.h"
+#include "rabbit/rb_pcm_cache.h"
+#include "rabbit/rb_pcmprint_pool.h"
 
 /* New.
  */
@@ -40,6 +41,7 @@ void rb_pcm_store_del(struct rb_pcm_store *store) {
     }
     free(store->entryv);
   }
+  rb_pcm_cache_del(store->cache);
   
   free(store);
 }
@@ -64,16 +66,18 @@ int rb_pcm_store_unload(struct rb_pcm_store *store) {
     rb_pcm_entry_cleanup(store->entryv+store->entryc);
   }
   store->size=0;
+  rb_pcm_cache_del(store->cache);
+  store->cache=0;
   return 0;
 }
 
 /* Remove PCMs for a given program.
  */
  
-int rb_pcm_store_drop_program(struct rb_pcm_store *store,uint8_t programid) {
-  if (programid>=0x80) return 0;
-  uint16_t lokey=rb_pcm_store_generate_key(programid,0x00);
-  uint16_t hikey=rb_pcm_store_generate_key(programid+1,0x00);
+int rb_pcm_store_drop_program(struct rb_pcm_store *store,uint32_t hash) {
+  if (!hash) return 0;
+  uint64_t lokey=rb_pcm_store_generate_key(hash,0x00);
+  uint64_t hikey=lokey+0x100;
   int lop=rb_pcm_store_search(store,lokey);
   if (lop<0) lop=-lop-1;
   if ((lop>=store->entryc)||(store->entryv[lop].key>=hikey)) return 0; // got none
@@ -83,9 +87,28 @@ int rb_pcm_store_drop_program(struct rb_pcm_store *store,uint8_t programid) {
   return rb_pcm_store_remove(store,lop,c);
 }
 
+/* Mark an entry as recently used.
+ */
+ 
+static inline void rb_pcm_store_touch(struct rb_pcm_store *store,struct rb_pcm_entry *entry) {
+  entry->stamp=++(store->clock);
+}
+
 /* Consider evicting PCMs.
  */
  
+struct rb_pcm_eviction_candidate {
+  uint32_t stamp;
+  int p;
+};
+
+static int rb_pcm_eviction_candidate_cmp(const void *a,const void *b) {
+  const struct rb_pcm_eviction_candidate *A=a,*B=b;
+  if (A->stamp<B->stamp) return -1;
+  if (A->stamp>B->stamp) return 1;
+  return 0;
+}
+ 
 static int rb_pcm_store_check_eviction(struct rb_pcm_store *store) {
 
   // Within both limits? Cool, do nothing.
@@ -94,20 +117,49 @@ static int rb_pcm_store_check_eviction(struct rb_pcm_store *store) {
     (store->entryc<=store->count_limit)
   ) return 0;
   
-  // Drop from the end until both targets are met.
+  // Order entries by access stamp, oldest first.
+  // This is O(n log n), but it only happens when we cross the limit, and then we drop down to (target).
+  struct rb_pcm_eviction_candidate *candidatev=malloc(sizeof(struct rb_pcm_eviction_candidate)*store->entryc);
+  if (!candidatev) return -1;
+  int i=store->entryc;
+  while (i-->0) {
+    candidatev[i].stamp=store->entryv[i].stamp;
+    candidatev[i].p=i;
+  }
+  qsort(candidatev,store->entryc,sizeof(struct rb_pcm_eviction_candidate),rb_pcm_eviction_candidate_cmp);
+  
+  // Drop the least recently used until both targets are met.
+  // Dropped entries get a null (pcm), and we'll compact the list after.
   int c0=store->entryc;
-  struct rb_pcm_entry *entry=store->entryv+c0;
+  int countc=store->entryc;
+  const struct rb_pcm_eviction_candidate *candidate=candidatev;
   while (
-    (store->size>store->size_target)||
-    (store->entryc>store->count_target)
+    (countc>0)&&(
+      (store->size>store->size_target)||
+      (countc>store->count_target)
+    )
   ) {
-    store->entryc--;
-    entry--;
+    struct rb_pcm_entry *entry=store->entryv+candidate->p;
+    candidate++;
+    countc--;
     store->size-=entry->pcm->c<<1;
     rb_pcm_entry_cleanup(entry);
+    entry->pcm=0;
   }
+  free(candidatev);
+  
+  // Compact, preserving key order.
+  struct rb_pcm_entry *dst=store->entryv;
+  const struct rb_pcm_entry *src=store->entryv;
+  for (i=c0;i-->0;src++) {
+    if (!src->pcm) continue;
+    if (dst!=src) *dst=*src;
+    dst++;
+  }
+  store->entryc=countc;
   
   int rmc=c0-store->entryc;
+  store->evictc+=rmc;
   fprintf(stderr,
     "rb_pcm_store evicted %d entries. Now count=%d size=%d\n",
     rmc,store->entryc,store->size
@@ -115,42 +167,40 @@ static int rb_pcm_store_check_eviction(struct rb_pcm_store *store) {
   return 0;
 }
 
-/* Write to the persistent cache if applicable.
+/* Open persistent cache.
  */
  
-int rb_pcm_store_persist(struct rb_pcm_store *store,uint16_t key,struct rb_pcm *pcm) {
-  if (!key||!pcm||!pcm->c) return 0;
+int rb_pcm_store_open_cache(struct rb_pcm_store *store) {
+  if (store->cache) return 0;
   const char *root=store->synth->cachedir;
   if (!root||!root[0]) return 0;
-  char path[1024];
-  int pathc=snprintf(path,sizeof(path),"%s/%d/%d",root,store->synth->rate,key);
-  if ((pathc<1)||(pathc>=sizeof(path))) return 0;
-  rb_mkdir_for_file(path);
-  if (rb_file_write(path,pcm->v,pcm->c<<1)<0) return -1;
-  //fprintf(stderr,"%s: persisted pcm\n",path);
+  if (!(store->cache=rb_pcm_cache_open(root,store->synth->rate))) {
+    fprintf(stderr,"%s: Failed to open PCM cache for rate %d\n",root,store->synth->rate);
+    return -1;
+  }
+  return 0;
+}
+
+/* Write to the persistent cache if applicable.
+ */
+ 
+int rb_pcm_store_persist(struct rb_pcm_store *store,uint64_t key,struct rb_pcm *pcm) {
+  if (!key||!pcm||!pcm->c) return 0;
+  if (pcm->map) return 0; // came from the cache
+  if (!store->cache) return 0;
+  if (!store->synth->pcmprint_pool) return 0;
+  if (rb_pcmprint_pool_persist(store->synth->pcmprint_pool,store->cache,key,pcm)<0) return -1;
   return 0;
 }
 
 /* If a persistent cache is in play, look for one PCM there.
- * If found, read it, add to the local cache, and return a WEAK reference.
+ * If found, add it to the local cache, and return a WEAK reference.
  */
  
-static struct rb_pcm *rb_pcm_store_check_persistent_cache(struct rb_pcm_store *store,uint16_t key) {
-  const char *root=store->synth->cachedir;
-  if (!root||!root[0]) return 0;
-  char path[1024];
-  int pathc=snprintf(path,sizeof(path),"%s/%d/%d",root,store->synth->rate,key);
-  if ((pathc<1)||(pathc>=sizeof(path))) return 0;
-  void *serial=0;
-  int serialc=rb_file_read(&serial,path);
-  if (!serial||(serialc<0)||(serialc&1)) return 0;
-  
-  struct rb_pcm *pcm=rb_pcm_new(serialc>>1);
-  if (!pcm) {
-    free(serial);
-    return 0;
-  }
-  memcpy(pcm->v,serial,serialc);
+static struct rb_pcm *rb_pcm_store_check_persistent_cache(struct rb_pcm_store *store,uint64_t key) {
+  if (!store->cache) return 0;
+  struct rb_pcm *pcm=rb_pcm_cache_get(store->cache,key);
+  if (!pcm) return 0;
   
   int p=rb_pcm_store_search(store,key);
   if (p>=0) { // the hell?
@@ -162,29 +212,35 @@ static struct rb_pcm *rb_pcm_store_check_persistent_cache(struct rb_pcm_store *s
   rb_pcm_del(pcm);
   if (err<0) return 0;
   
-  //fprintf(stderr,"%s: got pcm from persistent cache\n",path);
   return pcm;
 }
 
 /* Get PCM from cache.
  */
  
-struct rb_pcm *rb_pcm_store_get(struct rb_pcm_store *store,uint16_t key) {
+struct rb_pcm *rb_pcm_store_get(struct rb_pcm_store *store,uint64_t key) {
   int p=rb_pcm_store_search(store,key);
-  if (p<0) return rb_pcm_store_check_persistent_cache(store,key);
-  return store->entryv[p].pcm;
+  if (p<0) {
+    store->missc++;
+    return rb_pcm_store_check_persistent_cache(store,key);
+  }
+  store->hitc++;
+  struct rb_pcm_entry *entry=store->entryv+p;
+  rb_pcm_store_touch(store,entry);
+  return entry->pcm;
 }
 
 /* Add PCM to cache.
  */
  
-int rb_pcm_store_add(struct rb_pcm_store *store,uint16_t key,struct rb_pcm *pcm) {
+int rb_pcm_store_add(struct rb_pcm_store *store,uint64_t key,struct rb_pcm *pcm) {
   if (!pcm) return -1;
   
   // If we already have an entry, either swap its content or do nothing.
   int p=rb_pcm_store_search(store,key);
   if (p>=0) {
     struct rb_pcm_entry *entry=store->entryv+p;
+    rb_pcm_store_touch(store,entry);
     if (entry->pcm==pcm) return 0;
     if (rb_pcm_ref(pcm)<0) return -1;
     store->size-=entry->pcm->c<<1;
@@ -204,7 +260,7 @@ int rb_pcm_store_add(struct rb_pcm_store *store,uint16_t key,struct rb_pcm *pcm)
 /* Search.
  */
 
-int rb_pcm_store_search(const struct rb_pcm_store *store,uint16_t key) {
+int rb_pcm_store_search(const struct rb_pcm_store *store,uint64_t key) {
   int lo=0,hi=store->entryc;
   while (lo<hi) {
     int ck=(lo+hi)>>1;
@@ -219,7 +275,7 @@ int rb_pcm_store_search(const struct rb_pcm_store *store,uint16_t key) {
 /* Insert.
  */
  
-int rb_pcm_store_insert(struct rb_pcm_store *store,int p,uint16_t key,struct rb_pcm *pcm) {
+int rb_pcm_store_insert(struct rb_pcm_store *store,int p,uint64_t key,struct rb_pcm *pcm) {
   if ((p<0)||(p>store->entryc)) return -1;
   if (p&&(key<=store->entryv[p-1].key)) return -1;
   if ((p<store->entryc)&&(key>=store->entryv[p].key)) return -1;
@@ -239,6 +295,7 @@ int rb_pcm_store_insert(struct rb_pcm_store *store,int p,uint16_t key,struct rb_
   store->entryc++;
   entry->key=key;
   entry->pcm=pcm;
+  rb_pcm_store_touch(store,entry);
   store->size+=pcm->c<<1;
   
   return 0;
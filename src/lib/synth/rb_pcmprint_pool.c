@@ -0,0 +1,291 @@
+#include "rabbit/rb_internal.h"
+#include "rabbit/rb_pcmprint_pool.h"
+#include "rabbit/rb_pcm.h"
+#include "rabbit/rb_synth.h"
+#include "rabbit/rb_pcm_cache.h"
+
+/* Move newly added printers from the ring into (printv).
+ * Caller must hold the mutex.
+ */
+ 
+static void rb_pcmprint_pool_drain(struct rb_pcmprint_pool *pool) {
+  unsigned int tail=pool->ringtail;
+  unsigned int head=__atomic_load_n(&pool->ringhead,__ATOMIC_ACQUIRE);
+  for (;tail!=head;tail++) {
+    pool->printv[pool->printc++]=pool->ringv[tail%RB_PCMPRINT_POOL_SIZE_LIMIT];
+  }
+  __atomic_store_n(&pool->ringtail,tail,__ATOMIC_RELEASE);
+}
+
+/* Drop printer at (p), synth's thread only.
+ * Caller must hold the mutex.
+ */
+ 
+static void rb_pcmprint_pool_remove(struct rb_pcmprint_pool *pool,int p) {
+  struct rb_pcmprint *pcmprint=pool->printv[p];
+  pool->printc--;
+  memmove(pool->printv+p,pool->printv+p+1,sizeof(void*)*(pool->printc-p));
+  pool->heldc--;
+  pcmprint->pooled=0;
+  rb_pcmprint_del(pcmprint);
+}
+
+/* Pick the most urgent printer not already claimed, and claim it.
+ * Caller must hold the mutex.
+ */
+ 
+static struct rb_pcmprint *rb_pcmprint_pool_claim_next(struct rb_pcmprint_pool *pool) {
+  rb_pcmprint_pool_drain(pool);
+  struct rb_pcmprint *best=0;
+  int bestlead=INT_MAX;
+  int i=pool->printc;
+  while (i-->0) {
+    struct rb_pcmprint *pcmprint=pool->printv[i];
+    int p=rb_pcmprint_get_position(pcmprint);
+    if (p>=pcmprint->pcm->c) continue;
+    if (__atomic_load_n(&pcmprint->claim,__ATOMIC_RELAXED)) continue;
+    // Ties go to the earliest added, which for prewarm means earliest in the song.
+    int lead=p-__atomic_load_n(&pcmprint->due,__ATOMIC_RELAXED);
+    if (lead<=bestlead) {
+      best=pcmprint;
+      bestlead=lead;
+    }
+  }
+  if (!best) return 0;
+  if (!rb_pcmprint_try_claim(best)) return 0; // synth grabbed it just now; try again later
+  return best;
+}
+
+/* Take the next queued persist.
+ * Caller must hold the mutex.
+ */
+ 
+static struct rb_pcmprint_persist *rb_pcmprint_pool_take_persist(struct rb_pcmprint_pool *pool) {
+  struct rb_pcmprint_persist *persist=pool->persistv;
+  int i=RB_PCMPRINT_POOL_PERSIST_LIMIT;
+  for (;i-->0;persist++) {
+    if (__atomic_load_n(&persist->state,__ATOMIC_ACQUIRE)!=RB_PCMPRINT_PERSIST_QUEUED) continue;
+    __atomic_store_n(&persist->state,RB_PCMPRINT_PERSIST_WRITING,__ATOMIC_RELAXED);
+    return persist;
+  }
+  return 0;
+}
+
+/* Drop a persist's references and make it available again, synth's thread only.
+ */
+ 
+static void rb_pcmprint_persist_cleanup(struct rb_pcmprint_persist *persist) {
+  rb_pcm_cache_del(persist->cache);
+  rb_pcm_del(persist->pcm);
+  persist->cache=0;
+  persist->pcm=0;
+  __atomic_store_n(&persist->state,RB_PCMPRINT_PERSIST_IDLE,__ATOMIC_RELAXED);
+}
+
+/* Worker thread.
+ * Printing comes first, since the synth is waiting on it. Persists happen when there's nothing to print.
+ */
+ 
+static void *rb_pcmprint_pool_thread(void *arg) {
+  struct rb_pcmprint_pool *pool=arg;
+  if (pthread_mutex_lock(&pool->mutex)) return 0;
+  while (!pool->quit) {
+    struct rb_pcmprint *pcmprint=rb_pcmprint_pool_claim_next(pool);
+    if (pcmprint) {
+      pthread_mutex_unlock(&pool->mutex);
+      // Holding the claim keeps (pcmprint) alive: reap and clear won't drop a claimed printer.
+      rb_pcmprint_update(pcmprint,pcmprint->bufa);
+      rb_pcmprint_release(pcmprint);
+      if (pthread_mutex_lock(&pool->mutex)) return 0;
+      continue;
+    }
+    
+    struct rb_pcmprint_persist *persist=rb_pcmprint_pool_take_persist(pool);
+    if (persist) {
+      pthread_mutex_unlock(&pool->mutex);
+      // WRITING keeps (persist) alive: only the synth drops it, and only once it's DONE.
+      rb_pcm_cache_add(persist->cache,persist->key,persist->pcm);
+      if (pthread_mutex_lock(&pool->mutex)) return 0;
+      __atomic_store_n(&persist->state,RB_PCMPRINT_PERSIST_DONE,__ATOMIC_RELEASE);
+      pthread_cond_broadcast(&pool->cond); // in case clear is waiting
+      continue;
+    }
+    
+    pthread_cond_wait(&pool->cond,&pool->mutex);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  return 0;
+}
+
+/* New.
+ */
+ 
+struct rb_pcmprint_pool *rb_pcmprint_pool_new(struct rb_synth *synth,int threadc) {
+  if ((threadc<1)||(threadc>RB_PCMPRINT_POOL_THREAD_LIMIT)) return 0;
+  struct rb_pcmprint_pool *pool=calloc(1,sizeof(struct rb_pcmprint_pool));
+  if (!pool) return 0;
+  
+  pool->synth=synth;
+  pool->refc=1;
+  
+  if (pthread_mutex_init(&pool->mutex,0)) {
+    free(pool);
+    return 0;
+  }
+  if (pthread_cond_init(&pool->cond,0)) {
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+    return 0;
+  }
+  
+  while (pool->threadc<threadc) {
+    if (pthread_create(pool->threadv+pool->threadc,0,rb_pcmprint_pool_thread,pool)) {
+      rb_pcmprint_pool_del(pool);
+      return 0;
+    }
+    pool->threadc++;
+  }
+  
+  return pool;
+}
+
+/* Delete.
+ */
+ 
+void rb_pcmprint_pool_del(struct rb_pcmprint_pool *pool) {
+  if (!pool) return;
+  if (pool->refc-->1) return;
+  
+  pthread_mutex_lock(&pool->mutex);
+  pool->quit=1;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->mutex);
+  while (pool->threadc>0) {
+    pool->threadc--;
+    pthread_join(pool->threadv[pool->threadc],0);
+  }
+  
+  rb_pcmprint_pool_drain(pool);
+  while (pool->printc>0) {
+    rb_pcmprint_pool_remove(pool,pool->printc-1);
+  }
+  int i=RB_PCMPRINT_POOL_PERSIST_LIMIT;
+  while (i-->0) {
+    if (pool->persistv[i].state!=RB_PCMPRINT_PERSIST_IDLE) rb_pcmprint_persist_cleanup(pool->persistv+i);
+  }
+  pthread_cond_destroy(&pool->cond);
+  pthread_mutex_destroy(&pool->mutex);
+  
+  free(pool);
+}
+
+/* Retain.
+ */
+ 
+int rb_pcmprint_pool_ref(struct rb_pcmprint_pool *pool) {
+  if (!pool) return -1;
+  if (pool->refc<1) return -1;
+  if (pool->refc==INT_MAX) return -1;
+  pool->refc++;
+  return 0;
+}
+
+/* Add printer.
+ */
+ 
+int rb_pcmprint_pool_add(struct rb_pcmprint_pool *pool,struct rb_pcmprint *pcmprint) {
+  if (!pcmprint||!pcmprint->pcm) return -1;
+  
+  // Prewarm printers are already here when they get played; that's fine.
+  if (pcmprint->pooled) return 0;
+  
+  if (pool->heldc>=RB_PCMPRINT_POOL_SIZE_LIMIT) return -1;
+  unsigned int head=pool->ringhead;
+  if (head-__atomic_load_n(&pool->ringtail,__ATOMIC_ACQUIRE)>=RB_PCMPRINT_POOL_SIZE_LIMIT) return -1;
+  if (rb_pcmprint_ref(pcmprint)<0) return -1;
+  pool->ringv[head%RB_PCMPRINT_POOL_SIZE_LIMIT]=pcmprint;
+  __atomic_store_n(&pool->ringhead,head+1,__ATOMIC_RELEASE);
+  pcmprint->pooled=1;
+  pool->heldc++;
+  return 0;
+}
+
+/* Queue a persist.
+ */
+ 
+int rb_pcmprint_pool_persist(struct rb_pcmprint_pool *pool,struct rb_pcm_cache *cache,uint64_t key,struct rb_pcm *pcm) {
+  if (!cache||!key||!pcm) return -1;
+  struct rb_pcmprint_persist *persist=pool->persistv;
+  int i=RB_PCMPRINT_POOL_PERSIST_LIMIT;
+  for (;i-->0;persist++) {
+    if (__atomic_load_n(&persist->state,__ATOMIC_RELAXED)!=RB_PCMPRINT_PERSIST_IDLE) continue;
+    if (rb_pcm_cache_ref(cache)<0) return -1;
+    if (rb_pcm_ref(pcm)<0) {
+      rb_pcm_cache_del(cache);
+      return -1;
+    }
+    persist->cache=cache;
+    persist->key=key;
+    persist->pcm=pcm;
+    __atomic_store_n(&persist->state,RB_PCMPRINT_PERSIST_QUEUED,__ATOMIC_RELEASE);
+    return 0;
+  }
+  return -1;
+}
+
+/* Drop finished printers and persists.
+ */
+ 
+int rb_pcmprint_pool_reap(struct rb_pcmprint_pool *pool) {
+  int pendingc=0;
+  struct rb_pcmprint_persist *persist=pool->persistv;
+  int i=RB_PCMPRINT_POOL_PERSIST_LIMIT;
+  for (;i-->0;persist++) {
+    switch (__atomic_load_n(&persist->state,__ATOMIC_ACQUIRE)) {
+      case RB_PCMPRINT_PERSIST_QUEUED: pendingc++; break;
+      case RB_PCMPRINT_PERSIST_DONE: rb_pcmprint_persist_cleanup(persist); break;
+    }
+  }
+  
+  if (pthread_mutex_trylock(&pool->mutex)) return 0;
+  rb_pcmprint_pool_drain(pool);
+  i=pool->printc;
+  while (i-->0) {
+    struct rb_pcmprint *pcmprint=pool->printv[i];
+    if (rb_pcmprint_get_position(pcmprint)<pcmprint->pcm->c) {
+      pendingc++;
+      continue;
+    }
+    // Complete, but a worker might not have released it yet.
+    if (__atomic_load_n(&pcmprint->claim,__ATOMIC_ACQUIRE)) continue;
+    rb_pcmprint_pool_remove(pool,i);
+  }
+  // Nobody wakes workers when a printer or persist is added, or when the synth releases one it printed inline.
+  if (pendingc) pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->mutex);
+  return 0;
+}
+
+/* Drop everything.
+ */
+ 
+int rb_pcmprint_pool_clear(struct rb_pcmprint_pool *pool) {
+  if (pthread_mutex_lock(&pool->mutex)) return -1;
+  rb_pcmprint_pool_drain(pool);
+  while (pool->printc>0) {
+    struct rb_pcmprint *pcmprint=pool->printv[pool->printc-1];
+    rb_pcmprint_claim(pcmprint);
+    rb_pcmprint_release(pcmprint);
+    rb_pcmprint_pool_remove(pool,pool->printc-1);
+  }
+  int i;
+  for (i=RB_PCMPRINT_POOL_PERSIST_LIMIT;i-->0;) {
+    struct rb_pcmprint_persist *persist=pool->persistv+i;
+    while (__atomic_load_n(&persist->state,__ATOMIC_ACQUIRE)==RB_PCMPRINT_PERSIST_WRITING) {
+      pthread_cond_wait(&pool->cond,&pool->mutex);
+    }
+    if (persist->state!=RB_PCMPRINT_PERSIST_IDLE) rb_pcmprint_persist_cleanup(persist);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  return 0;
+}
@@ -4,6 +4,7 @@
 #include "rabbit/rb_synth_node.h"
 #include "rabbit/rb_pcm.h"
 #include "rabbit/rb_pcm_store.h"
+#include "rabbit/rb_pcm_cache.h"
 #include "rabbit/rb_synth.h"
 
 /* New.
@@ -49,6 +50,19 @@ int rb_program_store_ref(struct rb_program_store *store) {
   return 0;
 }
 
+/* Is this serial hash in use by any program other than (programid)?
+ */
+ 
+static int rb_program_store_hash_in_use(const struct rb_program_store *store,uint32_t hash,uint8_t programid) {
+  const struct rb_program_entry *entry=store->entryv;
+  int i=0;
+  for (;i<128;i++,entry++) {
+    if (i==programid) continue;
+    if (entry->hash==hash) return 1;
+  }
+  return 0;
+}
+
 /* Store a serial chunk.
  */
  
@@ -67,15 +81,19 @@ static int rb_program_store_receive_serial(struct rb_program_store *store,uint8_
     memcpy(nv,src,srcc);
   }
   if (entry->config) {
-    // Drop any existing PCMs from the prior config.
+    // Existing PCMs from the prior config are now unreachable from this slot, since the hash changes.
+    // Drop them early, unless another slot still plays the same serial.
     // We only check for this when a prior config existed.
-    rb_pcm_store_drop_program(store->synth->pcm_store,programid);
+    if (!rb_program_store_hash_in_use(store,entry->hash,programid)) {
+      rb_pcm_store_drop_program(store->synth->pcm_store,entry->hash);
+    }
     rb_synth_node_config_del(entry->config);
     entry->config=0;
   }
   if (entry->serial) free(entry->serial);
   entry->serial=nv;
   entry->serialc=srcc;
+  entry->hash=srcc?rb_pcm_cache_hash(nv,srcc):0;
   
   return 0;
 }
@@ -136,6 +154,17 @@ int rb_program_store_unload(struct rb_program_store *store) {
   return 0;
 }
 
+/* Key for a note.
+ */
+ 
+uint64_t rb_program_store_get_key(const struct rb_program_store *store,uint8_t programid,uint8_t noteid) {
+  if (programid>=0x80) return 0;
+  if (noteid>=0x80) return 0;
+  uint32_t hash=store->entryv[programid].hash;
+  if (!hash) return 0;
+  return rb_pcm_store_generate_key(hash,noteid);
+}
+
 /* Get pcm.
  */
 
@@ -148,8 +177,15 @@ int rb_program_store_get_note(
   if (programid>=0x80) return 0;
   if (noteid>=0x80) return 0;
   
+  struct rb_program_entry *entry=store->entryv+programid;
+  if (!entry->serialc) {
+    fprintf(stderr,"Missing program 0x%08x\n",programid);
+    return 0;
+  }
+  
   // If the PCM store already has it, retain that and we're done.
-  uint16_t key=rb_pcm_store_generate_key(programid,noteid);
+  // This might have been printed for some other program with identical serial, that's fine.
+  uint64_t key=rb_pcm_store_generate_key(entry->hash,noteid);
   struct rb_pcm *pcm=rb_pcm_store_get(store->synth->pcm_store,key);
   if (pcm) {
     if (rb_pcm_ref(pcm)<0) return -1;
@@ -158,18 +194,14 @@ int rb_program_store_get_note(
   }
   
   // Acquire node config.
-  struct rb_program_entry *entry=store->entryv+programid;
   if (!entry->config) {
-    if (!entry->serialc) {
-      fprintf(stderr,"Missing program 0x%08x\n",programid);
-      return 0;
-    }
     if (!(entry->config=rb_synth_node_config_new_decode(store->synth,entry->serial,entry->serialc))) {
       rb_synth_error(store->synth,"Failed to decode program 0x%02x from %d bytes",programid,entry->serialc);
       // ^ Log it but don't fail the whole operation.
       free(entry->serial);
       entry->serial=0;
       entry->serialc=0;
+      entry->hash=0;
       return 0;
     }
   }
@@ -234,6 +266,7 @@ struct rb_synth_node_config *rb_program_store_get_config(
       free(entry->serial);
       entry->serial=0;
       entry->serialc=0;
+      entry->hash=0;
       return 0;
     }
   }
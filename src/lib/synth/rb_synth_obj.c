@@ -4,6 +4,9 @@
 #include "rabbit/rb_pcm.h"
 #include "rabbit/rb_program_store.h"
 #include "rabbit/rb_pcm_store.h"
+#include "rabbit/rb_pcmprint_pool.h"
+#include "rabbit/rb_mix.h"
+#include "rabbit/rb_pcm_cache.h"
 #include <stdarg.h>
 
 #define RB_SYNTH_RATE_MIN 100
@@ -24,6 +27,9 @@ struct rb_synth *rb_synth_new(int rate,int chanc) {
   synth->refc=1;
   synth->rate=rate;
   synth->chanc=chanc;
+  synth->master_gain=1.0f;
+  synth->limiter_gain=1.0f;
+  synth->limit=1;
   
   if (
     !(synth->program_store=rb_program_store_new(synth))||
@@ -43,12 +49,21 @@ void rb_synth_del(struct rb_synth *synth) {
   if (!synth) return;
   if (synth->refc-->1) return;
   
+  // Workers must stop before anything they might be printing goes away.
+  rb_pcmprint_pool_del(synth->pcmprint_pool);
+  
   if (synth->pcmprintv) {
     while (synth->pcmprintc-->0) {
       rb_pcmprint_del(synth->pcmprintv[synth->pcmprintc]);
     }
     free(synth->pcmprintv);
   }
+  if (synth->prewarmv) {
+    while (synth->prewarmc-->0) {
+      rb_pcmprint_del(synth->prewarmv[synth->prewarmc]);
+    }
+    free(synth->prewarmv);
+  }
   if (synth->pcmrunv) {
     while (synth->pcmrunc-->0) {
       rb_pcmrun_cleanup(synth->pcmrunv+synth->pcmrunc);
@@ -83,12 +98,18 @@ int rb_synth_reinit(struct rb_synth *synth,int rate,int chanc) {
     synth->rate=rate;
     rb_synth_silence(synth);
     rb_synth_play_song(synth,0,0);
+    if (synth->pcmprint_pool) rb_pcmprint_pool_clear(synth->pcmprint_pool);
     while (synth->pcmprintc>0) {
       synth->pcmprintc--;
       rb_pcmprint_del(synth->pcmprintv[synth->pcmprintc]);
     }
+    while (synth->prewarmc>0) {
+      synth->prewarmc--;
+      rb_pcmprint_del(synth->prewarmv[synth->prewarmc]);
+    }
     rb_program_store_unload(synth->program_store);
     rb_pcm_store_unload(synth->pcm_store);
+    rb_pcm_store_open_cache(synth->pcm_store);
   }
   if ((chanc>0)&&(chanc!=synth->chanc)) {
     if ((chanc<RB_SYNTH_CHANC_MIN)||(chanc>RB_SYNTH_CHANC_MAX)) return -1;
@@ -97,6 +118,41 @@ int rb_synth_reinit(struct rb_synth *synth,int rate,int chanc) {
   return 0;
 }
 
+/* Start or stop print workers.
+ */
+ 
+int rb_synth_set_print_threads(struct rb_synth *synth,int threadc) {
+  if (threadc<0) return -1;
+  if (synth->pcmprint_pool) {
+    if (synth->pcmprint_pool->threadc==threadc) return 0;
+    rb_pcmprint_pool_del(synth->pcmprint_pool);
+    synth->pcmprint_pool=0;
+  }
+  if (!threadc) return 0;
+  if (!(synth->pcmprint_pool=rb_pcmprint_pool_new(synth,threadc))) return -1;
+  // Printers already in flight can join the pool too, as many as fit. The rest print inline.
+  int i=synth->pcmprintc;
+  while (i-->0) {
+    rb_pcmprint_pool_add(synth->pcmprint_pool,synth->pcmprintv[i]);
+  }
+  for (i=synth->prewarmc;i-->0;) {
+    rb_pcmprint_pool_add(synth->pcmprint_pool,synth->prewarmv[i]);
+  }
+  return 0;
+}
+
+/* Set persistent cache.
+ */
+ 
+int rb_synth_set_cachedir(struct rb_synth *synth,const char *path) {
+  if (synth->pcm_store->cache) {
+    rb_pcm_cache_del(synth->pcm_store->cache);
+    synth->pcm_store->cache=0;
+  }
+  synth->cachedir=path;
+  return rb_pcm_store_open_cache(synth->pcm_store);
+}
+
 /* Load serial data.
  */
  
@@ -122,7 +178,7 @@ static int rb_synth_update_pcmprint(struct rb_synth *synth,int framec) {
   int i=synth->pcmprintc;
   while (i-->0) {
     struct rb_pcmprint *pcmprint=synth->pcmprintv[i];
-    int err=rb_pcmprint_update(pcmprint,framec);
+    int err=rb_pcmprint_require(pcmprint,framec);
     if (err<0) return -1; // Should be rare, and must be serious.
     if (!err) {
       rb_pcm_store_persist(synth->pcm_store,pcmprint->key,pcmprint->pcm);
@@ -131,18 +187,31 @@ static int rb_synth_update_pcmprint(struct rb_synth *synth,int framec) {
       memmove(synth->pcmprintv+i,synth->pcmprintv+i+1,sizeof(void*)*(synth->pcmprintc-i));
     }
   }
+  
+  // Prewarm printers belong to the workers until somebody plays them.
+  // Once complete, they're just ordinary cache entries.
+  for (i=synth->prewarmc;i-->0;) {
+    struct rb_pcmprint *pcmprint=synth->prewarmv[i];
+    if (rb_pcmprint_get_position(pcmprint)<pcmprint->pcm->c) continue;
+    rb_pcm_store_persist(synth->pcm_store,pcmprint->key,pcmprint->pcm);
+    rb_pcmprint_del(pcmprint);
+    synth->prewarmc--;
+    memmove(synth->prewarmv+i,synth->prewarmv+i+1,sizeof(void*)*(synth->prewarmc-i));
+  }
+  
+  if (synth->pcmprint_pool) rb_pcmprint_pool_reap(synth->pcmprint_pool);
   return 0;
 }
 
-/* Generate signal, mono.
+/* Mix all running PCMs into the wide bus.
  */
  
-static int rb_synth_update_signal_mono(int16_t *v,int c,struct rb_synth *synth) {
+static int rb_synth_mix_bus(int32_t *bus,int c,struct rb_synth *synth) {
   int i=synth->pcmrunc;
   struct rb_pcmrun *pcmrun=synth->pcmrunv+i;
   while (i-->0) {
     pcmrun--;
-    if (rb_pcmrun_update(v,c,pcmrun)<=0) {
+    if (rb_pcmrun_update(bus,c,pcmrun)<=0) {
       rb_pcmrun_cleanup(pcmrun);
       synth->pcmrunc--;
       memmove(pcmrun,pcmrun+1,sizeof(struct rb_pcmrun)*(synth->pcmrunc-i));
@@ -151,30 +220,55 @@ static int rb_synth_update_signal_mono(int16_t *v,int c,struct rb_synth *synth)
   return 0;
 }
 
-/* Generate signal, multichannel.
+/* Choose the limiter gain for one chunk of the bus.
+ * Since we have the whole chunk before emitting any of it, we effectively look ahead one chunk.
+ * Gain drops immediately to fit the chunk's peak, and recovers toward (master_gain) over about RB_SYNTH_LIMITER_RELEASE_MS.
+ * We ramp linearly from the previous chunk's gain, and rb_mix_finish_s32() catches any overshoot during the ramp.
  */
  
-static int rb_synth_update_signal_multi(int16_t *v,int c,int framec,struct rb_synth *synth) {
-  int i=synth->pcmrunc;
-  struct rb_pcmrun *pcmrun=synth->pcmrunv+i;
-  while (i-->0) {
-    pcmrun--;
-    int16_t *vv=v;
-    int ii=framec;
-    while (ii-->0) {
-      if (pcmrun->p>=pcmrun->pcm->c) break;
-      int16_t sample=pcmrun->pcm->v[pcmrun->p++];
-      int jj=synth->chanc;
-      while (jj-->0) {
-        (*vv)+=sample;
-        vv++;
-      }
+#define RB_SYNTH_LIMITER_RELEASE_MS 100
+ 
+static float rb_synth_limit(const int32_t *bus,int c,struct rb_synth *synth) {
+  float gain=synth->master_gain;
+  if (synth->limit) {
+    int32_t peak=rb_mix_peak_s32(bus,c);
+    if (peak*gain>32767.0f) {
+      gain=32767.0f/peak;
+    } else if (synth->limiter_gain<gain) {
+      float k=(c*1000.0f)/(synth->rate*(float)RB_SYNTH_LIMITER_RELEASE_MS);
+      if (k>1.0f) k=1.0f;
+      gain=synth->limiter_gain+(gain-synth->limiter_gain)*k;
+      // Snap to the exact target when close; unity gain is our fast path.
+      if (synth->master_gain-gain<0.0001f) gain=synth->master_gain;
     }
-    if (pcmrun->p>=pcmrun->pcm->c) {
-      rb_pcmrun_cleanup(pcmrun);
-      synth->pcmrunc--;
-      memmove(pcmrun,pcmrun+1,sizeof(struct rb_pcmrun)*(synth->pcmrunc-i));
+  }
+  return gain;
+}
+
+/* Generate signal.
+ * Mix in chunks on the wide bus, limit, narrow to mono, then expand to each channel.
+ */
+ 
+#define RB_SYNTH_BUS_CHUNK 512
+ 
+static int rb_synth_update_signal(int16_t *v,int framec,struct rb_synth *synth) {
+  int32_t bus[RB_SYNTH_BUS_CHUNK];
+  int16_t mono[RB_SYNTH_BUS_CHUNK];
+  while (framec>0) {
+    int chunkc=framec;
+    if (chunkc>RB_SYNTH_BUS_CHUNK) chunkc=RB_SYNTH_BUS_CHUNK;
+    memset(bus,0,sizeof(int32_t)*chunkc);
+    if (rb_synth_mix_bus(bus,chunkc,synth)<0) return -1;
+    float gain=rb_synth_limit(bus,chunkc,synth);
+    if (synth->chanc==1) {
+      rb_mix_finish_s32(v,bus,chunkc,synth->limiter_gain,gain);
+    } else {
+      rb_mix_finish_s32(mono,bus,chunkc,synth->limiter_gain,gain);
+      rb_mix_expand_s16(v,mono,chunkc,synth->chanc);
     }
+    synth->limiter_gain=gain;
+    v+=chunkc*synth->chanc;
+    framec-=chunkc;
   }
   return 0;
 }
@@ -187,8 +281,10 @@ int rb_synth_update(int16_t *v,int c,struct rb_synth *synth) {
   int framec=c/synth->chanc;
   if (rb_synth_update_pcmprint(synth,framec)<0) return -1;
   synth->new_printer_framec=framec;
-
-  memset(v,0,c<<1);
+  
+  // We overwrite all full frames. Zero any partial frame at the end.
+  int extrac=c-framec*synth->chanc;
+  if (extrac>0) memset(v+c-extrac,0,extrac<<1);
   
   if (synth->song) {
     while (framec>0) {
@@ -207,26 +303,28 @@ int rb_synth_update(int16_t *v,int c,struct rb_synth *synth) {
           synth->song=0;
         }
       }
-      if (synth->chanc==1) {
-        if (rb_synth_update_signal_mono(v,err,synth)<0) return -1;
-        v+=err;
-      } else {
-        int samplec=err*synth->chanc;
-        if (rb_synth_update_signal_multi(v,samplec,err,synth)<0) return -1;
-        v+=samplec;
-      }
+      if (rb_synth_update_signal(v,err,synth)<0) return -1;
+      v+=err*synth->chanc;
     }
     
-  } else if (synth->chanc==1) {
-    if (rb_synth_update_signal_mono(v,c,synth)<0) return -1;
   } else {
-    if (rb_synth_update_signal_multi(v,c,framec,synth)<0) return -1;
+    if (rb_synth_update_signal(v,framec,synth)<0) return -1;
   }
   
   synth->new_printer_framec=0;
   return 0;
 }
 
+/* Master gain.
+ */
+ 
+int rb_synth_set_master_gain(struct rb_synth *synth,float gain) {
+  if ((gain<0.0f)||(gain>RB_SYNTH_MASTER_GAIN_LIMIT)) return -1;
+  synth->master_gain=gain;
+  if (!synth->limit||(synth->limiter_gain>gain)) synth->limiter_gain=gain;
+  return 0;
+}
+
 /* Drop all playback.
  */
 
@@ -260,7 +358,102 @@ int rb_synth_play_song(struct rb_synth *synth,struct rb_song *song,int restart)
   if (!player) return -1;
   if (synth->song) rb_song_player_del(synth->song);
   synth->song=player;
+  
+  // Failure to prewarm is not an error; we'll just print at the usual time.
+  rb_synth_prewarm_song(synth,song);
+
+  return 0;
+}
+
+/* Prewarm printers.
+ */
+ 
+static int rb_synth_find_prewarm(const struct rb_synth *synth,uint64_t key) {
+  int i=synth->prewarmc;
+  while (i-->0) {
+    if (synth->prewarmv[i]->key==key) return i;
+  }
+  return -1;
+}
+
+// Returns STRONG, and removes from the prewarm list.
+static struct rb_pcmprint *rb_synth_take_prewarm(struct rb_synth *synth,uint64_t key) {
+  if (!key) return 0;
+  int p=rb_synth_find_prewarm(synth,key);
+  if (p<0) return 0;
+  struct rb_pcmprint *pcmprint=synth->prewarmv[p];
+  synth->prewarmc--;
+  memmove(synth->prewarmv+p,synth->prewarmv+p+1,sizeof(void*)*(synth->prewarmc-p));
+  
+  // If the PCM was evicted since we started, the printer is stale.
+  // (if the program was replaced, its key changed and we wouldn't have found it).
+  int storep=rb_pcm_store_search(synth->pcm_store,key);
+  if ((storep<0)||(synth->pcm_store->entryv[storep].pcm!=pcmprint->pcm)) {
+    rb_pcmprint_del(pcmprint);
+    return 0;
+  }
+  return pcmprint;
+}
+
+static int rb_synth_add_prewarm(struct rb_synth *synth,struct rb_pcmprint *pcmprint) {
+  if (synth->prewarmc>=synth->prewarma) {
+    int na=synth->prewarma+32;
+    if (na>INT_MAX/sizeof(void*)) return -1;
+    void *nv=realloc(synth->prewarmv,sizeof(void*)*na);
+    if (!nv) return -1;
+    synth->prewarmv=nv;
+    synth->prewarma=na;
+  }
+  if (rb_pcmprint_ref(pcmprint)<0) return -1;
+  synth->prewarmv[synth->prewarmc++]=pcmprint;
+  if (rb_pcmprint_pool_add(synth->pcmprint_pool,pcmprint)<0) return -1;
+  return 0;
+}
 
+/* Prewarm song.
+ */
+ 
+int rb_synth_prewarm_song(struct rb_synth *synth,struct rb_song *song) {
+  if (!song) return 0;
+  
+  // Don't start more printers than the PCM store will keep, or the pool can take.
+  // A prewarm printer nobody runs would leave an unfinished PCM in the store.
+  int limit=synth->pcm_store->count_target-synth->prewarmc;
+  if (synth->pcmprint_pool) {
+    int room=RB_PCMPRINT_POOL_SIZE_LIMIT-synth->pcmprint_pool->heldc;
+    if (room<limit) limit=room;
+  }
+  
+  uint8_t seen[0x4000>>3]={0};
+  const uint16_t *cmd=song->cmdv;
+  int i=song->cmdc;
+  for (;i-->0;cmd++) {
+    if (((*cmd)&RB_SONG_CMD_TYPE_MASK)!=RB_SONG_CMD_NOTE) continue;
+    uint8_t programid=((*cmd)>>7)&0x7f;
+    uint8_t noteid=(*cmd)&0x7f;
+    int seenp=(programid<<7)|noteid;
+    if (seen[seenp>>3]&(1<<(seenp&7))) continue;
+    seen[seenp>>3]|=1<<(seenp&7);
+    
+    if (!rb_program_store_get_config(synth->program_store,programid,1)) continue;
+    if (!synth->pcmprint_pool) continue;
+    if (limit<1) continue;
+    uint64_t key=rb_program_store_get_key(synth->program_store,programid,noteid);
+    if (!key) continue;
+    if (rb_pcm_store_search(synth->pcm_store,key)>=0) continue;
+    if (rb_synth_find_prewarm(synth,key)>=0) continue;
+    
+    struct rb_pcm *pcm=0;
+    struct rb_pcmprint *pcmprint=0;
+    if (rb_program_store_get_note(&pcm,&pcmprint,synth->program_store,programid,noteid)<0) return -1;
+    rb_pcm_del(pcm);
+    if (pcmprint) {
+      int err=rb_synth_add_prewarm(synth,pcmprint);
+      rb_pcmprint_del(pcmprint);
+      if (err<0) return -1;
+      limit--;
+    }
+  }
   return 0;
 }
 
@@ -298,14 +491,18 @@ static int rb_synth_add_pcmprint(struct rb_synth *synth,struct rb_pcmprint *pcmp
   
   // If we are mid-update, print at least enough frames to finish the update.
   // Also, lucky, if that happens to complete it, no need to actually add.
+  // Workers can't help with this part; we need those frames right now.
   if (synth->new_printer_framec>0) {
-    int err=rb_pcmprint_update(pcmprint,synth->new_printer_framec);
+    int err=rb_pcmprint_require(pcmprint,synth->new_printer_framec);
     if (err<=0) return err;
   }
   
   if (rb_pcmprint_ref(pcmprint)<0) return -1;
   synth->pcmprintv[synth->pcmprintc++]=pcmprint;
   
+  // If the pool fails, we can still print inline.
+  if (synth->pcmprint_pool) rb_pcmprint_pool_add(synth->pcmprint_pool,pcmprint);
+  
   return 0;
 }
 
@@ -341,7 +538,13 @@ int rb_synth_play_note(struct rb_synth *synth,uint8_t programid,uint8_t noteid)
   
   struct rb_pcm *pcm=0;
   struct rb_pcmprint *pcmprint=0;
-  if (rb_program_store_get_note(&pcm,&pcmprint,synth->program_store,programid,noteid)<0) {
+  if (synth->prewarmc&&(pcmprint=rb_synth_take_prewarm(synth,rb_program_store_get_key(synth->program_store,programid,noteid)))) {
+    if (rb_pcm_ref(pcmprint->pcm)<0) {
+      rb_pcmprint_del(pcmprint);
+      return -1;
+    }
+    pcm=pcmprint->pcm;
+  } else if (rb_program_store_get_note(&pcm,&pcmprint,synth->program_store,programid,noteid)<0) {
     return rb_synth_error(synth,"Failed to acquire PCM for note %02x:%02x",programid,noteid);
   }
   if (pcmprint) {
@@ -0,0 +1,316 @@
+#include "rabbit/rb_internal.h"
+#include "rabbit/rb_wave.h"
+#include "rabbit/rb_simd.h"
+
+#if RB_SIMD_SSE2||RB_SIMD_NEON
+  #define RB_WAVE_VECTOR 1
+#endif
+
+/* Fixed phase to float 0..1.
+ * Top 24 bits only, so the conversion is exact and never reaches 1.
+ */
+
+#define RB_WAVE_FIXED_TO_FLOAT (1.0f/16777216.0f)
+
+/* Vector blocks, 4 samples each.
+ * Every kernel runs its tail through these too, padded.
+ */
+
+#if RB_SIMD_SSE2
+
+static inline void rb_wave_phase_out4(rb_sample_t *dst,__m128i vp) {
+  __m128 f=_mm_cvtepi32_ps(_mm_srli_epi32(vp,8));
+  _mm_storeu_ps(dst,_mm_mul_ps(f,_mm_set1_ps(RB_WAVE_FIXED_TO_FLOAT)));
+}
+
+static inline uint32_t rb_wave_phase_ratev4(rb_sample_t *dst,const rb_sample_t *ratev,uint32_t p,rb_sample_t k) {
+  __m128 x=_mm_mul_ps(_mm_loadu_ps(ratev),_mm_set1_ps(k));
+  __m128 r=_mm_sub_ps(x,_mm_cvtepi32_ps(_mm_cvtps_epi32(x)));
+  // -0.5 and 0.5 both overflow to 0x80000000, which happens to be correct.
+  __m128i step=_mm_cvttps_epi32(_mm_mul_ps(r,_mm_set1_ps(4294967296.0f)));
+  __m128i sum=_mm_add_epi32(step,_mm_slli_si128(step,4));
+  sum=_mm_add_epi32(sum,_mm_slli_si128(sum,8));
+  rb_wave_phase_out4(dst,_mm_add_epi32(_mm_set1_epi32(p),_mm_sub_epi32(sum,step)));
+  return p+(uint32_t)_mm_cvtsi128_si32(_mm_shuffle_epi32(sum,0xff));
+}
+
+static inline void rb_wave_sine4(rb_sample_t *dst,const rb_sample_t *phasev,rb_sample_t level) {
+  __m128 signmask=_mm_set1_ps(-0.0f);
+  __m128 x=_mm_loadu_ps(phasev);
+  __m128 r=_mm_sub_ps(x,_mm_cvtepi32_ps(_mm_cvtps_epi32(x)));
+  __m128 sign=_mm_and_ps(r,signmask);
+  __m128 a=_mm_andnot_ps(signmask,r);
+  a=_mm_min_ps(a,_mm_sub_ps(_mm_set1_ps(0.5f),a));
+  r=_mm_or_ps(a,sign);
+  __m128 r2=_mm_mul_ps(r,r);
+  __m128 n=_mm_set1_ps(RB_WAVE_SINE_C11);
+  n=_mm_add_ps(_mm_mul_ps(n,r2),_mm_set1_ps(RB_WAVE_SINE_C9));
+  n=_mm_add_ps(_mm_mul_ps(n,r2),_mm_set1_ps(RB_WAVE_SINE_C7));
+  n=_mm_add_ps(_mm_mul_ps(n,r2),_mm_set1_ps(RB_WAVE_SINE_C5));
+  n=_mm_add_ps(_mm_mul_ps(n,r2),_mm_set1_ps(RB_WAVE_SINE_C3));
+  n=_mm_add_ps(_mm_mul_ps(n,r2),_mm_set1_ps(RB_WAVE_SINE_C1));
+  _mm_storeu_ps(dst,_mm_mul_ps(_mm_mul_ps(n,r),_mm_set1_ps(level)));
+}
+
+static inline void rb_wave_square4(rb_sample_t *dst,const rb_sample_t *phasev,rb_sample_t level) {
+  __m128 mask=_mm_cmplt_ps(_mm_loadu_ps(phasev),_mm_set1_ps(0.5f));
+  _mm_storeu_ps(dst,_mm_or_ps(_mm_and_ps(mask,_mm_set1_ps(level)),_mm_andnot_ps(mask,_mm_set1_ps(-level))));
+}
+
+static inline void rb_wave_saw4(rb_sample_t *dst,const rb_sample_t *phasev,rb_sample_t base,rb_sample_t k) {
+  _mm_storeu_ps(dst,_mm_add_ps(_mm_set1_ps(base),_mm_mul_ps(_mm_loadu_ps(phasev),_mm_set1_ps(k))));
+}
+
+static inline void rb_wave_triangle4(rb_sample_t *dst,const rb_sample_t *phasev,rb_sample_t level) {
+  __m128 one=_mm_set1_ps(1.0f);
+  __m128 two=_mm_set1_ps(2.0f);
+  __m128 d=_mm_andnot_ps(_mm_set1_ps(-0.0f),_mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(phasev),two),one));
+  _mm_storeu_ps(dst,_mm_mul_ps(_mm_set1_ps(level),_mm_sub_ps(one,_mm_mul_ps(d,two))));
+}
+
+#elif RB_SIMD_NEON
+
+static inline void rb_wave_phase_out4(rb_sample_t *dst,uint32x4_t vp) {
+  vst1q_f32(dst,vmulq_n_f32(vcvtq_f32_u32(vshrq_n_u32(vp,8)),RB_WAVE_FIXED_TO_FLOAT));
+}
+
+// No round-to-nearest conversion before ARMv8, so bias by half and truncate.
+static inline float32x4_t rb_wave_round_neon(float32x4_t x) {
+  float32x4_t bias=vbslq_f32(vcltq_f32(x,vdupq_n_f32(0.0f)),vdupq_n_f32(-0.5f),vdupq_n_f32(0.5f));
+  return vcvtq_f32_s32(vcvtq_s32_f32(vaddq_f32(x,bias)));
+}
+
+static inline uint32_t rb_wave_phase_ratev4(rb_sample_t *dst,const rb_sample_t *ratev,uint32_t p,rb_sample_t k) {
+  float32x4_t x=vmulq_n_f32(vld1q_f32(ratev),k);
+  float32x4_t r=vsubq_f32(x,rb_wave_round_neon(x));
+  // NEON saturates out-of-range conversions, so convert at half scale and shift, to keep 0.5 exact.
+  uint32x4_t step=vreinterpretq_u32_s32(vshlq_n_s32(vcvtq_s32_f32(vmulq_n_f32(r,2147483648.0f)),1));
+  uint32x4_t zero=vdupq_n_u32(0);
+  uint32x4_t sum=vaddq_u32(step,vextq_u32(zero,step,3));
+  sum=vaddq_u32(sum,vextq_u32(zero,sum,2));
+  rb_wave_phase_out4(dst,vaddq_u32(vdupq_n_u32(p),vsubq_u32(sum,step)));
+  return p+vgetq_lane_u32(sum,3);
+}
+
+static inline void rb_wave_sine4(rb_sample_t *dst,const rb_sample_t *phasev,rb_sample_t level) {
+  float32x4_t x=vld1q_f32(phasev);
+  float32x4_t r=vsubq_f32(x,rb_wave_round_neon(x));
+  float32x4_t a=vabsq_f32(r);
+  a=vminq_f32(a,vsubq_f32(vdupq_n_f32(0.5f),a));
+  r=vbslq_f32(vcltq_f32(r,vdupq_n_f32(0.0f)),vnegq_f32(a),a);
+  float32x4_t r2=vmulq_f32(r,r);
+  float32x4_t n=vdupq_n_f32(RB_WAVE_SINE_C11);
+  n=vmlaq_f32(vdupq_n_f32(RB_WAVE_SINE_C9),n,r2);
+  n=vmlaq_f32(vdupq_n_f32(RB_WAVE_SINE_C7),n,r2);
+  n=vmlaq_f32(vdupq_n_f32(RB_WAVE_SINE_C5),n,r2);
+  n=vmlaq_f32(vdupq_n_f32(RB_WAVE_SINE_C3),n,r2);
+  n=vmlaq_f32(vdupq_n_f32(RB_WAVE_SINE_C1),n,r2);
+  vst1q_f32(dst,vmulq_n_f32(vmulq_f32(n,r),level));
+}
+
+static inline void rb_wave_square4(rb_sample_t *dst,const rb_sample_t *phasev,rb_sample_t level) {
+  uint32x4_t mask=vcltq_f32(vld1q_f32(phasev),vdupq_n_f32(0.5f));
+  vst1q_f32(dst,vbslq_f32(mask,vdupq_n_f32(level),vdupq_n_f32(-level)));
+}
+
+static inline void rb_wave_saw4(rb_sample_t *dst,const rb_sample_t *phasev,rb_sample_t base,rb_sample_t k) {
+  vst1q_f32(dst,vmlaq_n_f32(vdupq_n_f32(base),vld1q_f32(phasev),k));
+}
+
+static inline void rb_wave_triangle4(rb_sample_t *dst,const rb_sample_t *phasev,rb_sample_t level) {
+  float32x4_t one=vdupq_n_f32(1.0f);
+  float32x4_t d=vabsq_f32(vsubq_f32(vmulq_n_f32(vld1q_f32(phasev),2.0f),one));
+  vst1q_f32(dst,vmulq_n_f32(vsubq_f32(one,vmulq_n_f32(d,2.0f)),level));
+}
+
+#endif
+
+/* Run a 4-sample block function over the whole input, padding the tail.
+ * (...) are the block function's trailing arguments.
+ */
+
+#define RB_WAVE_RUN4(fn,dst,src,c,...) { \
+  for (;c>=4;c-=4,dst+=4,src+=4) fn(dst,src,##__VA_ARGS__); \
+  if (c>0) { \
+    rb_sample_t _tmp[4]={0}; \
+    memcpy(_tmp,src,sizeof(rb_sample_t)*c); \
+    fn(_tmp,_tmp,##__VA_ARGS__); \
+    memcpy(dst,_tmp,sizeof(rb_sample_t)*c); \
+  } \
+}
+
+/* Phase, constant rate.
+ */
+
+uint32_t rb_wave_phase_const(rb_sample_t *dst,int c,uint32_t p,uint32_t dp) {
+  #if RB_SIMD_SSE2
+    if (c>=4) {
+      __m128i vp=_mm_set_epi32(p+dp*3,p+dp*2,p+dp,p);
+      __m128i step=_mm_set1_epi32(dp*4);
+      for (;c>=4;c-=4,dst+=4,p+=dp*4) {
+        rb_wave_phase_out4(dst,vp);
+        vp=_mm_add_epi32(vp,step);
+      }
+    }
+  #elif RB_SIMD_NEON
+    if (c>=4) {
+      const uint32_t lanev[4]={0,1,2,3};
+      uint32x4_t vp=vmlaq_n_u32(vdupq_n_u32(p),vld1q_u32(lanev),dp);
+      uint32x4_t step=vdupq_n_u32(dp*4);
+      for (;c>=4;c-=4,dst+=4,p+=dp*4) {
+        rb_wave_phase_out4(dst,vp);
+        vp=vaddq_u32(vp,step);
+      }
+    }
+  #endif
+  // Integer phase converts exactly, so a scalar tail agrees with the vectors.
+  for (;c-->0;dst++,p+=dp) {
+    *dst=(rb_sample_t)(p>>8)*RB_WAVE_FIXED_TO_FLOAT;
+  }
+  return p;
+}
+
+/* Phase, variable rate.
+ * Within a vector, each lane's phase is a prefix sum of the steps before it.
+ */
+
+uint32_t rb_wave_phase_ratev(rb_sample_t *dst,const rb_sample_t *ratev,int c,uint32_t p,rb_sample_t k) {
+  #if RB_WAVE_VECTOR
+    for (;c>=4;c-=4,dst+=4,ratev+=4) {
+      p=rb_wave_phase_ratev4(dst,ratev,p,k);
+    }
+    if (c>0) {
+      // Zero padding steps zero, so the block's result is still right.
+      rb_sample_t tmp[4]={0};
+      memcpy(tmp,ratev,sizeof(rb_sample_t)*c);
+      p=rb_wave_phase_ratev4(tmp,tmp,p,k);
+      memcpy(dst,tmp,sizeof(rb_sample_t)*c);
+    }
+  #else
+    for (;c-->0;dst++,ratev++) {
+      uint32_t step=rb_wave_phase_fixed((*ratev)*k);
+      *dst=(rb_sample_t)(p>>8)*RB_WAVE_FIXED_TO_FLOAT;
+      p+=step;
+    }
+  #endif
+  return p;
+}
+
+/* Sine.
+ * Reduce to -0.5..0.5, fold into -0.25..0.25 by symmetry, then polynomial.
+ */
+
+void rb_wave_sine(rb_sample_t *dst,const rb_sample_t *phasev,int c,rb_sample_t level) {
+  #if RB_WAVE_VECTOR
+    RB_WAVE_RUN4(rb_wave_sine4,dst,phasev,c,level)
+  #else
+    for (;c-->0;dst++,phasev++) {
+      rb_sample_t p=*phasev;
+      rb_sample_t r=p-(rb_sample_t)(int)(p+((p<0.0f)?-0.5f:0.5f));
+      if (r>0.25f) r=0.5f-r;
+      else if (r<-0.25f) r=-0.5f-r;
+      rb_sample_t r2=r*r;
+      *dst=r*(RB_WAVE_SINE_C1+r2*(RB_WAVE_SINE_C3+r2*(RB_WAVE_SINE_C5+r2*(RB_WAVE_SINE_C7+r2*(RB_WAVE_SINE_C9+r2*RB_WAVE_SINE_C11)))))*level;
+    }
+  #endif
+}
+
+/* Square.
+ */
+
+void rb_wave_square(rb_sample_t *dst,const rb_sample_t *phasev,int c,rb_sample_t level) {
+  #if RB_WAVE_VECTOR
+    RB_WAVE_RUN4(rb_wave_square4,dst,phasev,c,level)
+  #else
+    for (;c-->0;dst++,phasev++) {
+      *dst=((*phasev)<0.5f)?level:-level;
+    }
+  #endif
+}
+
+/* Saw.
+ */
+
+void rb_wave_saw(rb_sample_t *dst,const rb_sample_t *phasev,int c,rb_sample_t base,rb_sample_t k) {
+  #if RB_WAVE_VECTOR
+    RB_WAVE_RUN4(rb_wave_saw4,dst,phasev,c,base,k)
+  #else
+    for (;c-->0;dst++,phasev++) {
+      *dst=base+(*phasev)*k;
+    }
+  #endif
+}
+
+/* Triangle.
+ */
+
+void rb_wave_triangle(rb_sample_t *dst,const rb_sample_t *phasev,int c,rb_sample_t level) {
+  #if RB_WAVE_VECTOR
+    RB_WAVE_RUN4(rb_wave_triangle4,dst,phasev,c,level)
+  #else
+    for (;c-->0;dst++,phasev++) {
+      rb_sample_t d=(*phasev)*2.0f-1.0f;
+      if (d<0.0f) d=-d;
+      *dst=level*(1.0f-d*2.0f);
+    }
+  #endif
+}
+
+/* Wavetable.
+ * Only AVX2 has a gather; everywhere else it's scalar.
+ * Both do the same arithmetic in the same order, but still pad the vector tail, to keep the rule simple.
+ * AVX2 is either assumed by the build, or compiled separately and checked at runtime.
+ */
+
+#if RB_SIMD_AVX2
+  #define RB_WAVE_AVX2 1
+  #define RB_WAVE_TARGET_AVX2
+  #define rb_wave_use_avx2() 1
+#elif RB_SIMD_AVX2_DISPATCH
+  #define RB_WAVE_AVX2 1
+  #define RB_WAVE_TARGET_AVX2 RB_SIMD_TARGET_AVX2
+  #define rb_wave_use_avx2() rb_simd_have_avx2()
+#endif
+
+#if RB_WAVE_AVX2
+
+static inline RB_WAVE_TARGET_AVX2 void rb_wave_table8(rb_sample_t *dst,const rb_sample_t *phasev,const rb_sample_t *tablev,int tablec) {
+  __m256 x=_mm256_mul_ps(_mm256_loadu_ps(phasev),_mm256_set1_ps((rb_sample_t)tablec));
+  __m256 fl=_mm256_floor_ps(x);
+  __m256 frac=_mm256_sub_ps(x,fl);
+  __m256i i=_mm256_and_si256(_mm256_cvttps_epi32(fl),_mm256_set1_epi32(tablec-1));
+  __m256 a=_mm256_i32gather_ps(tablev,i,4);
+  __m256 b=_mm256_i32gather_ps(tablev,_mm256_add_epi32(i,_mm256_set1_epi32(1)),4);
+  _mm256_storeu_ps(dst,_mm256_add_ps(a,_mm256_mul_ps(_mm256_sub_ps(b,a),frac)));
+}
+
+static RB_WAVE_TARGET_AVX2 void rb_wave_table_avx2(rb_sample_t *dst,const rb_sample_t *phasev,int c,const rb_sample_t *tablev,int tablec) {
+  for (;c>=8;c-=8,dst+=8,phasev+=8) rb_wave_table8(dst,phasev,tablev,tablec);
+  if (c>0) {
+    rb_sample_t tmp[8]={0};
+    memcpy(tmp,phasev,sizeof(rb_sample_t)*c);
+    rb_wave_table8(tmp,tmp,tablev,tablec);
+    memcpy(dst,tmp,sizeof(rb_sample_t)*c);
+  }
+}
+
+#endif
+
+void rb_wave_table(rb_sample_t *dst,const rb_sample_t *phasev,int c,const rb_sample_t *tablev,int tablec) {
+  #if RB_WAVE_AVX2
+    if (rb_wave_use_avx2()) {
+      rb_wave_table_avx2(dst,phasev,c,tablev,tablec);
+      return;
+    }
+  #endif
+  rb_sample_t scale=(rb_sample_t)tablec;
+  int mask=tablec-1;
+  for (;c-->0;dst++,phasev++) {
+    rb_sample_t x=(*phasev)*scale;
+    int i=(int)x;
+    if (x<(rb_sample_t)i) i--;
+    rb_sample_t frac=x-(rb_sample_t)i;
+    i&=mask;
+    *dst=tablev[i]+(tablev[i+1]-tablev[i])*frac;
+  }
+}
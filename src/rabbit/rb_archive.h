@@ -11,6 +11,7 @@
 #define RB_RES_TYPE_grid RB_RES_TYPE('g','r','i','d')
 #define RB_RES_TYPE_text RB_RES_TYPE('t','e','x','t')
 #define RB_RES_TYPE_data RB_RES_TYPE('d','a','t','a')
+#define RB_RES_TYPE_palt RB_RES_TYPE('p','a','l','t') /* rb_palette_new_decode() */
 
 /* Opens, decompresses, and decodes an archive file.
  * Each member is presented to your callback in the order we find them.
@@ -40,6 +40,7 @@ int rb_audio_ref(struct rb_audio *audio);
 /* Implementations probably use only one of update or lock/unlock.
  * It is safe to call these wrapper functions whether implemented or not.
  * Driver guarantees that your callback is not running while you hold the lock.
+ * Lock and unlock on a null (audio) are noops, for running a synth without any driver.
  */
 int rb_audio_update(struct rb_audio *audio);
 int rb_audio_lock(struct rb_audio *audio);
@@ -0,0 +1,47 @@
+/* rb_dirty.h
+ * List of framebuffer regions that changed since the previous frame.
+ * rb_vmgr_render() produces one of these, and video drivers may use it to upload less.
+ */
+ 
+#ifndef RB_DIRTY_H
+#define RB_DIRTY_H
+
+/* Past this many rects, we collapse to one bounding rect.
+ */
+#define RB_DIRTY_LIMIT 32
+
+struct rb_dirty_rect {
+  int x,y,w,h;
+};
+
+struct rb_dirty {
+  int rectc;
+  struct rb_dirty_rect rectv[RB_DIRTY_LIMIT];
+};
+
+static inline void rb_dirty_clear(struct rb_dirty *dirty) {
+  dirty->rectc=0;
+}
+
+/* Replace content with the whole framebuffer.
+ */
+void rb_dirty_all(struct rb_dirty *dirty);
+
+/* Add a rect, clipping to the framebuffer and merging with any it overlaps.
+ * Rects in the list never overlap each other.
+ */
+void rb_dirty_add(struct rb_dirty *dirty,int x,int y,int w,int h);
+
+/* Move all rects by (dx,dy) and clip.
+ */
+void rb_dirty_shift(struct rb_dirty *dirty,int dx,int dy);
+
+static inline int rb_dirty_rect_intersects(const struct rb_dirty_rect *rect,int x,int y,int w,int h) {
+  if (x>=rect->x+rect->w) return 0;
+  if (y>=rect->y+rect->h) return 0;
+  if (x+w<=rect->x) return 0;
+  if (y+h<=rect->y) return 0;
+  return 1;
+}
+
+#endif
@@ -38,6 +38,7 @@
 #define RB_ALPHAMODE_COLORKEY 1 /* Only pixel 0x00000000 is transparent, all others opaque. */
 #define RB_ALPHAMODE_DISCRETE 2 /* Alpha >=0x80 is 100% opaque, <=0x7f is 100% transparent. */
 #define RB_ALPHAMODE_OPAQUE   3 /* No alpha at all. */
+#define RB_ALPHAMODE_PREMUL   4 /* Like BLEND, but colors are already multiplied by alpha. Cheaper to blit; use for sources only. */
  
 struct rb_image {
   int refc;
@@ -50,6 +51,46 @@ struct rb_image *rb_image_new(int w,int h);
 void rb_image_del(struct rb_image *image);
 int rb_image_ref(struct rb_image *image);
 
+/* Convert a BLEND image to PREMUL in place. Noop for any other alphamode.
+ * Fully opaque pixels are not touched, and blitting the result matches BLEND within one per channel.
+ */
+void rb_image_premultiply(struct rb_image *image);
+
+/* Indexed images: One byte per pixel, looked up in a palette of 256 colors when you blit.
+ * A quarter the size of ARGB, and a different palette recolors the image without copying any pixels.
+ * Palette colors follow the same rules as the pixels of an ARGB image in the palette's alphamode.
+ * Unused entries are zero.
+ */
+struct rb_palette {
+  int refc;
+  int alphamode;
+  uint32_t v[256];
+};
+
+struct rb_palette *rb_palette_new();
+void rb_palette_del(struct rb_palette *palette);
+int rb_palette_ref(struct rb_palette *palette);
+
+// Same as rb_image_premultiply(), for every color in the palette.
+void rb_palette_premultiply(struct rb_palette *palette);
+
+struct rb_image8 {
+  int refc;
+  int w,h;
+  struct rb_palette *palette; // Default for blitting. If null, you must supply one each time.
+  uint8_t pixels[];
+};
+
+struct rb_image8 *rb_image8_new(int w,int h);
+void rb_image8_del(struct rb_image8 *image);
+int rb_image8_ref(struct rb_image8 *image);
+int rb_image8_set_palette(struct rb_image8 *image,struct rb_palette *palette);
+
+/* New ARGB image with the colors of (src), from (palette) or its own if null.
+ * Alphamode is the palette's.
+ */
+struct rb_image *rb_image8_expand(const struct rb_image8 *src,const struct rb_palette *palette);
+
 #define RB_FB_W 256
 #define RB_FB_H 144
 #define RB_FB_SIZE_BYTES (RB_FB_W*RB_FB_H*4)
@@ -61,6 +102,8 @@ struct rb_image *rb_framebuffer_new();
  *   00fff000 width-1
  *   00000fff height-1
  * Then pixels, rows padded to one byte.
+ * Images with continuous alpha come out PREMUL.
+ * I8 images decode to ARGB here; use rb_image8_new_decode() to keep them indexed.
  */
 struct rb_image *rb_image_new_decode(const void *src,int srcc);
 #define RB_IMAGE_FORMAT_RGBA    0x01 /* 32-bit RGBA */
@@ -68,6 +111,22 @@ struct rb_image *rb_image_new_decode(const void *src,int srcc);
 #define RB_IMAGE_FORMAT_RGBCK   0x03 /* 24-bit RGB and pure black is transparent */
 #define RB_IMAGE_FORMAT_A8      0x04 /* 8-bit alpha */
 #define RB_IMAGE_FORMAT_A1      0x05 /* 1-bit alpha */
+#define RB_IMAGE_FORMAT_I8      0x06 /* Serial palette, then 8-bit indices */
+
+/* Serial palettes are one byte (count-1), then (count) colors of 32-bit RGBA.
+ * Alphamode comes from the alphas: All 0xff is OPAQUE, only 0x00 and 0xff is COLORKEY, anything else PREMUL.
+ * rb_palette_measure() returns the length of the serial palette at (src), or <0 if it's short.
+ */
+struct rb_palette *rb_palette_new_decode(const void *src,int srcc);
+int rb_palette_measure(const void *src,int srcc);
+struct rb_image8 *rb_image8_new_decode(const void *src,int srcc);
+
+/* Append a PNG file to (dst): 8-bit RGB if OPAQUE, otherwise 8-bit RGBA.
+ * COLORKEY gets real alpha; other modes write the alpha byte verbatim (so PREMUL stays premultiplied).
+ * For frame capture and debugging. We never read PNG at runtime.
+ */
+struct rb_encoder;
+int rb_image_encode_png(struct rb_encoder *dst,const struct rb_image *image);
 
 /* Rendering.
  ********************************************************/
@@ -79,6 +138,7 @@ int rb_image_clear(struct rb_image *image,uint32_t argb);
  * Override per-pixel transfer with a custom (blend) function. Beware, that's expensive.
  * (blend) is called for every pixel if input alphamode is BLEND or OPAQUE.
  * For COLORKEY and DISCRETE images, we only call for pixels we think generically are opaque.
+ * PREMUL pixels are passed to (blend) as they are, premultiplied.
  */
 int rb_image_blit(
   struct rb_image *dst,int dstx,int dsty,
@@ -110,6 +170,63 @@ void rb_image_blit_unchecked(
   void *userdata
 );
 
+/* Row kernels for untransformed blits, named for the source alphamode.
+ * rb_image_blit_unchecked() picks one of these when there's no xform or blend hook.
+ *   blend: BLEND onto anything but BLEND.
+ *   premul: PREMUL onto anything but BLEND.
+ *   blend_blend: BLEND onto BLEND.
+ *   colorkey: Copy nonzero pixels.
+ *   discrete: Copy pixels with alpha >=0x80.
+ *   nonzero: OPAQUE onto COLORKEY, copy everything but replace zero with 0xff000000.
+ */
+void rb_image_row_blend(uint32_t *dst,const uint32_t *src,int c);
+void rb_image_row_premul(uint32_t *dst,const uint32_t *src,int c);
+void rb_image_row_blend_blend(uint32_t *dst,const uint32_t *src,int c);
+void rb_image_row_colorkey(uint32_t *dst,const uint32_t *src,int c);
+void rb_image_row_discrete(uint32_t *dst,const uint32_t *src,int c);
+void rb_image_row_nonzero(uint32_t *dst,const uint32_t *src,int c);
+
+/* Straight copies in another order, for blits with an xform. Pointers and strides in pixels.
+ *   reverse: (dst[i]=src[-i]), so (src) points to the last pixel of its row.
+ *   block_transpose: (dst[y*dststride+x]=src[x*srcstride+y*srcstep]), (srcstep) 1 or -1.
+ * Keep transposed blocks small, 16x16 say, so both sides stay in cache.
+ */
+void rb_image_row_reverse(uint32_t *dst,const uint32_t *src,int c);
+void rb_image_block_transpose(
+  uint32_t *dst,int dststride,
+  const uint32_t *src,int srcstride,int srcstep,
+  int w,int h
+);
+
+/* Blit indexed (src) onto (dst), with colors from (palette), or (src->palette) if null.
+ * Same result as blitting rb_image8_expand(src,palette), but it only ever looks up the colors it draws.
+ * No blend hook. rb_image8_blit_safe() fails if there's no palette; rb_image8_blit_unchecked() requires one.
+ */
+int rb_image8_blit_safe(
+  struct rb_image *dst,int dstx,int dsty,
+  const struct rb_image8 *src,int srcx,int srcy,
+  int w,int h,
+  uint8_t xform,
+  const struct rb_palette *palette
+);
+void rb_image8_blit_unchecked(
+  struct rb_image *dst,int dstx,int dsty,
+  const struct rb_image8 *src,int srcx,int srcy,
+  int w,int h,
+  uint8_t xform,
+  const struct rb_palette *palette
+);
+
+/* Write colors from (palette) into (dst) verbatim, alpha and all, regardless of alphamodes. No xform.
+ * Clips like rb_image8_blit_safe().
+ */
+int rb_image8_copy_safe(
+  struct rb_image *dst,int dstx,int dsty,
+  const struct rb_image8 *src,int srcx,int srcy,
+  int w,int h,
+  const struct rb_palette *palette
+);
+
 /* Adjust (dstx,dsty,srcx,srcy,w,h) if needed to keep all in bounds.
  * Returns >0 if the final bounds are valid.
  */
@@ -175,9 +292,15 @@ void rb_image_darken(struct rb_image *image,uint8_t brightness);
 /* Lighting.
  * For fade-to-black or spotlight effects.
  * Framebuffer gets darkened by a uniform amount, except for circles around designated light sources.
- * This is expensive! Avoid if you don't need it, and use as few lights as possible.
+ * Two stages: Lights rasterize into a light map of per-pixel brightness, then one pass multiplies the framebuffer by it.
+ * All integer: Each light gets a falloff table per draw, and only its own span of each map row is visited.
+ * Still not free. Cost scales with the lit area, so use as few lights as possible.
  ***************************************************************/
  
+#define RB_LIGHTS_BLEND_SCREEN 0 /* Each light lifts what's left: c+(255-c)*l/255. Default. */
+#define RB_LIGHTS_BLEND_ADD    1 /* c+l, saturating. */
+#define RB_LIGHTS_BLEND_MAX    2 /* Brightest light wins. */
+ 
 struct rb_lights {
   
   /* 0x00: Full black. Underlying image is irrevocably destroyed.
@@ -185,12 +308,19 @@ struct rb_lights {
    */
   uint8_t bg;
   
+  int blend; // RB_LIGHTS_BLEND_*, how each light combines with the bg and lights before it.
+  
+  /* Nonzero to rasterize the light map at half resolution and upsample it bilinearly.
+   * About a quarter of the rasterizing work. Soft lights look the same; small hard ones get fuzzy edges.
+   */
+  int halfres;
+  
   struct rb_light {
     int id; // Constant
     int x,y; // Position in world space.
     
     /* (radius) is the fully illuminated inner circle, and (gradius) the additional extent of fading out.
-     * Both must be >=0. If both are zero, the light is noop.
+     * Both must be >=0, and their sum <=RB_LIGHT_EXTENT_LIMIT. If both are zero, the light is noop.
      * I do recommend using gradius, even just 1 softens the circles' edges nicely.
      * Gradients follow a quadratic curve, not linear.
      * That's for computational simplicity, but also I think it looks better.
@@ -198,16 +328,35 @@ struct rb_lights {
     int radius;
     int gradius;
     
+    /* 0xrrggbb, white by default. Each channel lights independently.
+     * If all visible lights are white, we use a smaller map.
+     */
+    uint32_t rgb;
+    
     // Remainder for internal use:
     int visible;
     int ya,yz;
-    double inner,outer;
-    double adjust;
+    int inner,outer; // Squared radii.
+    int lutp; // Falloff table at (lutv+lutp), indexed by (distance**2-inner). <0 if too big, use (lutrecip).
+    int lutrecip; // (1<<40)/(outer-inner)
   } *lightv;
   int lightc,lighta;
   struct rb_image *scratch;
+  uint16_t *lutv; // Light intensity, 0..0xffff. Full intensity inside the inner circle is 0x10000.
+  int luta;
+  
+  // Light map, from rb_lights_prepare(). One byte per pixel, or if (mapcolor) four, laid out like a pixel.
+  uint8_t *mapv;
+  int mapa;
+  int mapw,maph,mapcolor;
+  int *extentv; // (xa,xz) per map row: Everything outside is (bg). Empty if (xa>xz).
+  int extenta;
+  int fbw,fbh,scrollx,scrolly,shift,visiblec;
 };
 
+#define RB_LIGHT_EXTENT_LIMIT 0x7fff
+#define RB_LIGHTS_LUT_SIZE 4096
+
 void rb_lights_cleanup(struct rb_lights *lights);
 
 /* Add a light with id 0 to make up an unused id.
@@ -218,9 +367,10 @@ struct rb_light *rb_lights_get(const struct rb_lights *lights,int id);
 int rb_lights_remove(struct rb_lights *lights,int id);
 int rb_lights_clear(struct rb_lights *lights);
 
-/* Draw (lights->bgargb) over (dst), except where it intersects one of the lights.
+/* Draw (lights->bg) over (dst), except where it intersects one of the lights.
  * (scrollx,scrolly) is subtracted from each light position, normally you get this from vmgr.
  * We only accept OPAQUE images.
+ * Same as rb_lights_prepare(), rb_lights_rasterize(), rb_lights_apply(), over the whole image.
  */
 int rb_lights_draw(
   struct rb_image *dst,
@@ -228,4 +378,14 @@ int rb_lights_draw(
   int scrollx,int scrolly
 );
 
+/* The stages of rb_lights_draw(), for callers that want to split the work by rows, eg across threads.
+ * Prepare once per frame, for an output of (w,h). Nothing else may touch (lights) until the frame is done.
+ * Then rasterize every row, then apply every row.
+ * Rasterize and apply are each safe to run concurrently on disjoint row ranges (y0..y1-1),
+ * but all rasterizing must finish before any applying starts.
+ */
+int rb_lights_prepare(struct rb_lights *lights,int w,int h,int scrollx,int scrolly);
+void rb_lights_rasterize(struct rb_lights *lights,int y0,int y1);
+int rb_lights_apply(struct rb_image *dst,const struct rb_lights *lights,int y0,int y1);
+
 #endif
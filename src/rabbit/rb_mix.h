@@ -0,0 +1,30 @@
+/* rb_mix.h
+ * Low-level kernels for mixing integer PCM.
+ * These use SIMD where available (see rb_simd.h).
+ */
+ 
+#ifndef RB_MIX_H
+#define RB_MIX_H
+
+#include <stdint.h>
+
+/* Copy (framec) mono samples from (src) to every channel of (dst), interleaved.
+ * (dst) must have room for (framec*chanc) samples, and must not overlap (src).
+ */
+void rb_mix_expand_s16(int16_t *dst,const int16_t *src,int framec,int chanc);
+
+/* (dst)+=(src), widening to int32. No saturation needed, for any plausible voice count.
+ */
+void rb_mix_add_s16_s32(int32_t *dst,const int16_t *src,int c);
+
+/* Largest absolute value in (src).
+ */
+int32_t rb_mix_peak_s32(const int32_t *src,int c);
+
+/* Narrow a wide mix bus to int16, with gain ramping linearly from (gain0) to (gain1) across the run.
+ * Anything still out of range saturates.
+ * Unity gain throughout is a straight saturating conversion, no float math.
+ */
+void rb_mix_finish_s32(int16_t *dst,const int32_t *src,int c,float gain0,float gain1);
+
+#endif
@@ -9,6 +9,7 @@
 
 struct rb_synth_node_config;
 struct rb_synth_node_runner;
+struct rb_pcm_map;
 
 /* PCM dump and runner.
  ****************************************************************/
@@ -16,10 +17,17 @@ struct rb_synth_node_runner;
 struct rb_pcm {
   int refc;
   int c;
-  int16_t v[];
+  int readyc; // Samples final so far; less than (c) only while a printer is filling it. Atomic.
+  int16_t *v;
+  struct rb_pcm_map *map; // STRONG, if (v) points into a mapped cache file. Read-only then.
 };
 
 struct rb_pcm *rb_pcm_new(int c);
+
+/* New PCM whose samples live in (map), not copied.
+ * We retain (map) for the PCM's life.
+ */
+struct rb_pcm *rb_pcm_new_view(struct rb_pcm_map *map,const int16_t *v,int c);
 void rb_pcm_del(struct rb_pcm *pcm);
 int rb_pcm_ref(struct rb_pcm *pcm);
 
@@ -33,24 +41,31 @@ int rb_pcmrun_init(struct rb_pcmrun *pcmrun,struct rb_pcm *pcm);
 
 void rb_pcmrun_cleanup(struct rb_pcmrun *pcmrun);
 
-/* Add to (v), mono only.
+/* Add to (v), a wide mix bus, mono only.
+ * Never reads past the PCM's (readyc): if its printer fell behind, the runner stalls and resumes later.
  * Returns >0 if more content remains, 0 if complete, never negative.
  */
-int rb_pcmrun_update(int16_t *v,int c,struct rb_pcmrun *pcmrun);
+int rb_pcmrun_update(int32_t *v,int c,struct rb_pcmrun *pcmrun);
 
 /* PCM Printer.
+ * A printer may be shared between the synth and a worker thread (see rb_pcmprint_pool.h).
+ * Whoever holds (claim) may run the node. (p) and (pcm->readyc) are published atomically after each chunk,
+ * and everything in (pcm) before them is final.
  **************************************************************/
 
 struct rb_pcmprint {
   struct rb_synth *synth; // WEAK
   int refc;
   struct rb_pcm *pcm;
-  int p;
+  int p; // Printed so far. Use rb_pcmprint_get_position() if a worker might be running.
+  int due; // Frames the synth has consumed or will consume this cycle. Owned by the synth.
+  int claim; // Nonzero while someone is printing. Atomic.
   struct rb_synth_node_runner *node;
   rb_sample_t *buf;
   int bufa;
   int16_t qlevel;
-  uint16_t key;
+  uint64_t key; // See rb_pcm_store_generate_key().
+  int pooled; // Nonzero while a rb_pcmprint_pool holds it. Owned by the synth's thread.
 };
 
 struct rb_pcmprint *rb_pcmprint_new(
@@ -62,6 +77,27 @@ void rb_pcmprint_del(struct rb_pcmprint *pcmprint);
 int rb_pcmprint_ref(struct rb_pcmprint *pcmprint);
 
 // Generate at least (c) samples and return 0 if complete, >0 if more remain.
+// Caller must hold the claim, if the printer is shared.
 int rb_pcmprint_update(struct rb_pcmprint *pcmprint,int c);
 
+/* Advance (due) by (c) and try to make sure at least that much is printed.
+ * If a worker is keeping ahead, this is just an atomic read.
+ * Otherwise we try once to claim it and print inline. We never wait: If a worker holds the claim,
+ * it is printing those frames right now, and runners stall until they're published.
+ * Returns 0 if complete, >0 if more remain.
+ */
+int rb_pcmprint_require(struct rb_pcmprint *pcmprint,int c);
+
+/* Try to claim a printer for exclusive use, returns >0 if we got it.
+ * Or claim it unconditionally, spinning if necessary. Never from the audio thread.
+ * Release when you're done.
+ */
+int rb_pcmprint_try_claim(struct rb_pcmprint *pcmprint);
+void rb_pcmprint_claim(struct rb_pcmprint *pcmprint);
+void rb_pcmprint_release(struct rb_pcmprint *pcmprint);
+
+static inline int rb_pcmprint_get_position(const struct rb_pcmprint *pcmprint) {
+  return __atomic_load_n(&pcmprint->p,__ATOMIC_ACQUIRE);
+}
+
 #endif
@@ -0,0 +1,110 @@
+/* rb_pcm_cache.h
+ * Persistent cache of printed PCM: One file per output rate, mapped into memory.
+ * PCMs we hand out are views directly into the mapping, no copying.
+ *
+ * File format. Integers are native byte order; it's a cache, not an interchange format.
+ *   0000   4 Signature: "rPCM"
+ *   0004   4 Byte order check: 0x01020304
+ *   0008   4 Rate, hz.
+ *   000c   4 Format version: 2
+ *   0010 ... Records:
+ *     0000   8 Key, see rb_pcm_store_generate_key(). (program hash<<8)|noteid
+ *     0008   4 Sample count.
+ *     000c   4 Reserved, zero.
+ *     0010 ... Samples, s16, zero-padded to a multiple of 16 bytes.
+ *
+ * Records are only ever appended. A later record for the same key replaces the earlier one.
+ * Keys include a hash of the program's serial, so an edited program just misses and you never need to flush it manually.
+ *
+ * Several processes may share the file. Scans and appends hold flock(LOCK_EX), and appends go after whatever the others wrote.
+ * The file never shrinks in place, since others may have it mapped. When it's invalid, or a record would
+ * take it past RB_PCM_CACHE_SIZE_LIMIT, we write a fresh one and rename it over.
+ */
+ 
+#ifndef RB_PCM_CACHE_H
+#define RB_PCM_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+struct rb_pcm;
+
+#define RB_PCM_CACHE_SIZE_LIMIT (64<<20)
+#define RB_PCM_CACHE_DONE_LIMIT 64
+
+/* One mapping of the file.
+ * We reserve RB_PCM_CACHE_SIZE_LIMIT up front, so the file can grow into it and we never map again.
+ * It lives on while any PCM uses it.
+ */
+struct rb_pcm_map {
+  int refc;
+  void *v;
+  size_t c;
+};
+
+int rb_pcm_map_ref(struct rb_pcm_map *map);
+void rb_pcm_map_del(struct rb_pcm_map *map);
+
+/* Reading and writing happen on different threads.
+ * The synth's thread owns (map,entryv) and does lookups, which never make a syscall.
+ * Print workers append; (writelock) serializes them, and guards the file and (fd,filelen,orig).
+ * Appended records come back to the index through (donev), a ring that lookups drain.
+ */
+struct rb_pcm_cache {
+  int refc;
+  int rate;
+  
+  // Reader, the synth's thread.
+  struct rb_pcm_map *map; // Of the file as it was at open. It never shrinks, so this stays good.
+  struct rb_pcm_cache_entry {
+    uint64_t key;
+    size_t p; // Offset of samples in the file.
+    int c; // Sample count.
+  } *entryv; // Sorted by key.
+  int entryc,entrya;
+  
+  // Writer, any thread holding (writelock).
+  pthread_mutex_t writelock;
+  char *path;
+  int fd;
+  size_t filelen; // End of the last good record.
+  int orig; // Nonzero while (fd) is the file (map) covers. Once it's replaced, our appends are for next time.
+  
+  // Writer produces, under (writelock). Reader consumes. Head and tail count forever and wrap. Atomic.
+  struct rb_pcm_cache_entry donev[RB_PCM_CACHE_DONE_LIMIT];
+  unsigned int donehead,donetail;
+};
+
+/* Open or create the cache file for one rate under directory (root).
+ * We map RB_PCM_CACHE_SIZE_LIMIT and ask the OS to read in what's there now, so later lookups don't touch the disk.
+ * If the file is invalid or for a different rate, we quietly replace it.
+ */
+struct rb_pcm_cache *rb_pcm_cache_open(const char *root,int rate);
+
+void rb_pcm_cache_del(struct rb_pcm_cache *cache);
+int rb_pcm_cache_ref(struct rb_pcm_cache *cache);
+
+/* Returns a new STRONG read-only view, or null if we don't have (key).
+ * Synth's thread only. No syscalls, so it's fine in the audio callback.
+ */
+struct rb_pcm *rb_pcm_cache_get(struct rb_pcm_cache *cache,uint64_t key);
+
+/* Append a record to the file, after indexing any that other processes appended.
+ * Any thread, but it blocks on the file lock, so not the audio callback. Print workers do it.
+ */
+int rb_pcm_cache_add(struct rb_pcm_cache *cache,uint64_t key,const struct rb_pcm *pcm);
+
+int rb_pcm_cache_search(const struct rb_pcm_cache *cache,uint64_t key);
+
+/* Index the records our writers reported since last time. Synth's thread only.
+ * rb_pcm_cache_get() does this for you; call it before reading (entryv) directly.
+ */
+void rb_pcm_cache_collect(struct rb_pcm_cache *cache);
+
+/* Hash of a program's serial data.
+ * Never zero; zero means "no program".
+ */
+uint32_t rb_pcm_cache_hash(const void *src,int srcc);
+
+#endif
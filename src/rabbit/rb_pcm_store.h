@@ -1,5 +1,11 @@
 /* rb_pcm_store.h
  * Cache of printed PCM dumps.
+ * Entries are sorted by key for lookup, and each carries an access stamp for eviction.
+ * When we exceed (limit), the least recently used entries are dropped until we're under (target).
+ *
+ * Keys are (program serial hash, noteid), not (programid, noteid).
+ * So reloading a program orphans only its own notes, and identical programs in different slots share PCM.
+ * Output rate is the third part of the key, implicitly: We unload everything when it changes.
  */
  
 #ifndef RB_PCM_STORE_H
@@ -17,45 +23,64 @@ struct rb_pcm_store {
   int count_limit;
   int count_target;
   
+  struct rb_pcm_cache *cache; // Persistent tier, if (synth->cachedir) set. See rb_pcm_store_open_cache().
+  
   struct rb_pcm_entry {
-    uint16_t key;
+    uint64_t key;
+    uint32_t stamp; // (clock) at the last get or add.
     struct rb_pcm *pcm;
   } *entryv;
   int entryc,entrya;
+  uint32_t clock;
+  
+  // Telemetry, for tuning the limits. Only 'get' counts hits and misses.
+  // Read directly, and zero them whenever you like.
+  int hitc;
+  int missc;
+  int evictc;
 };
 
 struct rb_pcm_store *rb_pcm_store_new(struct rb_synth *synth);
 void rb_pcm_store_del(struct rb_pcm_store *store);
 int rb_pcm_store_ref(struct rb_pcm_store *store);
 
-/* Drop any live objects which might depend on the global output rate.
+/* Drop any live objects which might depend on the global output rate, and close the persistent cache.
  * (Call this during a rate change).
- * Or drop just those associated with a given programid, eg if you're changing that program.
+ * Or drop just those printed from a given program serial, eg when no slot uses it anymore.
+ * Dropping is never necessary for correctness, it just frees memory sooner than eviction would.
  */
 int rb_pcm_store_unload(struct rb_pcm_store *store);
-int rb_pcm_store_drop_program(struct rb_pcm_store *store,uint8_t programid);
+int rb_pcm_store_drop_program(struct rb_pcm_store *store,uint32_t hash);
 
-static inline uint16_t rb_pcm_store_generate_key(uint8_t programid,uint8_t noteid) {
-  return (programid<<7)|noteid;
+/* (hash) is rb_pcm_cache_hash() of the program's serial. See rb_program_store_get_key().
+ */
+static inline uint64_t rb_pcm_store_generate_key(uint32_t hash,uint8_t noteid) {
+  return ((uint64_t)hash<<8)|noteid;
 }
 
 /* Consumers in general should stick to these two functions.
- * 'get' returns weak, or null if not found.
+ * 'get' returns weak, or null if not found. A successful 'get' marks the entry as recently used.
  * 'add' is not guaranteed to actually store the pcm.
  * You can add a pcm to replace an existing one (but i think that's not the general design).
  */
-struct rb_pcm *rb_pcm_store_get(struct rb_pcm_store *store,uint16_t key);
-int rb_pcm_store_add(struct rb_pcm_store *store,uint16_t key,struct rb_pcm *pcm);
+struct rb_pcm *rb_pcm_store_get(struct rb_pcm_store *store,uint64_t key);
+int rb_pcm_store_add(struct rb_pcm_store *store,uint64_t key,struct rb_pcm *pcm);
 
 /* Direct cache access, probably only useful internally.
  * These update all internal state but will not trigger eviction. (only 'add' does that)
  */
-int rb_pcm_store_search(const struct rb_pcm_store *store,uint16_t key);
-int rb_pcm_store_insert(struct rb_pcm_store *store,int p,uint16_t key,struct rb_pcm *pcm);
+int rb_pcm_store_search(const struct rb_pcm_store *store,uint64_t key);
+int rb_pcm_store_insert(struct rb_pcm_store *store,int p,uint64_t key,struct rb_pcm *pcm);
 int rb_pcm_store_remove(struct rb_pcm_store *store,int p,int c);
 
 /* Main synth will call this when it finishes printing a PCM, to have it persisted to disk.
+ * We only queue it for the print workers; without any, it doesn't persist. Never touches the disk itself.
+ */
+int rb_pcm_store_persist(struct rb_pcm_store *store,uint64_t key,struct rb_pcm *pcm);
+
+/* Open the persistent cache now, if (synth->cachedir) is set and we haven't yet.
+ * This does disk I/O, so it never happens implicitly: rb_synth_set_cachedir() and rb_synth_reinit() call it.
  */
-int rb_pcm_store_persist(struct rb_pcm_store *store,uint16_t key,struct rb_pcm *pcm);
+int rb_pcm_store_open_cache(struct rb_pcm_store *store);
 
 #endif
@@ -0,0 +1,88 @@
+/* rb_pcmprint_pool.h
+ * Optional worker threads that print PCM ahead of the synth.
+ * The synth still owns its printers and still calls rb_pcmprint_require() for each one every update.
+ * Workers just try to make that a no-op, by printing in chunks ahead of (due).
+ * Only the synth's thread adds, reaps, or clears printers; workers never touch a refcount.
+ * Adding never locks or allocates: new printers go through a fixed ring, and whoever holds (mutex) moves them into (printv).
+ * Workers also write finished PCMs to the persistent cache, when nothing needs printing, so the synth never touches the disk.
+ */
+ 
+#ifndef RB_PCMPRINT_POOL_H
+#define RB_PCMPRINT_POOL_H
+
+#include <pthread.h>
+
+#define RB_PCMPRINT_POOL_THREAD_LIMIT 16
+#define RB_PCMPRINT_POOL_SIZE_LIMIT 256
+#define RB_PCMPRINT_POOL_PERSIST_LIMIT 64
+
+#define RB_PCMPRINT_PERSIST_IDLE    0 /* Synth may fill it. */
+#define RB_PCMPRINT_PERSIST_QUEUED  1 /* Waiting for a worker. */
+#define RB_PCMPRINT_PERSIST_WRITING 2 /* A worker has it. */
+#define RB_PCMPRINT_PERSIST_DONE    3 /* Synth may drop it. */
+
+struct rb_pcm_cache;
+struct rb_pcm;
+
+struct rb_pcmprint_pool {
+  struct rb_synth *synth; // WEAK
+  int refc;
+  pthread_t threadv[RB_PCMPRINT_POOL_THREAD_LIMIT];
+  int threadc;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int quit;
+  
+  // Guarded by (mutex). Each is STRONG.
+  struct rb_pcmprint *printv[RB_PCMPRINT_POOL_SIZE_LIMIT];
+  int printc;
+  
+  // Single producer (synth), single consumer (whoever holds mutex). Each is STRONG.
+  // (ringhead,ringtail) count forever and wrap; index with modulo. Atomic.
+  struct rb_pcmprint *ringv[RB_PCMPRINT_POOL_SIZE_LIMIT];
+  unsigned int ringhead,ringtail;
+  
+  // Owned by the synth's thread: How many printers we hold, in (printv) or (ringv).
+  int heldc;
+  
+  // Finished PCMs to write to a persistent cache. (cache,pcm) are STRONG, and only the synth's thread touches their refcounts.
+  // (state) is atomic. Synth moves IDLE=>QUEUED and DONE=>IDLE, workers QUEUED=>WRITING=>DONE under (mutex).
+  struct rb_pcmprint_persist {
+    int state;
+    struct rb_pcm_cache *cache;
+    uint64_t key;
+    struct rb_pcm *pcm;
+  } persistv[RB_PCMPRINT_POOL_PERSIST_LIMIT];
+};
+
+/* (threadc) in 1..RB_PCMPRINT_POOL_THREAD_LIMIT.
+ */
+struct rb_pcmprint_pool *rb_pcmprint_pool_new(struct rb_synth *synth,int threadc);
+
+void rb_pcmprint_pool_del(struct rb_pcmprint_pool *pool);
+int rb_pcmprint_pool_ref(struct rb_pcmprint_pool *pool);
+
+/* Hand a printer to the workers. We retain it until it completes.
+ * Safe on the audio thread: no locks, no allocation, no syscalls.
+ * Workers pick it up on their next pass, or after the next reap wakes them.
+ * Fails if the pool is full; the synth still prints inline then.
+ */
+int rb_pcmprint_pool_add(struct rb_pcmprint_pool *pool,struct rb_pcmprint *pcmprint);
+
+/* Have a worker append (pcm) to (cache). We retain both until it's written.
+ * Safe on the audio thread, same as add. Fails if too many are waiting; the PCM just doesn't persist.
+ */
+int rb_pcmprint_pool_persist(struct rb_pcmprint_pool *pool,struct rb_pcm_cache *cache,uint64_t key,struct rb_pcm *pcm);
+
+/* Drop any completed printers and persists, and nudge the workers if anything is still pending.
+ * This only tries the lock; if a worker has it, we'll get it next time.
+ * Synth calls this once per update.
+ */
+int rb_pcmprint_pool_reap(struct rb_pcmprint_pool *pool);
+
+/* Drop all printers and unwritten persists, waiting for any in-progress chunks or writes to finish.
+ * Workers remain alive. This one blocks; don't call from the audio thread.
+ */
+int rb_pcmprint_pool_clear(struct rb_pcmprint_pool *pool);
+
+#endif
@@ -0,0 +1,86 @@
+/* rb_present.h
+ * Optional thread that delivers frames to the video driver, so rendering frame N+1 overlaps the swap of frame N.
+ * Submit a finished framebuffer, and it gets rb_video_swap_dirty() on the present thread, in order.
+ * Pair with rb_vmgr_set_buffers() and rb_vmgr_set_present(), so vmgr renders into a buffer not being presented.
+ * Latency is bounded: At most (queuelimit) frames wait, plus the one being swapped.
+ * While a present exists, don't touch its video from any other thread, except rb_video_update() and friends.
+ */
+
+#ifndef RB_PRESENT_H
+#define RB_PRESENT_H
+
+#include "rb_dirty.h"
+#include <pthread.h>
+
+struct rb_video;
+struct rb_image;
+
+#define RB_PRESENT_QUEUE_LIMIT 4
+
+/* When the queue is full at submit:
+ *   BLOCK: Wait for the present thread. Every frame reaches the screen; the renderer slows to the display.
+ *   DROP_OLDEST: Discard the oldest waiting frame. The renderer never waits for a slot; the screen shows the newest.
+ * Same when reclaiming a buffer that is still queued: BLOCK waits for it to present, DROP_OLDEST drops it.
+ * Nobody ever waits less than a buffer being swapped right now.
+ */
+#define RB_PRESENT_POLICY_BLOCK       0
+#define RB_PRESENT_POLICY_DROP_OLDEST 1
+
+struct rb_present_frame {
+  struct rb_image *fb; // WEAK, see rb_present_reclaim().
+  int full; // Nonzero to swap all of it, otherwise just (dirty).
+  struct rb_dirty dirty;
+};
+
+struct rb_present {
+  int refc;
+  struct rb_video *video;
+  int policy;
+  int queuelimit;
+  pthread_t thread;
+  int thread_running;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+
+  // Guarded by (mutex):
+  int quit;
+  int status; // <0 if a swap failed; reported at the next submit.
+  struct rb_present_frame queuev[RB_PRESENT_QUEUE_LIMIT];
+  int queuep,queuec;
+  struct rb_image *busy; // Being swapped right now.
+  struct rb_present_frame carry; // Damage from dropped frames, when nothing was queued behind them.
+  int carryc; // Nonzero if (carry) holds anything.
+  int framec; // Frames delivered.
+  int dropc; // Frames dropped.
+};
+
+/* We take over (video) until deleted: Its context is bound to our thread.
+ * (queuelimit) in 1..RB_PRESENT_QUEUE_LIMIT. One is plenty for double buffering.
+ */
+struct rb_present *rb_present_new(struct rb_video *video,int queuelimit,int policy);
+
+/* Delivers whatever is still queued, then joins the thread and returns the video context to the calling thread.
+ */
+void rb_present_del(struct rb_present *present);
+int rb_present_ref(struct rb_present *present);
+
+/* Queue (fb) to be swapped. We don't copy or retain it: It must stay alive and unmodified until reclaimed.
+ * (dirty) as for rb_video_swap_dirty(), null to swap the whole thing.
+ * (fb) must hold the previously submitted frame outside (dirty); we merge damage across dropped frames.
+ * Fails if an earlier swap on the present thread failed.
+ */
+int rb_present_submit(struct rb_present *present,struct rb_image *fb,const struct rb_dirty *dirty);
+
+/* Call before modifying or deleting an image you submitted.
+ * Waits if it's being swapped right now.
+ * If it's still queued, per (policy) we either wait for it or drop it.
+ * Swap errors are not reported here, see rb_present_submit() and rb_present_flush().
+ */
+int rb_present_reclaim(struct rb_present *present,struct rb_image *fb);
+
+/* Block until everything submitted has been swapped.
+ * Fails if any swap failed.
+ */
+int rb_present_flush(struct rb_present *present);
+
+#endif
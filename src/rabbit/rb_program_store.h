@@ -14,6 +14,7 @@ struct rb_program_store {
     struct rb_synth_node_config *config;
     void *serial;
     int serialc;
+    uint32_t hash; // rb_pcm_cache_hash(serial), or zero if empty. Printed PCM is keyed by this, not programid.
   } entryv[128];
 };
 
@@ -51,6 +52,11 @@ int rb_program_store_get_note(
   uint8_t programid,uint8_t noteid
 );
 
+/* Key for this note in rb_pcm_store and rb_pcm_cache, or zero if the program is empty.
+ * Two slots with identical serial produce the same keys.
+ */
+uint64_t rb_program_store_get_key(const struct rb_program_store *store,uint8_t programid,uint8_t noteid);
+
 /* Read content from the store.
  * Asked for a config, we may decode it if we haven't done yet, and (decode) nonzero.
  */
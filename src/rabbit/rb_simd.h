@@ -0,0 +1,41 @@
+/* rb_simd.h
+ * Which vector instruction sets are available at compile time.
+ * Kernels that use these must always have a plain C fallback.
+ * RB_SIMD_DISABLE=1 to force the fallbacks, eg for comparison in tests.
+ *
+ * Builds that don't assume AVX2 may still compile AVX2 kernels for runtime dispatch:
+ * When RB_SIMD_AVX2_DISPATCH, tag them RB_SIMD_TARGET_AVX2 and call only if rb_simd_have_avx2().
+ */
+ 
+#ifndef RB_SIMD_H
+#define RB_SIMD_H
+
+#if !RB_SIMD_DISABLE
+  #if defined(__SSE2__)
+    #define RB_SIMD_SSE2 1
+    #include <emmintrin.h>
+  #endif
+  #if defined(__AVX2__)
+    #define RB_SIMD_AVX2 1
+    #include <immintrin.h>
+  #endif
+  #if defined(__ARM_NEON)||defined(__ARM_NEON__)
+    #define RB_SIMD_NEON 1
+    #include <arm_neon.h>
+  #endif
+  #if RB_SIMD_SSE2&&!RB_SIMD_AVX2&&defined(__GNUC__)
+    #define RB_SIMD_AVX2_DISPATCH 1
+    #define RB_SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+    #include <immintrin.h>
+  #endif
+#endif
+
+#if RB_SIMD_AVX2_DISPATCH
+  static inline int rb_simd_have_avx2() {
+    static int have=-1;
+    if (have<0) have=__builtin_cpu_supports("avx2")?1:0;
+    return have;
+  }
+#endif
+
+#endif
@@ -7,6 +7,9 @@
 struct rb_sprite;
 struct rb_sprite_type;
 struct rb_sprite_group;
+struct rb_sprite_index;
+struct rb_sprite_sortkey;
+struct rb_sprite_group_pos;
 
 /* Base sprite instance.
  ****************************************************/
@@ -53,6 +56,9 @@ extern const struct rb_sprite_type rb_sprite_type_dummy;
 #define RB_SPRITE_GROUP_ORDER_EXPLICIT   1 /* Retain order of addition; re-add moves it to the back. */
 #define RB_SPRITE_GROUP_ORDER_RENDER     2 /* Render order, best-effort */
 #define RB_SPRITE_GROUP_ORDER_SINGLE     3 /* May contain only zero or one sprites; adding drops the prior one */
+
+#define RB_SPRITE_SORT_BUBBLE 0 /* rb_sprite_group_sort() does one pass of a bubble sort; default. */
+#define RB_SPRITE_SORT_FULL   1 /* rb_sprite_group_sort() sorts completely, see rb_sprite_group_sort_fully(). */
  
 struct rb_sprite_group {
   struct rb_sprite **v;
@@ -60,6 +66,18 @@ struct rb_sprite_group {
   int refc;
   int order; // Do not modify.
   int sortd;
+  int sortmode; // RB_SPRITE_SORT_*, only relevant to ORDER_RENDER. You may change it any time.
+  struct rb_sprite_index *index; // Optional, see rb_sprite_group_set_index(). Do not modify.
+  
+  // Private, for rb_sprite_group_sort_fully().
+  struct rb_sprite_sortkey *sortv; // (sorta*2)
+  int sorta;
+  
+  // Private, sprite=>position in (v), for finding members of SORT_FULL groups. Built on demand.
+  struct rb_sprite_group_pos *posv;
+  int posa; // Power of two.
+  int posc;
+  int posvalid;
 };
 
 /* In general, one should rb_sprite_group_clear() before deleting.
@@ -93,12 +111,78 @@ void rb_sprite_group_filter(
 );
 
 /* Only relevant with RB_SPRITE_GROUP_ORDER_RENDER.
- * Performs one pass of a bubble sort, putting sprites closer to render order.
+ * In RB_SPRITE_SORT_BUBBLE mode, performs one pass of a bubble sort, putting sprites closer to render order.
  * It may take several passes to achieve the correct order.
  * We assume it's better to be out of order for a few frames than to sort exhaustively every time.
- * If you disagree, use rb_sprite_group_sort_fully() instead.
+ * If you disagree, use RB_SPRITE_SORT_FULL, or call rb_sprite_group_sort_fully() directly.
+ *
+ * Full sorts are near-linear when little has changed since the last one: an insertion sort for sprites that moved a little,
+ * and a separate sort and merge for the few that moved far. If many moved far, a radix sort on (layer,y).
+ * In SORT_FULL mode, we also stop trying to keep the group in order between sorts:
+ * Adding appends, removing fills the hole with the last sprite, and finding a member is a hash lookup.
+ * So insert and remove are O(1) instead of O(n), but (v) is only in order right after a sort.
  */
 void rb_sprite_group_sort(struct rb_sprite_group *group);
 void rb_sprite_group_sort_fully(struct rb_sprite_group *group);
 
+/* Render order as a total order: (layer), then (y), then address.
+ */
+int rb_sprite_cmp_render(const struct rb_sprite *a,const struct rb_sprite *b);
+
+/* Spatial index.
+ *****************************************************/
+
+/* A group may keep a uniform grid over its sprites' positions, to find the ones near some point without visiting all of them.
+ * Cells are (1<<cellshift) pixels square, hashed into a fixed set of buckets, so the world can be any size.
+ * Membership is maintained for you. Position usually isn't: sprites move by plain assignment to (x,y),
+ * so call rb_sprite_group_index_update() after moving things and before querying.
+ * If you move sprites only with rb_sprite_move(), set (tracked) and updates become free.
+ */
+struct rb_sprite_index_entry {
+  struct rb_sprite *sprite;
+  int col,row; // Cell as of the last update.
+};
+
+struct rb_sprite_index_bucket {
+  struct rb_sprite_index_entry *v;
+  int c,a;
+};
+
+struct rb_sprite_index {
+  int cellshift;
+  struct rb_sprite_index_bucket *bucketv;
+  int bucketc; // Power of two, grows with the population.
+  int c; // Total entries.
+  int renderc; // How many have a render hook, ie draw somewhere we can't predict.
+  int tracked; // Nonzero if all moves go through rb_sprite_move(), so updates have nothing to do. You may set this.
+};
+
+/* Zero (cellshift) to drop the index. Otherwise 1..16, and we rebuild from scratch.
+ * Pick cells about the size of your largest sprite, or of your usual query.
+ */
+int rb_sprite_group_set_index(struct rb_sprite_group *group,int cellshift);
+
+/* Move each indexed sprite to its current cell.
+ * This has to look at every sprite, so it costs about as much as one pass over the group.
+ * No-op if the index is (tracked).
+ */
+void rb_sprite_group_index_update(struct rb_sprite_group *group);
+
+/* Set a sprite's position and update the index of each group it belongs to.
+ * Same as assigning (x,y) directly, except indexes don't have to go looking for it later.
+ */
+void rb_sprite_move(struct rb_sprite *sprite,int x,int y);
+
+/* Call (cb) for each sprite whose position (x,y) is within (x,y,w,h), in no particular order.
+ * Stops if (cb) returns nonzero, and returns that.
+ * Without an index, this visits every sprite, so it's correct either way.
+ * Don't add or remove sprites from (cb).
+ */
+int rb_sprite_group_query(
+  const struct rb_sprite_group *group,
+  int x,int y,int w,int h,
+  int (*cb)(struct rb_sprite *sprite,void *userdata),
+  void *userdata
+);
+
 #endif
@@ -17,6 +17,7 @@ struct rb_pcmrun;
 struct rb_song_player;
 struct rb_program_store;
 struct rb_pcm_store;
+struct rb_pcmprint_pool;
 
 struct rb_synth {
   int refc;
@@ -31,8 +32,20 @@ struct rb_synth {
   uint8_t chanv[16]; // Program ID by Channel ID
   int new_printer_framec;
   
+  /* Voices are mixed on a wide bus, then scaled by (master_gain) and narrowed to int16.
+   * With (limit) nonzero (the default), gain drops as needed to keep peaks in range, and recovers gradually.
+   * Otherwise peaks just clip.
+   * Set (limit) directly, but use rb_synth_set_master_gain().
+   */
+  float master_gain;
+  float limiter_gain; // Current effective gain, read-only.
+  int limit;
+  
   struct rb_program_store *program_store;
   struct rb_pcm_store *pcm_store;
+  struct rb_pcmprint_pool *pcmprint_pool; // Optional. See rb_synth_set_print_threads().
+  struct rb_pcmprint **prewarmv; // Printers started ahead of need, see rb_synth_prewarm_song().
+  int prewarmc,prewarma;
   
   char *message;
   int messagec;
@@ -43,9 +56,10 @@ struct rb_synth {
   void *userdata;
   int (*cb_play_note)(struct rb_synth *synth,uint8_t programid,uint8_t noteid); // 0 to suppress, 1 to proceed
   
-  /* If set, this is a directory where we will cache printed PCM.
-   * Beware, you have to flush it manually if you change an instrument.
-   * TODO If this works clean it up.
+  /* If set, this is a directory where we will cache printed PCM, one file per rate.
+   * Entries are validated against a hash of the program, so changing an instrument just misses.
+   * See rb_pcm_cache.h.
+   * Set it with rb_synth_set_cachedir(), which opens and preloads it. The audio thread never opens it.
    */
   const char *cachedir;
 };
@@ -66,6 +80,26 @@ int rb_synth_ref(struct rb_synth *synth);
  */
 int rb_synth_reinit(struct rb_synth *synth,int rate,int chanc);
 
+/* Overall output level, 1 by default.
+ * It's linear, and applies after mixing, so it won't affect printed PCM.
+ */
+#define RB_SYNTH_MASTER_GAIN_LIMIT 16.0f
+int rb_synth_set_master_gain(struct rb_synth *synth,float gain);
+
+/* Start or stop background PCM printing.
+ * With (threadc) zero (the default), all printing happens inline during rb_synth_update().
+ * Otherwise we create so many worker threads to print ahead of the playhead.
+ * We still print inline when a worker falls behind, so output is the same either way.
+ * Changing the count drops and recreates the whole pool.
+ */
+int rb_synth_set_print_threads(struct rb_synth *synth,int threadc);
+
+/* Set (cachedir) and open it immediately, reading the whole thing into memory.
+ * We do not copy (path); it must remain constant as long as the synth does.
+ * Print workers write new PCMs to it, so without rb_synth_set_print_threads() we only read.
+ */
+int rb_synth_set_cachedir(struct rb_synth *synth,const char *path);
+
 /* Load encoded program configurations.
  * You can "configure" multiple times; old content remains unless overwritten specifically.
  * Caches get updated and cleared out as necessary.
@@ -92,6 +126,13 @@ int rb_synth_silence(struct rb_synth *synth);
  */
 int rb_synth_play_song(struct rb_synth *synth,struct rb_song *song,int restart);
 
+/* Scan a song for the notes it will play, and get them ready ahead of time.
+ * Programs get decoded regardless.
+ * If print threads are running, we also start printing every note not already cached, in song order.
+ * rb_synth_play_song() does this automatically for new songs.
+ */
+int rb_synth_prewarm_song(struct rb_synth *synth,struct rb_song *song);
+
 /* Support for rhythm games!
  * (*p) is filled with the song's current position in ticks.
  * (*c) is filled with the length of a qnote in ticks, which is constant for a given song.
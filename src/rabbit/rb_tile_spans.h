@@ -0,0 +1,66 @@
+/* rb_tile_spans.h
+ * Precompiled tiles for fast sprite blitting.
+ * One tile, already transformed, with each row stored as a list of the spans that aren't transparent.
+ * Transparent pixels are never looked at, and opaque runs are a memcpy.
+ * rb_vmgr builds these on demand, per (imageid,tileid,xform).
+ */
+
+#ifndef RB_TILE_SPANS_H
+#define RB_TILE_SPANS_H
+
+#include <stdint.h>
+
+struct rb_image;
+
+struct rb_tile_span {
+  int x,w;
+  int translucent; // Nonzero if these pixels must blend, otherwise they copy verbatim.
+};
+
+struct rb_tile_spans {
+  int w,h; // Output dimensions, ie swapped if (xform) swaps.
+  int alphamode; // Source's, tells us how to blend the translucent spans.
+  int *rowv; // (h+1); row (y) is spanv[rowv[y]..rowv[y+1]-1].
+  struct rb_tile_span *spanv;
+  int spanc; // Zero if the whole tile is transparent.
+  uint32_t *pixels; // (w*h), transformed.
+};
+
+/* (srcx,srcy,w,h) must be in bounds. (w,h) refer to the source, as with rb_image_blit().
+ */
+struct rb_tile_spans *rb_tile_spans_new(
+  const struct rb_image *src,int srcx,int srcy,
+  int w,int h,
+  uint8_t xform
+);
+
+void rb_tile_spans_del(struct rb_tile_spans *spans);
+
+/* Same result as blitting the original tile with rb_image_blit_safe(), provided (dst) is OPAQUE.
+ * (dstx,dsty) are the output's top-left corner and may be out of bounds; we clip.
+ */
+void rb_tile_spans_blit(
+  struct rb_image *dst,int dstx,int dsty,
+  const struct rb_tile_spans *spans
+);
+
+/* Same as rb_tile_spans_blit(), but only touch pixels inside (clipx,clipy,clipw,cliph) too.
+ */
+void rb_tile_spans_blit_clip(
+  struct rb_image *dst,int dstx,int dsty,
+  const struct rb_tile_spans *spans,
+  int clipx,int clipy,int clipw,int cliph
+);
+
+/* Everything compiled from one source image.
+ * Indexed by (tileid<<3)|xform.
+ */
+#define RB_TILE_CACHE_SIZE (256*8)
+
+struct rb_tile_cache {
+  struct rb_tile_spans *v[RB_TILE_CACHE_SIZE];
+};
+
+void rb_tile_cache_del(struct rb_tile_cache *cache);
+
+#endif
@@ -9,6 +9,7 @@
 struct rb_video;
 struct rb_video_type;
 struct rb_video_delegate;
+struct rb_dirty;
 
 /* Video driver instance.
  ************************************************************/
@@ -43,7 +44,7 @@ struct rb_video {
 
 /* Create a video driver.
  * On success, you have a window or have control of the monitor.
- * Null for (type) to select the default.
+ * Null for (type) to select the default, the first real display that works.
  */
 struct rb_video *rb_video_new(
   const struct rb_video_type *type,
@@ -60,9 +61,17 @@ int rb_video_update(struct rb_video *video);
 
 /* Send (fb) to the screen and block until it gets there (ie vblank).
  * (fb) must have alphamode OPAQUE and dimensions (RB_FB_W,RB_FB_H).
+ * Drivers only read (fb). With rb_present, vmgr may be copying from it on another thread at the same time.
  */
 int rb_video_swap(struct rb_video *video,struct rb_image *fb);
 
+/* Same as rb_video_swap(), but only the regions in (dirty) changed since the previous swap.
+ * (fb) must match the image you swapped last time outside (dirty), eg rb_vmgr's, with (vmgr->dirty).
+ * That holds even when vmgr rotates among several buffers.
+ * Drivers that can, upload just those regions. Others, and null (dirty), behave like rb_video_swap().
+ */
+int rb_video_swap_dirty(struct rb_video *video,struct rb_image *fb,const struct rb_dirty *dirty);
+
 /* 0=window, 1=fullscreen, -1=query
  * Returns actual state after change.
  */
@@ -73,6 +82,13 @@ int rb_video_set_fullscreen(struct rb_video *video,int fullscreen);
  */
 void rb_video_suppress_screensaver(struct rb_video *video);
 
+/* Drivers whose rendering context belongs to one thread (GL) must be moved before another thread swaps.
+ * (bind) nonzero to make the calling thread current, zero to release it from the calling thread.
+ * Release on the old thread before binding on the new one; rb_present does this for you.
+ * Drivers without thread affinity ignore it. Only swap from one thread at a time, whatever the driver.
+ */
+int rb_video_bind_thread(struct rb_video *video,int bind);
+
 /* Video driver types.
  ***********************************************************/
  
@@ -81,12 +97,15 @@ struct rb_video_type {
   const char *desc;
   int objlen;
   void *singleton;
+  int by_name_only; // Never the default, eg headless: select it explicitly.
   void (*del)(struct rb_video *video);
   int (*init)(struct rb_video *video);
   int (*update)(struct rb_video *video);
   int (*swap)(struct rb_video *video,struct rb_image *fb); // REQUIRED
+  int (*swap_dirty)(struct rb_video *video,struct rb_image *fb,const struct rb_dirty *dirty);
   int (*set_fullscreen)(struct rb_video *video,int fullscreen);
   void (*suppress_screensaver)(struct rb_video *video);
+  int (*bind_thread)(struct rb_video *video,int bind);
 };
 
 const struct rb_video_type *rb_video_type_by_name(const char *name,int namec);
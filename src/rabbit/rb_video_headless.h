@@ -0,0 +1,73 @@
+/* rb_video_headless.h
+ * Video driver with no display at all.
+ * Swapped frames go into a ring of copies in memory, and optionally get hashed or written to disk.
+ * Always built, but rb_video_new(0,...) never picks it: ask for "headless" by name.
+ * Meant for benchmarks and golden-image tests on hosts without a GPU.
+ */
+
+#ifndef RB_VIDEO_HEADLESS_H
+#define RB_VIDEO_HEADLESS_H
+
+#include "rabbit/rb_video.h"
+#include <stdint.h>
+
+struct rb_image;
+
+extern const struct rb_video_type rb_video_type_headless;
+
+#define RB_VIDEO_HEADLESS_RING_LIMIT 16
+
+#define RB_VIDEO_HEADLESS_CAPTURE_NONE 0
+#define RB_VIDEO_HEADLESS_CAPTURE_RAW  1 /* RB_FB_SIZE_BYTES per file, 32-bit ARGB in native byte order. */
+#define RB_VIDEO_HEADLESS_CAPTURE_PNG  2 /* 8-bit RGB. */
+
+struct rb_video_headless {
+  struct rb_video hdr;
+
+  /* Simulated vsync in Hz, default 60. Zero to run unthrottled.
+   * Swap blocks until the next tick of a fixed clock; ticks we sleep through count in (latec).
+   * You may change it any time.
+   */
+  int rate;
+
+  /* Nonzero to hash each frame (off by default). You may change it any time.
+   * (hash) is the last frame's, FNV-1a over each pixel's RGB; alpha is ignored.
+   * (hashsum) folds in every hashed frame in order, so one number covers a whole run.
+   */
+  int hash_enable;
+  uint64_t hash;
+  uint64_t hashsum;
+
+// Read-only:
+  int framec; // Frames swapped.
+  int latec; // Vsync ticks missed because the caller was too slow.
+  double swaptime; // Seconds spent in swap, not counting the vsync wait.
+  struct rb_image *ringv[RB_VIDEO_HEADLESS_RING_LIMIT];
+  int ringc; // Default 1.
+  int ringp; // Where the next frame goes.
+  int ringfillc; // How many of (ringv) hold a frame.
+  char *capture_path;
+  int capture_format;
+  double starttime;
+  int64_t tick;
+};
+
+/* Keep the last (ringc) frames, 0..RB_VIDEO_HEADLESS_RING_LIMIT.
+ * Zero skips the copy entirely, eg for pure timing.
+ * Drops any frames already captured.
+ */
+int rb_video_headless_set_ring(struct rb_video *video,int ringc);
+
+/* Frame swapped (age) swaps ago, zero for the most recent.
+ * Null if we don't have it. It belongs to us and gets overwritten by later swaps.
+ */
+struct rb_image *rb_video_headless_get_frame(const struct rb_video *video,int age);
+
+/* Write every frame to disk from now on.
+ * (path) is a printf pattern with one integer conversion, which gets the frame index, eg "out/frames/%05d.png".
+ * We create directories as needed.
+ * Null (path) or CAPTURE_NONE to stop.
+ */
+int rb_video_headless_set_capture(struct rb_video *video,const char *path,int format);
+
+#endif
@@ -1,6 +1,6 @@
 /* rb_vmgr.h
  * High-level video manager, responsible for rendering the world scene.
- *  - Keeps a store of up to 256 source images, like tilesheets.
+ *  - Keeps a store of up to 256 source images, like tilesheets. ARGB or indexed.
  *  - Background grid.
  *  - Foreground sprites.
  */
@@ -12,38 +12,201 @@ struct rb_image;
 struct rb_grid;
 struct rb_sprite;
 struct rb_sprite_group;
+struct rb_tile_cache;
+struct rb_present;
+struct rb_lights;
 
 #include "rb_image.h"
+#include "rb_dirty.h"
+#include <pthread.h>
 
 #define RB_VMGR_IMAGE_COUNT 256
 
+/* Framebuffers we rotate among, see rb_vmgr_set_buffers().
+ */
+#define RB_VMGR_FB_LIMIT 3
+
+/* Threads for band-parallel compositing, including the one calling rb_vmgr_render().
+ */
+#define RB_VMGR_THREAD_LIMIT 8
+
+/* Grid layers. 0 is the main one, in the same space as sprites.
+ * Higher layers are further back, for parallax backgrounds.
+ */
+#define RB_VMGR_LAYER_LIMIT 4
+
+struct rb_vmgr_layer {
+  struct rb_grid *grid;
+  struct rb_image *bgbits; // 32 pixels wider and taller than the framebuffer, grid image
+  int bgbitsx,bgbitsy; // in this layer's space
+  int bgbitsdirty; // nonzero to redraw bgbits from scratch
+  int parallax; // Scroll factor in 1/256. Layer 0 is always 256.
+};
+
+/* What one sprite looked like at the last render, for dirty-rect tracking.
+ */
+struct rb_vmgr_sprite_snap {
+  struct rb_sprite *sprite; // Identity only, never dereferenced.
+  int x,y,w,h; // World space. Empty if it draws nothing.
+  uint8_t imageid,tileid,xform;
+  int layer;
+  int order; // Position in render order.
+  int changed;
+};
+
+/* Worker threads, see rb_vmgr_set_threads().
+ * Band (bandp) of (bandc) is framebuffer rows (RB_FB_H*bandp/bandc) up to the next one.
+ * The thread calling rb_vmgr_render() always takes band zero.
+ */
+struct rb_vmgr_workers {
+  struct rb_vmgr *vmgr; // WEAK
+  int bandc; // Worker threads plus one.
+  pthread_t threadv[RB_VMGR_THREAD_LIMIT];
+  int threadc; // Started so far.
+  pthread_mutex_t mutex;
+  pthread_cond_t cond; // Workers wait here for a job.
+  pthread_cond_t donecond; // And we wait here for them to finish it.
+  
+  // Guarded by (mutex):
+  int quit;
+  int idnext; // Each worker takes its band from here as it starts.
+  int jobserial; // Bumped for each job.
+  int busyc; // Workers still running the current job.
+  int status; // <0 if any of them failed it.
+  int (*job)(struct rb_vmgr *vmgr,int bandp,void *arg);
+  void *arg;
+};
+
 struct rb_vmgr {
   int refc;
-  struct rb_grid *grid;
+  struct rb_vmgr_layer layerv[RB_VMGR_LAYER_LIMIT];
+  int layerc; // Highest in use, plus one.
   struct rb_sprite_group *sprites;
   int scrollx,scrolly;
   struct rb_image *imagev[RB_VMGR_IMAGE_COUNT];
-  struct rb_image *fb;
-  struct rb_image *bgbits; // 32 pixels wider and taller than the framebuffer, grid image
-  int bgbitsx,bgbitsy;
-  int bgbitsdirty; // nonzero to redraw bgbits from scratch
+  struct rb_image8 *image8v[RB_VMGR_IMAGE_COUNT]; // Indexed images. At most one of (imagev,image8v) per id.
+  struct rb_palette *palettev[RB_VMGR_IMAGE_COUNT]; // Overrides the indexed image's own palette.
+  struct rb_tile_cache *tilecachev[RB_VMGR_IMAGE_COUNT]; // Sprite tiles compiled on demand, dropped when the image changes.
+  struct rb_image *fb; // The one we render into; one of (fbv).
+  struct rb_image *fbv[RB_VMGR_FB_LIMIT];
+  int fbc,fbp; // (fbv[fbp]==fb)
+  struct rb_present *present; // Optional. We reclaim each buffer from it before rendering.
+  
+  // Dirty-rect tracking, see rb_vmgr_set_dirty_tracking().
+  int dirtytracking;
+  int fbdirty; // nonzero to recomposite everything at the next render
+  struct rb_dirty dirty; // Regions of (fb) changed by the last render.
+  struct rb_dirty invalid; // From rb_vmgr_invalidate(), pending for the next render.
+  int fbscrollx,fbscrolly; // Scroll position (fb) was rendered at.
+  struct rb_vmgr_sprite_snap *snapv,*nsnapv; // Sorted by (sprite) between renders.
+  int snapc,snapa; // (snapa) applies to both lists.
+  int *snaporderv;
+  
+  // View culling, when (sprites) has a spatial index.
+  struct rb_sprite **cullv;
+  int cullc,culla;
+  int cullmargin; // Largest tile dimension among our images, reach of a sprite from its center.
+  
+  struct rb_vmgr_workers *workers; // Optional, see rb_vmgr_set_threads().
+  struct rb_lights *lights; // WEAK, optional, see rb_vmgr_set_lights().
 };
 
 struct rb_vmgr *rb_vmgr_new();
 void rb_vmgr_del(struct rb_vmgr *vmgr);
 int rb_vmgr_ref(struct rb_vmgr *vmgr);
 
+/* Images are only ever sources for vmgr, so we convert BLEND images to PREMUL in place.
+ * We also cache compiled sprite tiles per image; if you modify an installed image's pixels,
+ * set it to null and back again.
+ */
 int rb_vmgr_set_image(struct rb_vmgr *vmgr,uint8_t imageid,struct rb_image *image);
 int rb_vmgr_set_image_serial(struct rb_vmgr *vmgr,uint8_t imageid,const void *src,int srcc);
 
+/* Indexed images take the slot of any ARGB image with the same id, and vice versa.
+ * They draw with the palette from rb_vmgr_set_palette() if there is one, otherwise their own.
+ * Without either, it's as if the image wasn't there.
+ * rb_vmgr_set_image_serial() keeps RB_IMAGE_FORMAT_I8 images indexed.
+ */
+int rb_vmgr_set_image8(struct rb_vmgr *vmgr,uint8_t imageid,struct rb_image8 *image);
+
+/* Draw indexed image (imageid) with (palette) instead of its own, null to go back.
+ * This is all a palette swap costs: We redraw whatever uses the image, and don't copy it.
+ * The override stays when you replace the image.
+ * As with images, we premultiply BLEND palettes in place, and you must set it again if you change its colors.
+ */
+int rb_vmgr_set_palette(struct rb_vmgr *vmgr,uint8_t imageid,struct rb_palette *palette);
+
 /* Render one frame.
+ * If the sprite group has a spatial index (rb_sprite_group_set_index()) and is ORDER_RENDER,
+ * we update the index and only visit sprites near the view, drawing them in exact render order.
+ * Any sprite with a render hook defeats that, since we can't know where it draws.
  * Returns my framebuffer on success or null on error.
  * Caller should deliver this framebuffer to the video driver.
  * You can add overlay content before that, of course.
+ * After rendering, (vmgr->dirty) lists the regions of (fb) that changed, see rb_video_swap_dirty().
+ * With more than one buffer, each render moves on to the next, so (vmgr->fb) changes.
  */
 struct rb_image *rb_vmgr_render(struct rb_vmgr *vmgr);
 
+/* Render into a rotation of (fbc) framebuffers, 1..RB_VMGR_FB_LIMIT, default 1.
+ * Two or three let a present thread swap one frame while we render the next (see rb_present.h).
+ * With dirty tracking, each render first copies the previous frame into its new buffer,
+ * so the result and (vmgr->dirty) are the same as with a single buffer.
+ */
+int rb_vmgr_set_buffers(struct rb_vmgr *vmgr,int fbc);
+
+/* If you submit our frames to an rb_present, tell us about it, and we'll rb_present_reclaim()
+ * each buffer before drawing into it. Null to detach.
+ * We retain it, and reclaim all buffers before changing them or deleting.
+ */
+int rb_vmgr_set_present(struct rb_vmgr *vmgr,struct rb_present *present);
+
+/* Composite with (threadc) threads, 1..RB_VMGR_THREAD_LIMIT, default 1.
+ * Each takes a horizontal band of the framebuffer, and clips every sprite and layer to it.
+ * Output is identical to rendering with one thread.
+ * Sprites with render hooks can't be clipped, so if any is in view, compositing falls back to serial.
+ * The lights pass (rb_vmgr_set_lights()) runs in bands either way.
+ * Small dirty rects also go serial, it isn't worth waking anybody for them.
+ */
+int rb_vmgr_set_threads(struct rb_vmgr *vmgr,int threadc);
+
+/* Run (job) once for each band, in parallel, and return when they're all done.
+ * Fails if any of them does. For rb_vmgr_render(), and only with (vmgr->workers).
+ */
+int rb_vmgr_workers_run(
+  struct rb_vmgr *vmgr,
+  int (*job)(struct rb_vmgr *vmgr,int bandp,void *arg),
+  void *arg
+);
+
+/* Apply (lights) at the end of each render, as rb_lights_draw() at our scroll position.
+ * We don't retain it: Unset it before cleaning up the lights. Null to remove.
+ * While lights are set, every render touches the whole framebuffer, so dirty tracking reports it all.
+ */
+int rb_vmgr_set_lights(struct rb_vmgr *vmgr,struct rb_lights *lights);
+
+/* With dirty-rect tracking enabled, rb_vmgr_render() only recomposites regions that changed since the last render:
+ * sprites that moved, changed tile, appeared or disappeared, and the strips exposed by scrolling.
+ * Everything else in (fb) is left as it was, so if you draw overlays into (fb), you must rb_vmgr_invalidate() them.
+ * Changing images, grids, or sprite group, or setting any layer's (bgbitsdirty), recomposites everything.
+ * So does any sprite with a render hook, since we can't know where it draws.
+ * Disabled by default.
+ */
+void rb_vmgr_set_dirty_tracking(struct rb_vmgr *vmgr,int enable);
+
+/* Force a region of (fb) to be recomposited at the next render. Framebuffer coordinates.
+ */
+void rb_vmgr_invalidate(struct rb_vmgr *vmgr,int x,int y,int w,int h);
+
 int rb_vmgr_set_grid(struct rb_vmgr *vmgr,struct rb_grid *grid);
+
+/* Background layers behind the main grid, (layerid) 1..RB_VMGR_LAYER_LIMIT-1, higher is further back.
+ * Each uses its grid's tilesheet, and we composite them back to front,
+ * skipping any behind a layer that's opaque and covers the view.
+ * (parallax) is the scroll factor in 1/256: 256 moves with the camera, 128 at half speed, 0 not at all.
+ * Null (grid) to remove. Layer 0 is the main grid, you can set it here too but its parallax stays 256.
+ */
+int rb_vmgr_set_layer(struct rb_vmgr *vmgr,int layerid,struct rb_grid *grid,int parallax);
 int rb_vmgr_set_sprites(struct rb_vmgr *vmgr,struct rb_sprite_group *group);
 
 int rb_vmgr_add_sprite(struct rb_vmgr *vmgr,struct rb_sprite *sprite);
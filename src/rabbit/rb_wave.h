@@ -0,0 +1,60 @@
+/* rb_wave.h
+ * Low-level kernels for oscillators.
+ * These use SIMD where available (see rb_simd.h).
+ * Phase here is always in cycles, not radians: 0..1 is one period.
+ *
+ * Output must not depend on how a run is split into updates, since print workers and the inline printer
+ * use different chunk sizes and must agree bit for bit. So:
+ *  - Running phase is 32-bit fixed point, one cycle is 1<<32. Integer accumulation is exact.
+ *  - Vector kernels pad a short tail and run it through the vector path, rather than finishing in scalar.
+ */
+
+#ifndef RB_WAVE_H
+#define RB_WAVE_H
+
+#include "rabbit/rb_signal.h"
+
+/* Fixed-point phase from cycles. Anything outside 0..1 wraps.
+ */
+static inline uint32_t rb_wave_phase_fixed(rb_sample_t cycles) {
+  int i=(int)cycles;
+  if (cycles<(rb_sample_t)i) i--;
+  return (uint32_t)(int64_t)((cycles-(rb_sample_t)i)*4294967296.0f);
+}
+
+/* Fill (dst) with a running phase 0..1, starting at (p).
+ * 'const' advances by (dp) per sample, 'ratev' by (ratev[i]*k) cycles.
+ * Returns the phase for the next sample.
+ * (dst) and (ratev) may be the same.
+ */
+uint32_t rb_wave_phase_const(rb_sample_t *dst,int c,uint32_t p,uint32_t dp);
+uint32_t rb_wave_phase_ratev(rb_sample_t *dst,const rb_sample_t *ratev,int c,uint32_t p,rb_sample_t k);
+
+/* Shape a phase vector. (dst) and (phasev) may be the same.
+ * Sine accepts any phase.
+ * The others are straight formulas, meant for 0..1; outside that they extrapolate:
+ *   square: (p<0.5)?level:-level
+ *   saw: base+p*k
+ *   triangle: level*(1-2*|2p-1|)
+ */
+void rb_wave_sine(rb_sample_t *dst,const rb_sample_t *phasev,int c,rb_sample_t level);
+void rb_wave_square(rb_sample_t *dst,const rb_sample_t *phasev,int c,rb_sample_t level);
+void rb_wave_saw(rb_sample_t *dst,const rb_sample_t *phasev,int c,rb_sample_t base,rb_sample_t k);
+void rb_wave_triangle(rb_sample_t *dst,const rb_sample_t *phasev,int c,rb_sample_t level);
+
+/* Read a single-cycle table with linear interpolation. Accepts any phase.
+ * (tablec) must be a power of two, and (tablev) must have one more sample, a copy of the first.
+ */
+void rb_wave_table(rb_sample_t *dst,const rb_sample_t *phasev,int c,const rb_sample_t *tablev,int tablec);
+
+/* Odd polynomial for sin(2*pi*r), good for r in -0.25..0.25.
+ * Worst error about 2e-7, indistinguishable from sinf() after quantization.
+ */
+#define RB_WAVE_SINE_C1   6.28318530718f
+#define RB_WAVE_SINE_C3 -41.3417022404f
+#define RB_WAVE_SINE_C5  81.6052492761f
+#define RB_WAVE_SINE_C7 -76.7058597531f
+#define RB_WAVE_SINE_C9  42.0586939449f
+#define RB_WAVE_SINE_C11 -15.0946425768f
+
+#endif
@@ -0,0 +1,83 @@
+#include "test/rb_test.h"
+#include "rabbit/rb_image.h"
+#include "rabbit/rb_grid.h"
+
+/* PRNG.
+ */
+ 
+static uint32_t rb_test_seed=1;
+
+void rb_test_srand(uint32_t seed) {
+  rb_test_seed=seed;
+}
+
+int rb_test_rand(int range) {
+  rb_test_seed=rb_test_seed*1103515245+12345;
+  return (rb_test_seed>>8)%range;
+}
+
+/* Random ARGB pixel, per alpha mode.
+ */
+ 
+static uint32_t rb_test_random_pixel(int alphamode) {
+  uint32_t rgb=rb_test_rand(0x1000000);
+  if (alphamode==RB_ALPHAMODE_OPAQUE) return rgb|0xff000000;
+  switch (rb_test_rand(4)) {
+    case 0: return 0;
+    case 1: return rgb|(rb_test_rand(256)<<24);
+  }
+  return rgb|0xff000000;
+}
+
+/* Random image.
+ */
+ 
+struct rb_image *rb_test_random_image(int w,int h,int alphamode) {
+  struct rb_image *image=rb_image_new(w,h);
+  if (!image) return 0;
+  image->alphamode=alphamode;
+  int i=w*h; while (i-->0) image->pixels[i]=rb_test_random_pixel(alphamode);
+  return image;
+}
+
+/* Random palette.
+ */
+ 
+struct rb_palette *rb_test_random_palette(int alphamode) {
+  struct rb_palette *palette=rb_palette_new();
+  if (!palette) return 0;
+  palette->alphamode=alphamode;
+  int i=256; while (i-->0) {
+    if ((alphamode==RB_ALPHAMODE_COLORKEY)&&!i) palette->v[i]=0;
+    else palette->v[i]=rb_test_random_pixel(alphamode);
+  }
+  return palette;
+}
+
+/* Random indexed image, with its own random palette.
+ */
+ 
+struct rb_image8 *rb_test_random_image8(int w,int h,int alphamode) {
+  struct rb_image8 *image=rb_image8_new(w,h);
+  if (!image) return 0;
+  struct rb_palette *palette=rb_test_random_palette(alphamode);
+  if (!palette) {
+    rb_image8_del(image);
+    return 0;
+  }
+  rb_image8_set_palette(image,palette);
+  rb_palette_del(palette);
+  int i=w*h; while (i-->0) image->pixels[i]=rb_test_rand(4)?rb_test_rand(256):0;
+  return image;
+}
+
+/* Random grid.
+ */
+ 
+struct rb_grid *rb_test_random_grid(int w,int h,uint8_t imageid) {
+  struct rb_grid *grid=rb_grid_new(w,h);
+  if (!grid) return 0;
+  grid->imageid=imageid;
+  int i=w*h; while (i-->0) grid->v[i]=rb_test_rand(256);
+  return grid;
+}
@@ -0,0 +1,127 @@
+#include "test/rb_test.h"
+#include "test/rb_test_scene.h"
+#include "rabbit/rb_vmgr.h"
+#include "rabbit/rb_image.h"
+#include "rabbit/rb_grid.h"
+#include "rabbit/rb_sprite.h"
+
+/* Init.
+ */
+ 
+int rb_test_scene_init(struct rb_test_scene *scene,int vmgrc,int spritec) {
+  memset(scene,0,sizeof(struct rb_test_scene));
+  if ((vmgrc<1)||(vmgrc>RB_TEST_SCENE_VMGR_LIMIT)) return -1;
+  if ((spritec<0)||(spritec>RB_TEST_SCENE_SPRITE_LIMIT)) return -1;
+  if (!(scene->sheetv[0]=rb_test_random_image(128,128,RB_ALPHAMODE_OPAQUE))) return -1;
+  if (!(scene->sheetv[1]=rb_test_random_image(128,128,RB_ALPHAMODE_BLEND))) return -1;
+  if (!(scene->sheetv[2]=rb_test_random_image(160,96,RB_ALPHAMODE_COLORKEY))) return -1;
+  if (!(scene->grid=rb_test_random_grid(50,40,0))) return -1;
+  for (;scene->vmgrc<vmgrc;scene->vmgrc++) {
+    struct rb_vmgr *vmgr=rb_vmgr_new();
+    if (!vmgr) return -1;
+    scene->vmgrv[scene->vmgrc]=vmgr;
+    int i=0; for (;i<3;i++) {
+      if (rb_vmgr_set_image(vmgr,i,scene->sheetv[i])<0) return -1;
+    }
+    if (rb_vmgr_set_grid(vmgr,scene->grid)<0) return -1;
+  }
+  while (scene->spritec<spritec) {
+    if (rb_test_scene_add_sprite(scene,0)<0) return -1;
+  }
+  return 0;
+}
+
+/* Cleanup.
+ */
+
+void rb_test_scene_cleanup(struct rb_test_scene *scene) {
+  int i;
+  for (i=scene->vmgrc;i-->0;) rb_vmgr_del(scene->vmgrv[i]);
+  for (i=scene->spritec;i-->0;) rb_sprite_del(scene->spritev[i]);
+  for (i=3;i-->0;) rb_image_del(scene->sheetv[i]);
+  rb_grid_del(scene->grid);
+  memset(scene,0,sizeof(struct rb_test_scene));
+}
+
+/* Add sprite.
+ */
+ 
+int rb_test_scene_add_sprite(struct rb_test_scene *scene,const struct rb_sprite_type *type) {
+  if (scene->spritec>=RB_TEST_SCENE_SPRITE_LIMIT) return -1;
+  struct rb_sprite *sprite=rb_sprite_new(type?type:&rb_sprite_type_dummy);
+  if (!sprite) return -1;
+  sprite->x=rb_test_rand(500);
+  sprite->y=rb_test_rand(400);
+  sprite->imageid=1+rb_test_rand(2);
+  sprite->tileid=rb_test_rand(256);
+  sprite->xform=rb_test_rand(8);
+  sprite->layer=rb_test_rand(3);
+  int i=scene->vmgrc; while (i-->0) {
+    if (rb_vmgr_add_sprite(scene->vmgrv[i],sprite)<0) {
+      rb_sprite_del(sprite);
+      return -1;
+    }
+  }
+  scene->spritev[scene->spritec++]=sprite;
+  return 0;
+}
+
+/* Remove sprite.
+ */
+ 
+int rb_test_scene_remove_sprite(struct rb_test_scene *scene,int p) {
+  if ((p<0)||(p>=scene->spritec)) return -1;
+  struct rb_sprite *sprite=scene->spritev[p];
+  int i=scene->vmgrc; while (i-->0) {
+    if (rb_vmgr_remove_sprite(scene->vmgrv[i],sprite)<0) return -1;
+  }
+  rb_sprite_del(sprite);
+  scene->spritev[p]=scene->spritev[--scene->spritec];
+  return 0;
+}
+
+/* Scroll.
+ */
+ 
+void rb_test_scene_scroll(struct rb_test_scene *scene) {
+  struct rb_vmgr *lead=scene->vmgrv[0];
+  switch (rb_test_rand(8)) {
+    case 0: case 1: case 2: break;
+    case 3: lead->scrollx=rb_test_rand(600)-100; lead->scrolly=rb_test_rand(500)-100; break;
+    default: lead->scrollx+=rb_test_rand(9)-4; lead->scrolly+=rb_test_rand(9)-4; break;
+  }
+  int i=scene->vmgrc; while (i-->1) {
+    scene->vmgrv[i]->scrollx=lead->scrollx;
+    scene->vmgrv[i]->scrolly=lead->scrolly;
+  }
+}
+
+/* Change sprites.
+ */
+ 
+void rb_test_scene_move(struct rb_test_scene *scene,int changec) {
+  while ((changec-->0)&&scene->spritec) {
+    struct rb_sprite *sprite=scene->spritev[rb_test_rand(scene->spritec)];
+    switch (rb_test_rand(6)) {
+      case 0: sprite->tileid=rb_test_rand(256); break;
+      case 1: sprite->xform=rb_test_rand(8); break;
+      case 2: sprite->layer=rb_test_rand(3); break;
+      default: sprite->x+=rb_test_rand(11)-5; sprite->y+=rb_test_rand(11)-5; break;
+    }
+  }
+}
+
+/* One frame.
+ */
+ 
+int rb_test_scene_update(struct rb_test_scene *scene) {
+  rb_test_scene_scroll(scene);
+  rb_test_scene_move(scene,rb_test_rand(4));
+  if (!rb_test_rand(10)&&(scene->spritec<RB_TEST_SCENE_SPRITE_LIMIT)) {
+    if (rb_test_scene_add_sprite(scene,0)<0) return -1;
+  }
+  if (!rb_test_rand(10)&&scene->spritec) {
+    if (rb_test_scene_remove_sprite(scene,rb_test_rand(scene->spritec))<0) return -1;
+  }
+  return 0;
+}
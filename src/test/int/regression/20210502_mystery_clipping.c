@@ -3,6 +3,7 @@
 #include <rabbit/rb_synth.h>
 #include <rabbit/rb_synth_event.h>
 #include <rabbit/rb_pcm_store.h>
+#include <rabbit/rb_program_store.h>
 #include <rabbit/rb_pcm.h>
 #include <rabbit/rb_fs.h>
 #include <rabbit/rb_archive.h>
@@ -107,7 +108,8 @@ RB_ITEST(defect_20210502_mystery_clipping,regression) {
     else if ((nextphase>=16)&&(phase<16)) { playsound(audio,synth,0x7f36); phase=16; }
   }
   
-  struct rb_pcm *pcm=rb_pcm_store_get(synth->pcm_store,0x3fb5);
+  uint64_t key=rb_program_store_get_key(synth->program_store,0x7f,0x35);
+  struct rb_pcm *pcm=rb_pcm_store_get(synth->pcm_store,key);
   RB_ASSERT(pcm)
   const int16_t *v=pcm->v;
   int i=pcm->c;
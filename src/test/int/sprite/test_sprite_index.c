@@ -0,0 +1,136 @@
+#include "test/rb_test.h"
+#include "rabbit/rb_sprite.h"
+
+/* Collect query results as a bitmap over the test's sprite list.
+ */
+ 
+#define SPRITE_LIMIT 500
+ 
+struct index_result {
+  struct rb_sprite **spritev;
+  int spritec;
+  uint8_t hitv[SPRITE_LIMIT];
+  int hitc;
+};
+
+static int index_result_cb(struct rb_sprite *sprite,void *userdata) {
+  struct index_result *result=userdata;
+  int i=result->spritec;
+  while (i-->0) {
+    if (result->spritev[i]!=sprite) continue;
+    result->hitv[i]++;
+    result->hitc++;
+    return 0;
+  }
+  return -1;
+}
+
+static int index_keep_some(struct rb_sprite *sprite,void *userdata) {
+  return rb_test_rand(2);
+}
+
+/* Add, move, remove, and query at random, and compare every query against a brute-force scan.
+ * Sprites are spread across negative coordinates and far-apart regions, to exercise the hashing.
+ * First half moves by assignment and updates the index, second half uses rb_sprite_move() and (tracked).
+ */
+ 
+RB_ITEST(sprite_index_query_matches_scan,sprite) {
+  rb_test_srand(24680);
+  struct rb_sprite_group *group=rb_sprite_group_new(RB_SPRITE_GROUP_ORDER_ADDR);
+  RB_ASSERT(group)
+  struct rb_sprite *spritev[SPRITE_LIMIT];
+  int spritec=0;
+  
+  while (spritec<200) {
+    struct rb_sprite *sprite=rb_sprite_new(&rb_sprite_type_dummy);
+    RB_ASSERT(sprite)
+    sprite->x=rb_test_rand(2000)-500;
+    sprite->y=rb_test_rand(2000)-500;
+    RB_ASSERT_CALL(rb_sprite_group_add(group,sprite))
+    spritev[spritec++]=sprite;
+    if (spritec==100) RB_ASSERT_CALL(rb_sprite_group_set_index(group,5))
+  }
+  RB_ASSERT(group->index)
+  RB_ASSERT_INTS(group->index->c,spritec)
+  
+  struct index_result result={.spritev=spritev};
+  int iter=0; for (;iter<400;iter++) {
+    if (iter==200) group->index->tracked=1;
+  
+    int changec=rb_test_rand(20);
+    while (changec-->0) {
+      struct rb_sprite *sprite=spritev[rb_test_rand(spritec)];
+      int x,y;
+      if (rb_test_rand(4)) {
+        x=sprite->x+rb_test_rand(41)-20;
+        y=sprite->y+rb_test_rand(41)-20;
+      } else {
+        x=rb_test_rand(2000)-500;
+        y=rb_test_rand(2000)-500;
+      }
+      if (group->index->tracked) {
+        rb_sprite_move(sprite,x,y);
+      } else {
+        sprite->x=x;
+        sprite->y=y;
+      }
+    }
+    switch (rb_test_rand(8)) {
+      case 0: if (spritec<SPRITE_LIMIT) {
+          struct rb_sprite *sprite=rb_sprite_new(&rb_sprite_type_dummy);
+          RB_ASSERT(sprite)
+          sprite->x=rb_test_rand(2000)-500;
+          sprite->y=rb_test_rand(2000)-500;
+          RB_ASSERT_CALL(rb_sprite_group_add(group,sprite))
+          spritev[spritec++]=sprite;
+        } break;
+      case 1: if (spritec>1) {
+          // Remove before the update, so the index has to find it somewhere other than its current cell.
+          int p=rb_test_rand(spritec);
+          RB_ASSERT_CALL(rb_sprite_group_remove(group,spritev[p]))
+          rb_sprite_del(spritev[p]);
+          spritev[p]=spritev[--spritec];
+        } break;
+    }
+    
+    rb_sprite_group_index_update(group);
+    RB_ASSERT_INTS(group->index->c,spritec)
+    
+    int x,y,w,h;
+    if (rb_test_rand(4)) {
+      x=rb_test_rand(2000)-600; y=rb_test_rand(2000)-600;
+      w=1+rb_test_rand(100); h=1+rb_test_rand(100);
+    } else {
+      x=rb_test_rand(2000)-1000; y=rb_test_rand(2000)-1000;
+      w=1+rb_test_rand(2000); h=1+rb_test_rand(2000);
+    }
+    result.spritec=spritec;
+    result.hitc=0;
+    memset(result.hitv,0,sizeof(result.hitv));
+    RB_ASSERT_CALL(rb_sprite_group_query(group,x,y,w,h,index_result_cb,&result))
+    int i=0,expectc=0;
+    for (;i<spritec;i++) {
+      const struct rb_sprite *sprite=spritev[i];
+      int expect=((sprite->x>=x)&&(sprite->y>=y)&&(sprite->x<x+w)&&(sprite->y<y+h))?1:0;
+      RB_ASSERT_INTS(result.hitv[i],expect,"iter=%d query=(%d,%d,%d,%d) sprite=(%d,%d)",iter,x,y,w,h,sprite->x,sprite->y)
+      expectc+=expect;
+    }
+    RB_ASSERT_INTS(result.hitc,expectc)
+  }
+  
+  // Filtering and clearing must leave the index consistent.
+  rb_sprite_group_filter(group,index_keep_some,0);
+  RB_ASSERT(group->c<spritec)
+  RB_ASSERT_INTS(group->index->c,group->c)
+  RB_ASSERT_CALL(rb_sprite_group_clear(group))
+  RB_ASSERT_INTS(group->index->c,0)
+  result.hitc=0;
+  RB_ASSERT_CALL(rb_sprite_group_query(group,-10000,-10000,20000,20000,index_result_cb,&result))
+  RB_ASSERT_INTS(result.hitc,0)
+  
+  RB_ASSERT_CALL(rb_sprite_group_set_index(group,0))
+  RB_ASSERT(!group->index)
+  while (spritec-->0) rb_sprite_del(spritev[spritec]);
+  rb_sprite_group_del(group);
+  return 0;
+}
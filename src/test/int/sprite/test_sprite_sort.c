@@ -0,0 +1,193 @@
+#include "test/rb_test.h"
+#include "rabbit/rb_sprite.h"
+#include <time.h>
+
+/* Count adjacent pairs out of render order.
+ */
+ 
+static int sort_count_misordered(const struct rb_sprite_group *group) {
+  int c=0,i=1;
+  for (;i<group->c;i++) {
+    if (rb_sprite_cmp_render(group->v[i-1],group->v[i])>0) c++;
+  }
+  return c;
+}
+
+static struct rb_sprite *sort_new_sprite(struct rb_sprite_group *group,int worldh) {
+  struct rb_sprite *sprite=rb_sprite_new(&rb_sprite_type_dummy);
+  if (!sprite) return 0;
+  sprite->y=rb_test_rand(worldh);
+  sprite->layer=rb_test_rand(3);
+  if (rb_sprite_group_add(group,sprite)<0) {
+    rb_sprite_del(sprite);
+    return 0;
+  }
+  return sprite;
+}
+
+static int sort_keep_some(struct rb_sprite *sprite,void *userdata) {
+  return rb_test_rand(8);
+}
+
+/* SORT_FULL must be exactly in order after every sort, and membership must stay consistent
+ * through adds, removes, kills, and filters, which all shuffle the group in different ways.
+ */
+ 
+#define SPRITE_LIMIT 300
+ 
+RB_ITEST(sprite_sort_full_is_exact,sprite) {
+  rb_test_srand(11235);
+  struct rb_sprite_group *group=rb_sprite_group_new(RB_SPRITE_GROUP_ORDER_RENDER);
+  RB_ASSERT(group)
+  group->sortmode=RB_SPRITE_SORT_FULL;
+  struct rb_sprite *spritev[SPRITE_LIMIT];
+  int spritec=0,i;
+  while (spritec<200) {
+    RB_ASSERT(spritev[spritec]=sort_new_sprite(group,1000))
+    spritec++;
+  }
+  
+  int frame=0; for (;frame<500;frame++) {
+  
+    // Usually a few sprites move a bit. Sometimes everyone does, or everything is scrambled, or everything ties.
+    if (frame%200==100) {
+      for (i=0;i<spritec;i++) spritev[i]->y=rb_test_rand(1000);
+    } else if (frame==450) {
+      for (i=0;i<spritec;i++) {
+        spritev[i]->y=500;
+        spritev[i]->layer=1;
+      }
+    } else {
+      int movec=(frame%200)?rb_test_rand(10):spritec;
+      while (movec-->0) {
+        struct rb_sprite *sprite=spritev[rb_test_rand(spritec)];
+        sprite->y+=rb_test_rand(41)-20;
+        if (!rb_test_rand(10)) sprite->layer=rb_test_rand(3);
+      }
+    }
+    // Ties on (layer,y) must break on address, or the order would depend on history.
+    if (!(frame%7)) spritev[rb_test_rand(spritec)]->y=spritev[rb_test_rand(spritec)]->y;
+    
+    switch (rb_test_rand(6)) {
+      case 0: if (spritec<SPRITE_LIMIT) {
+          RB_ASSERT(spritev[spritec]=sort_new_sprite(group,1000))
+          spritec++;
+        } break;
+      case 1: if (spritec>1) {
+          int p=rb_test_rand(spritec);
+          RB_ASSERT_INTS(rb_sprite_group_remove(group,spritev[p]),1)
+          RB_ASSERT_INTS(rb_sprite_group_remove(group,spritev[p]),0)
+          rb_sprite_del(spritev[p]);
+          spritev[p]=spritev[--spritec];
+        } break;
+      case 2: if (spritec>1) {
+          int p=rb_test_rand(spritec);
+          RB_ASSERT_CALL(rb_sprite_ref(spritev[p]))
+          RB_ASSERT_CALL(rb_sprite_kill(spritev[p]))
+          rb_sprite_del(spritev[p]);
+          spritev[p]=spritev[--spritec];
+        } break;
+    }
+    if (frame==250) {
+      rb_sprite_group_filter(group,sort_keep_some,0);
+      for (i=spritec;i-->0;) {
+        if (rb_sprite_group_has(group,spritev[i])) continue;
+        spritev[i]=spritev[--spritec];
+      }
+    }
+    
+    // Re-adding a member is a no-op, and must not disturb the map.
+    RB_ASSERT_INTS(rb_sprite_group_add(group,spritev[rb_test_rand(spritec)]),0)
+    
+    rb_sprite_group_sort(group);
+    RB_ASSERT_INTS(group->c,spritec)
+    for (i=1;i<group->c;i++) {
+      RB_ASSERT_INTS_OP(rb_sprite_cmp_render(group->v[i-1],group->v[i]),<,0,"frame=%d i=%d",frame,i)
+    }
+    for (i=0;i<spritec;i++) {
+      RB_ASSERT(rb_sprite_group_has(group,spritev[i]))
+    }
+  }
+  
+  // rb_sprite_group_kill() takes sprites off the end one at a time, and each kill looks for itself in the group.
+  RB_ASSERT_CALL(rb_sprite_group_kill(group))
+  RB_ASSERT_INTS(group->c,0)
+  rb_sprite_group_del(group);
+  return 0;
+}
+
+/* Benchmark: Bubble vs full sorting.
+ * Sprites drift vertically at their own speed, like a crowd walking around, about one per row of pixels.
+ * "misordered" is the average count of adjacent pairs still out of order after sorting, ie how far behind bubble mode is.
+ * Also a few come and go each frame, which is where the O(1) insert and remove of SORT_FULL show up.
+ */
+ 
+static double sort_cputime() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID,&tv);
+  return (double)tv.tv_sec+tv.tv_nsec/1000000000.0;
+}
+
+static int sort_benchmark(int spritec,int sortmode) {
+  struct rb_sprite_group *group=rb_sprite_group_new(RB_SPRITE_GROUP_ORDER_RENDER);
+  RB_ASSERT(group)
+  group->sortmode=sortmode;
+  struct rb_sprite **spritev=calloc(spritec,sizeof(void*));
+  int *dyv=calloc(spritec,sizeof(int));
+  RB_ASSERT(spritev&&dyv)
+  int i;
+  for (i=0;i<spritec;i++) {
+    RB_ASSERT(spritev[i]=sort_new_sprite(group,spritec))
+    dyv[i]=rb_test_rand(5)-2;
+  }
+  rb_sprite_group_sort_fully(group);
+  
+  int framec=500,misorderedc=0,laggingc=0;
+  double sorttime=0.0,churntime=0.0;
+  int frame=0; for (;frame<framec;frame++) {
+    for (i=0;i<spritec;i++) {
+      spritev[i]->y+=dyv[i];
+      if (!rb_test_rand(100)) dyv[i]=rb_test_rand(5)-2;
+    }
+    
+    double t0=sort_cputime();
+    int churnc=spritec/100;
+    while (churnc-->0) {
+      int p=rb_test_rand(spritec);
+      rb_sprite_group_remove(group,spritev[p]);
+      rb_sprite_group_add(group,spritev[p]);
+    }
+    double t1=sort_cputime();
+    rb_sprite_group_sort(group);
+    double t2=sort_cputime();
+    churntime+=t1-t0;
+    sorttime+=t2-t1;
+    
+    int misordered=sort_count_misordered(group);
+    misorderedc+=misordered;
+    if (misordered) laggingc++;
+  }
+  
+  fprintf(stderr,
+    "%6d sprites, %6s: sort %8.1f us/frame, remove+add %8.1f us/frame, misordered %8.1f, out of order %3d%% of frames\n",
+    spritec,(sortmode==RB_SPRITE_SORT_FULL)?"full":"bubble",
+    (sorttime*1000000.0)/framec,(churntime*1000000.0)/framec,
+    (double)misorderedc/framec,(laggingc*100)/framec
+  );
+  
+  rb_sprite_group_clear(group);
+  rb_sprite_group_del(group);
+  for (i=0;i<spritec;i++) rb_sprite_del(spritev[i]);
+  free(spritev);
+  free(dyv);
+  return 0;
+}
+
+XXX_RB_ITEST(sprite_sort_benchmark) {
+  rb_test_srand(11235);
+  RB_ASSERT_CALL(sort_benchmark(1000,RB_SPRITE_SORT_BUBBLE))
+  RB_ASSERT_CALL(sort_benchmark(1000,RB_SPRITE_SORT_FULL))
+  RB_ASSERT_CALL(sort_benchmark(10000,RB_SPRITE_SORT_BUBBLE))
+  RB_ASSERT_CALL(sort_benchmark(10000,RB_SPRITE_SORT_FULL))
+  return 0;
+}
@@ -0,0 +1,165 @@
+#include "test/rb_test.h"
+#include "rabbit/rb_pcm_cache.h"
+#include "rabbit/rb_pcm.h"
+#include "rabbit/rb_pcm_store.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define CACHE_ROOT "mid/test/pcm_cache"
+#define CACHE_PATH CACHE_ROOT "/22050.pcm"
+
+static struct rb_pcm *ramp_pcm(int c,int16_t base) {
+  struct rb_pcm *pcm=rb_pcm_new(c);
+  if (!pcm) return 0;
+  int i=0; for (;i<c;i++) pcm->v[i]=base+i;
+  return pcm;
+}
+
+/* Records survive a reopen, and come back as views into the mapping.
+ * Keys carry the program hash, so a changed program misses.
+ */
+ 
+RB_ITEST(pcm_cache_round_trip,synth) {
+  unlink(CACHE_PATH);
+  uint32_t hash=rb_pcm_cache_hash("program",7);
+  RB_ASSERT(hash)
+  uint64_t keya=rb_pcm_store_generate_key(hash,0x45);
+  uint64_t keyb=rb_pcm_store_generate_key(hash,0x00);
+  
+  struct rb_pcm_cache *cache=rb_pcm_cache_open(CACHE_ROOT,22050);
+  RB_ASSERT(cache)
+  RB_ASSERT_INTS(cache->entryc,0)
+  struct rb_pcm *a=ramp_pcm(33,100);
+  struct rb_pcm *b=ramp_pcm(8,-50);
+  RB_ASSERT(a&&b)
+  RB_ASSERT_CALL(rb_pcm_cache_add(cache,keya,a))
+  RB_ASSERT_CALL(rb_pcm_cache_add(cache,keyb,b))
+  
+  // Available before reopening, without mapping again.
+  struct rb_pcm *view=rb_pcm_cache_get(cache,keya);
+  RB_ASSERT(view)
+  RB_ASSERT(view->map==cache->map)
+  RB_ASSERT_INTS(view->c,33)
+  RB_ASSERT(!memcmp(view->v,a->v,33*2))
+  rb_pcm_cache_del(cache);
+  
+  // View outlives the cache.
+  RB_ASSERT_INTS(view->v[32],132)
+  rb_pcm_del(view);
+  
+  // Reopen: both entries indexed, a different program or note misses.
+  RB_ASSERT(cache=rb_pcm_cache_open(CACHE_ROOT,22050))
+  RB_ASSERT_INTS(cache->entryc,2)
+  RB_ASSERT_NOT(rb_pcm_cache_get(cache,rb_pcm_store_generate_key(hash+1,0x45)))
+  RB_ASSERT_NOT(rb_pcm_cache_get(cache,rb_pcm_store_generate_key(hash,0x46)))
+  RB_ASSERT(view=rb_pcm_cache_get(cache,keyb))
+  RB_ASSERT_INTS(view->c,8)
+  RB_ASSERT(!memcmp(view->v,b->v,8*2))
+  rb_pcm_del(view);
+  
+  // A later record for the same key replaces the earlier one.
+  struct rb_pcm *c=ramp_pcm(5,7);
+  RB_ASSERT(c)
+  RB_ASSERT_CALL(rb_pcm_cache_add(cache,keya,c))
+  rb_pcm_cache_del(cache);
+  RB_ASSERT(cache=rb_pcm_cache_open(CACHE_ROOT,22050))
+  RB_ASSERT_INTS(cache->entryc,2)
+  RB_ASSERT(view=rb_pcm_cache_get(cache,keya))
+  RB_ASSERT_INTS(view->c,5)
+  RB_ASSERT_INTS(view->v[4],11)
+  rb_pcm_del(view);
+  rb_pcm_cache_del(cache);
+  
+  rb_pcm_del(a);
+  rb_pcm_del(b);
+  rb_pcm_del(c);
+  unlink(CACHE_PATH);
+  return 0;
+}
+
+/* Two handles on one file stand in for two processes: flock is per open file, so they exclude each other too.
+ * Each appends after the other's records, and garbage at the end is overwritten, never truncated.
+ */
+ 
+RB_ITEST(pcm_cache_shared_file,synth) {
+  unlink(CACHE_PATH);
+  uint32_t hash=rb_pcm_cache_hash("shared",6);
+  uint64_t keya=rb_pcm_store_generate_key(hash,1);
+  uint64_t keyb=rb_pcm_store_generate_key(hash,2);
+  uint64_t keyc=rb_pcm_store_generate_key(hash,3);
+  struct rb_pcm *a=ramp_pcm(20,0);
+  struct rb_pcm *b=ramp_pcm(30,1000);
+  struct rb_pcm *c=ramp_pcm(9,-9);
+  RB_ASSERT(a&&b&&c)
+  
+  struct rb_pcm_cache *x=rb_pcm_cache_open(CACHE_ROOT,22050);
+  struct rb_pcm_cache *y=rb_pcm_cache_open(CACHE_ROOT,22050);
+  RB_ASSERT(x&&y)
+  RB_ASSERT_CALL(rb_pcm_cache_add(x,keya,a))
+  RB_ASSERT_CALL(rb_pcm_cache_add(y,keyb,b))
+  rb_pcm_cache_collect(y);
+  RB_ASSERT_INTS(y->entryc,2,"y picked up x's record before appending")
+  RB_ASSERT_CALL(rb_pcm_cache_add(x,keyc,c))
+  rb_pcm_cache_collect(x);
+  RB_ASSERT_INTS(x->entryc,3)
+  struct rb_pcm *view=rb_pcm_cache_get(x,keyb);
+  RB_ASSERT(view)
+  RB_ASSERT(!memcmp(view->v,b->v,30*2))
+  
+  // A partial record at the end, as if a writer crashed. Opening leaves it alone.
+  int fd=open(CACHE_PATH,O_RDWR);
+  RB_ASSERT_INTS_OP(fd,>=,0)
+  off_t goodlen=lseek(fd,0,SEEK_END);
+  uint8_t junk[64];
+  memset(junk,0x5a,sizeof(junk));
+  RB_ASSERT_INTS(pwrite(fd,junk,sizeof(junk),goodlen),sizeof(junk))
+  close(fd);
+  struct rb_pcm_cache *z=rb_pcm_cache_open(CACHE_ROOT,22050);
+  RB_ASSERT(z)
+  RB_ASSERT_INTS(z->entryc,3)
+  RB_ASSERT_INTS(z->filelen,goodlen)
+  struct stat st;
+  RB_ASSERT_CALL(stat(CACHE_PATH,&st))
+  RB_ASSERT_INTS(st.st_size,goodlen+sizeof(junk),"Never truncate")
+  
+  // The next append overwrites the garbage, and everyone can still read everything.
+  RB_ASSERT_CALL(rb_pcm_cache_add(y,keya,c))
+  rb_pcm_cache_del(z);
+  RB_ASSERT(z=rb_pcm_cache_open(CACHE_ROOT,22050))
+  RB_ASSERT_INTS(z->entryc,3)
+  struct rb_pcm *view2=rb_pcm_cache_get(z,keya);
+  RB_ASSERT(view2)
+  RB_ASSERT_INTS(view2->c,9)
+  rb_pcm_del(view2);
+  
+  // Replacing an invalid file renames a new one in; old mappings stay readable, and other handles' writers follow.
+  // Their readers keep the old file, with everything they had indexed.
+  rb_pcm_cache_del(z);
+  RB_ASSERT((fd=open(CACHE_PATH,O_RDWR))>=0)
+  RB_ASSERT_INTS(pwrite(fd,"xPCM",4,0),4)
+  close(fd);
+  RB_ASSERT(z=rb_pcm_cache_open(CACHE_ROOT,22050))
+  RB_ASSERT_INTS(z->entryc,0)
+  RB_ASSERT_INTS(view->v[29],1029)
+  RB_ASSERT_CALL(rb_pcm_cache_add(x,keyb,b))
+  RB_ASSERT_NOT(x->orig,"x found the new file")
+  rb_pcm_cache_collect(x);
+  RB_ASSERT_INTS(x->entryc,3)
+  rb_pcm_del(view);
+  RB_ASSERT(view=rb_pcm_cache_get(x,keyc))
+  RB_ASSERT_INTS(view->v[8],-1)
+  rb_pcm_del(view);
+  rb_pcm_cache_del(z);
+  RB_ASSERT(z=rb_pcm_cache_open(CACHE_ROOT,22050))
+  RB_ASSERT_INTS(z->entryc,1)
+  
+  rb_pcm_cache_del(x);
+  rb_pcm_cache_del(y);
+  rb_pcm_cache_del(z);
+  rb_pcm_del(a);
+  rb_pcm_del(b);
+  rb_pcm_del(c);
+  unlink(CACHE_PATH);
+  return 0;
+}
@@ -0,0 +1,116 @@
+#include "test/rb_test.h"
+#include "rabbit/rb_pcm_store.h"
+#include "rabbit/rb_pcm.h"
+#include "rabbit/rb_synth.h"
+#include "rabbit/rb_program_store.h"
+#include "rabbit/rb_archive.h"
+
+static struct rb_synth mock_synth={
+  .rate=44100,
+  .chanc=1,
+};
+
+static int add_dummy_pcm(struct rb_pcm_store *store,uint64_t key) {
+  struct rb_pcm *pcm=rb_pcm_new(100);
+  if (!pcm) return -1;
+  int err=rb_pcm_store_add(store,key,pcm);
+  rb_pcm_del(pcm);
+  return err;
+}
+
+/* Eviction must drop the least recently used entries, not the highest keys.
+ */
+ 
+RB_ITEST(pcm_store_evicts_least_recently_used,synth) {
+  struct rb_pcm_store *store=rb_pcm_store_new(&mock_synth);
+  RB_ASSERT(store)
+  store->count_limit=8;
+  store->count_target=4;
+  
+  // Add 8 entries, keys descending so that key order and insertion order disagree.
+  int i=8;
+  while (i-->0) {
+    RB_ASSERT_CALL(add_dummy_pcm(store,0x3f00+i))
+  }
+  RB_ASSERT_INTS(store->entryc,8)
+  RB_ASSERT_INTS(store->evictc,0)
+  
+  // Touch the three highest keys, the ones the old policy would have dropped first.
+  RB_ASSERT(rb_pcm_store_get(store,0x3f07))
+  RB_ASSERT(rb_pcm_store_get(store,0x3f06))
+  RB_ASSERT(rb_pcm_store_get(store,0x3f05))
+  RB_ASSERT_NOT(rb_pcm_store_get(store,0x1234))
+  RB_ASSERT_INTS(store->hitc,3)
+  RB_ASSERT_INTS(store->missc,1)
+  
+  // One more puts us over the limit.
+  RB_ASSERT_CALL(add_dummy_pcm(store,0x0001))
+  RB_ASSERT_INTS(store->entryc,4)
+  RB_ASSERT_INTS(store->evictc,5)
+  RB_ASSERT_INTS(store->size,4*100*2)
+  
+  // Survivors are the three we touched and the newcomer, still in key order.
+  RB_ASSERT_INTS(store->entryv[0].key,0x0001)
+  RB_ASSERT_INTS(store->entryv[1].key,0x3f05)
+  RB_ASSERT_INTS(store->entryv[2].key,0x3f06)
+  RB_ASSERT_INTS(store->entryv[3].key,0x3f07)
+  
+  rb_pcm_store_del(store);
+  return 0;
+}
+
+/* PCM is keyed by program content, not slot.
+ */
+ 
+static int cb_archive(uint32_t type,int id,const void *src,int srcc,void *userdata) {
+  struct rb_synth *synth=userdata;
+  switch (type) {
+    case RB_RES_TYPE_snth: if (rb_synth_load_program(synth,id,src,srcc)<0) return -1; break;
+  }
+  return 0;
+}
+
+static int copy_program(struct rb_synth *synth,uint8_t dstid,uint8_t srcid) {
+  const void *serial=0;
+  int serialc=rb_program_store_get_serial(&serial,synth->program_store,srcid);
+  if (serialc<1) return -1;
+  // Copy it, the store replaces its own.
+  void *copy=malloc(serialc);
+  if (!copy) return -1;
+  memcpy(copy,serial,serialc);
+  int err=rb_synth_load_program(synth,dstid,copy,serialc);
+  free(copy);
+  return err;
+}
+ 
+RB_ITEST(pcm_store_keys_on_program_content,synth) {
+  struct rb_synth *synth=rb_synth_new(22050,1);
+  RB_ASSERT(synth)
+  RB_ASSERT_CALL(rb_archive_read("out/data",cb_archive,synth))
+  struct rb_pcm_store *store=synth->pcm_store;
+  
+  // Identical programs in slots 0 and 100 share one PCM per note.
+  RB_ASSERT_CALL(copy_program(synth,100,0))
+  RB_ASSERT_INTS(rb_program_store_get_key(synth->program_store,0,0x40),rb_program_store_get_key(synth->program_store,100,0x40))
+  RB_ASSERT_CALL(rb_synth_play_note(synth,0,0x40))
+  RB_ASSERT_INTS(store->entryc,1)
+  struct rb_pcm *pcm0=store->entryv[0].pcm;
+  RB_ASSERT_CALL(rb_synth_play_note(synth,100,0x40))
+  RB_ASSERT_INTS(store->entryc,1)
+  RB_ASSERT(store->entryv[0].pcm==pcm0)
+  
+  // Replace slot 100: slot 0's note is still cached, slot 100 prints anew.
+  RB_ASSERT_CALL(copy_program(synth,100,3))
+  RB_ASSERT_INTS(store->entryc,1)
+  RB_ASSERT_CALL(rb_synth_play_note(synth,100,0x40))
+  RB_ASSERT_INTS(store->entryc,2)
+  RB_ASSERT(rb_pcm_store_get(store,rb_program_store_get_key(synth->program_store,0,0x40))==pcm0)
+  
+  // Replace slot 0 too: its old serial is no longer used anywhere, so its PCM goes away.
+  RB_ASSERT_CALL(copy_program(synth,0,3))
+  RB_ASSERT_INTS(store->entryc,1)
+  RB_ASSERT(rb_pcm_store_get(store,rb_program_store_get_key(synth->program_store,0,0x40)))
+  
+  rb_synth_del(synth);
+  return 0;
+}
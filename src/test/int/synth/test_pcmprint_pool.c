@@ -0,0 +1,253 @@
+#include "test/rb_test.h"
+#include "rabbit/rb_synth.h"
+#include "rabbit/rb_pcmprint_pool.h"
+#include "rabbit/rb_pcm.h"
+#include "rabbit/rb_program_store.h"
+#include "rabbit/rb_archive.h"
+#include "rabbit/rb_synth_event.h"
+#include "rabbit/rb_pcm_store.h"
+#include "rabbit/rb_pcm_cache.h"
+#include <sched.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static int cb_archive(uint32_t type,int id,const void *src,int srcc,void *userdata) {
+  struct rb_synth *synth=userdata;
+  switch (type) {
+    case RB_RES_TYPE_snth: if (rb_synth_load_program(synth,id,src,srcc)<0) return -1; break;
+  }
+  return 0;
+}
+
+/* A real audio callback leaves workers a whole buffer period between updates; these tests update back to back.
+ * So let any chunk in progress finish, and hold workers off during the update: They only claim under (mutex).
+ * Otherwise the synth skips a claimed printer instead of waiting, its runners stall, and the output legitimately differs.
+ * Reap ourselves after, since the synth's reap can't get the lock.
+ */
+ 
+static int pool_update(int16_t *v,int c,struct rb_synth *synth) {
+  struct rb_pcmprint_pool *pool=synth->pcmprint_pool;
+  if (pthread_mutex_lock(&pool->mutex)) return -1;
+  int i=pool->printc;
+  while (i-->0) {
+    while (__atomic_load_n(&pool->printv[i]->claim,__ATOMIC_ACQUIRE)) sched_yield();
+  }
+  int err=rb_synth_update(v,c,synth);
+  pthread_mutex_unlock(&pool->mutex);
+  rb_pcmprint_pool_reap(pool);
+  return err;
+}
+
+/* Print workers must not change the output, only who does the work.
+ */
+ 
+RB_ITEST(pcmprint_pool_matches_inline,synth) {
+  struct rb_synth *inline_synth=rb_synth_new(44100,2);
+  struct rb_synth *pool_synth=rb_synth_new(44100,2);
+  RB_ASSERT(inline_synth&&pool_synth)
+  RB_ASSERT_CALL(rb_archive_read("out/data",cb_archive,inline_synth))
+  RB_ASSERT_CALL(rb_archive_read("out/data",cb_archive,pool_synth))
+  RB_ASSERT_CALL(rb_synth_set_print_threads(pool_synth,3))
+  RB_ASSERT(pool_synth->pcmprint_pool)
+  
+  const uint8_t noteidv[]={0x30,0x34,0x37,0x3c,0x40,0x43,0x48};
+  int notep=0;
+  int updatec=0;
+  while ((notep<sizeof(noteidv))||inline_synth->pcmrunc||pool_synth->pcmrunc) {
+    if ((notep<sizeof(noteidv))&&!(updatec%3)) {
+      RB_ASSERT_CALL(rb_synth_play_note(inline_synth,0,noteidv[notep]))
+      RB_ASSERT_CALL(rb_synth_play_note(pool_synth,0,noteidv[notep]))
+      notep++;
+    }
+    int16_t a[512],b[512];
+    RB_ASSERT_CALL(rb_synth_update(a,512,inline_synth))
+    RB_ASSERT_CALL(pool_update(b,512,pool_synth))
+    RB_ASSERT(!memcmp(a,b,sizeof(a)),"update %d",updatec)
+    updatec++;
+    RB_ASSERT_INTS_OP(updatec,<,100000)
+  }
+  
+  // Dropping the pool mid-song must be safe too.
+  RB_ASSERT_CALL(rb_synth_play_note(pool_synth,0,0x50))
+  RB_ASSERT_CALL(rb_synth_set_print_threads(pool_synth,0))
+  RB_ASSERT_NOT(pool_synth->pcmprint_pool)
+  
+  rb_synth_del(inline_synth);
+  rb_synth_del(pool_synth);
+  return 0;
+}
+
+/* Prewarming a song starts printers for its distinct notes, and again must not change the output.
+ */
+ 
+RB_ITEST(pcmprint_pool_prewarm_song,synth) {
+  struct rb_synth *inline_synth=rb_synth_new(22050,1);
+  struct rb_synth *pool_synth=rb_synth_new(22050,1);
+  RB_ASSERT(inline_synth&&pool_synth)
+  RB_ASSERT_CALL(rb_archive_read("out/data",cb_archive,inline_synth))
+  RB_ASSERT_CALL(rb_archive_read("out/data",cb_archive,pool_synth))
+  RB_ASSERT_CALL(rb_synth_set_print_threads(pool_synth,2))
+  
+  #define NOTE(noteid) 0x80,noteid
+  #define DELAY(ticks) 0x00,ticks
+  const uint8_t serial[]={
+    'r',0xab,'S','g', 0x03,0xe8, 0x00,0x18, 0,0,0,0,0,0,0,0,
+    NOTE(0x30),NOTE(0x37),DELAY(0x20),
+    NOTE(0x34),DELAY(0x40),
+    NOTE(0x30),NOTE(0x3c),DELAY(0x40),
+    NOTE(0x37),NOTE(0x34),DELAY(0x80),
+  };
+  #undef NOTE
+  #undef DELAY
+  struct rb_song *song=rb_song_new(serial,sizeof(serial));
+  RB_ASSERT(song)
+  RB_ASSERT_CALL(rb_synth_play_song(inline_synth,song,1))
+  RB_ASSERT_CALL(rb_synth_play_song(pool_synth,song,1))
+  rb_song_del(song);
+  inline_synth->song->repeat=0;
+  pool_synth->song->repeat=0;
+  
+  // Four distinct notes, each with a printer queued. Finished ones only leave the list at rb_synth_update().
+  RB_ASSERT_INTS(inline_synth->prewarmc,0)
+  RB_ASSERT_INTS(pool_synth->prewarmc,4)
+  const uint8_t songnoteidv[]={0x30,0x37,0x34,0x3c};
+  int i=0; for (;i<sizeof(songnoteidv);i++) {
+    uint64_t key=rb_program_store_get_key(pool_synth->program_store,0,songnoteidv[i]);
+    RB_ASSERT(key,"note 0x%02x",songnoteidv[i])
+    int found=0,j=pool_synth->prewarmc;
+    while (j-->0) if (pool_synth->prewarmv[j]->key==key) found=1;
+    RB_ASSERT(found,"note 0x%02x not prewarmed",songnoteidv[i])
+  }
+  
+  int updatec=0;
+  while (inline_synth->song||inline_synth->pcmrunc||pool_synth->song||pool_synth->pcmrunc) {
+    int16_t a[256],b[256];
+    RB_ASSERT_CALL(rb_synth_update(a,256,inline_synth))
+    RB_ASSERT_CALL(pool_update(b,256,pool_synth))
+    RB_ASSERT(!memcmp(a,b,sizeof(a)),"update %d",updatec)
+    updatec++;
+    RB_ASSERT_INTS_OP(updatec,<,100000)
+  }
+  RB_ASSERT_INTS(pool_synth->prewarmc,0)
+  
+  rb_synth_del(inline_synth);
+  rb_synth_del(pool_synth);
+  return 0;
+}
+
+/* The synth never waits for a worker. If one holds the claim, nothing gets printed inline,
+ * and runners stall at the last published sample instead of reading past it.
+ */
+ 
+RB_ITEST(pcmprint_require_never_waits,synth) {
+  struct rb_synth *synth=rb_synth_new(22050,1);
+  RB_ASSERT(synth)
+  RB_ASSERT_CALL(rb_archive_read("out/data",cb_archive,synth))
+  struct rb_pcm *pcm=0;
+  struct rb_pcmprint *pcmprint=0;
+  RB_ASSERT_CALL(rb_program_store_get_note(&pcm,&pcmprint,synth->program_store,0,0x40))
+  RB_ASSERT(pcm&&pcmprint)
+  RB_ASSERT_INTS(pcm->readyc,0)
+  
+  RB_ASSERT_INTS(rb_pcmprint_require(pcmprint,100),1)
+  RB_ASSERT_INTS(pcm->readyc,100)
+  
+  // Pretend a worker is mid-chunk.
+  RB_ASSERT(rb_pcmprint_try_claim(pcmprint))
+  RB_ASSERT_INTS(rb_pcmprint_require(pcmprint,100),1)
+  RB_ASSERT_INTS(rb_pcmprint_get_position(pcmprint),100)
+  
+  struct rb_pcmrun pcmrun;
+  RB_ASSERT_CALL(rb_pcmrun_init(&pcmrun,pcm))
+  int32_t bus[200]={0};
+  RB_ASSERT_INTS(rb_pcmrun_update(bus,200,&pcmrun),1)
+  RB_ASSERT_INTS(pcmrun.p,100)
+  RB_ASSERT_INTS(bus[100],0)
+  RB_ASSERT_INTS(rb_pcmrun_update(bus+100,100,&pcmrun),1,"Stalled, not finished")
+  RB_ASSERT_INTS(pcmrun.p,100)
+  
+  // Worker publishes, and the runner picks up where it stopped.
+  RB_ASSERT_CALL(rb_pcmprint_update(pcmprint,100))
+  rb_pcmprint_release(pcmprint);
+  RB_ASSERT_INTS(rb_pcmrun_update(bus+100,100,&pcmrun),1)
+  RB_ASSERT_INTS(pcmrun.p,200)
+  
+  rb_pcmrun_cleanup(&pcmrun);
+  rb_pcmprint_del(pcmprint);
+  rb_pcm_del(pcm);
+  rb_synth_del(synth);
+  return 0;
+}
+
+/* Finished PCMs persist through the workers, never from rb_synth_update().
+ * Without workers, the cache is read-only.
+ */
+ 
+#define PERSIST_ROOT "mid/test/pcm_cache_pool"
+#define PERSIST_PATH PERSIST_ROOT "/22050.pcm"
+ 
+static int play_out(struct rb_synth *synth,uint8_t noteid) {
+  if (rb_synth_play_note(synth,0,noteid)<0) return -1;
+  int updatec=0;
+  while (synth->pcmrunc||synth->pcmprintc) {
+    int16_t v[512];
+    if (synth->pcmprint_pool) {
+      if (pool_update(v,512,synth)<0) return -1;
+    } else {
+      if (rb_synth_update(v,512,synth)<0) return -1;
+    }
+    if (++updatec>=100000) return -1;
+  }
+  return 0;
+}
+ 
+RB_ITEST(pcmprint_pool_persists_to_cache,synth) {
+  unlink(PERSIST_PATH);
+  
+  struct rb_synth *synth=rb_synth_new(22050,1);
+  RB_ASSERT(synth)
+  RB_ASSERT_CALL(rb_archive_read("out/data",cb_archive,synth))
+  RB_ASSERT_CALL(rb_synth_set_cachedir(synth,PERSIST_ROOT))
+  struct rb_pcm_cache *cache=synth->pcm_store->cache;
+  RB_ASSERT(cache)
+  struct stat st;
+  RB_ASSERT_CALL(stat(PERSIST_PATH,&st))
+  off_t emptylen=st.st_size;
+  
+  // No workers: Plays fine, writes nothing.
+  RB_ASSERT_CALL(play_out(synth,0x30))
+  RB_ASSERT_CALL(stat(PERSIST_PATH,&st))
+  RB_ASSERT_INTS(st.st_size,emptylen)
+  
+  // With workers, the record appears in the file, and in our index without mapping again.
+  struct rb_pcm_map *map=cache->map;
+  RB_ASSERT_CALL(rb_synth_set_print_threads(synth,2))
+  RB_ASSERT_CALL(play_out(synth,0x34))
+  int waitc=0;
+  while (1) {
+    rb_pcmprint_pool_reap(synth->pcmprint_pool);
+    int busy=0,i=RB_PCMPRINT_POOL_PERSIST_LIMIT;
+    while (i-->0) {
+      if (__atomic_load_n(&synth->pcmprint_pool->persistv[i].state,__ATOMIC_ACQUIRE)!=RB_PCMPRINT_PERSIST_IDLE) busy=1;
+    }
+    if (!busy) break;
+    RB_ASSERT_INTS_OP(++waitc,<,100000)
+    sched_yield();
+  }
+  RB_ASSERT_CALL(stat(PERSIST_PATH,&st))
+  RB_ASSERT_INTS_OP(st.st_size,>,emptylen)
+  rb_pcm_cache_collect(cache);
+  RB_ASSERT_INTS(cache->entryc,1)
+  RB_ASSERT(cache->map==map)
+  
+  // Another process sees it too.
+  struct rb_pcm_cache *other=rb_pcm_cache_open(PERSIST_ROOT,22050);
+  RB_ASSERT(other)
+  RB_ASSERT_INTS(other->entryc,1)
+  RB_ASSERT_INTS(other->entryv[0].key,cache->entryv[0].key)
+  rb_pcm_cache_del(other);
+  
+  rb_synth_del(synth);
+  unlink(PERSIST_PATH);
+  return 0;
+}
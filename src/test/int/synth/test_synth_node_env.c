@@ -1,6 +1,7 @@
 #include "test/rb_test.h"
 #include "rabbit/rb_synth_node.h"
 #include "rabbit/rb_synth.h"
+#include <math.h>
 
 static struct rb_synth mock_synth={
   .rate=300,
@@ -115,3 +116,154 @@ XXX_RB_ITEST(generate_and_print_curve) {
   rb_synth_node_config_del(config);
   return 0;
 }
+
+/* Run an env config to completion in awkward chunks.
+ * Before each chunk, (dst) is filled with a ramp, so 'mlt' and 'add' have something to work on.
+ */
+ 
+static int run_env_chunked(rb_sample_t *dst,int dstc,struct rb_synth_node_config *config) {
+  #define buffera 97
+  rb_sample_t buffer[buffera];
+  rb_sample_t *bufferv[]={buffer};
+  struct rb_synth_node_runner *runner=rb_synth_node_runner_new(config,bufferv,1,0x40);
+  RB_ASSERT(runner)
+  int dstp=0,chunkc=1;
+  while (dstp<dstc) {
+    int c=dstc-dstp;
+    if (c>chunkc) c=chunkc;
+    int i=0; for (;i<c;i++) buffer[i]=0.5f+(dstp+i)*0.001f;
+    runner->update(runner,c);
+    memcpy(dst+dstp,buffer,sizeof(rb_sample_t)*c);
+    dstp+=c;
+    if (++chunkc>buffera) chunkc=1;
+  }
+  rb_synth_node_runner_del(runner);
+  #undef buffera
+  return 0;
+}
+
+static struct rb_synth_node_config *decode_env(int mode,const uint8_t *content,int contentc) {
+  uint8_t serial[64]={
+    RB_SYNTH_NTID_env,
+      0x01,0x00, // main
+      0x02,RB_SYNTH_FIELD_TYPE_U8,mode,
+      0x03,RB_SYNTH_FIELD_TYPE_SERIAL1,contentc,
+  };
+  int serialc=9;
+  memcpy(serial+serialc,content,contentc);
+  serialc+=contentc;
+  return rb_synth_node_config_new_decode(&mock_synth,serial,serialc);
+}
+
+/* Linear legs must accumulate exactly as they always have: Add (dlevel) once per sample, then snap to the target.
+ * This reference is that loop written out longhand.
+ * (content) is the long format with only RB_ENV_FLAG_INIT_LEVEL.
+ */
+ 
+static int reference_linear_env(rb_sample_t *dst,int dsta,const uint8_t *content,int contentc) {
+  int dstc=0;
+  rb_sample_t level=(content[0]*1.0f)/255.0f;
+  rb_sample_t inlevel=level;
+  int p=2;
+  for (;p<contentc;p+=2) {
+    rb_sample_t f=(content[p-1]*1.0f)/255.0f;
+    int time=f*mock_synth.rate;
+    if (time<1) time=1;
+    rb_sample_t target=(content[p]*1.0f)/255.0f;
+    rb_sample_t dlevel=(target-inlevel)/time;
+    while (time-->0) {
+      if (dstc>=dsta) return -1;
+      dst[dstc++]=level;
+      level+=dlevel;
+    }
+    level=inlevel=target;
+  }
+  return dstc;
+}
+
+RB_ITEST(env_linear_legs_bit_exact,synth) {
+  wipe_mock_synth();
+  mock_synth.rate=1000;
+  const uint8_t content[]={
+    RB_ENV_FLAG_INIT_LEVEL,
+    0x10, // level0
+    0x0b,0xff, // attack
+    0x13,0x60, // decay
+    0x40,0x60, // sustain, flat
+    0x01,0x70, // one frame
+    0x33,0x00, // release
+  };
+  #define dsta 2000
+  rb_sample_t expect[dsta],actual[dsta];
+  int expectc=reference_linear_env(expect,dsta,content+1,sizeof(content)-1);
+  RB_ASSERT_INTS_OP(expectc,>,0)
+  RB_ASSERT_INTS_OP(expectc,<,dsta-100)
+  
+  int mode=0; for (;mode<3;mode++) {
+    struct rb_synth_node_config *config=decode_env(mode,content,sizeof(content));
+    if (mock_synth.messagec) fprintf(stderr,"%.*s\n",mock_synth.messagec,mock_synth.message);
+    RB_ASSERT(config)
+    RB_ASSERT_CALL(run_env_chunked(actual,dsta,config))
+    int i=0; for (;i<dsta;i++) {
+      rb_sample_t input=0.5f+i*0.001f;
+      rb_sample_t level=(i<expectc)?expect[i]:0.0f;
+      rb_sample_t x;
+      switch (mode) {
+        case 0: x=input*level; break;
+        case 1: x=level; break;
+        case 2: x=input+level; break;
+      }
+      RB_ASSERT(actual[i]==x,"mode=%d i=%d expected=%.9f actual=%.9f",mode,i,x,actual[i])
+    }
+    rb_synth_node_config_del(config);
+  }
+  #undef dsta
+  return 0;
+}
+
+/* Curved legs are a geometric series: levelf=levelk*levelm**n, or levelm**(n+1) when curving the other way.
+ * Accumulating in floats drifts a little from the exact values.
+ */
+ 
+RB_ITEST(env_curved_legs_follow_geometric_series,synth) {
+  wipe_mock_synth();
+  mock_synth.rate=1000;
+  const uint8_t content[]={
+    RB_ENV_FLAG_INIT_LEVEL|RB_ENV_FLAG_CURVE,
+    0x00, // level0
+    0x20,0xff,0xc0, // attack, curving down
+    0x80,0x20,0x30, // release, curving up
+  };
+  #define dsta 1000
+  rb_sample_t actual[dsta];
+  struct rb_synth_node_config *config=decode_env(1,content,sizeof(content));
+  if (mock_synth.messagec) fprintf(stderr,"%.*s\n",mock_synth.messagec,mock_synth.message);
+  RB_ASSERT(config)
+  RB_ASSERT_CALL(run_env_chunked(actual,dsta,config))
+  
+  double inlevel=0.0;
+  int p=2,dstc=0;
+  for (;p<sizeof(content);p+=3) {
+    int time=((content[p]*1.0f)/255.0f)*mock_synth.rate;
+    double target=content[p+1]/255.0;
+    double curve=(int8_t)content[p+2]/255.0;
+    int i=0; for (;i<time;i++,dstc++) {
+      double expect;
+      if (!i) expect=inlevel;
+      else if (curve>0.0) {
+        double k=1.0+curve*100.0,m=pow(k,-1.0/time);
+        expect=target+(k*pow(m,i)-m)*(inlevel-target)/(k-m);
+      } else {
+        double k=1.0-curve*100.0,m=pow(k,1.0/time);
+        expect=inlevel+(pow(m,i+1)-m)*(target-inlevel)/(k-m);
+      }
+      RB_ASSERT_FLOATS(actual[dstc],expect,0.0001,"leg=%d i=%d",(p-2)/3,i)
+    }
+    inlevel=target;
+  }
+  for (;dstc<dsta;dstc++) RB_ASSERT(actual[dstc]==0.0f,"i=%d",dstc)
+  
+  rb_synth_node_config_del(config);
+  #undef dsta
+  return 0;
+}
@@ -0,0 +1,59 @@
+#include "test/rb_test.h"
+#include "rabbit/rb_synth_node.h"
+#include "rabbit/rb_synth.h"
+#include <math.h>
+
+static struct rb_synth mock_synth={
+  .rate=22050,
+  .chanc=1,
+};
+
+/* The wavetable must match direct additive synthesis, for any harmonic count.
+ */
+ 
+RB_ITEST(harm_table_matches_additive,synth) {
+  uint8_t serial[]={
+    RB_SYNTH_NTID_harm,
+      0x01,0x00, // main
+      0x02,RB_SYNTH_FIELD_TYPE_S15_16,0x01,0xb8,0x80,0x00, // rate=440.5
+      0x04,RB_SYNTH_FIELD_TYPE_SERIAL1,16,
+        0xff,0x00,0x80,0x40,0x00,0x20,0x10,0x08,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x33,
+  };
+  const rb_sample_t coefv[16]={
+    0xff/255.0f,0,0x80/255.0f,0x40/255.0f,0,0x20/255.0f,0x10/255.0f,0x08/255.0f,0,0,0,0,0,0,0,0x33/255.0f,
+  };
+  struct rb_synth_node_config *config=rb_synth_node_config_new_decode(&mock_synth,serial,sizeof(serial));
+  if (mock_synth.messagec) fprintf(stderr,"%.*s\n",mock_synth.messagec,mock_synth.message);
+  RB_ASSERT(config)
+  
+  #define buffera 333
+  #define outc 2000
+  rb_sample_t buffer[buffera];
+  rb_sample_t out[outc];
+  rb_sample_t *bufferv[]={buffer};
+  struct rb_synth_node_runner *runner=rb_synth_node_runner_new(config,bufferv,1,0x40);
+  RB_ASSERT(runner)
+  
+  // Awkward chunk lengths, to cross vector and update boundaries.
+  int p=0;
+  while (p<outc) {
+    int c=outc-p;
+    if (c>buffera) c=buffera;
+    runner->update(runner,c);
+    memcpy(out+p,buffer,sizeof(rb_sample_t)*c);
+    p+=c;
+  }
+  
+  int i=0; for (;i<outc;i++) {
+    double phase=(i*440.5)/22050.0;
+    double expect=0.0;
+    int n=0; for (;n<16;n++) expect+=sin(phase*(n+1)*M_PI*2.0)*coefv[n];
+    RB_ASSERT_FLOATS(out[i],expect,0.0005,"i=%d",i)
+  }
+  #undef buffera
+  #undef outc
+  
+  rb_synth_node_runner_del(runner);
+  rb_synth_node_config_del(config);
+  return 0;
+}
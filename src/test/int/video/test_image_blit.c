@@ -0,0 +1,109 @@
+#include "test/rb_test.h"
+#include "rabbit/rb_image.h"
+#include <time.h>
+
+/* Time each xform against RB_XFORM_NONE, for a big panel and a sprite-sized tile.
+ */
+
+static double blit_now() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return (double)tv.tv_sec+tv.tv_nsec/1000000000.0;
+}
+
+static double blit_time(struct rb_image *dst,const struct rb_image *src,int w,int h,uint8_t xform) {
+  int repc=(4<<20)/(w*h);
+  if (repc<4) repc=4;
+  double start=blit_now();
+  int i=repc; while (i-->0) {
+    rb_image_blit_unchecked(dst,0,0,src,0,0,w,h,xform,0,0);
+  }
+  return ((blit_now()-start)*1000000000.0)/((double)repc*w*h);
+}
+
+XXX_RB_ITEST(blit_xform_benchmark,video) {
+  const char *xformnamev[8]={"NONE","XREV","YREV","XREV|YREV","SWAP","SWAP|XREV","SWAP|YREV","SWAP|XREV|YREV"};
+  const int sizev[]={16,64,512};
+  const int alphamodev[]={RB_ALPHAMODE_OPAQUE,RB_ALPHAMODE_BLEND,RB_ALPHAMODE_COLORKEY};
+  const char *alphamodenamev[]={"OPAQUE","BLEND","COLORKEY"};
+  struct rb_image *src=rb_image_new(512,512);
+  struct rb_image *dst=rb_image_new(512,512);
+  RB_ASSERT(src&&dst)
+  dst->alphamode=RB_ALPHAMODE_OPAQUE;
+  uint32_t seed=13579;
+  int i=512*512; while (i-->0) {
+    seed=seed*1103515245+12345;
+    src->pixels[i]=seed;
+  }
+  int ai=0; for (;ai<sizeof(alphamodev)/sizeof(int);ai++) {
+    src->alphamode=alphamodev[ai];
+    int si=0; for (;si<sizeof(sizev)/sizeof(int);si++) {
+      int size=sizev[si];
+      double none=blit_time(dst,src,size,size,RB_XFORM_NONE);
+      int xform=0; for (;xform<8;xform++) {
+        double ns=xform?blit_time(dst,src,size,size,xform):none;
+        fprintf(stderr,
+          "%8s %3dx%-3d %-15s %6.3f ns/pixel, %5.2fx NONE\n",
+          alphamodenamev[ai],size,size,xformnamev[xform],ns,ns/none
+        );
+      }
+    }
+  }
+  rb_image_del(src);
+  rb_image_del(dst);
+  return 0;
+}
+
+/* Indexed against ARGB, same pixels, for the untransformed and swapped paths.
+ */
+
+static double blit8_time(struct rb_image *dst,const struct rb_image8 *src,int w,int h,uint8_t xform,const struct rb_palette *palette) {
+  int repc=(4<<20)/(w*h);
+  if (repc<4) repc=4;
+  double start=blit_now();
+  int i=repc; while (i-->0) {
+    rb_image8_blit_unchecked(dst,0,0,src,0,0,w,h,xform,palette);
+  }
+  return ((blit_now()-start)*1000000000.0)/((double)repc*w*h);
+}
+
+XXX_RB_ITEST(blit8_benchmark,video) {
+  const int sizev[]={16,64,512};
+  const int alphamodev[]={RB_ALPHAMODE_OPAQUE,RB_ALPHAMODE_BLEND,RB_ALPHAMODE_COLORKEY};
+  const char *alphamodenamev[]={"OPAQUE","BLEND","COLORKEY"};
+  struct rb_image8 *src8=rb_image8_new(512,512);
+  struct rb_palette *palette=rb_palette_new();
+  struct rb_image *dst=rb_image_new(512,512);
+  RB_ASSERT(src8&&palette&&dst)
+  dst->alphamode=RB_ALPHAMODE_OPAQUE;
+  uint32_t seed=13579;
+  int i=256; while (i-->0) {
+    seed=seed*1103515245+12345;
+    palette->v[i]=seed;
+  }
+  for (i=512*512;i-->0;) {
+    seed=seed*1103515245+12345;
+    src8->pixels[i]=seed>>24;
+  }
+  int ai=0; for (;ai<sizeof(alphamodev)/sizeof(int);ai++) {
+    palette->alphamode=alphamodev[ai];
+    struct rb_image *src=rb_image8_expand(src8,palette);
+    RB_ASSERT(src)
+    int si=0; for (;si<sizeof(sizev)/sizeof(int);si++) {
+      int size=sizev[si];
+      int xform=0; for (;xform<=RB_XFORM_SWAP;xform+=RB_XFORM_SWAP) {
+        double argb=blit_time(dst,src,size,size,xform);
+        double indexed=blit8_time(dst,src8,size,size,xform,palette);
+        fprintf(stderr,
+          "%8s %3dx%-3d %-4s argb %6.3f ns/pixel, indexed %6.3f ns/pixel\n",
+          alphamodenamev[ai],size,size,xform?"SWAP":"NONE",argb,indexed
+        );
+      }
+    }
+    rb_image_del(src);
+  }
+  rb_image8_del(src8);
+  rb_palette_del(palette);
+  rb_image_del(dst);
+  return 0;
+}
@@ -0,0 +1,261 @@
+#include "test/rb_test.h"
+#include "rabbit/rb_image.h"
+#include <math.h>
+#include <time.h>
+
+/* The original floating-point rb_lights_draw, for reference, extended to color and blend modes.
+ * Per pixel, per channel, per light, in light order. Positions are scrolled for distance too.
+ */
+
+static uint8_t lights_reference_channel(const struct rb_lights *lights,int x,int y,int scrollx,int scrolly,int chshift) {
+  int brightness=lights->bg;
+  const struct rb_light *light=lights->lightv;
+  int i=lights->lightc;
+  for (;i-->0;light++) {
+    if ((light->radius<0)||(light->gradius<0)||(!light->radius&&!light->gradius)) continue;
+    int level=(light->rgb>>chshift)&0xff;
+    double inner=light->radius*light->radius;
+    double outer=(light->radius+light->gradius)*(light->radius+light->gradius);
+    double dx=light->x-scrollx-x,dy=light->y-scrolly-y;
+    double distance=dx*dx+dy*dy;
+    double norm;
+    if (distance<=inner) norm=1.0;
+    else if (distance>=outer) continue;
+    else norm=1.0-(distance-inner)/(outer-inner);
+    switch (lights->blend) {
+      case RB_LIGHTS_BLEND_ADD: brightness+=(int)(norm*level); if (brightness>0xff) brightness=0xff; break;
+      case RB_LIGHTS_BLEND_MAX: if ((int)(norm*level)>brightness) brightness=norm*level; break;
+      default: brightness+=(int)((0xff-brightness)*norm*level/255.0); break;
+    }
+  }
+  return brightness;
+}
+
+static void lights_reference_draw(struct rb_image *dst,const struct rb_lights *lights,int scrollx,int scrolly) {
+  if (lights->bg==0xff) return;
+  uint32_t *p=dst->pixels;
+  int y=0; for (;y<dst->h;y++) {
+    int x=0; for (;x<dst->w;x++,p++) {
+      int chshift=0; for (;chshift<24;chshift+=8) {
+        uint8_t b=lights_reference_channel(lights,x,y,scrollx,scrolly,chshift);
+        if (b==0xff) continue;
+        uint32_t v=(((*p>>chshift)&0xff)*b)>>8;
+        *p=(*p&~(0xff<<chshift))|(v<<chshift);
+      }
+    }
+  }
+}
+
+static void lights_randomize(struct rb_lights *lights,int lightc,int color) {
+  rb_lights_clear(lights);
+  switch (rb_test_rand(6)) {
+    case 0: lights->bg=0; break;
+    case 1: lights->bg=0xfe; break;
+    default: lights->bg=rb_test_rand(0x100); break;
+  }
+  while (lightc-->0) {
+    struct rb_light *light=rb_lights_add(lights,0);
+    if (!light) return;
+    light->x=rb_test_rand(RB_FB_W+200)-100;
+    light->y=rb_test_rand(RB_FB_H+200)-100;
+    if (color) light->rgb=rb_test_rand(0x1000000)|(0x80<<(rb_test_rand(3)*8));
+    switch (rb_test_rand(8)) {
+      case 0: light->radius=0; light->gradius=1+rb_test_rand(40); break;
+      case 1: light->radius=1+rb_test_rand(40); light->gradius=0; break;
+      case 2: light->radius=rb_test_rand(20); light->gradius=100+rb_test_rand(200); break; // Shared table entries.
+      case 3: light->radius=-1; light->gradius=10; break;
+      default: light->radius=rb_test_rand(30); light->gradius=rb_test_rand(50); break;
+    }
+  }
+}
+
+/* Integer lights must match the floating-point original within one, in each channel.
+ */
+
+RB_ITEST(lights_match_float_reference,video) {
+  rb_test_srand(24680);
+  struct rb_lights lights={0};
+  struct rb_image *src=rb_test_random_image(RB_FB_W,RB_FB_H,RB_ALPHAMODE_OPAQUE);
+  struct rb_image *expect=rb_image_new(RB_FB_W,RB_FB_H);
+  struct rb_image *actual=rb_image_new(RB_FB_W,RB_FB_H);
+  RB_ASSERT(src&&expect&&actual)
+  expect->alphamode=actual->alphamode=RB_ALPHAMODE_OPAQUE;
+
+  int exactc=0,pixelc=0;
+  int pass=0; for (;pass<200;pass++) {
+    lights_randomize(&lights,rb_test_rand(6),0);
+    int scrollx=rb_test_rand(100)-50,scrolly=rb_test_rand(100)-50;
+    memcpy(expect->pixels,src->pixels,RB_FB_W*RB_FB_H*4);
+    memcpy(actual->pixels,src->pixels,RB_FB_W*RB_FB_H*4);
+    lights_reference_draw(expect,&lights,scrollx,scrolly);
+    RB_ASSERT_CALL(rb_lights_draw(actual,&lights,scrollx,scrolly))
+    int i=0; for (;i<RB_FB_W*RB_FB_H;i++,pixelc++) {
+      uint32_t e=expect->pixels[i],a=actual->pixels[i];
+      if ((e&0xffffff)==(a&0xffffff)) { exactc++; continue; }
+      int shift=0; for (;shift<24;shift+=8) {
+        int d=(int)((e>>shift)&0xff)-(int)((a>>shift)&0xff);
+        RB_ASSERT(d>=-1&&d<=1,"pass=%d x=%d y=%d expect=%08x actual=%08x bg=%02x",pass,i%RB_FB_W,i/RB_FB_W,e,a,lights.bg)
+      }
+    }
+  }
+  RB_ASSERT(exactc>=pixelc-pixelc/100,"Only %d of %d pixels exact.",exactc,pixelc)
+
+  rb_lights_cleanup(&lights);
+  rb_image_del(src);
+  rb_image_del(expect);
+  rb_image_del(actual);
+  return 0;
+}
+
+/* Colored lights in each blend mode, against the same reference.
+ * Rounding can stack where several lights overlap, so allow two.
+ */
+
+RB_ITEST(lights_color_blend_match_float_reference,video) {
+  rb_test_srand(24680);
+  struct rb_lights lights={0};
+  struct rb_image *src=rb_test_random_image(RB_FB_W,RB_FB_H,RB_ALPHAMODE_OPAQUE);
+  struct rb_image *expect=rb_image_new(RB_FB_W,RB_FB_H);
+  struct rb_image *actual=rb_image_new(RB_FB_W,RB_FB_H);
+  RB_ASSERT(src&&expect&&actual)
+  expect->alphamode=actual->alphamode=RB_ALPHAMODE_OPAQUE;
+
+  int pass=0; for (;pass<150;pass++) {
+    lights_randomize(&lights,1+rb_test_rand(5),1);
+    lights.blend=pass%3;
+    int scrollx=rb_test_rand(100)-50,scrolly=rb_test_rand(100)-50;
+    memcpy(expect->pixels,src->pixels,RB_FB_W*RB_FB_H*4);
+    memcpy(actual->pixels,src->pixels,RB_FB_W*RB_FB_H*4);
+    lights_reference_draw(expect,&lights,scrollx,scrolly);
+    RB_ASSERT_CALL(rb_lights_draw(actual,&lights,scrollx,scrolly))
+    int i=0; for (;i<RB_FB_W*RB_FB_H;i++) {
+      uint32_t e=expect->pixels[i],a=actual->pixels[i];
+      int shift=0; for (;shift<24;shift+=8) {
+        int d=(int)((e>>shift)&0xff)-(int)((a>>shift)&0xff);
+        RB_ASSERT(d>=-2&&d<=2,"pass=%d blend=%d x=%d y=%d expect=%08x actual=%08x",pass,lights.blend,i%RB_FB_W,i/RB_FB_W,e,a)
+      }
+    }
+  }
+
+  rb_lights_cleanup(&lights);
+  rb_image_del(src);
+  rb_image_del(expect);
+  rb_image_del(actual);
+  return 0;
+}
+
+/* Half resolution must match full at even pixels, and fall between its neighbors elsewhere.
+ * Also, rasterizing and applying in uneven bands must match a single draw exactly.
+ */
+
+RB_ITEST(lights_halfres_and_bands,video) {
+  rb_test_srand(24680);
+  struct rb_lights lights={0};
+  struct rb_image *full=rb_image_new(RB_FB_W,RB_FB_H);
+  struct rb_image *half=rb_image_new(RB_FB_W,RB_FB_H);
+  struct rb_image *banded=rb_image_new(RB_FB_W,RB_FB_H);
+  RB_ASSERT(full&&half&&banded)
+  full->alphamode=half->alphamode=banded->alphamode=RB_ALPHAMODE_OPAQUE;
+  const int bandv[]={0,1,37,38,90,143,RB_FB_H};
+  const int bandc=sizeof(bandv)/sizeof(int)-1;
+
+  int pass=0; for (;pass<100;pass++) {
+    lights_randomize(&lights,1+rb_test_rand(5),pass&1);
+    lights.blend=rb_test_rand(3);
+    int scrollx=rb_test_rand(100)-50,scrolly=rb_test_rand(100)-50;
+    
+    // White, so each output channel is a monotonic function of brightness.
+    memset(full->pixels,0xff,RB_FB_W*RB_FB_H*4);
+    memset(half->pixels,0xff,RB_FB_W*RB_FB_H*4);
+    memset(banded->pixels,0xff,RB_FB_W*RB_FB_H*4);
+    lights.halfres=0;
+    RB_ASSERT_CALL(rb_lights_draw(full,&lights,scrollx,scrolly))
+    lights.halfres=1;
+    RB_ASSERT_CALL(rb_lights_draw(half,&lights,scrollx,scrolly))
+    
+    lights.halfres=pass%3;
+    RB_ASSERT_CALL(rb_lights_prepare(&lights,RB_FB_W,RB_FB_H,scrollx,scrolly))
+    int i; for (i=bandc;i-->0;) rb_lights_rasterize(&lights,bandv[i],bandv[i+1]);
+    for (i=bandc;i-->0;) RB_ASSERT_CALL(rb_lights_apply(banded,&lights,bandv[i],bandv[i+1]))
+    RB_ASSERT(!memcmp(banded->pixels,lights.halfres?half->pixels:full->pixels,RB_FB_W*RB_FB_H*4),"pass=%d halfres=%d",pass,lights.halfres)
+    
+    int y=0; for (;y<RB_FB_H-2;y++) {
+      int x=0; for (;x<RB_FB_W-2;x++) {
+        uint32_t h=half->pixels[y*RB_FB_W+x];
+        int x0=x&~1,y0=y&~1;
+        int x1=(x&1)?(x0+2):x0,y1=(y&1)?(y0+2):y0;
+        uint32_t cornerv[4]={
+          full->pixels[y0*RB_FB_W+x0],full->pixels[y0*RB_FB_W+x1],
+          full->pixels[y1*RB_FB_W+x0],full->pixels[y1*RB_FB_W+x1],
+        };
+        if (!(x&1)&&!(y&1)) {
+          RB_ASSERT_INTS(h,cornerv[0],"pass=%d x=%d y=%d",pass,x,y)
+          continue;
+        }
+        int shift=0; for (;shift<24;shift+=8) {
+          int lo=0xff,hi=0,v=(h>>shift)&0xff;
+          for (i=0;i<4;i++) {
+            int c=(cornerv[i]>>shift)&0xff;
+            if (c<lo) lo=c;
+            if (c>hi) hi=c;
+          }
+          RB_ASSERT((v>=lo-1)&&(v<=hi+1),"pass=%d x=%d y=%d half=%08x corners=%d..%d",pass,x,y,h,lo,hi)
+        }
+      }
+    }
+  }
+
+  rb_lights_cleanup(&lights);
+  rb_image_del(full);
+  rb_image_del(half);
+  rb_image_del(banded);
+  return 0;
+}
+
+/* Timing, not a test. Enable manually to compare.
+ */
+
+static double lights_cputime() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID,&tv);
+  return tv.tv_sec+tv.tv_nsec/1000000000.0;
+}
+
+XXX_RB_ITEST(lights_benchmark) {
+  rb_test_srand(24680);
+  struct rb_lights lights={0};
+  struct rb_image *fb=rb_test_random_image(RB_FB_W,RB_FB_H,RB_ALPHAMODE_OPAQUE);
+  RB_ASSERT(fb)
+  int lightc=0; for (;lightc<=8;lightc+=(lightc<2)?1:3) {
+    rb_lights_clear(&lights);
+    lights.bg=0x40;
+    int i=0; for (;i<lightc;i++) {
+      struct rb_light *light=rb_lights_add(&lights,0);
+      RB_ASSERT(light)
+      light->x=(RB_FB_W*(i+1))/(lightc+1);
+      light->y=RB_FB_H/2+((i&1)?20:-20);
+      light->radius=12;
+      light->gradius=30;
+    }
+    int repc=lightc?20:200;
+    double start=lights_cputime();
+    for (i=repc;i-->0;) lights_reference_draw(fb,&lights,0,0);
+    double reference=(lights_cputime()-start)*1000000.0/repc;
+    repc*=10;
+    double modev[3];
+    int mode=0; for (;mode<3;mode++) {
+      lights.halfres=(mode==1);
+      for (i=0;i<lights.lightc;i++) lights.lightv[i].rgb=(mode==2)?0xff8040:0xffffff;
+      start=lights_cputime();
+      for (i=repc;i-->0;) RB_ASSERT_CALL(rb_lights_draw(fb,&lights,0,0))
+      modev[mode]=(lights_cputime()-start)*1000000.0/repc;
+    }
+    fprintf(stderr,
+      "  %d lights: float %8.1f us/frame, integer %8.1f, halfres %8.1f, color %8.1f\n",
+      lightc,reference,modev[0],modev[1],modev[2]
+    );
+  }
+  rb_lights_cleanup(&lights);
+  rb_image_del(fb);
+  return 0;
+}
@@ -0,0 +1,226 @@
+#include "test/rb_test.h"
+#include "rabbit/rb_video_headless.h"
+#include "rabbit/rb_image.h"
+#include "rabbit/rb_fs.h"
+#include <zlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct rb_video *headless_new() {
+  struct rb_video *video=rb_video_new(&rb_video_type_headless,0);
+  if (!video) return 0;
+  ((struct rb_video_headless*)video)->rate=0;
+  return video;
+}
+
+static void headless_fill(struct rb_image *fb,int seed) {
+  int i=RB_FB_W*RB_FB_H; while (i-->0) {
+    fb->pixels[i]=0xff000000|((i*2654435761u+seed*40503u)&0xffffff);
+  }
+}
+
+static double headless_now() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return (double)tv.tv_sec+tv.tv_nsec/1000000000.0;
+}
+
+/* Ring holds the last few frames; hashes ignore alpha and are deterministic and order-sensitive.
+ */
+
+RB_ITEST(headless_ring_and_hash) {
+  struct rb_image *fb=rb_framebuffer_new();
+  RB_ASSERT(fb)
+  struct rb_video *a=headless_new();
+  struct rb_video *b=headless_new();
+  RB_ASSERT(a&&b)
+  struct rb_video_headless *A=(struct rb_video_headless*)a;
+  struct rb_video_headless *B=(struct rb_video_headless*)b;
+  A->hash_enable=1;
+  B->hash_enable=1;
+
+  RB_ASSERT_FAILURE(rb_video_headless_set_ring(a,RB_VIDEO_HEADLESS_RING_LIMIT+1))
+  RB_ASSERT_CALL(rb_video_headless_set_ring(a,3))
+  RB_ASSERT_NOT(rb_video_headless_get_frame(a,0),"Nothing swapped yet")
+
+  int i=0; for (;i<5;i++) {
+    headless_fill(fb,i);
+    RB_ASSERT_CALL(rb_video_swap(a,fb))
+  }
+  RB_ASSERT_INTS(A->framec,5)
+  int age=0; for (;age<3;age++) {
+    struct rb_image *frame=rb_video_headless_get_frame(a,age);
+    RB_ASSERT(frame,"age=%d",age)
+    headless_fill(fb,4-age);
+    RB_ASSERT(!memcmp(frame->pixels,fb->pixels,RB_FB_SIZE_BYTES),"age=%d",age)
+  }
+  RB_ASSERT_NOT(rb_video_headless_get_frame(a,3))
+
+  // Same frames in reverse order: Each frame hash recurs, but the sum differs.
+  uint64_t lasta=A->hash;
+  for (i=5;i-->0;) {
+    headless_fill(fb,i);
+    RB_ASSERT_CALL(rb_video_swap(b,fb))
+    if (i==4) RB_ASSERT(B->hash==lasta)
+  }
+  RB_ASSERT(A->hashsum!=B->hashsum)
+
+  // And in the original order, with alpha scrambled: Same sum.
+  rb_video_del(b);
+  RB_ASSERT(b=headless_new())
+  B=(struct rb_video_headless*)b;
+  B->hash_enable=1;
+  RB_ASSERT_CALL(rb_video_headless_set_ring(b,0))
+  for (i=0;i<5;i++) {
+    headless_fill(fb,i);
+    int p=RB_FB_W*RB_FB_H; while (p-->0) fb->pixels[p]^=(p&0xff)<<24;
+    RB_ASSERT_CALL(rb_video_swap(b,fb))
+  }
+  RB_ASSERT(A->hashsum==B->hashsum)
+  RB_ASSERT_NOT(rb_video_headless_get_frame(b,0),"Ring disabled")
+
+  rb_video_del(a);
+  rb_video_del(b);
+  rb_image_del(fb);
+  return 0;
+}
+
+/* Capture to disk, raw and PNG. We decode the PNG by hand: Check every CRC, inflate, compare pixels.
+ */
+
+static uint32_t headless_u32(const uint8_t *src) {
+  return (src[0]<<24)|(src[1]<<16)|(src[2]<<8)|src[3];
+}
+
+static int headless_verify_png(const uint8_t *src,int srcc,const struct rb_image *expect) {
+  RB_ASSERT(srcc>=8)
+  RB_ASSERT(!memcmp(src,"\x89PNG\r\n\x1a\n",8))
+  int srcp=8,gotiend=0;
+  uint8_t *z=0;
+  int zc=0;
+  while (srcp<srcc) {
+    RB_ASSERT(srcp<=srcc-12)
+    int len=headless_u32(src+srcp);
+    RB_ASSERT((len>=0)&&(srcp<=srcc-12-len))
+    const uint8_t *type=src+srcp+4;
+    const uint8_t *body=type+4;
+    uint32_t crc=crc32(crc32(0,0,0),type,4+len);
+    RB_ASSERT(crc==headless_u32(body+len),"chunk '%.4s'",type)
+    if (!memcmp(type,"IHDR",4)) {
+      RB_ASSERT_INTS(len,13)
+      RB_ASSERT_INTS(headless_u32(body),expect->w)
+      RB_ASSERT_INTS(headless_u32(body+4),expect->h)
+      RB_ASSERT_INTS(body[8],8)
+      RB_ASSERT_INTS(body[9],2,"RGB")
+    } else if (!memcmp(type,"IDAT",4)) {
+      uint8_t *nv=realloc(z,zc+len);
+      RB_ASSERT(nv)
+      z=nv;
+      memcpy(z+zc,body,len);
+      zc+=len;
+    } else if (!memcmp(type,"IEND",4)) {
+      gotiend=1;
+    }
+    srcp+=12+len;
+  }
+  RB_ASSERT(gotiend)
+  uLong rawc=expect->h*(1+expect->w*3);
+  uint8_t *raw=malloc(rawc);
+  RB_ASSERT(raw)
+  RB_ASSERT(uncompress(raw,&rawc,z,zc)==Z_OK)
+  RB_ASSERT_INTS(rawc,expect->h*(1+expect->w*3))
+  const uint8_t *p=raw;
+  const uint32_t *e=expect->pixels;
+  int y=0; for (;y<expect->h;y++) {
+    RB_ASSERT_INTS(*p,0,"filter, row %d",y)
+    p++;
+    int x=0; for (;x<expect->w;x++,e++,p+=3) {
+      uint32_t rgb=(p[0]<<16)|(p[1]<<8)|p[2];
+      RB_ASSERT_INTS(rgb,(*e)&0xffffff,"(%d,%d)",x,y)
+    }
+  }
+  free(raw);
+  free(z);
+  return 0;
+}
+
+RB_ITEST(headless_capture) {
+  struct rb_image *fb=rb_framebuffer_new();
+  RB_ASSERT(fb)
+  struct rb_video *video=headless_new();
+  RB_ASSERT(video)
+
+  // Leftovers from an earlier run would pass the reads below, and fail "Capture stopped".
+  unlink("mid/test/headless/000.raw");
+  unlink("mid/test/headless/100%-001.png");
+  unlink("mid/test/headless/002.raw");
+  unlink("mid/test/headless/100%-002.png");
+
+  RB_ASSERT_FAILURE(rb_video_headless_set_capture(video,"mid/test/headless/frame.png",RB_VIDEO_HEADLESS_CAPTURE_PNG),"No conversion")
+  RB_ASSERT_FAILURE(rb_video_headless_set_capture(video,"mid/test/headless/%s.png",RB_VIDEO_HEADLESS_CAPTURE_PNG),"Not an integer")
+  RB_ASSERT_FAILURE(rb_video_headless_set_capture(video,"mid/test/headless/%d-%d.png",RB_VIDEO_HEADLESS_CAPTURE_PNG),"Two conversions")
+
+  RB_ASSERT_CALL(rb_video_headless_set_capture(video,"mid/test/headless/%03d.raw",RB_VIDEO_HEADLESS_CAPTURE_RAW))
+  headless_fill(fb,1);
+  RB_ASSERT_CALL(rb_video_swap(video,fb))
+  RB_ASSERT_CALL(rb_video_headless_set_capture(video,"mid/test/headless/100%%-%03d.png",RB_VIDEO_HEADLESS_CAPTURE_PNG))
+  headless_fill(fb,2);
+  RB_ASSERT_CALL(rb_video_swap(video,fb))
+  RB_ASSERT_CALL(rb_video_headless_set_capture(video,0,0))
+  RB_ASSERT_CALL(rb_video_swap(video,fb))
+
+  void *src=0;
+  int srcc=rb_file_read(&src,"mid/test/headless/000.raw");
+  RB_ASSERT_INTS(srcc,RB_FB_SIZE_BYTES)
+  headless_fill(fb,1);
+  RB_ASSERT(!memcmp(src,fb->pixels,srcc))
+  free(src);
+
+  src=0;
+  srcc=rb_file_read(&src,"mid/test/headless/100%-001.png");
+  RB_ASSERT(srcc>0)
+  headless_fill(fb,2);
+  RB_ASSERT_CALL(headless_verify_png(src,srcc,fb))
+  free(src);
+
+  RB_ASSERT_INTS(rb_file_get_type("mid/test/headless/002.raw"),0,"Capture stopped")
+  RB_ASSERT_INTS(rb_file_get_type("mid/test/headless/100%-002.png"),0,"Capture stopped")
+
+  rb_video_del(video);
+  rb_image_del(fb);
+  return 0;
+}
+
+/* Simulated vsync paces swaps. Only a lower bound; a slow host can always be slower.
+ */
+
+RB_ITEST(headless_vsync) {
+  struct rb_image *fb=rb_framebuffer_new();
+  RB_ASSERT(fb)
+  struct rb_video *video=headless_new();
+  RB_ASSERT(video)
+  ((struct rb_video_headless*)video)->rate=100;
+  RB_ASSERT_CALL(rb_video_swap(video,fb))
+  double start=headless_now();
+  int i=5; while (i-->0) {
+    RB_ASSERT_CALL(rb_video_swap(video,fb))
+  }
+  double elapsed=headless_now()-start;
+  RB_ASSERT(elapsed>=0.045,"5 frames at 100 Hz in %.03fs",elapsed)
+  rb_video_del(video);
+  rb_image_del(fb);
+  return 0;
+}
+
+/* Only by name. The default is a real display or nothing.
+ */
+
+RB_ITEST(headless_not_default) {
+  RB_ASSERT(rb_video_type_by_name("headless",-1)==&rb_video_type_headless)
+  struct rb_video *video=rb_video_new(0,0);
+  if (video) {
+    RB_ASSERT(video->type!=&rb_video_type_headless)
+    rb_video_del(video);
+  }
+  return 0;
+}
@@ -0,0 +1,182 @@
+#include "test/rb_test.h"
+#include "test/rb_test_scene.h"
+#include "rabbit/rb_vmgr.h"
+#include "rabbit/rb_image.h"
+#include "rabbit/rb_grid.h"
+#include "rabbit/rb_sprite.h"
+#include <time.h>
+
+/* Draws a little square, to make sure render hooks fall back to serial.
+ */
+
+static int bands_hook_render(struct rb_image *dst,struct rb_sprite *sprite,int x,int y) {
+  int yi=-3; for (;yi<3;yi++) {
+    if ((y+yi<0)||(y+yi>=dst->h)) continue;
+    int xi=-3; for (;xi<3;xi++) {
+      if ((x+xi<0)||(x+xi>=dst->w)) continue;
+      dst->pixels[(y+yi)*dst->w+x+xi]=0xff00ff00;
+    }
+  }
+  return 0;
+}
+
+static const struct rb_sprite_type bands_hook_type={
+  .name="bands_hook",
+  .objlen=sizeof(struct rb_sprite),
+  .render=bands_hook_render,
+};
+
+/* Banded output must match serial exactly, with or without dirty tracking and culling.
+ * Three bands doesn't divide the framebuffer height evenly, that's on purpose.
+ * Partway through, a sprite with a render hook forces the fallback, then goes away.
+ */
+
+RB_ITEST(vmgr_bands_match_serial,video) {
+  rb_test_srand(24680);
+  struct rb_test_scene scene;
+  RB_ASSERT_CALL(rb_test_scene_init(&scene,4,60))
+  struct rb_vmgr *serial=scene.vmgrv[0];
+  RB_ASSERT_CALL(rb_vmgr_set_threads(scene.vmgrv[1],3))
+  RB_ASSERT_CALL(rb_vmgr_set_threads(scene.vmgrv[2],4))
+  RB_ASSERT_CALL(rb_vmgr_set_threads(scene.vmgrv[3],RB_VMGR_THREAD_LIMIT))
+  rb_vmgr_set_dirty_tracking(scene.vmgrv[2],1);
+  RB_ASSERT_CALL(rb_sprite_group_set_index(scene.vmgrv[2]->sprites,5))
+  RB_ASSERT_CALL(rb_sprite_group_set_index(scene.vmgrv[3]->sprites,4))
+  RB_ASSERT_FAILURE(rb_vmgr_set_threads(serial,0))
+  RB_ASSERT_FAILURE(rb_vmgr_set_threads(serial,RB_VMGR_THREAD_LIMIT+1))
+
+  struct rb_sprite *hook=0;
+  int framei=0; for (;framei<200;framei++) {
+    rb_test_scene_scroll(&scene);
+    rb_test_scene_move(&scene,rb_test_rand(6));
+    if (framei==80) {
+      RB_ASSERT_CALL(rb_test_scene_add_sprite(&scene,&bands_hook_type))
+      hook=scene.spritev[scene.spritec-1];
+      hook->x=serial->scrollx+100;
+      hook->y=serial->scrolly+70;
+    } else if (framei==120) {
+      RB_ASSERT(scene.spritev[scene.spritec-1]==hook)
+      RB_ASSERT_CALL(rb_test_scene_remove_sprite(&scene,scene.spritec-1))
+    }
+    struct rb_image *expect=rb_vmgr_render(serial);
+    RB_ASSERT(expect)
+    int i=1; for (;i<scene.vmgrc;i++) {
+      struct rb_image *fb=rb_vmgr_render(scene.vmgrv[i]);
+      RB_ASSERT(fb)
+      if (memcmp(fb->pixels,expect->pixels,RB_FB_SIZE_BYTES)) {
+        RB_FAIL("vmgr %d (%d threads) differs from serial at frame %d",i,scene.vmgrv[i]->workers->bandc,framei)
+      }
+    }
+  }
+
+  // Back to serial and up again, on the fly.
+  RB_ASSERT_CALL(rb_vmgr_set_threads(scene.vmgrv[1],1))
+  RB_ASSERT(!scene.vmgrv[1]->workers)
+  RB_ASSERT_CALL(rb_vmgr_set_threads(scene.vmgrv[1],2))
+  RB_ASSERT(scene.vmgrv[1]->workers)
+  RB_ASSERT(rb_vmgr_render(serial))
+  RB_ASSERT(rb_vmgr_render(scene.vmgrv[1]))
+  RB_ASSERT(!memcmp(serial->fb->pixels,scene.vmgrv[1]->fb->pixels,RB_FB_SIZE_BYTES))
+
+  rb_test_scene_cleanup(&scene);
+  return 0;
+}
+
+/* Lights rasterize and apply in bands too. Half-res rows read their neighbors across band edges.
+ * Seed the PRNG before each init, to get the same lights twice.
+ */
+
+static int bands_lights_init(struct rb_lights *lights) {
+  memset(lights,0,sizeof(struct rb_lights));
+  lights->bg=0x40;
+  lights->halfres=1;
+  int i=1; for (;i<=12;i++) {
+    struct rb_light *light=rb_lights_add(lights,i);
+    RB_ASSERT(light)
+    light->x=rb_test_rand(500);
+    light->y=rb_test_rand(400);
+    light->radius=rb_test_rand(30);
+    light->gradius=1+rb_test_rand(40);
+    light->rgb=(i&1)?0xffffff:(0x404040|rb_test_rand(0x1000000));
+  }
+  return 0;
+}
+
+RB_ITEST(vmgr_bands_lights_match_serial,video) {
+  rb_test_srand(24680);
+  struct rb_test_scene scene;
+  RB_ASSERT_CALL(rb_test_scene_init(&scene,2,40))
+  struct rb_lights lightsv[2];
+  rb_test_srand(13579);
+  if (bands_lights_init(lightsv+0)<0) return -1;
+  rb_test_srand(13579);
+  if (bands_lights_init(lightsv+1)<0) return -1;
+  RB_ASSERT_CALL(rb_vmgr_set_lights(scene.vmgrv[0],lightsv+0))
+  RB_ASSERT_CALL(rb_vmgr_set_lights(scene.vmgrv[1],lightsv+1))
+  RB_ASSERT_CALL(rb_vmgr_set_threads(scene.vmgrv[1],5))
+  rb_vmgr_set_dirty_tracking(scene.vmgrv[1],1);
+
+  int framei=0; for (;framei<60;framei++) {
+    rb_test_scene_scroll(&scene);
+    rb_test_scene_move(&scene,3);
+    if (framei==30) {
+      lightsv[0].halfres=lightsv[1].halfres=0;
+      lightsv[0].blend=lightsv[1].blend=RB_LIGHTS_BLEND_ADD;
+    }
+    struct rb_image *expect=rb_vmgr_render(scene.vmgrv[0]);
+    struct rb_image *fb=rb_vmgr_render(scene.vmgrv[1]);
+    RB_ASSERT(expect&&fb)
+    if (memcmp(fb->pixels,expect->pixels,RB_FB_SIZE_BYTES)) {
+      RB_FAIL("Lit frame %d differs from serial",framei)
+    }
+    RB_ASSERT_INTS(scene.vmgrv[1]->dirty.rectc,1,"Lights should dirty the whole framebuffer.")
+  }
+
+  RB_ASSERT_CALL(rb_vmgr_set_lights(scene.vmgrv[0],0))
+  RB_ASSERT_CALL(rb_vmgr_set_lights(scene.vmgrv[1],0))
+  rb_lights_cleanup(lightsv+0);
+  rb_lights_cleanup(lightsv+1);
+  rb_test_scene_cleanup(&scene);
+  return 0;
+}
+
+/* Time it, with lots of sprites and no dirty tracking.
+ */
+
+static double bands_now() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return (double)tv.tv_sec+tv.tv_nsec/1000000000.0;
+}
+
+XXX_RB_ITEST(vmgr_bands_benchmark,video) {
+  rb_test_srand(24680);
+  struct rb_test_scene scene;
+  RB_ASSERT_CALL(rb_test_scene_init(&scene,1,RB_TEST_SCENE_SPRITE_LIMIT))
+  struct rb_vmgr *vmgr=scene.vmgrv[0];
+  struct rb_lights lights;
+  if (bands_lights_init(&lights)<0) return -1;
+  const int threadcv[]={1,2,4,RB_VMGR_THREAD_LIMIT};
+  int uselights=0; for (;uselights<2;uselights++) {
+    RB_ASSERT_CALL(rb_vmgr_set_lights(vmgr,uselights?&lights:0))
+    int ti=0; for (;ti<sizeof(threadcv)/sizeof(int);ti++) {
+      RB_ASSERT_CALL(rb_vmgr_set_threads(vmgr,threadcv[ti]))
+      const int framec=500;
+      double start=bands_now();
+      int framei=0; for (;framei<framec;framei++) {
+        vmgr->scrollx=(framei*3)%250;
+        vmgr->scrolly=(framei*2)%250;
+        RB_ASSERT(rb_vmgr_render(vmgr))
+      }
+      double elapsed=bands_now()-start;
+      fprintf(stderr,
+        "%d sprites, %s, %d threads: %.3f ms/frame\n",
+        scene.spritec,uselights?"lights":"no lights",threadcv[ti],(elapsed*1000.0)/framec
+      );
+    }
+  }
+  RB_ASSERT_CALL(rb_vmgr_set_lights(vmgr,0))
+  rb_lights_cleanup(&lights);
+  rb_test_scene_cleanup(&scene);
+  return 0;
+}
@@ -0,0 +1,49 @@
+#include "test/rb_test.h"
+#include "rabbit/rb_vmgr.h"
+#include "rabbit/rb_image.h"
+#include "rabbit/rb_grid.h"
+
+/* Scrolling bgbits incrementally must look the same as redrawing it every frame.
+ * Try a tile size that divides bgbits evenly (16) and one that doesn't (24).
+ */
+ 
+RB_ITEST(vmgr_bgbits_scroll_matches_refresh,video) {
+  rb_test_srand(97531);
+  int tilesize=16; for (;tilesize<=24;tilesize+=8) {
+    struct rb_vmgr *a=rb_vmgr_new();
+    struct rb_vmgr *b=rb_vmgr_new();
+    struct rb_image *sheet=rb_test_random_image(tilesize*16,tilesize*16,RB_ALPHAMODE_OPAQUE);
+    struct rb_grid *grid=rb_test_random_grid(60,50,0);
+    RB_ASSERT(a&&b&&sheet&&grid)
+    RB_ASSERT_CALL(rb_vmgr_set_image(a,0,sheet))
+    RB_ASSERT_CALL(rb_vmgr_set_image(b,0,sheet))
+    RB_ASSERT_CALL(rb_vmgr_set_grid(a,grid))
+    RB_ASSERT_CALL(rb_vmgr_set_grid(b,grid))
+    int worldw=grid->w*tilesize,worldh=grid->h*tilesize;
+    
+    int frame=0; for (;frame<500;frame++) {
+      switch (rb_test_rand(10)) {
+        case 0: a->scrollx=rb_test_rand(worldw+100)-50; a->scrolly=rb_test_rand(worldh+100)-50; break;
+        case 1: a->scrollx+=rb_test_rand(81)-40; a->scrolly+=rb_test_rand(81)-40; break;
+        default: a->scrollx+=rb_test_rand(7)-3; a->scrolly+=rb_test_rand(7)-3; break;
+      }
+      b->scrollx=a->scrollx;
+      b->scrolly=a->scrolly;
+      b->layerv[0].bgbitsdirty=1;
+      struct rb_image *fba=rb_vmgr_render(a);
+      struct rb_image *fbb=rb_vmgr_render(b);
+      RB_ASSERT(fba&&fbb)
+      int i=0; for (;i<RB_FB_W*RB_FB_H;i++) {
+        RB_ASSERT_INTS(fba->pixels[i],fbb->pixels[i],
+          "tilesize=%d frame=%d scroll=%d,%d x=%d y=%d",tilesize,frame,a->scrollx,a->scrolly,i%RB_FB_W,i/RB_FB_W
+        )
+      }
+    }
+    
+    rb_image_del(sheet);
+    rb_grid_del(grid);
+    rb_vmgr_del(a);
+    rb_vmgr_del(b);
+  }
+  return 0;
+}
@@ -0,0 +1,108 @@
+#include "test/rb_test.h"
+#include "rabbit/rb_vmgr.h"
+#include "rabbit/rb_image.h"
+#include "rabbit/rb_grid.h"
+#include "rabbit/rb_sprite.h"
+
+/* Many sprites over a big world, rendered by three vmgrs:
+ *   a: No index, visits every sprite. We sort it fully, so the order is well defined.
+ *   b: Indexed, culls to the view, finds moved sprites by sweeping.
+ *   c: Indexed with (tracked), and dirty-rect tracking.
+ * Sprites move with rb_sprite_move(), except sometimes they're assigned directly and we sweep (c) manually.
+ * All three must match exactly.
+ */
+ 
+#define SPRITE_COUNT 400
+ 
+RB_ITEST(vmgr_culled_sprites_match_unculled,video) {
+  rb_test_srand(97531);
+  struct rb_vmgr *a=rb_vmgr_new();
+  struct rb_vmgr *b=rb_vmgr_new();
+  struct rb_vmgr *c=rb_vmgr_new();
+  struct rb_image *bgsheet=rb_test_random_image(128,128,RB_ALPHAMODE_OPAQUE);
+  struct rb_image *sheet1=rb_test_random_image(128,128,RB_ALPHAMODE_BLEND);
+  struct rb_image *sheet2=rb_test_random_image(384,256,RB_ALPHAMODE_COLORKEY);
+  struct rb_grid *grid=rb_test_random_grid(150,120,0);
+  RB_ASSERT(a&&b&&c&&bgsheet&&sheet1&&sheet2&&grid)
+  struct rb_vmgr *vmgrv[3]={a,b,c};
+  int vi=0; for (;vi<3;vi++) {
+    RB_ASSERT_CALL(rb_vmgr_set_image(vmgrv[vi],0,bgsheet))
+    RB_ASSERT_CALL(rb_vmgr_set_image(vmgrv[vi],1,sheet1))
+    RB_ASSERT_CALL(rb_vmgr_set_image(vmgrv[vi],2,sheet2))
+    RB_ASSERT_CALL(rb_vmgr_set_grid(vmgrv[vi],grid))
+  }
+  RB_ASSERT_CALL(rb_sprite_group_set_index(b->sprites,4))
+  RB_ASSERT_CALL(rb_sprite_group_set_index(c->sprites,6))
+  c->sprites->index->tracked=1;
+  rb_vmgr_set_dirty_tracking(c,1);
+  
+  struct rb_sprite *spritev[SPRITE_COUNT];
+  int i=0; for (;i<SPRITE_COUNT;i++) {
+    struct rb_sprite *sprite=spritev[i]=rb_sprite_new(&rb_sprite_type_dummy);
+    RB_ASSERT(sprite)
+    sprite->x=rb_test_rand(1200);
+    sprite->y=rb_test_rand(960);
+    sprite->imageid=1+rb_test_rand(2);
+    sprite->tileid=rb_test_rand(256);
+    sprite->xform=rb_test_rand(8);
+    sprite->layer=rb_test_rand(3);
+    for (vi=0;vi<3;vi++) RB_ASSERT_CALL(rb_vmgr_add_sprite(vmgrv[vi],sprite))
+  }
+  
+  int frame=0; for (;frame<200;frame++) {
+    switch (rb_test_rand(8)) {
+      case 0: a->scrollx=rb_test_rand(1200)-100; a->scrolly=rb_test_rand(960)-100; break;
+      default: a->scrollx+=rb_test_rand(9)-4; a->scrolly+=rb_test_rand(9)-4; break;
+    }
+    b->scrollx=c->scrollx=a->scrollx;
+    b->scrolly=c->scrolly=a->scrolly;
+    
+    // Everything moves a little, a few jump across the world.
+    int assign=!rb_test_rand(10);
+    for (i=0;i<SPRITE_COUNT;i++) {
+      struct rb_sprite *sprite=spritev[i];
+      if (rb_test_rand(2)) continue;
+      int x,y;
+      if (!rb_test_rand(100)) {
+        x=rb_test_rand(1200);
+        y=rb_test_rand(960);
+      } else {
+        x=sprite->x+rb_test_rand(5)-2;
+        y=sprite->y+rb_test_rand(5)-2;
+      }
+      if (assign) {
+        sprite->x=x;
+        sprite->y=y;
+      } else {
+        rb_sprite_move(sprite,x,y);
+      }
+      if (!rb_test_rand(50)) sprite->layer=rb_test_rand(3);
+    }
+    if (assign) {
+      c->sprites->index->tracked=0;
+      rb_sprite_group_index_update(c->sprites);
+      c->sprites->index->tracked=1;
+    }
+    
+    rb_sprite_group_sort_fully(a->sprites);
+    struct rb_image *fba=rb_vmgr_render(a);
+    struct rb_image *fbb=rb_vmgr_render(b);
+    struct rb_image *fbc=rb_vmgr_render(c);
+    RB_ASSERT(fba&&fbb&&fbc)
+    RB_ASSERT_INTS_OP(b->cullc,<,SPRITE_COUNT/2,"Culling should leave out most sprites.")
+    for (i=0;i<RB_FB_W*RB_FB_H;i++) {
+      RB_ASSERT_INTS(fbb->pixels[i],fba->pixels[i],"frame=%d x=%d y=%d",frame,i%RB_FB_W,i/RB_FB_W)
+      RB_ASSERT_INTS(fbc->pixels[i],fba->pixels[i],"frame=%d x=%d y=%d",frame,i%RB_FB_W,i/RB_FB_W)
+    }
+  }
+  
+  for (i=0;i<SPRITE_COUNT;i++) rb_sprite_del(spritev[i]);
+  rb_grid_del(grid);
+  rb_image_del(bgsheet);
+  rb_image_del(sheet1);
+  rb_image_del(sheet2);
+  rb_vmgr_del(a);
+  rb_vmgr_del(b);
+  rb_vmgr_del(c);
+  return 0;
+}
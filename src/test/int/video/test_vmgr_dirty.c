@@ -0,0 +1,42 @@
+#include "test/rb_test.h"
+#include "test/rb_test_scene.h"
+#include "rabbit/rb_vmgr.h"
+#include "rabbit/rb_image.h"
+#include "rabbit/rb_grid.h"
+
+/* Render the same changing scene with and without dirty-rect tracking. Output must be identical.
+ */
+ 
+RB_ITEST(vmgr_dirty_rects_match_full_render,video) {
+  rb_test_srand(13579);
+  struct rb_test_scene scene;
+  RB_ASSERT_CALL(rb_test_scene_init(&scene,2,20))
+  struct rb_vmgr *a=scene.vmgrv[0];
+  struct rb_vmgr *b=scene.vmgrv[1];
+  rb_vmgr_set_dirty_tracking(a,1);
+  
+  int partialc=0;
+  int frame=0; for (;frame<300;frame++) {
+  
+    // Scroll, change sprites, add and remove. Rarely a grid cell too.
+    RB_ASSERT_CALL(rb_test_scene_update(&scene))
+    if (!rb_test_rand(50)) {
+      scene.grid->v[rb_test_rand(scene.grid->w*scene.grid->h)]=rb_test_rand(256);
+      a->layerv[0].bgbitsdirty=b->layerv[0].bgbitsdirty=1;
+    }
+    
+    struct rb_image *fba=rb_vmgr_render(a);
+    struct rb_image *fbb=rb_vmgr_render(b);
+    RB_ASSERT(fba&&fbb)
+    int i=0; for (;i<RB_FB_W*RB_FB_H;i++) {
+      RB_ASSERT_INTS(fba->pixels[i],fbb->pixels[i],"frame=%d x=%d y=%d",frame,i%RB_FB_W,i/RB_FB_W)
+    }
+    
+    RB_ASSERT(b->dirty.rectc==1)
+    if ((a->dirty.rectc!=1)||(a->dirty.rectv[0].w!=RB_FB_W)||(a->dirty.rectv[0].h!=RB_FB_H)) partialc++;
+  }
+  RB_ASSERT(partialc>0,"Dirty tracking never did a partial render.")
+  
+  rb_test_scene_cleanup(&scene);
+  return 0;
+}
@@ -0,0 +1,110 @@
+#include "test/rb_test.h"
+#include "rabbit/rb_vmgr.h"
+#include "rabbit/rb_image.h"
+#include "rabbit/rb_grid.h"
+#include "rabbit/rb_sprite.h"
+
+/* Indexed images in vmgr must render exactly like the same images expanded to ARGB.
+ */
+
+static int indexed_set_expanded(struct rb_vmgr *vmgr,uint8_t imageid,struct rb_image8 *src,struct rb_palette *palette) {
+  struct rb_image *image=rb_image8_expand(src,palette);
+  RB_ASSERT(image)
+  RB_ASSERT_CALL(rb_vmgr_set_image(vmgr,imageid,image))
+  rb_image_del(image);
+  return 0;
+}
+
+static int indexed_render_and_compare(struct rb_vmgr *indexed,struct rb_vmgr *argb,int framec,const char *desc) {
+  while (framec-->0) {
+    switch (rb_test_rand(4)) {
+      case 0: indexed->scrollx=rb_test_rand(600)-100; indexed->scrolly=rb_test_rand(500)-100; break;
+      default: indexed->scrollx+=rb_test_rand(9)-4; indexed->scrolly+=rb_test_rand(9)-4; break;
+    }
+    argb->scrollx=indexed->scrollx;
+    argb->scrolly=indexed->scrolly;
+    struct rb_image *a=rb_vmgr_render(indexed);
+    struct rb_image *b=rb_vmgr_render(argb);
+    RB_ASSERT(a&&b)
+    int i=0; for (;i<RB_FB_W*RB_FB_H;i++) {
+      if (a->pixels[i]==b->pixels[i]) continue;
+      RB_FAIL(
+        "%s: frame=%d scroll=%d,%d pixel=%d,%d indexed=%08x argb=%08x",
+        desc,framec,indexed->scrollx,indexed->scrolly,i%RB_FB_W,i/RB_FB_W,a->pixels[i],b->pixels[i]
+      )
+    }
+  }
+  return 0;
+}
+
+/* Sheets: 0 OPAQUE behind, 1 BLEND sprites, 2 COLORKEY in front.
+ * Then swap palettes on a sprite sheet and a grid sheet, and swap back.
+ * The indexed side runs three bands, so tiles must compile ahead of the workers.
+ */
+
+RB_ITEST(vmgr_indexed_matches_argb,video) {
+  rb_test_srand(97531);
+  struct rb_image8 *sheetv[3];
+  RB_ASSERT(sheetv[0]=rb_test_random_image8(128,128,RB_ALPHAMODE_OPAQUE))
+  RB_ASSERT(sheetv[1]=rb_test_random_image8(128,128,RB_ALPHAMODE_BLEND))
+  RB_ASSERT(sheetv[2]=rb_test_random_image8(160,96,RB_ALPHAMODE_COLORKEY))
+  struct rb_palette *alt1=rb_test_random_palette(RB_ALPHAMODE_BLEND);
+  struct rb_palette *alt2=rb_test_random_palette(RB_ALPHAMODE_COLORKEY);
+  RB_ASSERT(alt1&&alt2)
+  struct rb_grid *front=rb_test_random_grid(50,40,2);
+  struct rb_grid *back=rb_test_random_grid(30,30,0);
+  RB_ASSERT(front&&back)
+
+  struct rb_vmgr *indexed=rb_vmgr_new();
+  struct rb_vmgr *argb=rb_vmgr_new();
+  RB_ASSERT(indexed&&argb)
+  RB_ASSERT_CALL(rb_vmgr_set_threads(indexed,3))
+  rb_vmgr_set_dirty_tracking(indexed,1);
+  rb_vmgr_set_dirty_tracking(argb,1);
+  int i=0; for (;i<3;i++) {
+    if (indexed_set_expanded(argb,i,sheetv[i],0)<0) return -1;
+    RB_ASSERT_CALL(rb_vmgr_set_image8(indexed,i,sheetv[i]))
+  }
+  RB_ASSERT_CALL(rb_vmgr_set_grid(indexed,front))
+  RB_ASSERT_CALL(rb_vmgr_set_grid(argb,front))
+  RB_ASSERT_CALL(rb_vmgr_set_layer(indexed,1,back,128))
+  RB_ASSERT_CALL(rb_vmgr_set_layer(argb,1,back,128))
+
+  struct rb_sprite *spritev[80];
+  for (i=0;i<80;i++) {
+    struct rb_sprite *sprite=rb_sprite_new(&rb_sprite_type_dummy);
+    RB_ASSERT(sprite)
+    sprite->x=rb_test_rand(500);
+    sprite->y=rb_test_rand(400);
+    sprite->imageid=rb_test_rand(3);
+    sprite->tileid=rb_test_rand(256);
+    sprite->xform=rb_test_rand(8);
+    RB_ASSERT_CALL(rb_vmgr_add_sprite(indexed,sprite))
+    RB_ASSERT_CALL(rb_vmgr_add_sprite(argb,sprite))
+    spritev[i]=sprite;
+  }
+
+  if (indexed_render_and_compare(indexed,argb,20,"own palettes")<0) return -1;
+
+  RB_ASSERT_CALL(rb_vmgr_set_palette(indexed,1,alt1))
+  if (indexed_set_expanded(argb,1,sheetv[1],alt1)<0) return -1;
+  RB_ASSERT_CALL(rb_vmgr_set_palette(indexed,2,alt2))
+  if (indexed_set_expanded(argb,2,sheetv[2],alt2)<0) return -1;
+  if (indexed_render_and_compare(indexed,argb,20,"swapped palettes")<0) return -1;
+
+  RB_ASSERT_CALL(rb_vmgr_set_palette(indexed,1,0))
+  if (indexed_set_expanded(argb,1,sheetv[1],0)<0) return -1;
+  RB_ASSERT_CALL(rb_vmgr_set_palette(indexed,2,0))
+  if (indexed_set_expanded(argb,2,sheetv[2],0)<0) return -1;
+  if (indexed_render_and_compare(indexed,argb,20,"restored palettes")<0) return -1;
+
+  rb_vmgr_del(indexed);
+  rb_vmgr_del(argb);
+  for (i=80;i-->0;) rb_sprite_del(spritev[i]);
+  for (i=3;i-->0;) rb_image8_del(sheetv[i]);
+  rb_palette_del(alt1);
+  rb_palette_del(alt2);
+  rb_grid_del(front);
+  rb_grid_del(back);
+  return 0;
+}
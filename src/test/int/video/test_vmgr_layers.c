@@ -0,0 +1,101 @@
+#include "test/rb_test.h"
+#include "rabbit/rb_vmgr.h"
+#include "rabbit/rb_image.h"
+#include "rabbit/rb_grid.h"
+
+/* Composite one pixel at a time with 1x1 blits, the slow obvious way.
+ */
+ 
+static void layers_reference(
+  struct rb_image *dst,
+  struct rb_vmgr *vmgr
+) {
+  memset(dst->pixels,0,RB_FB_SIZE_BYTES);
+  int layerid=vmgr->layerc; while (layerid-->0) {
+    const struct rb_vmgr_layer *layer=vmgr->layerv+layerid;
+    if (!layer->grid) continue;
+    struct rb_image *sheet=vmgr->imagev[layer->grid->imageid];
+    int colw=sheet->w>>4,rowh=sheet->h>>4;
+    int scrollx=(vmgr->scrollx*layer->parallax)>>8;
+    int scrolly=(vmgr->scrolly*layer->parallax)>>8;
+    int y=0; for (;y<RB_FB_H;y++) {
+      int wy=scrolly+y;
+      if ((wy<0)||(wy>=layer->grid->h*rowh)) continue;
+      int x=0; for (;x<RB_FB_W;x++) {
+        int wx=scrollx+x;
+        if ((wx<0)||(wx>=layer->grid->w*colw)) continue;
+        uint8_t tileid=layer->grid->v[(wy/rowh)*layer->grid->w+wx/colw];
+        int srcx=(tileid&15)*colw+wx%colw;
+        int srcy=(tileid>>4)*rowh+wy%rowh;
+        rb_image_blit_safe(dst,x,y,sheet,srcx,srcy,1,1,0,0,0);
+      }
+    }
+  }
+}
+
+/* Three layers: Colorkey far back, opaque in the middle, premultiplied in front, at different scroll rates.
+ * When the opaque one covers the view, the back one is skipped. Halfway through, we remove the opaque one.
+ * Compare against the reference, with and without dirty-rect tracking.
+ */
+ 
+RB_ITEST(vmgr_layers_match_reference,video) {
+  rb_test_srand(86420);
+  struct rb_vmgr *a=rb_vmgr_new();
+  struct rb_vmgr *b=rb_vmgr_new();
+  struct rb_image *expect=rb_framebuffer_new();
+  struct rb_image *sheet0=rb_test_random_image(16*16,16*16,RB_ALPHAMODE_BLEND);
+  struct rb_image *sheet1=rb_test_random_image(8*16,8*16,RB_ALPHAMODE_COLORKEY);
+  struct rb_image *sheet2=rb_test_random_image(24*16,24*16,RB_ALPHAMODE_OPAQUE);
+  struct rb_grid *grid0=rb_test_random_grid(40,30,0);
+  struct rb_grid *grid1=rb_test_random_grid(60,40,1);
+  struct rb_grid *grid2=rb_test_random_grid(20,15,2);
+  RB_ASSERT(a&&b&&expect&&sheet0&&sheet1&&sheet2&&grid0&&grid1&&grid2)
+  rb_vmgr_set_dirty_tracking(b,1);
+  struct rb_vmgr *vmgr=a;
+  int i=0; for (;i<2;i++,vmgr=b) {
+    RB_ASSERT_CALL(rb_vmgr_set_image(vmgr,0,sheet0))
+    RB_ASSERT_CALL(rb_vmgr_set_image(vmgr,1,sheet1))
+    RB_ASSERT_CALL(rb_vmgr_set_image(vmgr,2,sheet2))
+    RB_ASSERT_CALL(rb_vmgr_set_grid(vmgr,grid0))
+    RB_ASSERT_CALL(rb_vmgr_set_layer(vmgr,1,grid2,0x80))
+    RB_ASSERT_CALL(rb_vmgr_set_layer(vmgr,3,grid1,0x40))
+    RB_ASSERT_INTS(vmgr->layerc,4)
+  }
+  
+  int frame=0; for (;frame<60;frame++) {
+    switch (rb_test_rand(4)) {
+      case 0: a->scrollx=rb_test_rand(800)-100; a->scrolly=rb_test_rand(600)-100; break;
+      case 1: break;
+      default: a->scrollx+=rb_test_rand(21)-10; a->scrolly+=rb_test_rand(21)-10; break;
+    }
+    b->scrollx=a->scrollx;
+    b->scrolly=a->scrolly;
+    if (frame==40) {
+      RB_ASSERT_CALL(rb_vmgr_set_layer(a,1,0,0))
+      RB_ASSERT_CALL(rb_vmgr_set_layer(b,1,0,0))
+    }
+    
+    layers_reference(expect,a);
+    struct rb_image *fba=rb_vmgr_render(a);
+    struct rb_image *fbb=rb_vmgr_render(b);
+    RB_ASSERT(fba&&fbb)
+    for (i=0;i<RB_FB_W*RB_FB_H;i++) {
+      RB_ASSERT_INTS(fba->pixels[i],expect->pixels[i],"frame=%d scroll=%d,%d x=%d y=%d",frame,a->scrollx,a->scrolly,i%RB_FB_W,i/RB_FB_W)
+      RB_ASSERT_INTS(fbb->pixels[i],expect->pixels[i],"frame=%d scroll=%d,%d x=%d y=%d",frame,a->scrollx,a->scrolly,i%RB_FB_W,i/RB_FB_W)
+    }
+  }
+  
+  RB_ASSERT_CALL(rb_vmgr_set_layer(a,3,0,0))
+  RB_ASSERT_INTS(a->layerc,1)
+  
+  rb_image_del(expect);
+  rb_image_del(sheet0);
+  rb_image_del(sheet1);
+  rb_image_del(sheet2);
+  rb_grid_del(grid0);
+  rb_grid_del(grid1);
+  rb_grid_del(grid2);
+  rb_vmgr_del(a);
+  rb_vmgr_del(b);
+  return 0;
+}
@@ -0,0 +1,228 @@
+#include "test/rb_test.h"
+#include "test/rb_test_scene.h"
+#include "rabbit/rb_vmgr.h"
+#include "rabbit/rb_image.h"
+#include "rabbit/rb_video.h"
+#include "rabbit/rb_present.h"
+#include <unistd.h>
+#include <time.h>
+
+#define PRESENT_FRAMEC 120
+
+static uint32_t present_hash(const struct rb_image *image) {
+  uint32_t hash=0x811c9dc5;
+  int i=image->w*image->h;
+  const uint32_t *p=image->pixels;
+  for (;i-->0;p++) hash=(hash^*p)*0x01000193;
+  return hash;
+}
+
+/* Rotating buffers must not change the output or dirty rects, with tracking or without.
+ */
+
+RB_ITEST(vmgr_buffers_match_single,video) {
+  rb_test_srand(97531);
+  struct rb_test_scene scene;
+  RB_ASSERT_CALL(rb_test_scene_init(&scene,3,15))
+  struct rb_vmgr *a=scene.vmgrv[0]; // single, tracking
+  struct rb_vmgr *b=scene.vmgrv[1]; // triple, tracking
+  struct rb_vmgr *c=scene.vmgrv[2]; // double, no tracking
+  rb_vmgr_set_dirty_tracking(a,1);
+  rb_vmgr_set_dirty_tracking(b,1);
+  RB_ASSERT_FAILURE(rb_vmgr_set_buffers(b,0))
+  RB_ASSERT_FAILURE(rb_vmgr_set_buffers(b,RB_VMGR_FB_LIMIT+1))
+  RB_ASSERT_CALL(rb_vmgr_set_buffers(b,3))
+  RB_ASSERT_CALL(rb_vmgr_set_buffers(c,2))
+
+  struct rb_image *prevb=0;
+  int frame=0; for (;frame<PRESENT_FRAMEC;frame++) {
+    RB_ASSERT_CALL(rb_test_scene_update(&scene))
+    if (frame==PRESENT_FRAMEC/2) RB_ASSERT_CALL(rb_vmgr_set_buffers(b,2),"change count midstream")
+    struct rb_image *fba=rb_vmgr_render(a);
+    struct rb_image *fbb=rb_vmgr_render(b);
+    struct rb_image *fbc=rb_vmgr_render(c);
+    RB_ASSERT(fba&&fbb&&fbc)
+    RB_ASSERT(fbb!=prevb,"frame=%d, buffer should rotate",frame)
+    prevb=fbb;
+    int i=0; for (;i<RB_FB_W*RB_FB_H;i++) {
+      RB_ASSERT_INTS(fba->pixels[i],fbb->pixels[i],"frame=%d x=%d y=%d",frame,i%RB_FB_W,i/RB_FB_W)
+      RB_ASSERT_INTS(fba->pixels[i],fbc->pixels[i],"frame=%d x=%d y=%d",frame,i%RB_FB_W,i/RB_FB_W)
+    }
+    RB_ASSERT_INTS(a->dirty.rectc,b->dirty.rectc,"frame=%d",frame)
+    RB_ASSERT(!memcmp(a->dirty.rectv,b->dirty.rectv,sizeof(struct rb_dirty_rect)*a->dirty.rectc),"frame=%d",frame)
+  }
+
+  rb_test_scene_cleanup(&scene);
+  return 0;
+}
+
+/* Fake video driver that keeps its own copy of the screen, only updating dirty regions like a GL texture.
+ * Records a hash of that copy at each swap, so we can see exactly what reached the screen.
+ */
+
+struct present_video {
+  struct rb_video hdr;
+  struct rb_image *screen;
+  uint32_t hashv[PRESENT_FRAMEC];
+  int hashc;
+  int delayus;
+  int fullc;
+};
+
+#define PVIDEO ((struct present_video*)video)
+
+static int present_video_record(struct rb_video *video) {
+  if (PVIDEO->delayus) usleep(PVIDEO->delayus);
+  if (PVIDEO->hashc>=PRESENT_FRAMEC) return -1;
+  PVIDEO->hashv[PVIDEO->hashc++]=present_hash(PVIDEO->screen);
+  return 0;
+}
+
+static int present_video_swap(struct rb_video *video,struct rb_image *fb) {
+  if (!PVIDEO->screen&&!(PVIDEO->screen=rb_framebuffer_new())) return -1;
+  memcpy(PVIDEO->screen->pixels,fb->pixels,RB_FB_SIZE_BYTES);
+  PVIDEO->fullc++;
+  return present_video_record(video);
+}
+
+static int present_video_swap_dirty(struct rb_video *video,struct rb_image *fb,const struct rb_dirty *dirty) {
+  if (!PVIDEO->screen) return present_video_swap(video,fb);
+  const struct rb_dirty_rect *rect=dirty->rectv;
+  int i=dirty->rectc;
+  for (;i-->0;rect++) {
+    int y=rect->y; for (;y<rect->y+rect->h;y++) {
+      memcpy(PVIDEO->screen->pixels+y*RB_FB_W+rect->x,fb->pixels+y*RB_FB_W+rect->x,rect->w<<2);
+    }
+  }
+  return present_video_record(video);
+}
+
+static void present_video_del(struct rb_video *video) {
+  rb_image_del(PVIDEO->screen);
+}
+
+static const struct rb_video_type present_video_type={
+  .name="present_test",
+  .objlen=sizeof(struct present_video),
+  .del=present_video_del,
+  .swap=present_video_swap,
+  .swap_dirty=present_video_swap_dirty,
+};
+
+/* Render a scene through rb_present into the fake driver.
+ * Every frame that reaches the screen must be exactly one we rendered, in order, ending with the last.
+ */
+
+static int present_run(int policy,int queuelimit,int fbc,int delayus,int *dropc) {
+  struct rb_test_scene scene;
+  RB_ASSERT_CALL(rb_test_scene_init(&scene,1,15))
+  struct rb_vmgr *vmgr=scene.vmgrv[0];
+  rb_vmgr_set_dirty_tracking(vmgr,1);
+  RB_ASSERT_CALL(rb_vmgr_set_buffers(vmgr,fbc))
+
+  struct rb_video *video=rb_video_new(&present_video_type,0);
+  RB_ASSERT(video)
+  PVIDEO->delayus=delayus;
+  struct rb_present *present=rb_present_new(video,queuelimit,policy);
+  RB_ASSERT(present)
+  RB_ASSERT_CALL(rb_vmgr_set_present(vmgr,present))
+
+  uint32_t renderedv[PRESENT_FRAMEC];
+  int frame=0; for (;frame<PRESENT_FRAMEC;frame++) {
+    RB_ASSERT_CALL(rb_test_scene_update(&scene))
+    struct rb_image *fb=rb_vmgr_render(vmgr);
+    RB_ASSERT(fb)
+    renderedv[frame]=present_hash(fb);
+    RB_ASSERT_CALL(rb_present_submit(present,fb,&vmgr->dirty),"frame=%d",frame)
+  }
+  RB_ASSERT_CALL(rb_present_flush(present))
+
+  RB_ASSERT_INTS(present->framec,PVIDEO->hashc)
+  RB_ASSERT_INTS(present->framec+present->dropc,PRESENT_FRAMEC)
+  RB_ASSERT_INTS(PVIDEO->fullc,1,"Only the first swap should be full")
+  int renderedp=0,i=0;
+  for (;i<PVIDEO->hashc;i++) {
+    while ((renderedp<PRESENT_FRAMEC)&&(renderedv[renderedp]!=PVIDEO->hashv[i])) renderedp++;
+    RB_ASSERT(renderedp<PRESENT_FRAMEC,"Presented frame %d does not match any rendered frame in order.",i)
+    renderedp++;
+  }
+  RB_ASSERT(PVIDEO->hashv[PVIDEO->hashc-1]==renderedv[PRESENT_FRAMEC-1],"Last frame must reach the screen.")
+  *dropc=present->dropc;
+
+  RB_ASSERT_CALL(rb_vmgr_set_present(vmgr,0))
+  rb_present_del(present);
+  rb_video_del(video);
+  rb_test_scene_cleanup(&scene);
+  return 0;
+}
+
+RB_ITEST(present_block_delivers_every_frame,video) {
+  rb_test_srand(97531);
+  int dropc=-1;
+  RB_ASSERT_CALL(present_run(RB_PRESENT_POLICY_BLOCK,1,2,500,&dropc))
+  RB_ASSERT_INTS(dropc,0)
+  RB_ASSERT_CALL(present_run(RB_PRESENT_POLICY_BLOCK,2,3,0,&dropc))
+  RB_ASSERT_INTS(dropc,0)
+  RB_ASSERT_CALL(present_run(RB_PRESENT_POLICY_BLOCK,1,1,0,&dropc),"Single buffer still works, just doesn't overlap")
+  RB_ASSERT_INTS(dropc,0)
+  return 0;
+}
+
+RB_ITEST(present_drop_oldest_merges_damage,video) {
+  rb_test_srand(97531);
+  int dropc=0;
+  RB_ASSERT_CALL(present_run(RB_PRESENT_POLICY_DROP_OLDEST,1,3,5000,&dropc))
+  RB_ASSERT(dropc>0,"Presenting is much slower than rendering, some frames should drop.")
+  return 0;
+}
+
+/* Timing, not a test. Enable manually to compare.
+ * Each frame spends 1.5 ms on the CPU (standing in for game logic) plus a full render,
+ * against a driver that takes 2 ms per swap. Serial pays both; with a present thread, only the larger.
+ */
+
+static double present_now() {
+  struct timespec tv={0};
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return tv.tv_sec+tv.tv_nsec/1000000000.0;
+}
+
+XXX_RB_ITEST(present_benchmark) {
+  rb_test_srand(97531);
+  int mode=0; for (;mode<3;mode++) {
+    struct rb_test_scene scene;
+    RB_ASSERT_CALL(rb_test_scene_init(&scene,1,15))
+    struct rb_vmgr *vmgr=scene.vmgrv[0];
+    struct rb_video *video=rb_video_new(&present_video_type,0);
+    RB_ASSERT(video)
+    PVIDEO->delayus=2000;
+    struct rb_present *present=0;
+    if (mode) {
+      RB_ASSERT_CALL(rb_vmgr_set_buffers(vmgr,mode+1))
+      RB_ASSERT(present=rb_present_new(video,mode,RB_PRESENT_POLICY_BLOCK))
+      RB_ASSERT_CALL(rb_vmgr_set_present(vmgr,present))
+    }
+    double start=present_now();
+    int frame=0; for (;frame<PRESENT_FRAMEC;frame++) {
+      RB_ASSERT_CALL(rb_test_scene_update(&scene))
+      double busyuntil=present_now()+0.0015;
+      while (present_now()<busyuntil) ;
+      struct rb_image *fb=rb_vmgr_render(vmgr);
+      RB_ASSERT(fb)
+      if (present) RB_ASSERT_CALL(rb_present_submit(present,fb,0))
+      else RB_ASSERT_CALL(rb_video_swap(video,fb))
+    }
+    if (present) RB_ASSERT_CALL(rb_present_flush(present))
+    double elapsed=present_now()-start;
+    fprintf(stderr,
+      "%-7s: %.03f ms/frame\n",
+      mode?((mode==1)?"double":"triple"):"serial",
+      (elapsed*1000.0)/PRESENT_FRAMEC
+    );
+    rb_vmgr_set_present(vmgr,0);
+    rb_present_del(present);
+    rb_video_del(video);
+    rb_test_scene_cleanup(&scene);
+  }
+  return 0;
+}
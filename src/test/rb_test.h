@@ -85,13 +85,13 @@
 }
 
 #define RB_ASSERT_FLOATS(a,b,e,...) { \
-  double _a=(a),_b=(b),_e=(d); \
+  double _a=(a),_b=(b),_e=(e); \
   double _d=_a-_b; \
   if (_d<0.0) _d=-_d; \
   if (_d>_e) { \
     RB_FAIL_BEGIN(""__VA_ARGS__) \
     RB_FAIL_MORE("As written","%s == %s within %s",#a,#b,#e) \
-    RB_FAIL_MORE("Values","%f == %f within %f",_a,_b,_d) \
+    RB_FAIL_MORE("Values","%f == %f within %f",_a,_b,_e) \
     RB_FAIL_MORE("Difference","%f",_d) \
     RB_FAIL_END \
   } \
@@ -103,6 +103,22 @@
 void rb_render_image_to_console(const struct rb_image *image);
 void rb_render_image_alpha_to_console(const struct rb_image *image);
 
+/* Deterministic PRNG for fixtures, shared by all tests.
+ * Seed it at the start of each test, so results don't depend on what ran before.
+ */
+void rb_test_srand(uint32_t seed);
+int rb_test_rand(int range);
+
+/* Random content from rb_test_rand().
+ * OPAQUE images are opaque throughout. Otherwise a quarter of the pixels are zero, a quarter random alpha, and the rest opaque.
+ * Palettes likewise, except COLORKEY keeps index zero for the key.
+ * Grids get random tiles from sheet (imageid).
+ */
+struct rb_image *rb_test_random_image(int w,int h,int alphamode);
+struct rb_palette *rb_test_random_palette(int alphamode);
+struct rb_image8 *rb_test_random_image8(int w,int h,int alphamode);
+struct rb_grid *rb_test_random_grid(int w,int h,uint8_t imageid);
+
 /* Nothing for test cases below this point, just internals...
  ********************************************************************/
  
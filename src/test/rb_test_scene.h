@@ -0,0 +1,53 @@
+/* rb_test_scene.h
+ * Random vmgr scene for tests that render the same content several ways and compare.
+ * All vmgrs share three sheets (0 OPAQUE, 1 BLEND, 2 COLORKEY), one grid, and every sprite.
+ * Random choices come from rb_test_rand(); seed it first.
+ */
+
+#ifndef RB_TEST_SCENE_H
+#define RB_TEST_SCENE_H
+
+struct rb_vmgr;
+struct rb_image;
+struct rb_grid;
+struct rb_sprite;
+struct rb_sprite_type;
+
+#define RB_TEST_SCENE_VMGR_LIMIT 4
+#define RB_TEST_SCENE_SPRITE_LIMIT 300
+
+struct rb_test_scene {
+  struct rb_vmgr *vmgrv[RB_TEST_SCENE_VMGR_LIMIT];
+  int vmgrc;
+  struct rb_image *sheetv[3];
+  struct rb_grid *grid;
+  struct rb_sprite *spritev[RB_TEST_SCENE_SPRITE_LIMIT];
+  int spritec;
+};
+
+/* Build the sheets, grid, and (vmgrc) vmgrs, then add (spritec) dummy sprites.
+ * Sprites go anywhere a scroll can reach, on layers 0..2, with random tiles and transforms.
+ * On failure, you must still clean up.
+ */
+int rb_test_scene_init(struct rb_test_scene *scene,int vmgrc,int spritec);
+void rb_test_scene_cleanup(struct rb_test_scene *scene);
+
+/* Add a random sprite to every vmgr. Null (type) for rb_sprite_type_dummy.
+ * Remove and delete the sprite at (p) in (spritev).
+ */
+int rb_test_scene_add_sprite(struct rb_test_scene *scene,const struct rb_sprite_type *type);
+int rb_test_scene_remove_sprite(struct rb_test_scene *scene,int p);
+
+/* Scroll the first vmgr, usually a little, sometimes a jump, and copy it to the others.
+ */
+void rb_test_scene_scroll(struct rb_test_scene *scene);
+
+/* Change up to (changec) random sprites: Tile, transform, layer, or a small move.
+ */
+void rb_test_scene_move(struct rb_test_scene *scene,int changec);
+
+/* One frame's worth of all the above: Scroll, a few changes, and occasionally add or remove a sprite.
+ */
+int rb_test_scene_update(struct rb_test_scene *scene);
+
+#endif
@@ -2,6 +2,8 @@
 #include "rabbit/rb_image.h"
 #include "lib/image/rb_image_obj.c"
 #include "lib/image/rb_image_blit.c"
+#include "lib/image/rb_image_blit_rows.c"
+#include "lib/image/rb_image_decode.c"
 
 /* Generate 4x4-pixel test images.
  */
@@ -188,6 +190,272 @@ static int blit_to_colorkey() {
   return 0;
 }
 
+/* Row kernels must match the general per-pixel path exactly.
+ * Reference is rb_image_blit_general() doing XREV from a mirrored copy, so its iterator runs backward too.
+ * Alphas lean heavily toward 0x00, 0x80 and 0xff, since those are the interesting edges.
+ */
+ 
+static uint32_t random_pixel(uint32_t *seed) {
+  *seed=(*seed)*1103515245+12345;
+  uint32_t rgb=((*seed)>>8)&0x00ffffff;
+  switch (((*seed)>>4)&7) {
+    case 0: return 0;
+    case 1: return rgb;
+    case 2: return 0xff000000|rgb;
+    case 3: return 0x80000000|rgb;
+    case 4: return 0x7f000000|rgb;
+  }
+  *seed=(*seed)*1103515245+12345;
+  return (((*seed)>>8)<<24)|rgb;
+}
+ 
+static int blit_rows_match_general_path() {
+  uint32_t seed=12345;
+  int w=1; for (;w<=37;w+=3) {
+    int srcmode=0; for (;srcmode<5;srcmode++) {
+      int dstmode=0; for (;dstmode<4;dstmode++) {
+        struct rb_image *src=rb_image_new(w,3);
+        struct rb_image *mirror=rb_image_new(w,3);
+        struct rb_image *expect=rb_image_new(w+2,3);
+        struct rb_image *actual=rb_image_new(w+2,3);
+        RB_ASSERT(src&&mirror&&expect&&actual)
+        src->alphamode=mirror->alphamode=srcmode;
+        expect->alphamode=actual->alphamode=dstmode;
+        int i=w*3; while (i-->0) src->pixels[i]=random_pixel(&seed);
+        int y=0; for (;y<3;y++) {
+          int x=0; for (;x<w;x++) mirror->pixels[y*w+x]=src->pixels[y*w+w-x-1];
+        }
+        for (i=expect->w*expect->h;i-->0;) expect->pixels[i]=actual->pixels[i]=random_pixel(&seed);
+        
+        rb_image_blit_unchecked(actual,1,0,src,0,0,w,3,0,0,0);
+        rb_image_blit_general(expect,1,0,mirror->pixels,mirror->w,mirror->alphamode,0,0,w,3,RB_XFORM_XREV,0,0);
+        for (i=0;i<expect->w*expect->h;i++) {
+          RB_ASSERT_INTS(actual->pixels[i],expect->pixels[i],"w=%d src=%d dst=%d p=%d",w,srcmode,dstmode,i)
+        }
+        
+        rb_image_del(src);
+        rb_image_del(mirror);
+        rb_image_del(expect);
+        rb_image_del(actual);
+      }
+    }
+  }
+  return 0;
+}
+
+/* Transformed blits go through transposes and row kernels, and must match the per-pixel path too.
+ * Sizes straddle the 4-pixel vector blocks and 16-pixel cache blocks, from inside a bigger source.
+ */
+ 
+static int blit_xforms_match_general_path() {
+  uint32_t seed=24680;
+  const int sizev[]={1,3,4,5,15,16,17,35};
+  const int sizec=sizeof(sizev)/sizeof(int);
+  struct rb_image *src=rb_image_new(40,38);
+  struct rb_image *expect=rb_image_new(40,40);
+  struct rb_image *actual=rb_image_new(40,40);
+  RB_ASSERT(src&&expect&&actual)
+  int xform=0; for (;xform<8;xform++) {
+    int srcmode=0; for (;srcmode<5;srcmode++) {
+      int dstmode=0; for (;dstmode<4;dstmode++) {
+        int wi=0; for (;wi<sizec;wi++) {
+          int hi=0; for (;hi<sizec;hi++) {
+            int w=sizev[wi],h=sizev[hi];
+            src->alphamode=srcmode;
+            expect->alphamode=actual->alphamode=dstmode;
+            int i=src->w*src->h; while (i-->0) src->pixels[i]=random_pixel(&seed);
+            for (i=expect->w*expect->h;i-->0;) expect->pixels[i]=actual->pixels[i]=random_pixel(&seed);
+            rb_image_blit_unchecked(actual,2,1,src,3,2,w,h,xform,0,0);
+            rb_image_blit_general(expect,2,1,src->pixels,src->w,src->alphamode,3,2,w,h,xform,0,0);
+            for (i=0;i<expect->w*expect->h;i++) {
+              if (actual->pixels[i]==expect->pixels[i]) continue;
+              RB_FAIL(
+                "xform=%d src=%d dst=%d w=%d h=%d p=%d expect=%08x actual=%08x",
+                xform,srcmode,dstmode,w,h,i,expect->pixels[i],actual->pixels[i]
+              )
+            }
+          }
+        }
+      }
+    }
+  }
+  rb_image_del(src);
+  rb_image_del(expect);
+  rb_image_del(actual);
+  return 0;
+}
+
+/* Blitting a premultiplied copy must look the same as blitting the BLEND original.
+ * Each channel may be off by one, since we round the two products separately.
+ * Onto transparent BLEND pixels, we unpremultiply, and lose more at low alpha. Only alpha must match there.
+ */
+ 
+static int premul_matches_blend() {
+  uint32_t seed=98765;
+  int dstmode=0; for (;dstmode<4;dstmode++) {
+    struct rb_image *src=rb_image_new(29,7);
+    struct rb_image *premul=rb_image_new(29,7);
+    struct rb_image *expect=rb_image_new(29,7);
+    struct rb_image *actual=rb_image_new(29,7);
+    uint32_t dstv[29*7];
+    RB_ASSERT(src&&premul&&expect&&actual)
+    int i=29*7; while (i-->0) premul->pixels[i]=src->pixels[i]=random_pixel(&seed);
+    rb_image_premultiply(premul);
+    RB_ASSERT_INTS(premul->alphamode,RB_ALPHAMODE_PREMUL)
+    expect->alphamode=actual->alphamode=dstmode;
+    for (i=29*7;i-->0;) dstv[i]=random_pixel(&seed);
+    
+    int xform=0; for (;xform<2;xform++) {
+      memcpy(expect->pixels,dstv,sizeof(dstv));
+      memcpy(actual->pixels,dstv,sizeof(dstv));
+      rb_image_blit_unchecked(expect,0,0,src,0,0,29,7,xform,0,0);
+      rb_image_blit_unchecked(actual,0,0,premul,0,0,29,7,xform,0,0);
+      for (i=0;i<29*7;i++) {
+        uint32_t e=expect->pixels[i],a=actual->pixels[i];
+        RB_ASSERT_INTS(a>>24,e>>24,"dst=%d xform=%d p=%d",dstmode,xform,i)
+        if ((dstmode==RB_ALPHAMODE_BLEND)&&!(dstv[i]>>24)) continue;
+        int shift=0; for (;shift<24;shift+=8) {
+          int d=((a>>shift)&0xff)-((e>>shift)&0xff);
+          RB_ASSERT((d>=-1)&&(d<=1),"dst=%d xform=%d p=%d expect=%08x actual=%08x",dstmode,xform,i,e,a)
+        }
+      }
+    }
+    
+    rb_image_del(src);
+    rb_image_del(premul);
+    rb_image_del(expect);
+    rb_image_del(actual);
+  }
+  return 0;
+}
+
+/* Indexed blits must match blitting the same image expanded to ARGB, exactly.
+ */
+ 
+static int blit8_matches_expanded() {
+  uint32_t seed=11235;
+  const int sizev[]={1,5,16,17,35};
+  const int sizec=sizeof(sizev)/sizeof(int);
+  struct rb_image8 *src=rb_image8_new(40,38);
+  struct rb_palette *palette=rb_palette_new();
+  struct rb_image *expect=rb_image_new(40,40);
+  struct rb_image *actual=rb_image_new(40,40);
+  RB_ASSERT(src&&palette&&expect&&actual)
+  int xform=0; for (;xform<8;xform++) {
+    int srcmode=0; for (;srcmode<5;srcmode++) {
+      int dstmode=0; for (;dstmode<4;dstmode++) {
+        int wi=0; for (;wi<sizec;wi++) {
+          int hi=0; for (;hi<sizec;hi++) {
+            int w=sizev[wi],h=sizev[hi];
+            palette->alphamode=srcmode;
+            expect->alphamode=actual->alphamode=dstmode;
+            int i=256; while (i-->0) palette->v[i]=random_pixel(&seed);
+            for (i=src->w*src->h;i-->0;) src->pixels[i]=random_pixel(&seed);
+            for (i=expect->w*expect->h;i-->0;) expect->pixels[i]=actual->pixels[i]=random_pixel(&seed);
+            struct rb_image *expanded=rb_image8_expand(src,palette);
+            RB_ASSERT(expanded)
+            RB_ASSERT_INTS(expanded->alphamode,srcmode)
+            rb_image_blit_unchecked(expect,2,1,expanded,3,2,w,h,xform,0,0);
+            rb_image8_blit_unchecked(actual,2,1,src,3,2,w,h,xform,palette);
+            rb_image_del(expanded);
+            for (i=0;i<expect->w*expect->h;i++) {
+              if (actual->pixels[i]==expect->pixels[i]) continue;
+              RB_FAIL(
+                "xform=%d src=%d dst=%d w=%d h=%d p=%d expect=%08x actual=%08x",
+                xform,srcmode,dstmode,w,h,i,expect->pixels[i],actual->pixels[i]
+              )
+            }
+          }
+        }
+      }
+    }
+  }
+  rb_image8_del(src);
+  rb_palette_del(palette);
+  rb_image_del(expect);
+  rb_image_del(actual);
+  return 0;
+}
+
+/* Decode an I8 image both ways, then blit it with clipping and a palette override.
+ */
+ 
+static int image8_decode_and_clip() {
+  const uint8_t serial[]={
+    RB_IMAGE_FORMAT_I8,0x00,0x40,0x02, // 5x3
+    2, // 3 colors
+      0x12,0x34,0x56,0x00, // transparent
+      0xff,0x00,0x00,0xff, // red
+      0x00,0xff,0x00,0x80, // half green
+    0,1,2,1,0,
+    1,1,1,1,1,
+    2,0,0,0,2,
+  };
+  struct rb_image8 *image8=rb_image8_new_decode(serial,sizeof(serial));
+  RB_ASSERT(image8)
+  RB_ASSERT_INTS(image8->w,5)
+  RB_ASSERT_INTS(image8->h,3)
+  RB_ASSERT(image8->palette)
+  RB_ASSERT_INTS(image8->palette->alphamode,RB_ALPHAMODE_PREMUL)
+  RB_ASSERT_INTS(image8->palette->v[0],0x00000000)
+  RB_ASSERT_INTS(image8->palette->v[1],0xffff0000)
+  RB_ASSERT_INTS(image8->palette->v[2],0x80007f00)
+  RB_ASSERT_INTS(image8->palette->v[3],0)
+  RB_ASSERT(!rb_image8_new_decode(serial,sizeof(serial)-1))
+  RB_ASSERT(!rb_image8_new_decode(serial,9))
+  
+  struct rb_image *image=rb_image_new_decode(serial,sizeof(serial));
+  RB_ASSERT(image)
+  RB_ASSERT_INTS(image->alphamode,RB_ALPHAMODE_PREMUL)
+  int i=15; while (i-->0) {
+    RB_ASSERT_INTS(image->pixels[i],image8->palette->v[image8->pixels[i]],"p=%d",i)
+  }
+  
+  // Only 0x00 and 0xff alphas make a COLORKEY palette, with transparent colors zeroed.
+  uint8_t ckserial[]={1, 0x12,0x34,0x56,0x00, 0x00,0x00,0x00,0xff};
+  struct rb_palette *palette=rb_palette_new_decode(ckserial,sizeof(ckserial));
+  RB_ASSERT(palette)
+  RB_ASSERT_INTS(palette->alphamode,RB_ALPHAMODE_COLORKEY)
+  RB_ASSERT_INTS(palette->v[0],0)
+  RB_ASSERT_INTS(palette->v[1],0xff000000)
+  ckserial[4]=0xff;
+  rb_palette_del(palette);
+  RB_ASSERT(palette=rb_palette_new_decode(ckserial,sizeof(ckserial)))
+  RB_ASSERT_INTS(palette->alphamode,RB_ALPHAMODE_OPAQUE)
+  
+  // Clipping matches the ARGB blitter, for any xform, with either palette.
+  struct rb_image *expect=rb_image_new(4,4);
+  struct rb_image *actual=rb_image_new(4,4);
+  RB_ASSERT(expect&&actual)
+  expect->alphamode=actual->alphamode=RB_ALPHAMODE_OPAQUE;
+  int xform=0; for (;xform<8;xform++) {
+    int pi=0; for (;pi<2;pi++) {
+      struct rb_palette *override=pi?palette:0;
+      struct rb_image *expanded=rb_image8_expand(image8,override);
+      RB_ASSERT(expanded)
+      rb_image_clear(expect,0xff404040);
+      rb_image_clear(actual,0xff404040);
+      rb_image_blit_safe(expect,-1,2,expanded,0,-1,5,3,xform,0,0);
+      RB_ASSERT_CALL(rb_image8_blit_safe(actual,-1,2,image8,0,-1,5,3,xform,override))
+      rb_image_del(expanded);
+      for (i=0;i<16;i++) {
+        RB_ASSERT_INTS(actual->pixels[i],expect->pixels[i],"xform=%d palette=%d p=%d",xform,pi,i)
+      }
+    }
+  }
+  
+  // No palette at all is an error.
+  RB_ASSERT_CALL(rb_image8_set_palette(image8,0))
+  RB_ASSERT_FAILURE(rb_image8_blit_safe(actual,0,0,image8,0,0,5,3,0,0))
+  
+  rb_image8_del(image8);
+  rb_image_del(image);
+  rb_palette_del(palette);
+  rb_image_del(expect);
+  rb_image_del(actual);
+  return 0;
+}
+
 /* TOC
  */
  
@@ -195,5 +463,10 @@ int main(int argc,char **argv) {
   RB_UTEST(blit_to_opaque)
   RB_UTEST(blit_to_alpha)
   RB_UTEST(blit_to_colorkey)
+  RB_UTEST(blit_rows_match_general_path)
+  RB_UTEST(blit_xforms_match_general_path)
+  RB_UTEST(premul_matches_blend)
+  RB_UTEST(blit8_matches_expanded)
+  RB_UTEST(image8_decode_and_clip)
   return 0;
 }
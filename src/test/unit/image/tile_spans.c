@@ -0,0 +1,90 @@
+#include "test/rb_test.h"
+#include "rabbit/rb_image.h"
+#include "rabbit/rb_tile_spans.h"
+#include "lib/image/rb_image_obj.c"
+#include "lib/image/rb_image_blit.c"
+#include "lib/image/rb_image_blit_rows.c"
+#include "lib/image/rb_tile_spans.c"
+
+/* Random pixels with plenty of each kind: transparent, opaque, and in between.
+ */
+ 
+static uint32_t random_pixel(uint32_t *seed) {
+  *seed=(*seed)*1103515245+12345;
+  uint32_t rgb=((*seed)>>8)&0x00ffffff;
+  switch (((*seed)>>4)&7) {
+    case 0: case 1: return 0;
+    case 2: case 3: return 0xff000000|rgb;
+    case 4: return 0x80000000|rgb;
+    case 5: return 0x7f000000|rgb;
+  }
+  *seed=(*seed)*1103515245+12345;
+  return (((*seed)>>8)<<24)|rgb;
+}
+
+/* Blitting spans must produce exactly what rb_image_blit_safe() does, including clipped positions.
+ */
+ 
+static int spans_match_blit_safe() {
+  uint32_t seed=24680;
+  const int tilew=12,tileh=10;
+  const int positions[]={0,0, 5,3, -7,2, 3,-6, 25,17, 30,33, -11,-9, 40,40};
+  int srcmode=0; for (;srcmode<5;srcmode++) {
+    struct rb_image *src=rb_image_new(tilew*4,tileh*4);
+    struct rb_image *expect=rb_image_new(36,31);
+    struct rb_image *actual=rb_image_new(36,31);
+    RB_ASSERT(src&&expect&&actual)
+    int i=src->w*src->h; while (i-->0) src->pixels[i]=random_pixel(&seed);
+    if (srcmode==RB_ALPHAMODE_PREMUL) rb_image_premultiply(src);
+    else src->alphamode=srcmode;
+    expect->alphamode=actual->alphamode=RB_ALPHAMODE_OPAQUE;
+    
+    int tileid=0; for (;tileid<16;tileid+=5) {
+      int srcx=(tileid&3)*tilew,srcy=(tileid>>2)*tileh;
+      int xform=0; for (;xform<8;xform++) {
+        struct rb_tile_spans *spans=rb_tile_spans_new(src,srcx,srcy,tilew,tileh,xform);
+        RB_ASSERT(spans)
+        RB_ASSERT_INTS(spans->w,(xform&RB_XFORM_SWAP)?tileh:tilew)
+        int p=0; for (;p<sizeof(positions)/sizeof(int);p+=2) {
+          for (i=expect->w*expect->h;i-->0;) expect->pixels[i]=actual->pixels[i]=random_pixel(&seed)|0xff000000;
+          rb_image_blit_safe(expect,positions[p],positions[p+1],src,srcx,srcy,tilew,tileh,xform,0,0);
+          rb_tile_spans_blit(actual,positions[p],positions[p+1],spans);
+          for (i=0;i<expect->w*expect->h;i++) {
+            RB_ASSERT_INTS(actual->pixels[i],expect->pixels[i],"src=%d tile=%d xform=%d pos=%d,%d p=%d",
+              srcmode,tileid,xform,positions[p],positions[p+1],i
+            )
+          }
+        }
+        rb_tile_spans_del(spans);
+      }
+    }
+    
+    rb_image_del(src);
+    rb_image_del(expect);
+    rb_image_del(actual);
+  }
+  return 0;
+}
+
+/* A fully transparent tile has no spans and blits nothing.
+ */
+ 
+static int transparent_tile_has_no_spans() {
+  struct rb_image *src=rb_image_new(8,8);
+  RB_ASSERT(src)
+  struct rb_tile_spans *spans=rb_tile_spans_new(src,0,0,8,8,RB_XFORM_SWAP);
+  RB_ASSERT(spans)
+  RB_ASSERT_INTS(spans->spanc,0)
+  rb_tile_spans_del(spans);
+  rb_image_del(src);
+  return 0;
+}
+
+/* TOC
+ */
+ 
+int main(int argc,char **argv) {
+  RB_UTEST(spans_match_blit_safe)
+  RB_UTEST(transparent_tile_has_no_spans)
+  return 0;
+}
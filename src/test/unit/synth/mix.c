@@ -0,0 +1,84 @@
+#include "test/rb_test.h"
+#include "rabbit/rb_mix.h"
+#include "lib/synth/rb_mix.c"
+
+/* Mono to interleaved, every legal channel count.
+ */
+ 
+static int mix_expand_interleaves() {
+  int16_t src[21];
+  int16_t dst[21*8+1];
+  int i=0; for (;i<21;i++) src[i]=i*1000-10000;
+  int chanc=1;
+  for (;chanc<=8;chanc++) {
+    int framec=0;
+    for (;framec<=21;framec++) {
+      memset(dst,0x55,sizeof(dst));
+      rb_mix_expand_s16(dst,src,framec,chanc);
+      for (i=0;i<framec*chanc;i++) {
+        RB_ASSERT_INTS(dst[i],src[i/chanc],"chanc=%d framec=%d i=%d",chanc,framec,i)
+      }
+      RB_ASSERT_INTS(dst[framec*chanc],0x5555,"overrun chanc=%d framec=%d",chanc,framec)
+    }
+  }
+  return 0;
+}
+
+/* Widening add, peak, and narrowing.
+ */
+ 
+static int mix_wide_bus() {
+  int32_t bus[37];
+  int16_t src[37],dst[37];
+  int i=0; for (;i<37;i++) {
+    bus[i]=i*3000-50000;
+    src[i]=(i&1)?32767:-32768;
+  }
+  rb_mix_add_s16_s32(bus,src,37);
+  for (i=0;i<37;i++) {
+    int32_t expect=i*3000-50000+((i&1)?32767:-32768);
+    RB_ASSERT_INTS(bus[i],expect,"i=%d",i)
+  }
+  
+  RB_ASSERT_INTS(rb_mix_peak_s32(bus,37),35*3000-50000+32767)
+  RB_ASSERT_INTS(rb_mix_peak_s32(bus,2),50000+32768)
+  RB_ASSERT_INTS(rb_mix_peak_s32(bus+20,15),33*3000-50000+32767)
+  RB_ASSERT_INTS(rb_mix_peak_s32(bus,0),0)
+  
+  // Unity gain is a plain saturating conversion.
+  rb_mix_finish_s32(dst,bus,37,1.0f,1.0f);
+  for (i=0;i<37;i++) {
+    int32_t expect=bus[i];
+    if (expect>32767) expect=32767;
+    else if (expect<-32768) expect=-32768;
+    RB_ASSERT_INTS(dst[i],expect,"i=%d",i)
+  }
+  
+  // Scaled to fit the peak, nothing may clip, and sign must be preserved.
+  float gain=32767.0f/rb_mix_peak_s32(bus,37);
+  rb_mix_finish_s32(dst,bus,37,gain,gain);
+  for (i=0;i<37;i++) {
+    int32_t expect=(int32_t)(bus[i]*gain);
+    RB_ASSERT_INTS_OP(dst[i]-expect,<=,1,"i=%d",i)
+    RB_ASSERT_INTS_OP(dst[i]-expect,>=,-1,"i=%d",i)
+  }
+  
+  // Ramp: first sample gets (gain0), and we approach (gain1) at the end.
+  for (i=0;i<37;i++) bus[i]=10000;
+  rb_mix_finish_s32(dst,bus,37,1.0f,0.5f);
+  RB_ASSERT_INTS(dst[0],10000)
+  for (i=1;i<37;i++) RB_ASSERT_INTS_OP(dst[i],<=,dst[i-1],"i=%d",i)
+  RB_ASSERT_INTS_OP(dst[36],<,5200)
+  RB_ASSERT_INTS_OP(dst[36],>=,5000)
+  
+  return 0;
+}
+
+/* TOC
+ */
+ 
+int main(int argc,char **argv) {
+  RB_UTEST(mix_expand_interleaves)
+  RB_UTEST(mix_wide_bus)
+  return 0;
+}
@@ -0,0 +1,151 @@
+#include "test/rb_test.h"
+#include "rabbit/rb_wave.h"
+#include "lib/synth/rb_wave.c"
+#include <math.h>
+
+/* Sine against sinf(), across several periods in both directions, at lengths that exercise the scalar tail.
+ */
+ 
+static int wave_sine_matches_sinf() {
+  rb_sample_t phasev[1003],dst[1003];
+  int i=0; for (;i<1003;i++) phasev[i]=(i-501)*0.00731f;
+  rb_wave_sine(dst,phasev,1003,0.75f);
+  for (i=0;i<1003;i++) {
+    rb_sample_t expect=sinf(phasev[i]*M_PI*2.0f)*0.75f;
+    RB_ASSERT_FLOATS(dst[i],expect,0.000002f,"i=%d phase=%f",i,phasev[i])
+  }
+  
+  // In place is allowed.
+  rb_wave_sine(phasev,phasev,1003,0.75f);
+  RB_ASSERT(!memcmp(phasev,dst,sizeof(dst)))
+  
+  // Exact at the quarters.
+  const rb_sample_t quarterv[]={0.0f,0.25f,0.5f,0.75f,1.0f,-0.25f};
+  const rb_sample_t expectv[]={0.0f,1.0f,0.0f,-1.0f,0.0f,-1.0f};
+  rb_wave_sine(dst,quarterv,6,1.0f);
+  for (i=0;i<6;i++) RB_ASSERT_FLOATS(dst[i],expectv[i],0.0000001f,"i=%d",i)
+  return 0;
+}
+
+/* Phase generators track a serial accumulator, and stay in 0..1.
+ */
+ 
+static int wave_phase_tracks_serial() {
+  rb_sample_t dst[1001],ratev[1001];
+  
+  double p=0.9;
+  uint32_t next=rb_wave_phase_const(dst,1001,rb_wave_phase_fixed(0.9f),rb_wave_phase_fixed(0.0123f));
+  int i=0; for (;i<1001;i++) {
+    RB_ASSERT(dst[i]>=0.0f&&dst[i]<1.0f,"i=%d p=%f",i,dst[i])
+    RB_ASSERT_FLOATS(dst[i],p,0.00001f,"i=%d",i)
+    p+=0.0123; if (p>=1.0) p-=1.0;
+  }
+  RB_ASSERT_FLOATS(next/4294967296.0,p,0.00001f)
+  
+  // Variable rate, including negative rates which must wrap the other way.
+  for (i=0;i<1001;i++) ratev[i]=((i%37)-10)*30.0f;
+  p=0.5;
+  next=rb_wave_phase_ratev(dst,ratev,1001,rb_wave_phase_fixed(0.5f),1.0f/22050.0f);
+  for (i=0;i<1001;i++) {
+    RB_ASSERT(dst[i]>=0.0f&&dst[i]<1.0f,"i=%d p=%f",i,dst[i])
+    RB_ASSERT_FLOATS(dst[i],p,0.00001f,"i=%d",i)
+    p+=ratev[i]/22050.0; p-=floor(p);
+  }
+  RB_ASSERT_FLOATS(next/4294967296.0,p,0.00001f)
+  
+  // In place.
+  rb_sample_t copy[1001];
+  for (i=0;i<1001;i++) ratev[i]=((i%37)-10)*30.0f;
+  rb_wave_phase_ratev(copy,ratev,1001,0,1.0f/22050.0f);
+  rb_wave_phase_ratev(ratev,ratev,1001,0,1.0f/22050.0f);
+  RB_ASSERT(!memcmp(copy,ratev,sizeof(copy)))
+  return 0;
+}
+
+/* Splitting a run into arbitrary chunks must not change a single bit.
+ * Print workers and the inline printer chunk differently, and their output must match.
+ */
+ 
+static int wave_chunking_is_invisible() {
+  rb_sample_t ratev[1001],whole[1001],chunked[1001];
+  int i=0; for (;i<1001;i++) ratev[i]=440.0f+(i%23)*17.5f;
+  
+  uint32_t wholep=rb_wave_phase_ratev(whole,ratev,1001,12345,1.0f/44100.0f);
+  rb_wave_sine(whole,whole,1001,0.5f);
+  
+  uint32_t p=12345;
+  int dstp=0,chunkc=1;
+  while (dstp<1001) {
+    int c=1001-dstp;
+    if (c>chunkc) c=chunkc;
+    p=rb_wave_phase_ratev(chunked+dstp,ratev+dstp,c,p,1.0f/44100.0f);
+    rb_wave_sine(chunked+dstp,chunked+dstp,c,0.5f);
+    dstp+=c;
+    chunkc=(chunkc%13)+1;
+  }
+  RB_ASSERT_INTS(p,wholep)
+  RB_ASSERT(!memcmp(whole,chunked,sizeof(whole)))
+  
+  wholep=rb_wave_phase_const(whole,1001,0xfff00000,0x01234567);
+  rb_wave_triangle(whole,whole,1001,0.5f);
+  p=0xfff00000;
+  dstp=0; chunkc=1;
+  while (dstp<1001) {
+    int c=1001-dstp;
+    if (c>chunkc) c=chunkc;
+    p=rb_wave_phase_const(chunked+dstp,c,p,0x01234567);
+    rb_wave_triangle(chunked+dstp,chunked+dstp,c,0.5f);
+    dstp+=c;
+    chunkc=(chunkc%11)+1;
+  }
+  RB_ASSERT_INTS(p,wholep)
+  RB_ASSERT(!memcmp(whole,chunked,sizeof(whole)))
+  return 0;
+}
+
+/* The straight shapes match their scalar formulas exactly, even outside 0..1.
+ */
+ 
+static int wave_shapes_match_formulas() {
+  rb_sample_t phasev[203],dst[203];
+  int i=0; for (;i<203;i++) phasev[i]=(i-50)*0.01f;
+  
+  rb_wave_square(dst,phasev,203,0.5f);
+  for (i=0;i<203;i++) RB_ASSERT(dst[i]==((phasev[i]<0.5f)?0.5f:-0.5f),"i=%d",i)
+  
+  rb_wave_saw(dst,phasev,203,-0.5f,1.0f);
+  for (i=0;i<203;i++) RB_ASSERT(dst[i]==-0.5f+phasev[i]*1.0f,"i=%d",i)
+  
+  rb_wave_triangle(dst,phasev,203,0.5f);
+  for (i=0;i<203;i++) {
+    rb_sample_t expect=(phasev[i]>=0.5f)?(0.5f-(phasev[i]-0.5f)*2.0f):(phasev[i]*2.0f-0.5f);
+    RB_ASSERT_FLOATS(dst[i],expect,0.000001f,"i=%d phase=%f",i,phasev[i])
+  }
+  return 0;
+}
+
+/* Table reads interpolate between samples and wrap in both directions.
+ * A triangle table makes the expected values easy.
+ */
+ 
+static int wave_table_interpolates_and_wraps() {
+  rb_sample_t tablev[9]={0.0f,0.25f,0.5f,0.75f,1.0f,0.75f,0.5f,0.25f,0.0f};
+  rb_sample_t phasev[13]={0.0f,0.0625f,0.125f,0.5f,0.5625f,0.9375f,1.0625f,-0.0625f,-0.5f,2.25f,0.99999f,0.03125f,0.75f};
+  rb_sample_t expect[13]={0.0f,0.125f,0.25f,1.0f,0.875f,0.125f,0.125f,0.125f,1.0f,0.5f,0.0f,0.0625f,0.5f};
+  rb_sample_t dst[13];
+  rb_wave_table(dst,phasev,13,tablev,8);
+  int i=0; for (;i<13;i++) RB_ASSERT_FLOATS(dst[i],expect[i],0.0001f,"i=%d phase=%f",i,phasev[i])
+  return 0;
+}
+
+/* TOC
+ */
+ 
+int main(int argc,char **argv) {
+  RB_UTEST(wave_sine_matches_sinf)
+  RB_UTEST(wave_phase_tracks_serial)
+  RB_UTEST(wave_chunking_is_invisible)
+  RB_UTEST(wave_shapes_match_formulas)
+  RB_UTEST(wave_table_interpolates_and_wraps)
+  return 0;
+}